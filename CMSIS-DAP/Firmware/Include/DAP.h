@@ -282,6 +282,8 @@ extern uint32_t JTAG_ReadIDCode (void);
 extern void     JTAG_WriteAbort (uint32_t data);
 extern uint8_t  JTAG_Transfer   (uint32_t request, uint32_t *data);
 extern uint8_t  SWD_Transfer    (uint32_t request, uint32_t *data);
+extern uint8_t  SWD_TransferBlock (uint32_t request, const uint8_t *wdata, uint8_t *rdata,
+                                   uint32_t count, uint32_t *done);
 
 extern void     Delayms         (uint32_t delay);
 
@@ -296,6 +298,7 @@ extern uint32_t SWO_Data           (const uint8_t *request, uint8_t *response);
 extern void     SWO_QueueTransfer    (uint8_t *buf, uint32_t num);
 extern void     SWO_AbortTransfer    (void);
 extern void     SWO_TransferComplete (void);
+extern void     SWO_StreamPoll       (void);
 
 extern uint32_t SWO_Mode_UART     (uint32_t enable);
 extern uint32_t SWO_Baudrate_UART (uint32_t baudrate);
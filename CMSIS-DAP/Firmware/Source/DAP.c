@@ -43,6 +43,16 @@
 #error "Maximum Packet Count is 255!"
 #endif
 
+#ifndef SWD_TRANSFER_BLOCK
+#define SWD_TRANSFER_BLOCK 0
+#endif
+#ifndef SWJ_CLOCK_HOOK
+#define SWJ_CLOCK_HOOK 0
+#endif
+#ifndef JTAG_CONFIGURE_HOOK
+#define JTAG_CONFIGURE_HOOK 0
+#endif
+
 
 // Clock Macros
 
@@ -416,6 +426,10 @@ static uint32_t DAP_SWJ_Clock(const uint8_t *request, uint8_t *response) {
     DAP_Data.clock_delay = delay;
   }
 
+#if (SWJ_CLOCK_HOOK != 0)
+  PORT_SWJ_CLOCK(clock);
+#endif
+
   *response = DAP_OK;
 #else
   *response = DAP_ERROR;
@@ -600,6 +614,10 @@ static uint32_t DAP_JTAG_Configure(const uint8_t *request, uint8_t *response) {
     DAP_Data.jtag_dev.ir_after[n] = (uint16_t)bits;
   }
 
+#if (JTAG_CONFIGURE_HOOK != 0)
+  PORT_JTAG_CONFIGURE();
+#endif
+
   *response = DAP_OK;
 #else
   count = *request;
@@ -1293,6 +1311,9 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
   uint8_t  *response_head;
   uint32_t  retry;
   uint32_t  data;
+#if (SWD_TRANSFER_BLOCK != 0)
+  uint32_t  n;
+#endif
 
   response_count = 0U;
   response_value = 0U;
@@ -1323,6 +1344,21 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
         goto end;
       }
     }
+#if (SWD_TRANSFER_BLOCK != 0)
+    // Read all but the last AP register (which comes from RDBUFF) in one go,
+    // the loop below takes care of whatever is left
+    n = request_count;
+    if ((request_value & DAP_TRANSFER_APnDP) != 0U) {
+      n--;
+    }
+    response_value = SWD_TransferBlock(request_value, NULL, response, n, &n);
+    response       += 4U * n;
+    response_count += n;
+    request_count  -= n;
+    if (response_value != DAP_TRANSFER_OK) {
+      goto end;
+    }
+#endif
     while (request_count--) {
       // Read DP/AP register
       if ((request_count == 0U) && ((request_value & DAP_TRANSFER_APnDP) != 0U)) {
@@ -1345,6 +1381,15 @@ static uint32_t DAP_SWD_TransferBlock(const uint8_t *request, uint8_t *response)
     }
   } else {
     // Write register block
+#if (SWD_TRANSFER_BLOCK != 0)
+    response_value = SWD_TransferBlock(request_value, request, NULL, request_count, &n);
+    request        += 4U * n;
+    response_count += n;
+    request_count  -= n;
+    if (response_value != DAP_TRANSFER_OK) {
+      goto end;
+    }
+#endif
     while (request_count--) {
       // Load data
       data = (uint32_t)(*(request+0) <<  0) |
@@ -1795,6 +1840,7 @@ void DAP_Setup(void) {
   // Default settings
   DAP_Data.debug_port  = 0U;
   DAP_Data.fast_clock  = 0U;
+  DAP_Data.clock_freq  = DAP_DEFAULT_SWJ_CLOCK;
   DAP_Data.clock_delay = CLOCK_DELAY(DAP_DEFAULT_SWJ_CLOCK);
   DAP_Data.transfer.idle_cycles = 0U;
   DAP_Data.transfer.retry_count = 100U;
@@ -27,16 +27,35 @@
 
 #include "DAP_config.h"
 #include "DAP.h"
+#include <string.h>
 #if (SWO_UART != 0)
 #include "Driver_USART.h"
 #endif
-#if (SWO_STREAM != 0)
+
+#ifndef SWO_STREAM_POLL
+#define SWO_STREAM_POLL 0
+#endif
+#ifndef SWO_RING_CAPTURE
+#define SWO_RING_CAPTURE 0
+#endif
+
+// Streaming code, also used for polled streaming that isn't advertised
+#if (SWO_STREAM != 0) || (SWO_STREAM_POLL != 0)
+#define SWO_STREAM_CODE 1
+#else
+#define SWO_STREAM_CODE 0
+#endif
+
+#if (SWO_STREAM != 0) && (SWO_STREAM_POLL == 0)
 #include "cmsis_os2.h"
 #define   osObjectsExternal
 #include "osObjects.h"
+#define SWO_StreamSignal()  osThreadFlagsSet(SWO_ThreadId, 1U)
+#else
+#define SWO_StreamSignal()
 #endif
 
-#if (SWO_STREAM != 0)
+#if (SWO_STREAM_CODE != 0)
 #ifdef DAP_FW_V1
 #error "SWO Streaming Trace not supported in DAP V1!"
 #endif
@@ -71,7 +90,12 @@ static uint8_t  TraceError[2]  = {0U, 0U};  /* Trace Error flags (banked) */
 static uint8_t  TraceError_n   =  0U;       /* Active Trace Error bank */
 
 // Trace Buffer
+#if (SWO_RING_CAPTURE != 0)
+/* the capture ring wraps on the buffer size, so it has to be aligned to it */
+static uint8_t  TraceBuf[SWO_BUFFER_SIZE] __ALIGNED(SWO_BUFFER_SIZE);
+#else
 static uint8_t  TraceBuf[SWO_BUFFER_SIZE];  /* Trace Buffer (must be 2^n) */
+#endif
 static volatile uint32_t TraceIndexI  = 0U; /* Incoming Trace Index */
 static volatile uint32_t TraceIndexO  = 0U; /* Outgoing Trace Index */
 static volatile uint8_t  TraceUpdate;       /* Trace Update Flag */
@@ -92,10 +116,15 @@ static uint32_t GetTraceCount  (void);
 static uint8_t  GetTraceStatus (void);
 static void     SetTraceError  (uint8_t flag);
 
-#if (SWO_STREAM != 0)
+#if (SWO_STREAM_CODE != 0)
+#if (SWO_STREAM_POLL == 0)
 extern osThreadId_t      SWO_ThreadId;
+#endif
 static volatile uint8_t  TransferBusy = 0U; /* Transfer Busy Flag */
 static          uint32_t TransferSize;      /* Current Transfer Size */
+#if (SWO_RING_CAPTURE != 0)
+static uint8_t  TransferBuf[USB_BLOCK_SIZE];  /* Copy of the block being sent */
+#endif
 #endif
 
 
@@ -130,10 +159,10 @@ static void USART_Callback (uint32_t event) {
       TraceStatus = DAP_SWO_CAPTURE_ACTIVE | DAP_SWO_CAPTURE_PAUSED;
     }
     TraceUpdate = 1U;
-#if (SWO_STREAM != 0)
+#if (SWO_STREAM_CODE != 0)
     if (TraceTransport == 2U) {
       if (count >= (USB_BLOCK_SIZE - (index_o & (USB_BLOCK_SIZE - 1U)))) {
-        osThreadFlagsSet(SWO_ThreadId, 1U);
+        SWO_StreamSignal();
       }
     }
 #endif
@@ -320,7 +349,7 @@ __WEAK uint32_t SWO_GetCount_Manchester (void) {
 // Clear Trace Errors and Data
 static void ClearTrace (void) {
 
-#if (SWO_STREAM != 0)
+#if (SWO_STREAM_CODE != 0)
   if (TraceTransport == 2U) {
     if (TransferBusy != 0U) {
       SWO_AbortTransfer();
@@ -371,11 +400,62 @@ static void ResumeTrace (void) {
   }
 }
 
+#if (SWO_RING_CAPTURE != 0)
+
+// Update Incoming Trace Index from the capture ring
+//   In ring capture mode, the capture runs continuously over the whole trace
+//   buffer, and SWO_GetCount_X returns the total number of bytes captured so
+//   far. When unread data has been overwritten, the oldest half is dropped,
+//   once no transfer that will move TraceIndexO is in progress.
+static void UpdateTrace (void) {
+  uint32_t index_i;
+
+  switch (TraceMode) {
+#if (SWO_UART != 0)
+    case DAP_SWO_UART:
+      index_i = SWO_GetCount_UART();
+      break;
+#endif
+#if (SWO_MANCHESTER != 0)
+    case DAP_SWO_MANCHESTER:
+      index_i = SWO_GetCount_Manchester();
+      break;
+#endif
+    default:
+      return;
+  }
+
+  if (index_i != TraceIndexI) {
+    TraceIndexI = index_i;
+#if (TIMESTAMP_CLOCK != 0U) 
+    TraceTimestamp.tick  = TIMESTAMP_GET();
+    TraceTimestamp.index = index_i;
+#endif
+  }
+  if ((index_i - TraceIndexO) > SWO_BUFFER_SIZE) {
+#if (SWO_STREAM_CODE != 0)
+    if (TransferBusy != 0U) {
+      return;   /* SWO_TransferComplete() catches up */
+    }
+#endif
+    TraceIndexO = index_i - (SWO_BUFFER_SIZE / 2U);
+    SetTraceError(DAP_SWO_BUFFER_OVERRUN);
+  }
+}
+
+#endif  /* (SWO_RING_CAPTURE != 0) */
+
 // Get Trace Count
 //   return: number of available data bytes in trace buffer
 static uint32_t GetTraceCount (void) {
   uint32_t count;
 
+#if (SWO_RING_CAPTURE != 0)
+  if (TraceStatus & DAP_SWO_CAPTURE_ACTIVE) {
+    UpdateTrace();
+  }
+  count = TraceIndexI - TraceIndexO;
+#else
   if (TraceStatus == DAP_SWO_CAPTURE_ACTIVE) {
     do {
       TraceUpdate = 0U;
@@ -398,6 +478,7 @@ static uint32_t GetTraceCount (void) {
   } else {
     count = TraceIndexI - TraceIndexO;
   }
+#endif
 
   return (count);
 }
@@ -437,7 +518,7 @@ uint32_t SWO_Transport (const uint8_t *request, uint8_t *response) {
     switch (transport) {
       case 0U:
       case 1U:
-#if (SWO_STREAM != 0)
+#if (SWO_STREAM_CODE != 0)
       case 2U:
 #endif
         TraceTransport = transport;
@@ -583,11 +664,21 @@ uint32_t SWO_Control (const uint8_t *request, uint8_t *response) {
     switch (TraceMode) {
 #if (SWO_UART != 0)
       case DAP_SWO_UART:
+#if (SWO_RING_CAPTURE != 0)
+        if (active) {
+          SWO_Capture_UART(TraceBuf, SWO_BUFFER_SIZE);
+        }
+#endif
         result = SWO_Control_UART(active);
         break;
 #endif
 #if (SWO_MANCHESTER != 0)
       case DAP_SWO_MANCHESTER:
+#if (SWO_RING_CAPTURE != 0)
+        if (active) {
+          SWO_Capture_Manchester(TraceBuf, SWO_BUFFER_SIZE);
+        }
+#endif
         result = SWO_Control_Manchester(active);
         break;
 #endif
@@ -595,11 +686,17 @@ uint32_t SWO_Control (const uint8_t *request, uint8_t *response) {
         result = 0U;
         break;
     }
+#if (SWO_RING_CAPTURE != 0)
+    if (!active) {
+      /* the capture has stopped, this is the final count */
+      UpdateTrace();
+    }
+#endif
     if (result != 0U) {
       TraceStatus = active;
-#if (SWO_STREAM != 0)
+#if (SWO_STREAM_CODE != 0)
       if (TraceTransport == 2U) {
-        osThreadFlagsSet(SWO_ThreadId, 1U);
+        SWO_StreamSignal();
       }
 #endif
     }
@@ -738,16 +835,89 @@ uint32_t SWO_Data (const uint8_t *request, uint8_t *response) {
 }
 
 
-#if (SWO_STREAM != 0)
+#if (SWO_STREAM_CODE != 0)
 
 // SWO Data Transfer complete callback
 void SWO_TransferComplete (void) {
   TraceIndexO += TransferSize;
   TransferBusy = 0U;
+#if (SWO_RING_CAPTURE != 0)
+  /* handle an overrun during the transfer */
+  UpdateTrace();
+#endif
   ResumeTrace();
-  osThreadFlagsSet(SWO_ThreadId, 1U);
+  SWO_StreamSignal();
 }
 
+#if (SWO_STREAM_POLL != 0)
+
+// SWO Stream polling, for use without an RTOS
+//   Call this regularly from the main loop. Like SWO_Thread, it only queues
+//   whole USB blocks, unless no data was sent for SWO_STREAM_TIMEOUT or the
+//   capture has been stopped.
+void SWO_StreamPoll (void) {
+  static uint32_t tick;
+  uint32_t count;
+  uint32_t index;
+  uint32_t i, n;
+
+  if ((TraceTransport != 2U) || (TransferBusy != 0U)) {
+    return;
+  }
+
+  count = GetTraceCount();
+  if (count == 0U) {
+    tick = TIMESTAMP_GET();
+    return;
+  }
+
+  index = TraceIndexO & (SWO_BUFFER_SIZE - 1U);
+  n = SWO_BUFFER_SIZE - index;
+  if (count > n) {
+    count = n;
+  }
+  if ((TraceStatus & DAP_SWO_CAPTURE_ACTIVE) &&
+      ((TIMESTAMP_GET() - tick) < (SWO_STREAM_TIMEOUT * (TIMESTAMP_CLOCK / 1000U)))) {
+    i = index & (USB_BLOCK_SIZE - 1U);
+    if (i == 0U) {
+      count &= ~(USB_BLOCK_SIZE - 1U);
+    } else {
+      n = USB_BLOCK_SIZE - i;
+      if (count >= n) {
+        count = n;
+      } else {
+        count = 0U;
+      }
+    }
+  }
+  if (count != 0U) {
+    tick = TIMESTAMP_GET();
+#if (SWO_RING_CAPTURE != 0)
+    /* the capture keeps writing to the ring while the block is being sent,
+       so it is sent from a copy. When the capture overtook the copy, the
+       overrun resyncs TraceIndexO and the copy is dropped. */
+    if (count > USB_BLOCK_SIZE) {
+      count = USB_BLOCK_SIZE;
+    }
+    memcpy(TransferBuf, &TraceBuf[index], count);
+    index = TraceIndexO;
+    UpdateTrace();
+    if (TraceIndexO != index) {
+      return;
+    }
+    TransferSize = count;
+    TransferBusy = 1U;
+    SWO_QueueTransfer(TransferBuf, count);
+#else
+    TransferSize = count;
+    TransferBusy = 1U;
+    SWO_QueueTransfer(&TraceBuf[index], count);
+#endif
+  }
+}
+
+#else
+
 // SWO Thread
 __NO_RETURN void SWO_Thread (void *argument) {
   uint32_t timeout;
@@ -798,7 +968,9 @@ __NO_RETURN void SWO_Thread (void *argument) {
   }
 }
 
-#endif  /* (SWO_STREAM != 0) */
+#endif  /* (SWO_STREAM_POLL != 0) */
+
+#endif  /* (SWO_STREAM_CODE != 0) */
 
 
 #endif  /* ((SWO_UART != 0) || (SWO_MANCHESTER != 0)) */
@@ -47,6 +47,7 @@ This information includes:
 
 #include <stdint.h>
 
+#include <hardware/clocks.h>
 #include <hardware/gpio.h>
 #include <hardware/regs/io_bank0.h>
 #include <hardware/regs/pads_bank0.h>
@@ -56,6 +57,8 @@ This information includes:
 #include <hardware/structs/padsbank0.h>
 #include <hardware/structs/resets.h>
 #include <hardware/structs/sio.h>
+#include <hardware/structs/systick.h>
+#include <hardware/structs/timer.h>
 #include <pico/binary_info.h>
 
 #include "bsp/board.h"
@@ -98,6 +101,18 @@ This information includes:
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
 #define DAP_SWD 1  ///< SWD Mode:  1 = available, 0 = not available.
 
+/// Indicate that SWD_TransferBlock is implemented, which DAP_TransferBlock then uses instead
+/// of one SWD_Transfer call per register access.
+#define SWD_TRANSFER_BLOCK 1  ///< SWD Transfer Block: 1 = available, 0 = not available.
+
+/// Indicate that \ref PORT_SWJ_CLOCK is implemented, which DAP_SWJ_Clock then calls with the
+/// new clock frequency, so the PIO clock dividers only have to be computed when it changes.
+#define SWJ_CLOCK_HOOK 1  ///< SWJ Clock hook: 1 = available, 0 = not available.
+
+/// Indicate that \ref PORT_JTAG_CONFIGURE is implemented, which DAP_JTAG_Configure then calls
+/// after updating the scan chain, so the IR/DR bypass padding only has to be set up once.
+#define JTAG_CONFIGURE_HOOK 1  ///< JTAG Configure hook: 1 = available, 0 = not available.
+
 /// Indicate that JTAG communication mode is available at the Debug Port.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
 #define DAP_JTAG 1  ///< JTAG Mode: 1 = available, 0 = not available.
@@ -119,13 +134,17 @@ This information includes:
 /// This configuration settings is used to optimize the communication performance with the
 /// debugger and depends on the USB peripheral. Typical vales are 64 for Full-speed USB HID or
 /// WinUSB, 1024 for High-speed USB HID and 512 for High-speed USB WinUSB.
-#define DAP_PACKET_SIZE CFG_TUD_HID_EP_BUFSIZE  ///< Specifies Packet Size in bytes.
+/// Requests and responses on the bulk (v2) interface span multiple USB packets, HID ones
+/// stay at CFG_TUD_HID_EP_BUFSIZE (and DAP_Info reports that size over HID).
+#define DAP_PACKET_SIZE 512U  ///< Specifies Packet Size in bytes.
 
 /// Maximum Package Buffers for Command and Response data.
 /// This configuration settings is used to optimize the communication performance with the
 /// debugger and depends on the USB peripheral. For devices with limited RAM or USB buffer the
 /// setting can be reduced (valid range is 1 .. 255).
-#define DAP_PACKET_COUNT 1U  ///< Specifies number of packets buffered.
+/// Each slot of the request queue (m_default/dap_queue.c) holds a request and a response of
+/// DAP_PACKET_SIZE bytes. 4 slots cover receiving, executing and sending, with one to spare.
+#define DAP_PACKET_COUNT 4U  ///< Specifies number of packets buffered (must be 2^n).
 
 /// Indicate that UART Serial Wire Output (SWO) trace is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
@@ -143,11 +162,23 @@ This information includes:
 #define SWO_MANCHESTER 1  ///< SWO Manchester:  1 = available, 0 = not available.
 
 /// SWO Trace Buffer Size.
-#define SWO_BUFFER_SIZE 4096U  ///< SWO Trace Buffer Size in bytes (must be 2^n).
+#define SWO_BUFFER_SIZE 16384U  ///< SWO Trace Buffer Size in bytes (must be 2^n, max. 64k).
 
 /// SWO Streaming Trace.
+/// Not advertised: hosts expect the stream on a third endpoint of the CMSIS-DAP
+/// bulk interface, which TinyUSB's vendor class can't provide.
 #define SWO_STREAM 0  ///< SWO Streaming Trace: 1 = available, 0 = not available.
 
+/// SWO Streaming Trace without an RTOS, over a bulk interface of its own:
+/// SWO_StreamPoll() is called from the main loop instead of running SWO_Thread.
+/// Transport 2 is still accepted, for hosts that know about that interface.
+#define SWO_STREAM_POLL 1
+
+/// SWO capture runs continuously into the whole trace buffer, using two DMA
+/// channels chained to each other, each filling one half of the buffer.
+/// SWO_GetCount_UART/Manchester return the total number of bytes captured.
+#define SWO_RING_CAPTURE 1
+
 /// Indicate that UART Communication Port is available.
 /// This information is returned by the command \ref DAP_Info as part of <b>Capabilities</b>.
 #define DAP_UART 1  ///< DAP UART:  1 = available, 0 = not available.
@@ -170,7 +201,8 @@ This information includes:
 #endif
 
 /// Clock frequency of the Test Domain Timer. Timer value is returned with \ref TIMESTAMP_GET.
-#define TIMESTAMP_CLOCK 0U  ///< Timestamp clock in Hz (0 = timestamps not supported).
+/// The RP2040 system timer ticks at 1 MHz, independent of clk_sys.
+#define TIMESTAMP_CLOCK 1000000U  ///< Timestamp clock in Hz (0 = timestamps not supported).
 
 /// Debug Unit is connected to fixed Target Device.
 /// The Debug Unit may be part of an evaluation board and always connected to a fixed
@@ -379,6 +411,18 @@ void PORT_OFF(void);
                         | PINOUT_nTRST_MASK | PINOUT_nRESET_MASK;
 }*/
 
+/** Set the SWCLK/TCK frequency (called by \ref DAP_SWJ_Clock when \ref SWJ_CLOCK_HOOK is set).
+Reprograms the clock divider of the SWD or JTAG state machine, if one is set up.
+\param clock  SWCLK/TCK frequency in Hz.
+*/
+void PORT_SWJ_CLOCK(uint32_t clock);
+
+/** Set up the IR/DR scan padding for the scan chain (called by \ref DAP_JTAG_Configure when
+\ref JTAG_CONFIGURE_HOOK is set, and by \ref PORT_JTAG_SETUP).
+Uses the device count and IR lengths in \ref DAP_Data.
+*/
+void PORT_JTAG_CONFIGURE(void);
+
 // SWCLK/TCK I/O pin -------------------------------------
 
 /** SWCLK/TCK I/O pin: Get Input.
@@ -577,8 +621,8 @@ __STATIC_INLINE void LED_RUNNING_OUT(uint32_t bit) {
 Access function for Test Domain Timer.
 
 The value of the Test Domain Timer in the Debug Unit is returned by the function \ref TIMESTAMP_GET.
-By default, the DWT timer is used.  The frequency of this timer is configured with \ref
-TIMESTAMP_CLOCK.
+The Cortex-M0+ has no DWT timer, so the lower 32 bits of the 1 MHz RP2040 system timer are
+used instead. The frequency of this timer is configured with \ref TIMESTAMP_CLOCK.
 
 */
 
@@ -587,12 +631,23 @@ TIMESTAMP_CLOCK.
 */
 __STATIC_INLINE uint32_t TIMESTAMP_GET(void) {
 #if TIMESTAMP_CLOCK > 0
-    return (DWT->CYCCNT);
+    return timer_hw->timerawl;
 #else
     return 0;
 #endif
 }
 
+/** Get the CPU cycle counter, used to measure the execution time of DAP commands.
+The Cortex-M0+ has no DWT cycle counter, so SysTick is used instead: a 24-bit down counter
+running from clk_sys, started by \ref DAP_SETUP.
+\return Current cycle count, only the bits in \ref DAP_CYCLES_MASK are valid.
+*/
+#define DAP_CYCLES_MASK 0x00ffffffU
+#define DAP_CYCLES_CLOCK() clock_get_hz(clk_sys)  ///< Cycle counter frequency in Hz.
+__STATIC_FORCEINLINE uint32_t DAP_CYCLES_GET(void) {
+    return DAP_CYCLES_MASK - systick_hw->cvr;
+}
+
 ///@}
 
 //**************************************************************************************************
@@ -620,6 +675,11 @@ __STATIC_INLINE void DAP_SETUP(void) {
         &padsbank0_hw->io[PINOUT_LED], 0, PADS_BANK0_GPIO0_IE_BITS | PADS_BANK0_GPIO0_OD_BITS);
     iobank0_hw->io[PINOUT_LED].ctrl = GPIO_FUNC_SIO << IO_BANK0_GPIO0_CTRL_FUNCSEL_LSB;
 
+    // free-running SysTick for DAP_CYCLES_GET (processor clock, no interrupt)
+    systick_hw->rvr = 0x00ffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+
     bi_decl(bi_2pins_with_names(PINOUT_JTAG_TCK, "TCK / SWCLK", PINOUT_JTAG_TMS, "TMS / SWDIO"));
     bi_decl(bi_4pins_with_names(PINOUT_JTAG_TDI, "TDI", PINOUT_JTAG_TDO, "TDO", PINOUT_JTAG_nTRST,
         "nTRST", PINOUT_JTAG_nRESET, "nRESET"));
@@ -640,5 +700,25 @@ __STATIC_INLINE uint8_t RESET_TARGET(void) {
 
 extern int swdsm, swdoffset, jtagsm, jtagoffset;
 
+// last value written to the (write-only) DP SELECT register over SWD, so that
+// the sampler can put it back after its own accesses
+extern uint32_t swd_dp_select;
+
+// stop the SWD/JTAG state machine and unload its PIO program
+void dap_swd_release(void);
+void dap_jtag_release(void);
+
+// PIO clock divider (16.8 fixed point) for a SWCLK/TCK of 'clock' Hz, with
+// 'cycles' PIO cycles per clock period
+uint32_t dap_pio_clkdiv(uint32_t clock, uint32_t cycles);
+void dap_swd_set_clock(uint32_t clock);
+void dap_jtag_set_clock(uint32_t clock);
+// the TCK period in nanoseconds that dap_jtag_set_clock(clock) ends up with
+uint32_t dap_jtag_period_ns(uint32_t clock);
+
+// shift n bits through the JTAG state machine, with TMS left as it is. tdi
+// may be NULL for all-ones, tdo may be NULL if TDO isn't needed
+void jtag_shift(uint32_t n, const uint8_t* tdi, uint8_t* tdo);
+
 #endif /* __DAP_CONFIG_H__ */
 
@@ -24,6 +24,6 @@
 #else
 #define CFG_TUD_CDC 2
 #endif
-#define CFG_TUD_VENDOR 2
+#define CFG_TUD_VENDOR 5
 
 #endif
@@ -29,6 +29,11 @@ enum {
 #if CFG_TUD_VENDOR > 0
     VND_N_CFG,
 #endif
+#ifdef DBOARD_HAS_CMSISDAP
+    VND_N_DAPSAMPLE,
+    VND_N_DAPSWO,
+    VND_N_DAPXVC,
+#endif
 
     VND_N__NITF
 };
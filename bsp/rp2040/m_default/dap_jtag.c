@@ -1,23 +1,23 @@
 // vim: set et:
 
+#include <string.h>
+
 #include <hardware/clocks.h>
+#include <hardware/dma.h>
 #include <hardware/gpio.h>
 #include <hardware/pio.h>
 
-#include "util.h"
-
 #include "DAP_config.h"
 #include <DAP.h>
 
 #include "dap_jtag.pio.h"
-#include "dap_swd.pio.h"
 
 #define JTAG_PIO
 
 int jtagsm = -1, jtagoffset = -1;
+static int jtag_dmatx = -1, jtag_dmarx = -1;
 
-void PORT_OFF(void) {
-    //printf("disable\n");
+void dap_jtag_release(void) {
     if (jtagsm >= 0) {
         pio_sm_set_enabled(PINOUT_JTAG_PIO_DEV, jtagsm, false);
         pio_sm_unclaim(PINOUT_JTAG_PIO_DEV, jtagsm);
@@ -27,20 +27,53 @@ void PORT_OFF(void) {
     }
     jtagoffset = jtagsm = -1;
 
-    if (swdsm >= 0) {
-        pio_sm_set_enabled(PINOUT_JTAG_PIO_DEV, swdsm, false);
-        pio_sm_unclaim(PINOUT_JTAG_PIO_DEV, swdsm);
-    }
-    if (swdoffset >= 0) {
-        pio_remove_program(PINOUT_JTAG_PIO_DEV, &dap_swd_program, swdoffset);
-    }
-    swdoffset = swdsm = -1;
+    if (jtag_dmatx >= 0) dma_channel_unclaim(jtag_dmatx);
+    if (jtag_dmarx >= 0) dma_channel_unclaim(jtag_dmarx);
+    jtag_dmatx = jtag_dmarx = -1;
+}
+
+void PORT_OFF(void) {
+    //printf("disable\n");
+    dap_jtag_release();
+    dap_swd_release();
 
     sio_hw->gpio_oe_clr = PINOUT_SWCLK_MASK | PINOUT_SWDIO_MASK |
                           PINOUT_TDI_MASK  //| PINOUT_TDO_MASK
                         | PINOUT_nTRST_MASK | PINOUT_nRESET_MASK;
 }
 
+uint32_t dap_pio_clkdiv(uint32_t clock, uint32_t cycles) {
+    // integer math, as the M0+ has no FPU. round up, so SWCLK/TCK never ends
+    // up faster than requested
+    uint64_t den = (uint64_t)clock * cycles;
+    uint64_t div = den ? (((uint64_t)clock_get_hz(clk_sys) << 8) + den - 1) / den : 0;
+
+    if (den == 0 || div > (65536u << 8)) div = 65536u << 8;
+    else if (div < (2u << 8)) div = 2u << 8;
+
+    return (uint32_t)div;
+}
+
+void PORT_SWJ_CLOCK(uint32_t clock) {
+    dap_swd_set_clock(clock);
+    dap_jtag_set_clock(clock);
+}
+
+void dap_jtag_set_clock(uint32_t clock) {
+    if (jtagsm < 0) return; // applied by PORT_JTAG_SETUP instead
+
+    uint32_t div = dap_pio_clkdiv(clock, 4);
+    // an integer part of 0 means 65536
+    pio_sm_set_clkdiv_int_frac(PINOUT_JTAG_PIO_DEV, jtagsm, (uint16_t)(div >> 8), (uint8_t)div);
+}
+
+uint32_t dap_jtag_period_ns(uint32_t clock) {
+    uint64_t sys = (uint64_t)clock_get_hz(clk_sys) << 8;
+
+    // 4 PIO cycles of div/256 system clocks each, rounded to nearest
+    return (uint32_t)(((uint64_t)dap_pio_clkdiv(clock, 4) * 4 * 1000000000u + sys / 2) / sys);
+}
+
 #ifndef JTAG_PIO
 void PORT_JTAG_SETUP(void) {
     resets_hw->reset &= ~(RESETS_RESET_IO_BANK0_BITS | RESETS_RESET_PADS_BANK0_BITS);
@@ -152,6 +185,9 @@ void jtag_tms_seq(uint32_t count, const uint8_t* data) {
 
 void PORT_JTAG_SETUP(void) {
     //printf("jtag setup\n");
+    // SWD uses the same pins, and there isn't enough room in the PIO for both
+    dap_swd_release();
+
     resets_hw->reset &= ~(RESETS_RESET_IO_BANK0_BITS | RESETS_RESET_PADS_BANK0_BITS);
 
     /* set to default high level */
@@ -200,82 +236,96 @@ void PORT_JTAG_SETUP(void) {
     if (jtagoffset == -1)
         jtagoffset = pio_add_program(PINOUT_JTAG_PIO_DEV, &dap_jtag_program);
     dap_jtag_program_init(PINOUT_JTAG_PIO_DEV, jtagsm, jtagoffset,
-             50*1000, PINOUT_JTAG_TCK, PINOUT_JTAG_TDI, PINOUT_JTAG_TDO);
-}
+             dap_pio_clkdiv(DAP_Data.clock_freq, 4),
+             PINOUT_JTAG_TCK, PINOUT_JTAG_TDI, PINOUT_JTAG_TDO);
 
-#define JTAG_SEQUENCE_NO_TMS 0x80000u /* should be large enough */
+    // for long shifts in jtag_shift(), which uses the CPU without them
+    if (jtag_dmatx == -1) jtag_dmatx = dma_claim_unused_channel(false);
+    if (jtag_dmarx == -1) jtag_dmarx = dma_claim_unused_channel(false);
 
-void JTAG_Sequence(uint32_t info, const uint8_t* tdi, uint8_t* tdo) {
-    //printf("jtag seq\n");
-    //pio_sm_set_enabled(PINOUT_JTAG_PIO_DEV, jtagsm, true);
+    PORT_JTAG_CONFIGURE();
+}
 
-    float div = (float)clock_get_hz(clk_sys) / (4 * DAP_Data.clock_freq);
-    if (div < 2) div = 2;
-    else if (div > 65536) div = 65536;
-    pio_sm_set_clkdiv(PINOUT_JTAG_PIO_DEV, jtagsm, div);
-    /*dap_jtag_program_init(PINOUT_JTAG_PIO_DEV, jtagsm, offset,
-             DAP_Data.clock_freq, PINOUT_JTAG_TCK, PINOUT_JTAG_TDI, PINOUT_JTAG_TDO);*/
+#define JTAG_SEQUENCE_NO_TMS 0x80000u /* should be large enough */
 
-    uint32_t n = info & JTAG_SEQUENCE_TCK;
-    if (n == 0) n = 64;
+// shifts of at least this many whole bytes are done by DMA
+#define JTAG_DMA_MIN_BYTES 16
 
-    //if (!(n & JTAG_SEQUENCE_NO_TMS)) {
-        if (info & JTAG_SEQUENCE_TMS) PIN_SWDIO_TMS_SET();
-        else PIN_SWDIO_TMS_CLR();
-    //}
+// shift n bits (any number) through the PIO, with TMS left as it is. tdi may
+// be NULL for all-ones, tdo may be NULL when TDO isn't needed.
+void jtag_shift(uint32_t n, const uint8_t* tdi, uint8_t* tdo) {
+    static const uint8_t ones = 0xff;
+    static uint8_t devnull;
 
+    // the SM stays enabled, and its clock divider is set by PORT_SWJ_CLOCK
     io_wo_8* tx = (io_wo_8*)&PINOUT_JTAG_PIO_DEV->txf[jtagsm];
-    io_ro_8* rx = (io_ro_8*)&PINOUT_JTAG_PIO_DEV->rxf[jtagsm];
+    // the SM shifts LSB-first, so the captured bits end up in the uppermost
+    // byte of the FIFO word, and no bit reversal is needed
+    io_ro_8* rx = (io_ro_8*)&PINOUT_JTAG_PIO_DEV->rxf[jtagsm] + 3;
 
     uint32_t bytelen = (n + 7) >> 3;
     uint32_t last_shift = (8 - n) & 7;
-    //printf("n=%lu bytelen=%lu last_shift=%lu\n", n, bytelen, last_shift);
-    uint32_t txremain = bytelen,
-             rxremain = last_shift ? bytelen : (bytelen + 1);
-    //printf("txremain=%lu rxremain=%lu\n", txremain, rxremain);
 
-    /*printf("%s", "tdi: ");
-    for (size_t j = 0; j < ((n + 7) >> 3); ++j) {
-        printf("0x%x ", ((const uint8_t*)tdi)[j]);
+    pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, jtagsm, n - 1);
+
+    if ((n >> 3) >= JTAG_DMA_MIN_BYTES && jtag_dmatx >= 0 && jtag_dmarx >= 0) {
+        // everything except the final push (the last partial byte, or an
+        // empty one) goes through DMA
+        dma_channel_config txc = dma_channel_get_default_config(jtag_dmatx);
+        channel_config_set_read_increment(&txc, tdi != NULL);
+        channel_config_set_write_increment(&txc, false);
+        channel_config_set_dreq(&txc, pio_get_dreq(PINOUT_JTAG_PIO_DEV, jtagsm, true));
+        channel_config_set_transfer_data_size(&txc, DMA_SIZE_8);
+        dma_channel_config rxc = dma_channel_get_default_config(jtag_dmarx);
+        channel_config_set_read_increment(&rxc, false);
+        channel_config_set_write_increment(&rxc, tdo != NULL);
+        channel_config_set_dreq(&rxc, pio_get_dreq(PINOUT_JTAG_PIO_DEV, jtagsm, false));
+        channel_config_set_transfer_data_size(&rxc, DMA_SIZE_8);
+
+        dma_channel_configure(jtag_dmarx, &rxc, tdo ? tdo : &devnull, rx, n >> 3, true);
+        dma_channel_configure(jtag_dmatx, &txc, tx, tdi ? tdi : &ones, bytelen, true);
+        dma_channel_wait_for_finish_blocking(jtag_dmarx);
+
+        while (pio_sm_is_rx_fifo_empty(PINOUT_JTAG_PIO_DEV, jtagsm)) tight_loop_contents();
+        uint8_t ov = *rx;
+        if (tdo && last_shift) tdo[bytelen - 1] = ov >> last_shift;
+        return;
     }
-    printf("%c", '\n');*/
 
-    pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, jtagsm, (uint8_t)(n - 1));
+    uint32_t txremain = bytelen,
+             rxremain = last_shift ? bytelen : (bytelen + 1);
 
     for (size_t oi = 0, ii = 0; txremain || rxremain; tight_loop_contents()) {
         if (txremain && !pio_sm_is_tx_fifo_full(PINOUT_JTAG_PIO_DEV, jtagsm)) {
-            *tx = bitswap(tdi[ii]);
+            *tx = tdi ? tdi[ii] : 0xff;
             --txremain;
-            //printf("tx %02x rem %lu smpc=%x\n", tdi[ii], txremain, pio_sm_get_pc(PINOUT_JTAG_PIO_DEV, jtagsm));
             ++ii;
         }
 
         if (rxremain && !pio_sm_is_rx_fifo_empty(PINOUT_JTAG_PIO_DEV, jtagsm)) {
             uint8_t ov = *rx;
             --rxremain;
-            //printf("rx %02x rem %lu smpc=%x\n", ov, rxremain, pio_sm_get_pc(PINOUT_JTAG_PIO_DEV, jtagsm));
             // avoid writing extra byte generated by final 'push' insn, would cause buffer ovf
-            if ((info & JTAG_SEQUENCE_TDO) && oi < bytelen) {
+            if (tdo && oi < bytelen) {
                 if (last_shift && oi == bytelen - 1) {
-                    //printf("orig=%02x swap=%02x shamt=%lu result=%02x\n", ov, bitswap(ov), last_shift, bitswap(ov)>>last_shift);
-                    tdo[oi] = bitswap(ov) >> last_shift;
+                    tdo[oi] = ov >> last_shift;
                 } else {
-                    tdo[oi] = bitswap(ov);
+                    tdo[oi] = ov;
                 }
                 ++oi;
             }
         }
     }
+}
 
-    /*if (info & JTAG_SEQUENCE_TDO) {
-        printf("%s", "tdo: ");
-        for (size_t j = 0; j < ((n + 7) >> 3); ++j) {
-            printf("0x%x ", ((const uint8_t*)tdo)[j]);
-        }
-        printf("%c", '\n');
-    } else printf("%s", "no tdo\n");*/
+void JTAG_Sequence(uint32_t info, const uint8_t* tdi, uint8_t* tdo) {
+    uint32_t n = info & JTAG_SEQUENCE_TCK;
+    if (n == 0) n = 64;
+
+    if (info & JTAG_SEQUENCE_TMS) PIN_SWDIO_TMS_SET();
+    else PIN_SWDIO_TMS_CLR();
 
-    //pio_sm_set_enabled(PINOUT_JTAG_PIO_DEV, jtagsm, false);
+    jtag_shift(n, tdi, (info & JTAG_SEQUENCE_TDO) ? tdo : NULL);
 }
 
 void jtag_tms_seq(uint32_t count, const uint8_t* data) {
@@ -324,300 +374,4 @@ void jtag_tms_seq(uint32_t count, const uint8_t* data) {
     gpio_set_function(PINOUT_JTAG_TCK, GPIO_FUNC_PIO0);
 }
 #endif
-
-static void jtag_seq(uint32_t num, int tms, const void* tdi, void* tdo) {
-    static uint64_t last_bit = ~(uint64_t)0;
-    uint64_t devnull = 0;
-
-    bool notdi = tdi == NULL, notdo = tdo == NULL;
-
-    if (!notdo) tms |= JTAG_SEQUENCE_TDO;
-
-    const void* jdi;
-    void* jdo;
-
-    uint32_t nreal;
-    for (uint32_t i = 0; i < num; i += nreal) {
-        uint32_t nmod = (num - i) & 63;
-        nreal = nmod ? nmod : 64;
-
-        jdi = notdi ? (const void*)&last_bit : ((const uint8_t*)tdi + (i >> 3));
-        jdo = notdo ? (      void*)&devnull  : ((      uint8_t*)tdo + (i >> 3));
-
-        JTAG_Sequence(nmod | tms, jdi, jdo);
-    }
-
-    if (tdi) {
-        uint8_t lastbyte = *((const uint8_t*)tdi + (((num + 7) >> 3)) - 1);
-        last_bit = (lastbyte & (1 << (num & 7))) ? ~(uint64_t)0 : (uint64_t)0;
-    }
-}
-
-uint32_t JTAG_ReadIDCode(void) {
-    //printf("jtag readID\n");
-    // tdi=NULL: ~~0xff!~~ repeat last-seen bit, ignore otherwise
-    // tdo=NULL: ignore
-    jtag_seq(1, JTAG_SEQUENCE_TMS, NULL, NULL);
-    jtag_seq(2+DAP_Data.jtag_dev.index, 0, NULL, NULL);
-    uint32_t v=0, v2=0;
-    jtag_seq(31, 0, NULL, &v);
-    jtag_seq(2, JTAG_SEQUENCE_TMS, NULL, &v2);
-    v |= (v2 << 31);
-    jtag_seq(1, 0, NULL, NULL);
-    return v;
-
-    /*// TMS HI
-    // TCK LOW; DELAY; TCK HI; DELAY (DRscan)
-    // TMS LOW
-    // TCK LOW; DELAY; TCK HI; DELAY (capture)
-    // TCK LOW; DELAY; TCK HI; DELAY (shift)
-
-    for (size_t i = 0; i < DAP_Data.jtag_dev.index; ++i) {
-        // TCK LOW; DELAY; TCK HI; DELAY (bypass to correct chain location)
-    }
-
-    uint32_t v = 0;
-    for (size_t i = 0; i < 31; ++i) {
-        // TCK LOW
-        // DELAY
-        // GET TDO; TCK HI; DELAY
-        v |= tdo << k;
-    }
-    // TMS HI
-    // TCK LOW; DELAY; GET TDO; TCK HI; DELAY
-    v |= tdo << 31;
-
-    // TCK LOW; DELAY; TCK HI; DELAY
-    // TMS LO
-    // TCK LOW; DELAY; TCK HI; DELAY
-
-    return v;*/
-}
-
-void JTAG_IR(uint32_t ir) {
-    //printf("jtag IR\n");
-    jtag_seq(2,JTAG_SEQUENCE_TMS, NULL, NULL);
-    jtag_seq(2,0, NULL, NULL);
-    uint64_t v = ~(uint64_t)0;
-    jtag_seq(DAP_Data.jtag_dev.ir_before[DAP_Data.jtag_dev.index],0, &v, NULL);
-    jtag_seq((DAP_Data.jtag_dev.ir_length[DAP_Data.jtag_dev.index]-1),0, &ir, NULL);
-    uint32_t ir2 = ir >> (DAP_Data.jtag_dev.ir_length[DAP_Data.jtag_dev.index]-1);
-    uint32_t n = DAP_Data.jtag_dev.ir_after[DAP_Data.jtag_dev.index];
-    if (n) {
-        jtag_seq(1,0, &ir2, NULL);
-        ir = ~(uint32_t)0;
-        jtag_seq((n-1),0, &ir, NULL);
-        jtag_seq(1,JTAG_SEQUENCE_TMS, &ir, NULL);
-    } else {
-        jtag_seq(1,JTAG_SEQUENCE_TMS, &ir2, NULL);
-    }
-    jtag_seq(1,JTAG_SEQUENCE_TMS, NULL, NULL);
-    jtag_seq(1,0, NULL, NULL);
-    PIN_TDI_OUT(1); // TODO: TDI HI
-
-    /*// TMS HI
-    // TCK LOW; DELAY; TCK HI; DELAY (DRscan)
-    // TCK LOW; DELAY; TCK HI; DELAY (IRscan)
-    // TMS LO
-    // TCK LOW; DELAY; TCK HI; DELAY (capture)
-    // TCK LOW; DELAY; TCK HI; DELAY (shift)
-
-    // TDI HI
-    for (size_t i = 0; i < DAP_Data.jtag_dev.ir_before[DAP_Data.jtag_dev.index]; ++i) {
-        // TCK LOW; DELAY; TCK HI; DELAY (bypass)
-    }
-    for (size_t i = 0; i < DAP_Data.jtag_dev.ir_length[DAP_Data.jtag_dev.index] - 1; ++i) {
-        tdi = ir & 1;
-        // SET TDI
-        // TCK LOW; DELAY; TCK HI; DELAY
-        ir >>= 1;
-    }
-
-    uint32_t n = DAP_Data.jtag_dev.ir_after[DAP_Data.jtag_dev.index];
-    if (n) {
-        tdi = ir & 1;
-        // SET TDI
-        // TCK LOW; DELAY; TCK HI; DELAY
-
-        for (size_t i = 1; i < n-1; ++i) {
-            // TCK LOW; DELAY; TCK HI; DELAY
-        }
-        // TMS HI
-        // TCK LOW; DELAY; TCK HI; DELAY
-    } else {
-        tdi = ir & 1;
-        // TMS HI
-        // SET TDI
-        // TCK LOW; DELAY; TCK HI; DELAY
-    }
-
-    // TCK LOW; DELAY; TCK HI; DELAY
-    // TMS LO
-    // TCK LOW; DELAY; TCK HI; DELAY
-    // TDI HI*/
-}
-
-static uint8_t xfer_base(uint32_t request, uint32_t* data, bool check_ack) {
-    jtag_seq(1,JTAG_SEQUENCE_TMS, NULL, NULL);
-    jtag_seq((2+DAP_Data.jtag_dev.index),0, NULL, NULL);
-    uint32_t ack=0;
-    uint32_t reqsh1 = request>>1;
-    jtag_seq(3,0, &reqsh1, &ack);
-    // ack bits are 1,0,2, not 0,1,2 => swap bottom 2 bits
-    ack = ((ack & 2) >> 1) | ((ack & 1) << 2) | (ack & ~(uint32_t)3);
-    if (ack!=DAP_TRANSFER_OK && check_ack) {
-        jtag_seq(1,JTAG_SEQUENCE_TMS, NULL, NULL);
-        goto exit;
-    } else ack=DAP_TRANSFER_OK;
-    if (request & DAP_TRANSFER_RnW) { // read
-        uint32_t val = 0;
-        jtag_seq(31,0, NULL, &val);
-        uint32_t n = DAP_Data.jtag_dev.count - DAP_Data.jtag_dev.index - 1;
-        uint32_t valb = 0;
-        if (n) {
-            jtag_seq(1,0, NULL, &valb);
-            jtag_seq((n-1),0, NULL, NULL);
-            jtag_seq(1,JTAG_SEQUENCE_TMS, NULL, NULL);
-        } else {
-            jtag_seq(1,JTAG_SEQUENCE_TMS, NULL, &valb);
-        }
-        *data = val | (valb << 31);
-    } else {
-        uint32_t val = *data, valb=val>>31;
-        jtag_seq(31,0, &val, NULL);
-        uint32_t n = DAP_Data.jtag_dev.count - DAP_Data.jtag_dev.index - 1;
-        if (n) {
-            jtag_seq(1,0, &valb, NULL);
-            jtag_seq((n-1),0, NULL, NULL);
-            jtag_seq(1,JTAG_SEQUENCE_TMS, NULL, NULL);
-        } else {
-            jtag_seq(1,JTAG_SEQUENCE_TMS, &valb, NULL);
-        }
-    }
-exit:
-    jtag_seq(1,JTAG_SEQUENCE_TMS, NULL, NULL);
-    jtag_seq(1,0, NULL, NULL);
-    PIN_TDI_OUT(1); // TDI HI (no clk)
-    if (request & DAP_TRANSFER_TIMESTAMP) DAP_Data.timestamp = TIMESTAMP_GET();
-    if (check_ack) jtag_seq(DAP_Data.transfer.idle_cycles, 0, NULL, NULL);
-    return (uint8_t)ack;
-
-
-    /*// TMS HI
-    // TCK LOW; DELAY; TCK HI; DELAY
-    // TMS LO
-    // TCK LOW; DELAY; TCK HI; DELAY
-    // TCK LOW; DELAY; TCK HI; DELAY
-
-    for (size_t i = 0; i < DAP_Data.jtag_dev.index; ++i) {
-        // TCK LOW; DELAY; TCK HI; DELAY
-    }
-
-    uint32_t ack = 0;
-
-    tdi = (request >> 1) & 1;
-    // SET TDI
-    // TCK LOW; DELAY
-    // GET TDO
-    // TCK HI; DELAY
-    ack = tdo << 1;
-
-    tdi = (request >> 2) & 1;
-    // SET TDI
-    // TCK LOW; DELAY
-    // GET TDO
-    // TCK HI; DELAY
-    ack |= tdo << 0;
-
-    tdi = (request >> 3) & 1;
-    // SET TDI
-    // TCK LOW; DELAY
-    // GET TDO
-    // TCK HI; DELAY
-    ack |= tdo << 2;
-
-    if (ack != DAP_TRANSFER_OK && check_ack) {
-        // TMS HI
-        // TCK LOW; DELAY; TCK HI; DELAY
-        goto exit;
-    }
-
-    if (request & DAP_TRANSFER_RnW) { // read
-        uint32_t val = 0;
-
-        for (size_t i = 0; i < 31; ++i) {
-            // TCK LOW; DELAY;
-            // GET TDO; TCK HI; DELAY
-            val |= tdo << i;
-        }
-
-        uint32_t n = DAP_Data.jtag_dev.count - DAP_Data.jtag_dev.index - 1;
-        if (n) {
-            // TCK LOW; DELAY;
-            // GET TDO; TCK HI; DELAY
-            for (size_t i = 0; i < n - 1; ++i) {
-                // TCK LOW; DELAY; TCK HI; DELAY
-            }
-            // TMS HI
-            // TCK LOW; DELAY; TCK HI; DELAY
-        } else {
-            // TMS HI
-            // TCK LOW; DELAY;
-            // GET TDO; TCK HI; DELAY
-        }
-
-        val |= tdo << 31;
-    } else { // write
-        uint32_t val = *data;
-
-        for (size_t i = 0; i < 31; ++i) {
-            tdi = (val >> i) & 1;
-            // SET TDI
-            // TCK LOW; DELAY; TCK HI; DELAY
-        }
-
-        uint32_t n = DAP_Data.jtag_dev.count - DAP_Data.jtag_dev.index - 1;
-        if (n) {
-            tdi = (val >> 31) & 1;
-            // SET TDI
-            // TCK LOW; DELAY; TCK HI; DELAY
-            for (size_t i = 0; i < n - 1; ++i) {
-                // TCK LOW; DELAY; TCK HI; DELAY
-            }
-            // TMS HI
-            // TCK LOW; DELAY; TCK HI; DELAY
-        } else {
-            tdi = (val >> 31) & 1;
-            // TMS HI
-            // SET TDI
-            // TCK LOW; DELAY; TCK HI; DELAY
-        }
-    }
-
-exit:
-    // TCK LOW; DELAY; TCK HI; DELAY
-    // TMS LO
-    // TCK LOW; DELAY; TCK HI; DELAY
-    // TDI HI
-
-    if (request & DAP_REQUEST_TIMESTAMP)
-        DAP_Data.timestamp = TIMESTAMP_GET();
-
-    for (size_t i = 0; i < DAP_Data.idle_cycles && check_ack; ++i) {
-        // TCK LOW; DELAY; TCK HI; DELAY
-    }
-
-    return (uint8_t)ack;*/
-}
-
-void JTAG_WriteAbort(uint32_t data) {
-    //printf("jtag wrabort\n");
-    xfer_base(0 /* write,A2=0,A3=0 */, &data, false);
-}
-
-uint8_t JTAG_Transfer(uint32_t request, uint32_t* data) {
-    //printf("jtag xfer\n");
-    return xfer_base(request, data, true);
-}
 //#endif
-
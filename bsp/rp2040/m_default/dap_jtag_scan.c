@@ -0,0 +1,153 @@
+// vim: set et:
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "DAP_config.h"
+#include <DAP.h>
+
+/* IR and DR scans with the other TAPs of the chain in bypass. The padding
+ * around the IR or DR of each TAP is worked out once per JTAG_Configure (or
+ * port setup) and kept in the scan buffers, so each transfer only has to fill
+ * in its own bits, after which the whole Shift-xR part goes out in a single
+ * PIO burst. TMS only has to change around it.
+ *
+ * Scan buffer layout, LSB first: 2 bits for Capture-xR and entering Shift-xR
+ * (TMS=0, TDI don't care), followed by the bits shifted through the chain.
+ * Padding for IR scans is all-ones (BYPASS), and one bit per bypassed TAP for
+ * DR scans. */
+
+#define JTAG_SCAN_LEAD 2
+// DPACC/APACC scan: 3 bits RnW/A[3:2] (ack on TDO), 32 bits data
+#define JTAG_XFER_BITS 35
+
+#define JTAG_IR_SCAN_MAX (JTAG_SCAN_LEAD + DAP_JTAG_DEV_CNT * 255)
+#define JTAG_DR_SCAN_MAX (JTAG_SCAN_LEAD + (DAP_JTAG_DEV_CNT - 1) + JTAG_XFER_BITS)
+
+static struct {
+    uint16_t ir_bits; // length of the IR scan, excluding JTAG_SCAN_LEAD
+    uint8_t  dr_bits; // same for a DPACC/APACC DR scan
+} jtag_taps[DAP_JTAG_DEV_CNT];
+
+static uint8_t ir_tdi[(JTAG_IR_SCAN_MAX + 7) >> 3];
+static uint8_t dr_tdi[(JTAG_DR_SCAN_MAX + 7) >> 3],
+               dr_tdo[(JTAG_DR_SCAN_MAX + 7) >> 3];
+// the part of ir_tdi the last JTAG_IR call put an IR value in
+static uint16_t ir_dirty_off, ir_dirty_len;
+
+static void bits_put(uint8_t* buf, uint32_t off, uint32_t val, uint32_t n) {
+    for (uint32_t i = 0; i < n; ++i, ++off) {
+        if ((val >> i) & 1) buf[off >> 3] |=  (uint8_t)(1u << (off & 7));
+        else                buf[off >> 3] &= ~(uint8_t)(1u << (off & 7));
+    }
+}
+static uint32_t bits_get(const uint8_t* buf, uint32_t off, uint32_t n) {
+    uint32_t val = 0;
+    for (uint32_t i = 0; i < n; ++i, ++off) {
+        val |= (uint32_t)((buf[off >> 3] >> (off & 7)) & 1) << i;
+    }
+    return val;
+}
+
+void PORT_JTAG_CONFIGURE(void) {
+    uint32_t count = DAP_Data.jtag_dev.count;
+    if (count > DAP_JTAG_DEV_CNT) count = DAP_JTAG_DEV_CNT;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        jtag_taps[i].ir_bits = DAP_Data.jtag_dev.ir_before[i]
+            + DAP_Data.jtag_dev.ir_length[i] + DAP_Data.jtag_dev.ir_after[i];
+        jtag_taps[i].dr_bits = (count - 1) + JTAG_XFER_BITS;
+    }
+
+    memset(ir_tdi, 0xff, sizeof ir_tdi);
+    memset(dr_tdi, 0xff, sizeof dr_tdi);
+    ir_dirty_off = ir_dirty_len = 0;
+}
+
+// go from Run-Test/Idle to Shift-IR or Shift-DR, shift n bits from the scan
+// buffer (the last one going to Exit1-xR), then go back to Run-Test/Idle
+// through Update-xR, and stay there for 'idle' more cycles
+static void jtag_scan(bool ir, uint32_t n, const uint8_t* tdi, uint8_t* tdo, uint32_t idle) {
+    uint8_t lastdi, lastdo = 0;
+    uint32_t m = JTAG_SCAN_LEAD + n - 1;
+
+    PIN_SWDIO_TMS_SET(); // Select-DR(-Select-IR)
+    jtag_shift(ir ? 2 : 1, NULL, NULL);
+
+    PIN_SWDIO_TMS_CLR(); // Capture-xR, Shift-xR, and all but the last bit
+    jtag_shift(m, tdi, tdo);
+
+    lastdi = (uint8_t)(bits_get(tdi, m, 1) | 2);
+    PIN_SWDIO_TMS_SET(); // last bit to Exit1-xR, Update-xR
+    jtag_shift(2, &lastdi, tdo ? &lastdo : NULL);
+    if (tdo) bits_put(tdo, m, lastdo, 1);
+
+    PIN_SWDIO_TMS_CLR(); // Run-Test/Idle
+    jtag_shift(1 + idle, NULL, NULL);
+
+    PIN_TDI_OUT(1); // TDI HI (no clk)
+}
+
+uint32_t JTAG_ReadIDCode(void) {
+    // the IDCODE register of the selected TAP, after the bypass registers of
+    // the TAPs before it. the ones after it don't need to be shifted through.
+    uint32_t index = DAP_Data.jtag_dev.index;
+    uint32_t n = index + 32;
+
+    bits_put(dr_tdi, JTAG_SCAN_LEAD + index, ~(uint32_t)0, 32);
+    jtag_scan(false, n, dr_tdi, dr_tdo, 0);
+
+    return bits_get(dr_tdo, JTAG_SCAN_LEAD + index, 32);
+}
+
+void JTAG_IR(uint32_t ir) {
+    uint32_t index = DAP_Data.jtag_dev.index;
+    uint32_t off = JTAG_SCAN_LEAD + DAP_Data.jtag_dev.ir_before[index],
+             len = DAP_Data.jtag_dev.ir_length[index];
+    if (len > 32) len = 32; // and any bits above that stay 1
+
+    // put back the padding where the previous TAP's IR value was
+    if (ir_dirty_len) bits_put(ir_tdi, ir_dirty_off, ~(uint32_t)0, ir_dirty_len);
+    bits_put(ir_tdi, off, ir, len);
+    ir_dirty_off = (uint16_t)off;
+    ir_dirty_len = (uint16_t)len;
+
+    jtag_scan(true, jtag_taps[index].ir_bits, ir_tdi, NULL, 0);
+}
+
+static uint8_t xfer_base(uint32_t request, uint32_t* data, bool check_ack) {
+    uint32_t index = DAP_Data.jtag_dev.index;
+    uint32_t off = JTAG_SCAN_LEAD + index;
+
+    // the data of a read is ignored, and comes from the previous access
+    bits_put(dr_tdi, off, request >> 1, 3);
+    bits_put(dr_tdi, off + 3, (request & DAP_TRANSFER_RnW) ? 0 : *data, 32);
+
+    // there's no stopping early on a bad ack: the whole scan goes out in one
+    // burst. the DP ignores the request at Update-DR when the ack is WAIT.
+    jtag_scan(false, jtag_taps[index].dr_bits, dr_tdi, dr_tdo,
+            check_ack ? DAP_Data.transfer.idle_cycles : 0);
+
+    // first ack bit is bit 1 of the DAP ack, second is bit 0 (OK and WAIT
+    // are swapped w.r.t. the JTAG-DP encoding), third is bit 2
+    uint32_t ack = bits_get(dr_tdo, off, 3);
+    ack = ((ack & 2) >> 1) | ((ack & 1) << 1) | (ack & 4);
+
+    if (request & DAP_TRANSFER_TIMESTAMP) DAP_Data.timestamp = TIMESTAMP_GET();
+
+    if (!check_ack) return DAP_TRANSFER_OK;
+    if (ack == DAP_TRANSFER_OK && (request & DAP_TRANSFER_RnW)) {
+        *data = bits_get(dr_tdo, off + 3, 32);
+    }
+    return (uint8_t)ack;
+}
+
+void JTAG_WriteAbort(uint32_t data) {
+    //printf("jtag wrabort\n");
+    xfer_base(0 /* write,A2=0,A3=0 */, &data, false);
+}
+
+uint8_t JTAG_Transfer(uint32_t request, uint32_t* data) {
+    //printf("jtag xfer\n");
+    return xfer_base(request, data, true);
+}
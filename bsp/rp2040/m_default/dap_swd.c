@@ -1,6 +1,7 @@
 // vim: set et:
 
 #include <hardware/clocks.h>
+#include <hardware/dma.h>
 #include <hardware/gpio.h>
 #include <hardware/pio.h>
 #include <hardware/timer.h>
@@ -43,6 +44,9 @@ void PIN_SWDIO_OUT_DISABLE(void) {
 
 inline static void PIN_SWDIO_SET_PIO(void) { PIN_SWDIO_TMS_SET(); }
 
+void dap_swd_release(void) { }
+void dap_swd_set_clock(uint32_t clock) { (void)clock; }
+
 /*#define PIN_SWCLK_SET PIN_SWCLK_TCK_SET
 #define PIN_SWCLK_CLR PIN_SWCLK_TCK_CLR
 
@@ -102,8 +106,89 @@ void SWD_Sequence (uint32_t info, const uint8_t *swdo, uint8_t *swdi) {
 }*/
 #else
 
+static int swd_dmatx = -1, swd_dmarx = -1;
+
+uint32_t swd_dp_select = 0;
+
+#define SWD_REQ_SELECT_MASK (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2 | DAP_TRANSFER_A3)
+
+/* helpers for the dap_swd PIO program, see dap_swd.pio for the command format */
+
+#define SWD_HDR_BITS 15
+
+static inline uint32_t swd_hdr(uint32_t cmd, bool drive, uint32_t n) {
+    return (drive ? 1u : 0u) | ((n - 1) << 1) | ((swdoffset + cmd) << 10);
+}
+
+// clock out n (1..64) bits, or just clock if !drive
+static void swd_cmd_out(bool drive, uint32_t n, uint64_t bits) {
+    pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, swdsm,
+            swd_hdr(dap_swd_offset_cmd_out, drive, n) | ((uint32_t)bits << SWD_HDR_BITS));
+    if (n > 32 - SWD_HDR_BITS)
+        pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, swdsm, (uint32_t)(bits >> (32 - SWD_HDR_BITS)));
+    if (n > 64 - SWD_HDR_BITS)
+        pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, swdsm, (uint32_t)(bits >> (64 - SWD_HDR_BITS)));
+}
+static void swd_cmd_clocks(bool drive, uint32_t n) {
+    for (uint32_t i = 0; i < n; i += 64) {
+        swd_cmd_out(drive, (n - i) > 64 ? 64 : (n - i), 0);
+    }
+}
+
+static void swd_cmd_in(uint32_t n) {
+    pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, swdsm, swd_hdr(dap_swd_offset_cmd_in, false, n));
+}
+// get the result of an n-bit (1..64) swd_cmd_in
+static uint64_t swd_get_in(uint32_t n) {
+    uint64_t v = 0;
+    uint32_t i;
+
+    // full words are autopushed, the rest is pushed explicitly at the end
+    for (i = 0; i + 32 <= n; i += 32) {
+        v |= (uint64_t)pio_sm_get_blocking(PINOUT_JTAG_PIO_DEV, swdsm) << i;
+    }
+    uint32_t last = pio_sm_get_blocking(PINOUT_JTAG_PIO_DEV, swdsm);
+    if (n & 31) v |= (uint64_t)(last >> (32 - (n & 31))) << i;
+
+    return v;
+}
+
+static void swd_wait_idle(void) {
+    // wait until the last command has been fetched, and finished
+    while (!pio_sm_is_tx_fifo_empty(PINOUT_JTAG_PIO_DEV, swdsm)) tight_loop_contents();
+    while (pio_sm_get_pc(PINOUT_JTAG_PIO_DEV, swdsm) != swdoffset + dap_swd_offset_get_cmd)
+        tight_loop_contents();
+}
+
+void dap_swd_set_clock(uint32_t clock) {
+    if (swdsm < 0) return; // applied by PORT_SWD_SETUP instead
+
+    uint32_t div = dap_pio_clkdiv(clock, 2);
+    // an integer part of 0 means 65536
+    pio_sm_set_clkdiv_int_frac(PINOUT_JTAG_PIO_DEV, swdsm, (uint16_t)(div >> 8), (uint8_t)div);
+}
+
+void dap_swd_release(void) {
+    if (swdsm >= 0) {
+        if (swdoffset >= 0) swd_wait_idle();
+        pio_sm_set_enabled(PINOUT_JTAG_PIO_DEV, swdsm, false);
+        pio_sm_unclaim(PINOUT_JTAG_PIO_DEV, swdsm);
+    }
+    if (swdoffset >= 0) {
+        pio_remove_program(PINOUT_JTAG_PIO_DEV, &dap_swd_program, swdoffset);
+    }
+    swdoffset = swdsm = -1;
+
+    if (swd_dmatx >= 0) dma_channel_unclaim(swd_dmatx);
+    if (swd_dmarx >= 0) dma_channel_unclaim(swd_dmarx);
+    swd_dmatx = swd_dmarx = -1;
+}
+
 void PORT_SWD_SETUP(void) {
     //printf("swd setup\n");
+    // JTAG uses the same pins, and there isn't enough room in the PIO for both
+    dap_jtag_release();
+
     resets_hw->reset &= ~(RESETS_RESET_IO_BANK0_BITS | RESETS_RESET_PADS_BANK0_BITS);
 
     /* set to default high level */
@@ -123,11 +208,16 @@ void PORT_SWD_SETUP(void) {
     if (swdoffset == -1)
         swdoffset = pio_add_program(PINOUT_JTAG_PIO_DEV, &dap_swd_program);
     dap_swd_program_init(PINOUT_JTAG_PIO_DEV, swdsm, swdoffset,
-             50*1000, PINOUT_SWCLK, PINOUT_SWDIO);
+             dap_pio_clkdiv(DAP_Data.clock_freq, 2), PINOUT_SWCLK, PINOUT_SWDIO);
+
+    // for SWD_TransferBlock(), which falls back to SWD_Transfer() without them
+    if (swd_dmatx == -1) swd_dmatx = dma_claim_unused_channel(false);
+    if (swd_dmarx == -1) swd_dmarx = dma_claim_unused_channel(false);
 }
 
 // TODO: also hijack DAP_SWJ_PINS(?: should data pins be controlled like that? only rst stuff tbh)
 
+// only used by the generic SW_DP.c code, which is overridden below
 void PIN_SWDIO_OUT_ENABLE(void) {
     pio_sm_set_pindirs_with_mask(PINOUT_JTAG_PIO_DEV, swdsm,
             (1u << PINOUT_SWDIO), (1u << PINOUT_SWDIO));
@@ -137,123 +227,23 @@ void PIN_SWDIO_OUT_DISABLE(void) {
             (0u << PINOUT_SWDIO), (1u << PINOUT_SWDIO));
 }
 
-inline static void PIN_SWDIO_SET_PIO(void) {
-    pio_sm_set_pins_with_mask(PINOUT_JTAG_PIO_DEV, swdsm,
-            (1u << PINOUT_SWDIO), (1u << PINOUT_SWDIO));
-}
-
 void SWD_Sequence(uint32_t info, const uint8_t* swdo, uint8_t* swdi) {
     //printf("swd sequence\n");
-    pio_sm_set_enabled(PINOUT_JTAG_PIO_DEV, swdsm, true);
-    //busy_wait_us_32(0);
-
-    float div = (float)clock_get_hz(clk_sys) / (2 * DAP_Data.clock_freq);
-    if (div < 2) div = 2;
-    else if (div > 65536) div = 65536;
-    pio_sm_set_clkdiv(PINOUT_JTAG_PIO_DEV, swdsm, div);
-
     uint32_t n = info & SWD_SEQUENCE_CLK;
     if (n == 0) n = 64;
 
-    io_wo_8* tx = (io_wo_8*)&PINOUT_JTAG_PIO_DEV->txf[swdsm];
-    io_ro_8* rx = (io_ro_8*)&PINOUT_JTAG_PIO_DEV->rxf[swdsm];
-
     uint32_t bytelen = (n + 7) >> 3;
-    uint32_t last_shift = (8 - n) & 7;
-    uint32_t txremain = bytelen,
-             rxremain = last_shift ? bytelen : (bytelen + 1);
-
-    /*printf("seq n=%lu bytelen=%lu lsh=%lu txr=%lu rxr=%lu\n",
-            n, bytelen, last_shift, txremain, rxremain);*/
-
-    pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, swdsm,
-            (uint8_t)(n - 1) | ((info & SWD_SEQUENCE_DIN) ? 0x80000000u : 0));
+    uint64_t v = 0;
 
     if (info & SWD_SEQUENCE_DIN) {
-        for (size_t i = 0; rxremain; tight_loop_contents()) {
-            if (!pio_sm_is_rx_fifo_empty(PINOUT_JTAG_PIO_DEV, swdsm)) {
-                uint8_t v = *rx;
-                --rxremain;
-                //printf("seq din  rx %02x rxr=%lu\n", bitswap(v), rxremain);
-                if (i < bytelen) {
-                    if (last_shift && i == bytelen - 1) {
-                        swdi[i] = bitswap(v) >> last_shift;
-                    } else {
-                        swdi[i] = bitswap(v);
-                    }
-                    ++i;
-                }
-            }
-        }
-    } else {
-        for (size_t i = 0; txremain; tight_loop_contents()) {
-            if (!pio_sm_is_tx_fifo_full(PINOUT_JTAG_PIO_DEV, swdsm)) {
-                *tx = bitswap(swdo[i]);
-                --txremain;
-                //printf("seq dout tx %02x txr=%lu\n", swdo[i], txremain);
-                ++i;
-            }
-        }
-
-        // wait until FIFO empty, so that all bytes have been xmitted
-        while (!pio_sm_is_tx_fifo_empty(PINOUT_JTAG_PIO_DEV, swdsm)) tight_loop_contents();
-        // ^ isn't enough, because of the side-set, so we need the loop below
-        //   however, we still need the above one because otherwise we might
-        //   somehow miss sending some bits in practice...
-
-        // wait until last bit xmitted, and back at the starting insn
-        while (pio_sm_get_pc(PINOUT_JTAG_PIO_DEV, swdsm) != swdoffset) tight_loop_contents();
-    }
-
-    // we need to disable (and reenable at the start of this routine) the SM
-    // because we also use it to set the SWDIO pin and direction elsewhere,
-    // which shouldn't happen when the SM is enabled
-    //busy_wait_us_32(0);
-    pio_sm_set_enabled(PINOUT_JTAG_PIO_DEV, swdsm, false);
-
-    //printf("seq done, disabled\n");
-}
-#endif
-
-static void swd_seq(uint32_t count, uint32_t flags, const uint8_t* swdo, uint8_t* swdi) {
-    //printf("swd seqbase count=%lu\n", count);
-    static uint64_t last_bit = ~(uint64_t)0;
-    uint64_t devnull = 0;
-
-    if ( (flags & SWD_SEQUENCE_DIN) && !swdi) swdi = (uint8_t*)&devnull;
-    if (!(flags & SWD_SEQUENCE_DIN) && !swdo) swdo = (const uint8_t*)&last_bit;
-
-    if (flags & SWD_SEQUENCE_DIN) {
-        PIN_SWDIO_OUT_DISABLE();
+        swd_cmd_in(n);
+        v = swd_get_in(n);
+        for (size_t i = 0; i < bytelen; ++i) swdi[i] = (uint8_t)(v >> (i * 8));
     } else {
-        PIN_SWDIO_OUT_ENABLE();
+        for (size_t i = 0; i < bytelen; ++i) v |= (uint64_t)swdo[i] << (i * 8);
+        swd_cmd_out(true, n, v);
+        swd_wait_idle();
     }
-
-    const uint8_t* sdo = NULL;
-    uint8_t* sdi = NULL;
-
-    uint32_t nreal;
-    for (uint32_t i = 0; i < count; i += nreal) {
-        uint32_t nmod = (count - i) & 63;
-        nreal = nmod ? nmod : 64;
-
-        if (flags & SWD_SEQUENCE_DIN) {
-            sdi = swdi ? &swdi[i >> 3] : (      uint8_t*)&devnull ;
-            sdo = NULL;
-        } else {
-            sdo = swdo ? &swdo[i >> 3] : (const uint8_t*)&last_bit;
-            sdi = NULL;
-        }
-
-        SWD_Sequence(nmod | flags, sdo, sdi);
-    }
-
-    if (!(flags & SWD_SEQUENCE_DIN) && swdo) {
-        uint8_t lastbyte = swdo[((count + 7) >> 3) - 1];
-        last_bit = (lastbyte & (1 << (count & 7))) ? ~(uint64_t)0 : (uint64_t)0;
-    }
-
-    //printf("swd seqbase end\n");
 }
 
 void jtag_tms_seq(uint32_t count, const uint8_t* data);
@@ -267,7 +257,14 @@ void SWJ_Sequence(uint32_t count, const uint8_t* data) {
     if ((swdsm == -1 || swdoffset == -1) && jtagsm >= 0 && jtagoffset >= 0) {
         jtag_tms_seq(count, data); // JTAG mode -- handle in JTAG code
     } else if (swdsm >= 0 && swdoffset >= 0) {
-        swd_seq(count, 0, data, NULL); // SWD mode - we can do just this
+        // SWD mode - we can do just this
+        for (uint32_t i = 0; i < count; i += 64) {
+            uint32_t n = (count - i) > 64 ? 64 : (count - i);
+            uint64_t v = 0;
+            for (uint32_t j = 0; j < n; j += 8) v |= (uint64_t)data[(i + j) >> 3] << j;
+            swd_cmd_out(true, n, v);
+        }
+        swd_wait_idle();
     } else {
         //printf("E: SWJ_Sequence while not in JTAG or SBW mode\n");
         // welp - can't really report an error to the upper CMSIS-DAP layers
@@ -282,99 +279,246 @@ void SWJ_Sequence(uint32_t count, const uint8_t* data) {
     }*/
 }
 
+// header word of the request phase of a transfer
+static uint32_t swd_req_word(uint32_t request) {
+    uint32_t parity = __builtin_parity(request & 0xf);
+    uint32_t req = 1 | ((request & 0xf) << 1) | (parity << 5) | (0<<6) | (1<<7);
+
+    return swd_hdr(dap_swd_offset_cmd_out, true, 8) | (req << SWD_HDR_BITS);
+}
+
+// the SM is stuck after a bad ack: throw away the rest of the transfer, and
+// finish it on the wire
+static void swd_transfer_fail(uint32_t request, uint8_t ack) {
+    uint32_t trn = DAP_Data.swd_conf.turnaround;
+    uint32_t num;
+
+    pio_sm_clear_fifos(PINOUT_JTAG_PIO_DEV, swdsm);
+    pio_sm_exec(PINOUT_JTAG_PIO_DEV, swdsm,
+            pio_encode_jmp(swdoffset + dap_swd_offset_get_cmd));
+
+    switch (ack) {
+    case DAP_TRANSFER_WAIT: case DAP_TRANSFER_FAULT:
+        num = trn;
+        if (DAP_Data.swd_conf.data_phase &&  (request & DAP_TRANSFER_RnW)) {
+            num += 33; // 32 bits + parity
+        }
+        //printf("  wait/fault: %lu\n", num);
+
+        swd_cmd_clocks(false, num);
+
+        if (DAP_Data.swd_conf.data_phase && !(request & DAP_TRANSFER_RnW)) {
+            //printf("  w/f dataphase\n");
+            swd_cmd_clocks(true, 33); // 32 data bits + parity
+        }
+        break;
+    default: // protocol error
+        //printf("  proto error\n");
+        swd_cmd_clocks(false, trn + 33);
+        break;
+    }
+}
+
 uint8_t SWD_Transfer(uint32_t request, uint32_t* data) {
     //printf("swd xfer request=%08lx\n", request);
-    uint32_t parity;
-    uint8_t swdo;
+    uint32_t trn = DAP_Data.swd_conf.turnaround;
+    uint32_t parity, val;
 
-    parity = ((request >> 0) & 1) + ((request >> 1) & 1)
-           + ((request >> 2) & 1) + ((request >> 3) & 1);
-    swdo = 1 | ((request & 0xf) << 1) | ((parity & 1) << 5) | (0<<6) | (1<<7);
-    swd_seq(8, 0, &swdo, NULL);
+    // queue the entire transfer: if the ack isn't OK, the SM stops after
+    // reporting it, and whatever comes after is discarded
+    pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, swdsm, swd_req_word(request));
+    swd_cmd_out(false, trn, 0);
+    pio_sm_put_blocking(PINOUT_JTAG_PIO_DEV, swdsm, swd_hdr(dap_swd_offset_cmd_ack, false, 3));
 
-    swd_seq(DAP_Data.swd_conf.turnaround, SWD_SEQUENCE_DIN, NULL, NULL);
+    if (request & DAP_TRANSFER_RnW) {
+        swd_cmd_in(33 + trn); // data, parity, turnaround
+    } else {
+        val = *data;
+        swd_cmd_out(false, trn, 0);
+        swd_cmd_out(true, 33, val | ((uint64_t)__builtin_parity(val) << 32));
+    }
 
-    uint8_t ack = 0;
-    swd_seq(3, SWD_SEQUENCE_DIN, NULL, &ack);
+    uint8_t ack = pio_sm_get_blocking(PINOUT_JTAG_PIO_DEV, swdsm) >> 29;
     //printf("  ack=%hhu\n", ack);
 
-    uint32_t num;
-    switch (ack) {
-    case DAP_TRANSFER_OK:
-        if (request & DAP_TRANSFER_RnW) {
-            //printf("  xfer ok, r\n");
-            uint64_t val = 0;
-            parity = 0;
-            // FIXME: this is little-endian-only!
-            swd_seq(33, SWD_SEQUENCE_DIN, NULL, (uint8_t*)&val);
-
-            for (size_t i = 0; i < 32; ++i) parity += ((uint32_t)val >> i) & 1;
-            if ((parity & 1) != ((uint32_t)(val >> 32) & 1)) {
-                ack = DAP_TRANSFER_ERROR;
-            }
-            if (data) *data = (uint32_t)val;
+    if (ack != DAP_TRANSFER_OK) {
+        swd_transfer_fail(request, ack);
+        return ack;
+    }
 
-            swd_seq(DAP_Data.swd_conf.turnaround, SWD_SEQUENCE_DIN, NULL, NULL);
+    if ((request & SWD_REQ_SELECT_MASK) == DP_SELECT) swd_dp_select = *data;
 
-            //PIN_SWDIO_OUT_ENABLE();
-        } else { // write
-            //printf("  xfer ok, w\n");
-            swd_seq(DAP_Data.swd_conf.turnaround, SWD_SEQUENCE_DIN, NULL, NULL);
+    if (request & DAP_TRANSFER_RnW) {
+        val    = pio_sm_get_blocking(PINOUT_JTAG_PIO_DEV, swdsm);
+        parity = pio_sm_get_blocking(PINOUT_JTAG_PIO_DEV, swdsm) >> (31 - trn);
 
-            //PIN_SWDIO_OUT_ENABLE();
+        if ((parity ^ __builtin_parity(val)) & 1) {
+            ack = DAP_TRANSFER_ERROR;
+        }
+        if (data) *data = val;
+    }
 
-            uint32_t val = *data;
+    if (request & DAP_TRANSFER_TIMESTAMP) {
+        swd_wait_idle();
+        DAP_Data.timestamp = TIMESTAMP_GET();
+    }
 
-            parity = 0;
-            for (size_t i = 0; i < 32; ++i) parity += (val >> i) & 1;
+    swd_cmd_clocks(true, DAP_Data.transfer.idle_cycles);
 
-            uint64_t out = val | ((uint64_t)(parity & 1) << 32);
-            // FIXME: this is little-endian-only!
-            swd_seq(33, 0, (const uint8_t*)&out, NULL);
-        }
+    //printf("  finished\n");
+    return ack;
+}
 
-        //printf("  set ts\n");
-        if (request & DAP_TRANSFER_TIMESTAMP) DAP_Data.timestamp = TIMESTAMP_GET();
+/* block transfers: the commands for a chunk of transfers are built in RAM,
+ * and DMA'd into the SM, with the results DMA'd back out, so the SM doesn't
+ * have to wait for the CPU between transfers. when a transfer gets a bad
+ * ack, the SM stops, and the chunk is restarted from there. */
+
+#define SWD_BLOCK_CHUNK 32
+#define SWD_BLOCK_TXW   7  /* request, trn, ack, [trn, data, data] or [in], [idle] */
+
+static uint32_t swd_blk_tx[SWD_BLOCK_CHUNK * SWD_BLOCK_TXW];
+static uint32_t swd_blk_rx[SWD_BLOCK_CHUNK * 3]; /* ack, [data, parity] */
+
+// stop a chunk that's stuck on a bad ack: nothing may be left in flight, in
+// the FIFOs or in the shift registers once the SM fetches commands again
+static void swd_blk_abort(void) {
+    dma_channel_abort(swd_dmatx);
+    dma_channel_abort(swd_dmarx);
+    pio_sm_clear_fifos(PINOUT_JTAG_PIO_DEV, swdsm);
+    pio_sm_restart(PINOUT_JTAG_PIO_DEV, swdsm);
+    pio_sm_exec(PINOUT_JTAG_PIO_DEV, swdsm,
+            pio_encode_jmp(swdoffset + dap_swd_offset_get_cmd));
+}
 
-        num = DAP_Data.transfer.idle_cycles;
-        //printf("  idlecyc=%lu\n", num);
-        for (uint32_t i = 0; i < num; i += 64) {
-            uint64_t swdio = 0;
+uint8_t SWD_TransferBlock(uint32_t request, const uint8_t* wdata, uint8_t* rdata,
+        uint32_t count, uint32_t* done) {
+    uint32_t trn  = DAP_Data.swd_conf.turnaround,
+             idle = DAP_Data.transfer.idle_cycles;
+    bool rnw = request & DAP_TRANSFER_RnW;
+    uint32_t rxw = rnw ? 3 : 1; // RX words per transfer
+    uint32_t retry = DAP_Data.transfer.retry_count;
+    uint32_t i = 0, j;
+    uint8_t ack = DAP_TRANSFER_OK;
+
+    *done = 0;
+    // leave anything unusual to SWD_Transfer()
+    if (swd_dmatx < 0 || swd_dmarx < 0 || idle > 32 - SWD_HDR_BITS
+            || (request & DAP_TRANSFER_TIMESTAMP)) {
+        return DAP_TRANSFER_OK;
+    }
 
-            uint32_t cyc = num - i;
-            if (cyc > 64) cyc = 64;
+    dma_channel_config txc = dma_channel_get_default_config(swd_dmatx);
+    channel_config_set_read_increment(&txc, true);
+    channel_config_set_write_increment(&txc, false);
+    channel_config_set_dreq(&txc, pio_get_dreq(PINOUT_JTAG_PIO_DEV, swdsm, true));
+    channel_config_set_transfer_data_size(&txc, DMA_SIZE_32);
+    dma_channel_config rxc = dma_channel_get_default_config(swd_dmarx);
+    channel_config_set_read_increment(&rxc, false);
+    channel_config_set_write_increment(&rxc, true);
+    channel_config_set_dreq(&rxc, pio_get_dreq(PINOUT_JTAG_PIO_DEV, swdsm, false));
+    channel_config_set_transfer_data_size(&rxc, DMA_SIZE_32);
+
+    while (i < count) {
+        uint32_t n = count - i, ntx = 0, nrx, got;
+        if (n > SWD_BLOCK_CHUNK) n = SWD_BLOCK_CHUNK;
+        nrx = n * rxw;
+
+        for (j = 0; j < n; ++j) {
+            swd_blk_tx[ntx++] = swd_req_word(request);
+            swd_blk_tx[ntx++] = swd_hdr(dap_swd_offset_cmd_out, false, trn);
+            swd_blk_tx[ntx++] = swd_hdr(dap_swd_offset_cmd_ack, false, 3);
+            if (rnw) {
+                swd_blk_tx[ntx++] = swd_hdr(dap_swd_offset_cmd_in, false, 33 + trn);
+            } else {
+                const uint8_t* d = &wdata[(i + j) * 4];
+                uint32_t val = d[0] | ((uint32_t)d[1] << 8)
+                    | ((uint32_t)d[2] << 16) | ((uint32_t)d[3] << 24);
+
+                swd_blk_tx[ntx++] = swd_hdr(dap_swd_offset_cmd_out, false, trn);
+                swd_blk_tx[ntx++] = swd_hdr(dap_swd_offset_cmd_out, true, 33)
+                                  | (val << SWD_HDR_BITS);
+                swd_blk_tx[ntx++] = (val >> (32 - SWD_HDR_BITS))
+                                  | ((uint32_t)__builtin_parity(val) << SWD_HDR_BITS);
+            }
+            if (idle) swd_blk_tx[ntx++] = swd_hdr(dap_swd_offset_cmd_out, true, idle);
 
-            //printf("  sequence of %lu\n", cyc);
-            SWD_Sequence((cyc & SWD_SEQUENCE_CLK), (const uint8_t*)&swdio, NULL);
+            // an ack that hasn't arrived yet looks OK, see below
+            swd_blk_rx[j * rxw] = (uint32_t)DAP_TRANSFER_OK << 29;
         }
-        //printf("  idlecyc end\n");
-        break;
-    case DAP_TRANSFER_WAIT: case DAP_TRANSFER_FAULT:
-        num = DAP_Data.swd_conf.turnaround;
-        if (DAP_Data.swd_conf.data_phase &&  (request & DAP_TRANSFER_RnW)) {
-            num += 33; // 32 bits + parity
+
+        // the idle cycles of the previous chunk might still be underway
+        dma_channel_wait_for_finish_blocking(swd_dmatx);
+        dma_channel_configure(swd_dmarx, &rxc, swd_blk_rx,
+                &PINOUT_JTAG_PIO_DEV->rxf[swdsm], nrx, true);
+        dma_channel_configure(swd_dmatx, &txc, &PINOUT_JTAG_PIO_DEV->txf[swdsm],
+                swd_blk_tx, ntx, true);
+
+        // wait until the chunk is done, or the SM is stuck on a bad ack
+        for (;;) {
+            if (!dma_channel_is_busy(swd_dmarx)) {
+                got = nrx;
+                break;
+            }
+
+            got = nrx - dma_hw->ch[swd_dmarx].transfer_count;
+            if (got && (got - 1) % rxw == 0
+                    && (swd_blk_rx[got - 1] >> 29) != DAP_TRANSFER_OK) {
+                break;
+            }
+            tight_loop_contents();
         }
-        //printf("  wait/fault: %lu\n", num);
 
-        swd_seq(num, SWD_SEQUENCE_DIN, NULL, NULL);
+        for (j = 0; j * rxw < got; ++j) {
+            ack = swd_blk_rx[j * rxw] >> 29;
+            if (ack != DAP_TRANSFER_OK) break;
 
-        if (DAP_Data.swd_conf.data_phase && !(request & DAP_TRANSFER_RnW)) {
-            //printf("  w/f dataphase\n");
+            if (rnw) {
+                uint32_t val    = swd_blk_rx[j * 3 + 1],
+                         parity = swd_blk_rx[j * 3 + 2] >> (31 - trn);
+
+                if ((parity ^ __builtin_parity(val)) & 1) {
+                    ack = DAP_TRANSFER_ERROR;
+                    break;
+                }
 
-            uint64_t swdio = 0;
-            swd_seq(33, 0, (const uint8_t*)&swdio, NULL); // 32 data bits + parity
+                uint8_t* d = &rdata[(i + j) * 4];
+                d[0] = (uint8_t)(val >>  0);
+                d[1] = (uint8_t)(val >>  8);
+                d[2] = (uint8_t)(val >> 16);
+                d[3] = (uint8_t)(val >> 24);
+            }
         }
-        break;
-    default: // protocol error
-        //printf("  proto error\n");
-        swd_seq(DAP_Data.swd_conf.turnaround + 33, SWD_SEQUENCE_DIN, NULL, NULL);
-        break;
+
+        i += j;
+        if (j) retry = DAP_Data.transfer.retry_count;
+        if (j == n) continue;
+
+        // a bad ack is always the last thing the SM sends before it stops
+        uint8_t last = swd_blk_rx[((got - 1) / rxw) * rxw] >> 29;
+        if (last != DAP_TRANSFER_OK) {
+            swd_blk_abort();
+            swd_transfer_fail(request, last);
+        } else {
+            // a parity error: all of the chunk has been read, only the
+            // trailing idle cycles can still be going
+            dma_channel_wait_for_finish_blocking(swd_dmatx);
+            swd_wait_idle();
+        }
+
+        if (ack != DAP_TRANSFER_WAIT || !retry-- || DAP_TransferAbort) break;
     }
 
-    //printf("  finished\n");
-    PIN_SWDIO_OUT_ENABLE();
-    PIN_SWDIO_SET_PIO();
+    // don't let the next transfer's commands overtake the last ones of this
+    dma_channel_wait_for_finish_blocking(swd_dmatx);
+
+    if ((request & SWD_REQ_SELECT_MASK) == DP_SELECT && i) {
+        const uint8_t* d = &wdata[(i - 1) * 4];
+        swd_dp_select = d[0] | ((uint32_t)d[1] << 8)
+            | ((uint32_t)d[2] << 16) | ((uint32_t)d[3] << 24);
+    }
+
+    *done = i;
     return ack;
 }
-//#endif
-
+#endif
@@ -3,8 +3,10 @@
 #include "DAP_config.h"
 #include "DAP.h"
 
+#include <hardware/clocks.h>
 #include <hardware/dma.h>
 #include <hardware/gpio.h>
+#include <hardware/irq.h>
 #include <hardware/pio.h>
 #include <hardware/structs/dma.h>
 
@@ -13,71 +15,197 @@
 
 static uint32_t
     swo_baudrate = 115200,
-    swo_pio_off = ~(uint32_t)0, swo_num = 0;
-static int swo_sm = -1, swo_dmach = -1;
+    swo_pio_off = ~(uint32_t)0;
+static int swo_sm = -1, swo_dmach[2] = { -1, -1 };
 static bool mode_enabled = false;
 
+// capture ring state: two DMA channels, each filling one half of the ring and
+// then triggering the other one, so capturing never stops. the DMA IRQ only
+// counts the filled halves.
+static volatile uint32_t swo_blocks = 0;
+static uint32_t swo_half = 0, swo_xfersize = 1;
+static volatile void* swo_rxsrc = NULL;
+// count of bytes captured, as of when the capture was stopped
+static uint32_t swo_stop_count = 0;
+static bool swo_running = false;
+
 #define SWO_PIO PINOUT_JTAG_SWO_DEV
 
+static void dap_swo_dma_isr() {
+    uint32_t ints = dma_hw->ints0 & ((1u << swo_dmach[0]) | (1u << swo_dmach[1]));
+
+    if (ints) {
+        dma_hw->ints0 = ints;
+        swo_blocks += __builtin_popcount(ints);
+    }
+}
+
+static void swo_dma_stop(void) {
+    uint32_t mask = (1u << swo_dmach[0]) | (1u << swo_dmach[1]);
+
+    // disable both channels first so an abort doesn't trigger the other one
+    // through the chain
+    for (int i = 0; i < 2; ++i) {
+        dma_irqn_set_channel_enabled(0, swo_dmach[i], false);
+        hw_clear_bits(&dma_hw->ch[swo_dmach[i]].al1_ctrl, DMA_CH0_CTRL_TRIG_EN_BITS);
+    }
+    dma_hw->abort = mask;
+    while (dma_hw->abort & mask) tight_loop_contents();
+    dma_hw->ints0 = mask;
+}
+
+static bool swo_claim(const pio_program_t* prg) {
+    swo_sm = pio_claim_unused_sm(SWO_PIO, false);
+    if (swo_sm == -1) return false;
+
+    for (int i = 0; i < 2; ++i) {
+        swo_dmach[i] = dma_claim_unused_channel(false);
+        if (swo_dmach[i] == -1) goto err_dma;
+    }
+
+    if (!pio_can_add_program(SWO_PIO, prg)) goto err_dma;
+    swo_pio_off = pio_add_program(SWO_PIO, prg);
+
+    irq_set_enabled(DMA_IRQ_0, false);
+    irq_add_shared_handler(DMA_IRQ_0, dap_swo_dma_isr,
+            PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    return true;
+
+err_dma:
+    for (int i = 0; i < 2; ++i) {
+        if (swo_dmach[i] >= 0) {
+            dma_channel_unclaim(swo_dmach[i]);
+            swo_dmach[i] = -1;
+        }
+    }
+    pio_sm_unclaim(SWO_PIO, swo_sm);
+    swo_sm = -1;
+    return false;
+}
+
+static void swo_release(const pio_program_t* prg) {
+    mode_enabled = false;
+    swo_running = false;
+
+    if (swo_dmach[0] >= 0) {
+        swo_dma_stop();
+
+        irq_set_enabled(DMA_IRQ_0, false);
+        irq_remove_handler(DMA_IRQ_0, dap_swo_dma_isr);
+        irq_set_enabled(DMA_IRQ_0, true);
+
+        for (int i = 0; i < 2; ++i) {
+            dma_channel_unclaim(swo_dmach[i]); // ugh why is it "dma_channel_xyz" and "dma_xyz_channel"
+            swo_dmach[i] = -1;
+        }
+    }
+
+    if (swo_sm >= 0) {
+        pio_sm_set_enabled(SWO_PIO, swo_sm, false);
+        pio_sm_unclaim(SWO_PIO, swo_sm);
+        swo_sm = -1;
+    }
+    if (~swo_pio_off != 0) {
+        pio_remove_program(SWO_PIO, prg, swo_pio_off);
+        swo_pio_off = ~(uint32_t)0;
+    }
+
+    // hi-Z nothing
+    gpio_set_function(PINOUT_SWO, GPIO_FUNC_NULL);
+    gpio_set_pulls(PINOUT_SWO, false, false);
+}
+
+// set up the capture ring over buf, which must be aligned to num (a power of
+// two, at most 64k). nothing is captured until swo_control() starts it.
+static void swo_capture(uint8_t* buf, uint32_t num) {
+    if (!mode_enabled) return;
+
+    swo_blocks = 0;
+    swo_stop_count = 0;
+    swo_half = num >> 1;
+
+    for (int i = 0; i < 2; ++i) {
+        dma_channel_config dcfg = dma_channel_get_default_config(swo_dmach[i]);
+        channel_config_set_read_increment(&dcfg, false);
+        channel_config_set_write_increment(&dcfg, true);
+        channel_config_set_dreq(&dcfg, pio_get_dreq(SWO_PIO, swo_sm, false));
+        channel_config_set_transfer_data_size(&dcfg,
+                (swo_xfersize == 4) ? DMA_SIZE_32 : DMA_SIZE_8);
+        // wrap the write address within this channel's half of the ring
+        channel_config_set_ring(&dcfg, true, __builtin_ctz(swo_half));
+        channel_config_set_chain_to(&dcfg, swo_dmach[i ^ 1]);
+        dma_channel_configure(swo_dmach[i], &dcfg, buf + i * swo_half,
+                swo_rxsrc, swo_half / swo_xfersize, false);
+
+        dma_hw->ints0 = 1u << swo_dmach[i];
+        dma_irqn_set_channel_enabled(0, swo_dmach[i], true);
+    }
+}
+
+// total number of bytes captured since swo_capture(), modulo 2^32
+static uint32_t swo_get_count(void) {
+    if (!mode_enabled) return 0;
+    // with neither channel running, there's no current one to look at
+    if (!swo_running) return swo_stop_count;
+
+    uint32_t blocks = swo_blocks;
+    int ch = swo_dmach[blocks & 1];
+    // the IRQ of a half that just got filled may not have been handled yet,
+    // the other channel is running already then
+    if (!dma_channel_is_busy(ch)) {
+        ++blocks;
+        ch = swo_dmach[blocks & 1];
+    }
+
+    // DMA hw decreases transfer_count by one on every transfer, so it contains
+    // the number of remaining transfers for this half
+    uint32_t remaining = dma_hw->ch[ch].transfer_count * swo_xfersize;
+    return blocks * swo_half + (swo_half - remaining);
+}
+
+static uint32_t swo_control(uint32_t active) {
+    if (!mode_enabled) return 0;
+
+    if (active) {
+        pio_sm_clear_fifos(SWO_PIO, swo_sm);
+        pio_sm_set_enabled(SWO_PIO, swo_sm, true);
+        dma_channel_start(swo_dmach[0]);
+        swo_running = true;
+    } else if (swo_running) {
+        // stop receiving, and let the DMA take what is left in the FIFO, so
+        // that nothing comes in after the final count
+        pio_sm_set_enabled(SWO_PIO, swo_sm, false);
+        while (!pio_sm_is_rx_fifo_empty(SWO_PIO, swo_sm)) tight_loop_contents();
+
+        swo_stop_count = swo_get_count();
+        swo_running = false;
+        swo_dma_stop();
+    }
+
+    return 1;
+}
+
 // Enable or disable SWO Mode (UART)
 //   enable: enable flag
 //   return: 1 - Success, 0 - Error
 uint32_t SWO_Mode_UART(uint32_t enable) {
-    //for(;;);//printf("SWO mode %lu\n", enable);
     if (enable) {
         if (mode_enabled) { // already inited!
             return 0;
         }
 
-        swo_sm = pio_claim_unused_sm(SWO_PIO, false);
-        if (swo_sm == -1) {
-            //for(;;);//printf("E: no PIO\n");
-            return 0;
-        }
-
-        swo_dmach = dma_claim_unused_channel(false);
-        if (swo_dmach == -1) {
-            //for(;;);//printf("E: no DMA\n");
-            pio_sm_unclaim(SWO_PIO, swo_sm);
-            swo_sm = -1;
-            return 0;
-        }
-
-        if (!pio_can_add_program(SWO_PIO, &swo_uart_rx_program)) {
-            //for(;;);//printf("E: no prg\n");
-            dma_channel_unclaim(swo_dmach);
-            swo_dmach = -1;
-            pio_sm_unclaim(SWO_PIO, swo_sm);
-            swo_sm = -1;
-            return 0;
-        }
+        if (!swo_claim(&swo_uart_rx_program)) return 0;
 
-        swo_pio_off = pio_add_program(SWO_PIO, &swo_uart_rx_program);
         swo_uart_rx_program_init(SWO_PIO, swo_sm, swo_pio_off, PINOUT_SWO, swo_baudrate);
-        gpio_set_function(PINOUT_SWO, GPIO_FUNC_PIO1);
+        // the received byte is left-justified in the FIFO word
+        swo_rxsrc = (io_rw_8*)&SWO_PIO->rxf[swo_sm] + 3;
+        swo_xfersize = 1;
 
         mode_enabled = true;
     } else {
-        mode_enabled = false;
-
-        if (swo_dmach >= 0) {
-            dma_channel_unclaim(swo_dmach); // ugh why is it "dma_channel_xyz" and "dma_xyz_channel"
-            swo_dmach = -1;
-        }
-
-        if (swo_sm >= 0) {
-            pio_sm_set_enabled(SWO_PIO, swo_sm, false);
-            pio_sm_unclaim(SWO_PIO, swo_sm);
-            swo_sm = -1;
-        }
-        if (~swo_pio_off != 0) {
-            pio_remove_program(SWO_PIO, &swo_uart_rx_program, swo_pio_off);
-            swo_pio_off = ~(uint32_t)0;
-        }
-
-        // hi-Z nothing
-        gpio_set_function(PINOUT_SWO, GPIO_FUNC_NULL);
-        gpio_set_pulls(PINOUT_SWO, false, false);
+        swo_release(&swo_uart_rx_program);
     }
 
     return 1;
@@ -87,7 +215,6 @@ uint32_t SWO_Mode_UART(uint32_t enable) {
 //   baudrate: requested baudrate
 //   return: actual baudrate or 0 when not configured
 uint32_t SWO_Baudrate_UART(uint32_t baudrate) {
-    //for(;;);//printf("SWO baudrate %lu\n", baudrate);
     swo_baudrate = baudrate;
     if (!mode_enabled) return 0;
 
@@ -100,169 +227,66 @@ uint32_t SWO_Baudrate_UART(uint32_t baudrate) {
 //   active: active flag
 //   return: 1 - Success, 0 - Error
 uint32_t SWO_Control_UART(uint32_t active) {
-    //for(;;);//printf("SWO control %lu\n", active);
-    if (!mode_enabled) return 0;
-
-    if (active) {
-        pio_sm_set_enabled(SWO_PIO, swo_sm, true);
-        dma_channel_start(swo_dmach);
-    }
-    else {
-        dma_channel_abort(swo_dmach);
-        pio_sm_set_enabled(SWO_PIO, swo_sm, false);
-        swo_num = 0;
-    }
-
-    return 1;
+    return swo_control(active);
 }
 
 // Start SWO Capture (UART)
 //   buf: pointer to buffer for capturing
 //   num: number of bytes to capture
 void SWO_Capture_UART(uint8_t* buf, uint32_t num) {
-    //for(;;);//printf("SWO capture %p 0x%lx\n", buf, num);
-    if (!mode_enabled) return;
-
-    swo_num = num;
-
-    // set up DMA params
-    dma_channel_config dcfg = dma_channel_get_default_config(swo_dmach);
-    channel_config_set_read_increment(&dcfg, false);
-    channel_config_set_write_increment(&dcfg, true);
-    channel_config_set_dreq(&dcfg, pio_get_dreq(SWO_PIO, swo_sm, false));
-    channel_config_set_transfer_data_size(&dcfg, DMA_SIZE_8);
-    dma_channel_configure(swo_dmach, &dcfg, buf, &SWO_PIO->rxf[swo_sm], num, false);
+    swo_capture(buf, num);
 }
 
 // Get SWO Pending Trace Count (UART)
 //   return: number of pending trace data bytes
 uint32_t SWO_GetCount_UART(void) {
-    // DMA hw decreases transfer_count by one on every transfer, so it contains
-    // the number of remaining bytes to be received.
-    // however, CMSIS-DAP wants (badly worded) the number of bytes already
-    // received
-    if (!mode_enabled || swo_num == 0) return 0; // not initialized
-
-    uint32_t remaining = dma_hw->ch[swo_dmach].transfer_count;
-    //for(;;);//printf("SWO getcount -> 0x%lx\n", swo_num - remaining);
-    return swo_num - remaining;
+    // with SWO_RING_CAPTURE, this is the total number of bytes received
+    return swo_get_count();
 }
 
 /*** MANCHESTER **************************************************************/
 
 uint32_t SWO_Mode_Manchester(uint32_t enable) {
-    //for(;;);//printf("SWOM mode %lu\n", enable);
     if (enable) {
         if (mode_enabled) { // already inited!
             return 0;
         }
 
-        swo_sm = pio_claim_unused_sm(SWO_PIO, false);
-        if (swo_sm == -1) {
-            //for(;;);//printf("E: no PIO\n");
-            return 0;
-        }
-
-        swo_dmach = dma_claim_unused_channel(false);
-        if (swo_dmach == -1) {
-            //for(;;);//printf("E: no DMA\n");
-            pio_sm_unclaim(SWO_PIO, swo_sm);
-            swo_sm = -1;
-            return 0;
-        }
-
-        if (!pio_can_add_program(SWO_PIO, &swo_manchester_rx_program)) {
-            //for(;;);//printf("E: no prg\n");
-            dma_channel_unclaim(swo_dmach);
-            swo_dmach = -1;
-            pio_sm_unclaim(SWO_PIO, swo_sm);
-            swo_sm = -1;
-            return 0;
-        }
+        if (!swo_claim(&swo_manchester_rx_program)) return 0;
 
-        swo_pio_off = pio_add_program(SWO_PIO, &swo_manchester_rx_program);
-        swo_manchester_rx_program_init(SWO_PIO, swo_sm, swo_pio_off, PINOUT_SWO, swo_baudrate);
-        gpio_set_function(PINOUT_SWO, GPIO_FUNC_PIO1);
+        // one bit is 12 PIO cycles
+        swo_manchester_rx_program_init(SWO_PIO, swo_sm, swo_pio_off, PINOUT_SWO,
+                (float)clock_get_hz(clk_sys) / (12 * swo_baudrate));
+        // autopush of whole words, LSB first
+        swo_rxsrc = &SWO_PIO->rxf[swo_sm];
+        swo_xfersize = 4;
 
         mode_enabled = true;
     } else {
-        mode_enabled = false;
-
-        if (swo_dmach >= 0) {
-            dma_channel_unclaim(swo_dmach); // ugh why is it "dma_channel_xyz" and "dma_xyz_channel"
-            swo_dmach = -1;
-        }
-
-        if (swo_sm >= 0) {
-            pio_sm_set_enabled(SWO_PIO, swo_sm, false);
-            pio_sm_unclaim(SWO_PIO, swo_sm);
-            swo_sm = -1;
-        }
-        if (~swo_pio_off != 0) {
-            pio_remove_program(SWO_PIO, &swo_manchester_rx_program, swo_pio_off);
-            swo_pio_off = ~(uint32_t)0;
-        }
-
-        // hi-Z nothing
-        gpio_set_function(PINOUT_SWO, GPIO_FUNC_NULL);
-        gpio_set_pulls(PINOUT_SWO, false, false);
+        swo_release(&swo_manchester_rx_program);
     }
 
     return 1;
-    return 0;
 }
 
 uint32_t SWO_Baudrate_Manchester(uint32_t baudrate) {
-    //for(;;);//printf("SWOM baudrate %lu\n", baudrate);
     swo_baudrate = baudrate;
     if (!mode_enabled) return 0;
 
-    swo_manchester_rx_program_init(SWO_PIO, swo_sm, swo_pio_off, PINOUT_SWO, baudrate);
+    swo_manchester_rx_program_init(SWO_PIO, swo_sm, swo_pio_off, PINOUT_SWO,
+            (float)clock_get_hz(clk_sys) / (12 * baudrate));
 
     return baudrate; // should be ok
 }
 
 uint32_t SWO_Control_Manchester(uint32_t active) {
-    //for(;;);//printf("SWOM control %lu\n", active);
-    if (!mode_enabled) return 0;
-
-    if (active) {
-        pio_sm_set_enabled(SWO_PIO, swo_sm, true);
-        dma_channel_start(swo_dmach);
-    }
-    else {
-        dma_channel_abort(swo_dmach);
-        pio_sm_set_enabled(SWO_PIO, swo_sm, false);
-        swo_num = 0;
-    }
-
-    return 1;
+    return swo_control(active);
 }
 
 void SWO_Capture_Manchester(uint8_t* buf, uint32_t num) {
-    //for(;;);//printf("SWOM capture %p 0x%lx\n", buf, num);
-    if (!mode_enabled) return;
-
-    swo_num = num;
-
-    // set up DMA params
-    dma_channel_config dcfg = dma_channel_get_default_config(swo_dmach);
-    channel_config_set_read_increment(&dcfg, false);
-    channel_config_set_write_increment(&dcfg, true);
-    channel_config_set_dreq(&dcfg, pio_get_dreq(SWO_PIO, swo_sm, false));
-    channel_config_set_transfer_data_size(&dcfg, DMA_SIZE_8);
-    dma_channel_configure(swo_dmach, &dcfg, buf, &SWO_PIO->rxf[swo_sm], num, false);
+    swo_capture(buf, num);
 }
 
 uint32_t SWO_GetCount_Manchester(void) {
-    // DMA hw decreases transfer_count by one on every transfer, so it contains
-    // the number of remaining bytes to be received.
-    // however, CMSIS-DAP wants (badly worded) the number of bytes already
-    // received
-    if (!mode_enabled || swo_num == 0) return 0; // not initialized
-
-    uint32_t remaining = dma_hw->ch[swo_dmach].transfer_count;
-    //for(;;);//printf("SWO getcount -> 0x%lx\n", swo_num - remaining);
-    return swo_num - remaining;
+    return swo_get_count();
 }
-
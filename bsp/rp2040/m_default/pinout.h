@@ -27,6 +27,11 @@
 #define PINOUT_SPI_MOSI 15
 #define PINOUT_SPI_MISO 12
 #define PINOUT_SPI_nCS  13
+// extra data lines for dual/quad transfers, IO0 is MOSI, IO1 is MISO.
+// IO0..IO3 must all be within 8 GPIOs from the lowest one.
+#define PINOUT_SPI_IO2  16  // == #WP
+#define PINOUT_SPI_IO3  17  // == #HOLD
+#define PINOUT_SPI_PIO_DEV pio1
 
 // I2C config
 #define PINOUT_I2C_DEV i2c0
@@ -53,22 +58,25 @@
  * HARDWARE RESOURCE USAGE:
  *
  * IRQ:
- *   DMA0	DAP-UART
+ *   DMA0	DAP-UART, SWO
  *   UART1	DAP-UART
  *
  * DMA: (max. 12)
  *   DAP-UART	2
- *   SWO-UART	1
- *   SWO-MC	1
+ *   SWO	2 (UART or manchester)
+ *   SWD	2
+ *   JTAG	2 (never at the same time as SWD)
+ *   SPI	2 (serprog)
  *
  * PIO:
  *   PIO0: (max. 4 SM, max. 32 insn)
  *     JTAG	1	6
- *     SWD	1	11
+ *     SWD	1	15 (never loaded at the same time as JTAG)
  *     SWO	2	6 (manchester) + 9 (uart)
  *
  *     PIO0 IS NOW FULL!
  *   PIO1: (max. 4 SM, max. 32 insn)
+ *     SPI	1	5 (dual/quad rx) + 2 (dual/quad tx)
  *
  * UART: stdio
  *   0: stdio
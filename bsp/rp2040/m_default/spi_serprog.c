@@ -3,23 +3,126 @@
 #include <stdio.h>
 
 #include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/pio.h>
 #include <hardware/spi.h>
 #include <pico/binary_info.h>
 #include <pico/stdlib.h>
+#include <pico/time.h>
 
 #include "m_default/bsp-feature.h"
 #include "m_default/pinout.h"
 
 #include "m_default/serprog.h"
 
+#include "spi_wide.pio.h"
+
 static bool cs_asserted;
 
 static uint32_t freq;
 static enum serprog_flags sflags;
 static uint8_t bpw;
 
+// transfers shorter than this are done by the CPU, setting up DMA isn't
+// worth it for those
+#define SPI_DMA_MIN_LEN 16
+
+static int spi_dmatx = -1, spi_dmarx = -1;
+static bool spi_dma_busy;
+
+// dual/quad transfers: the PIO sees an 8-GPIO window starting at the lowest
+// data line, samples are converted from/to data bits using these tables
+#define WIDE_PIN_BASE PINOUT_SPI_MISO
+#define WIDE_IN_WINDOW(pin) ((pin) >= WIDE_PIN_BASE && (pin) < WIDE_PIN_BASE + 8)
+#if !WIDE_IN_WINDOW(PINOUT_SPI_MOSI) || !WIDE_IN_WINDOW(PINOUT_SPI_IO2) \
+        || !WIDE_IN_WINDOW(PINOUT_SPI_IO3)
+#error "SPI data lines must be within 8 GPIOs from PINOUT_SPI_MISO"
+#endif
+
+static const uint8_t wide_pins[4] = {
+    PINOUT_SPI_MOSI, PINOUT_SPI_MISO, PINOUT_SPI_IO2, PINOUT_SPI_IO3
+};
+
+static int wide_sm = -1, wide_rxoff = -1, wide_txoff = -1;
+static uint8_t wide_dec[256]; // sample -> IO3..IO0
+static uint8_t wide_enc[16];  // IO3..IO0 -> sample
+
+static void wide_init(void) {
+    PIO pio = PINOUT_SPI_PIO_DEV;
+
+    for (size_t i = 0; i < 256; ++i) {
+        uint8_t v = 0;
+        for (size_t j = 0; j < 4; ++j)
+            v |= ((i >> (wide_pins[j] - WIDE_PIN_BASE)) & 1) << j;
+        wide_dec[i] = v;
+    }
+    for (size_t i = 0; i < 16; ++i) {
+        uint8_t v = 0;
+        for (size_t j = 0; j < 4; ++j)
+            v |= ((i >> j) & 1) << (wide_pins[j] - WIDE_PIN_BASE);
+        wide_enc[i] = v;
+    }
+
+    // #WP and #HOLD must stay high when not used as data lines
+    gpio_init(PINOUT_SPI_IO2);
+    gpio_init(PINOUT_SPI_IO3);
+    gpio_pull_up(PINOUT_SPI_IO2);
+    gpio_pull_up(PINOUT_SPI_IO3);
+
+    if (!pio_can_add_program(pio, &spi_wide_rx_program)) return;
+    wide_rxoff = pio_add_program(pio, &spi_wide_rx_program);
+    if (!pio_can_add_program(pio, &spi_wide_tx_program)) goto err_rx;
+    wide_txoff = pio_add_program(pio, &spi_wide_tx_program);
+    wide_sm = pio_claim_unused_sm(pio, false);
+    if (wide_sm < 0) goto err_tx;
+
+    // the data lines are sampled right at the SCLK edge
+    for (size_t i = 0; i < 4; ++i)
+        hw_set_bits(&pio->input_sync_bypass, 1u << wide_pins[i]);
+
+    bi_decl(bi_2pins_with_names(PINOUT_SPI_IO2, "SPI IO2/#WP", PINOUT_SPI_IO3, "SPI IO3/#HOLD"));
+    return;
+
+err_tx:
+    pio_remove_program(pio, &spi_wide_tx_program, wide_txoff);
+    wide_txoff = -1;
+err_rx:
+    pio_remove_program(pio, &spi_wide_rx_program, wide_rxoff);
+    wide_rxoff = -1;
+}
+static void wide_deinit(void) {
+    PIO pio = PINOUT_SPI_PIO_DEV;
+
+    if (wide_sm >= 0) {
+        pio_sm_set_enabled(pio, wide_sm, false);
+        pio_sm_unclaim(pio, wide_sm);
+        wide_sm = -1;
+
+        for (size_t i = 0; i < 4; ++i)
+            hw_clear_bits(&pio->input_sync_bypass, 1u << wide_pins[i]);
+    }
+    if (wide_txoff >= 0) {
+        pio_remove_program(pio, &spi_wide_tx_program, wide_txoff);
+        wide_txoff = -1;
+    }
+    if (wide_rxoff >= 0) {
+        pio_remove_program(pio, &spi_wide_rx_program, wide_rxoff);
+        wide_rxoff = -1;
+    }
+
+    gpio_set_function(PINOUT_SPI_IO2, GPIO_FUNC_NULL);
+    gpio_set_function(PINOUT_SPI_IO3, GPIO_FUNC_NULL);
+    gpio_disable_pulls(PINOUT_SPI_IO2);
+    gpio_disable_pulls(PINOUT_SPI_IO3);
+}
+
 void sp_spi_init(void) {
     cs_asserted = false;
+    spi_dma_busy = false;
+
+    // if there are no channels left, everything is done by the CPU
+    spi_dmatx = dma_claim_unused_channel(false);
+    spi_dmarx = dma_claim_unused_channel(false);
 
     freq = 512*1000;  // default to 512 kHz
     sflags = 0; // CPOL 0, CPHA 0, MSB first
@@ -37,8 +140,15 @@ void sp_spi_init(void) {
 
     bi_decl(bi_3pins_with_func(PINOUT_SPI_MISO, PINOUT_SPI_MOSI, PINOUT_SPI_SCLK, GPIO_FUNC_SPI));
     bi_decl(bi_1pin_with_name(PINOUT_SPI_nCS, "SPI #CS"));
+
+    wide_init();
 }
 void sp_spi_deinit(void) {
+    sp_spi_op_wait();
+    if (spi_dmatx >= 0) { dma_channel_unclaim(spi_dmatx); spi_dmatx = -1; }
+    if (spi_dmarx >= 0) { dma_channel_unclaim(spi_dmarx); spi_dmarx = -1; }
+    wide_deinit();
+
     cs_asserted = false;
     sflags = 0;
     freq = 512*1000;
@@ -56,11 +166,14 @@ void sp_spi_deinit(void) {
 }
 
 uint32_t sp_spi_set_freq(uint32_t freq_wanted) {
+    sp_spi_op_wait();
     freq = spi_set_baudrate(PINOUT_SPI_DEV, freq_wanted);
     return freq;
 }
 
 static void apply_settings(void) {
+    sp_spi_op_wait();
+
     /*spi_set_format(PINOUT_SPI_DEV, bpw,
             (sflags & S_FLG_CPOL) ? SPI_CPOL_1 : SPI_CPOL_0,
             (sflags & S_FLG_CPHA) ? SPI_CPHA_1 : SPI_CPHA_0,
@@ -93,6 +206,10 @@ uint8_t sp_spi_set_bpw(uint8_t bpw_) {
     return bpw;
 }
 
+static absolute_time_t timer_target;
+void sp_spi_timer_start(uint32_t ms) { timer_target = make_timeout_time_ms(ms); }
+bool sp_spi_timer_reached(void) { return time_reached(timer_target); }
+
 __attribute__((__const__)) const struct sp_spi_caps* sp_spi_get_caps(void) {
     static struct sp_spi_caps caps = {
         .freq_min = ~(uint32_t)0,
@@ -105,6 +222,9 @@ __attribute__((__const__)) const struct sp_spi_caps* sp_spi_get_caps(void) {
             | S_CAP_MSBFST | S_CAP_LSBFST | S_CAP_CSACHI
     };
 
+    if (wide_sm >= 0) caps.caps |= S_CAP_DUAL | S_CAP_QUAD;
+    else caps.caps &= ~(uint16_t)(S_CAP_DUAL | S_CAP_QUAD);
+
     caps.freq_min = clock_get_hz(clk_peri) / 254;
     caps.freq_max = clock_get_hz(clk_peri) /   1;
 
@@ -113,6 +233,7 @@ __attribute__((__const__)) const struct sp_spi_caps* sp_spi_get_caps(void) {
 
 void __not_in_flash_func(sp_spi_cs_deselect)(uint8_t csflags) {
     (void)csflags;
+    sp_spi_op_wait();
 
     asm volatile("nop\nnop\nnop");  // idk if this is needed
     gpio_put(PINOUT_SPI_nCS, 1);
@@ -141,6 +262,7 @@ void __not_in_flash_func(sp_spi_op_begin)(uint8_t csflags) {
 void __not_in_flash_func(sp_spi_op_end)(uint8_t csflags) {
     // sp_spi_cs_deselect(csflags);
     (void)csflags;
+    sp_spi_op_wait();
 
     if (!cs_asserted) {                 // YES, this condition is the intended one!
         asm volatile("nop\nnop\nnop");  // idk if this is needed
@@ -149,29 +271,210 @@ void __not_in_flash_func(sp_spi_op_end)(uint8_t csflags) {
     }
 }
 
-// TODO: use dma?
-void sp_spi_op_write(uint32_t write_len, const void* write_data) {
+static void spi_xfer_cpu(uint32_t len, void* read_data, const void* write_data) {
+    static uint16_t sink[16];
+
     if (bpw > 8) {
-        spi_write16_blocking(PINOUT_SPI_DEV, (const uint16_t*)write_data, write_len >> 1);
+        if (read_data && write_data) {
+            spi_write16_read16_blocking(PINOUT_SPI_DEV, (const uint16_t*)write_data,
+                    (uint16_t*)read_data, len >> 1);
+        } else if (write_data) {
+            spi_write16_blocking(PINOUT_SPI_DEV, (const uint16_t*)write_data, len >> 1);
+        } else if (read_data) {
+            spi_read16_blocking(PINOUT_SPI_DEV, 0, (uint16_t*)read_data, len >> 1);
+        } else {
+            for (uint32_t n, i = 0; i < (len >> 1); i += n) {
+                n = (len >> 1) - i;
+                if (n > 16) n = 16;
+                spi_read16_blocking(PINOUT_SPI_DEV, 0, sink, n);
+            }
+        }
     } else {
-        spi_write_blocking(PINOUT_SPI_DEV, (const uint8_t*)write_data, write_len);
+        if (read_data && write_data) {
+            spi_write_read_blocking(PINOUT_SPI_DEV, (const uint8_t*)write_data,
+                    (uint8_t*)read_data, len);
+        } else if (write_data) {
+            spi_write_blocking(PINOUT_SPI_DEV, (const uint8_t*)write_data, len);
+        } else if (read_data) {
+            spi_read_blocking(PINOUT_SPI_DEV, 0, (uint8_t*)read_data, len);
+        } else {
+            for (uint32_t n, i = 0; i < len; i += n) {
+                n = len - i;
+                if (n > sizeof sink) n = sizeof sink;
+                spi_read_blocking(PINOUT_SPI_DEV, 0, (uint8_t*)sink, n);
+            }
+        }
     }
 }
-void sp_spi_op_read(uint32_t read_len, void* read_data) {
-    if (bpw > 8) {
-        spi_read16_blocking(PINOUT_SPI_DEV, 0, (uint16_t*)read_data, read_len >> 1);
-    } else {
-        spi_read_blocking(PINOUT_SPI_DEV, 0, (uint8_t*)read_data, read_len);
+
+void sp_spi_op_start(uint32_t len, void* read_data, const void* write_data) {
+    static const uint16_t zero = 0;
+    static uint16_t sink;
+
+    sp_spi_op_wait();
+
+    if (len < SPI_DMA_MIN_LEN || spi_dmatx < 0 || spi_dmarx < 0) {
+        spi_xfer_cpu(len, read_data, write_data);
+        return;
     }
+
+    enum dma_channel_transfer_size size = (bpw > 8) ? DMA_SIZE_16 : DMA_SIZE_8;
+    uint32_t count = (bpw > 8) ? (len >> 1) : len;
+    volatile void* dr = &spi_get_hw(PINOUT_SPI_DEV)->dr;
+
+    // the RX side always runs as well, so that the RX FIFO never overflows
+    dma_channel_config txc = dma_channel_get_default_config(spi_dmatx);
+    channel_config_set_transfer_data_size(&txc, size);
+    channel_config_set_dreq(&txc, spi_get_dreq(PINOUT_SPI_DEV, true));
+    channel_config_set_read_increment(&txc, write_data != NULL);
+    channel_config_set_write_increment(&txc, false);
+    dma_channel_configure(spi_dmatx, &txc, dr, write_data ? write_data : &zero,
+            count, false);
+
+    dma_channel_config rxc = dma_channel_get_default_config(spi_dmarx);
+    channel_config_set_transfer_data_size(&rxc, size);
+    channel_config_set_dreq(&rxc, spi_get_dreq(PINOUT_SPI_DEV, false));
+    channel_config_set_read_increment(&rxc, false);
+    channel_config_set_write_increment(&rxc, read_data != NULL);
+    dma_channel_configure(spi_dmarx, &rxc, read_data ? read_data : &sink, dr,
+            count, false);
+
+    spi_dma_busy = true;
+    dma_start_channel_mask((1u << spi_dmatx) | (1u << spi_dmarx));
+}
+void sp_spi_op_wait(void) {
+    if (!spi_dma_busy) return;
+
+    // the last frame is done once it has been received
+    dma_channel_wait_for_finish_blocking(spi_dmarx);
+    spi_dma_busy = false;
+}
+
+void sp_spi_op_write(uint32_t write_len, const void* write_data) {
+    sp_spi_op_start(write_len, NULL, write_data);
+    sp_spi_op_wait();
+}
+void sp_spi_op_read(uint32_t read_len, void* read_data) {
+    sp_spi_op_start(read_len, read_data, NULL);
+    sp_spi_op_wait();
 }
 void sp_spi_op_read_write(uint32_t len, void* read_data,
         const void* write_data) {
-    if (bpw > 8) {
-        spi_write16_read16_blocking(PINOUT_SPI_DEV, (const uint16_t*)write_data,
-                (uint16_t*)read_data, len >> 1);
+    sp_spi_op_start(len, read_data, write_data);
+    sp_spi_op_wait();
+}
+
+bool sp_spi_wide_ok(uint8_t width) {
+    return wide_sm >= 0 && (width == 2 || width == 4) && bpw == 8
+        && (sflags & (S_FLG_CPOL | S_FLG_CPHA | (3<<2))) == 0; // mode 0, moto
+}
+
+// 4 PIO cycles per SCLK period, in 16.8 fixed point
+static uint32_t wide_clkdiv(void) {
+    uint32_t div = (uint32_t)(((uint64_t)clock_get_hz(clk_sys) << 8) / ((uint64_t)freq * 4));
+
+    if (div < 0x100) div = 0x100;
+    if (div > 0xffff00) div = 0xffff00;
+
+    return div;
+}
+
+// hand SCLK and the data lines over to the PIO
+static void __not_in_flash_func(wide_begin)(uint8_t width, bool out) {
+    PIO pio = PINOUT_SPI_PIO_DEV;
+    uint32_t iomask = 0;
+
+    for (size_t i = 0; i < width; ++i) iomask |= 1u << wide_pins[i];
+
+    // the SPI peripheral has to be done before its pins can be taken
+    sp_spi_op_wait();
+    while (spi_is_busy(PINOUT_SPI_DEV)) tight_loop_contents();
+
+    if (out) {
+        spi_wide_tx_program_init(pio, wide_sm, wide_txoff, wide_clkdiv(),
+                WIDE_PIN_BASE, PINOUT_SPI_SCLK);
     } else {
-        spi_write_read_blocking(PINOUT_SPI_DEV, (const uint8_t*)write_data,
-                (uint8_t*)read_data, len);
+        spi_wide_rx_program_init(pio, wide_sm, wide_rxoff, wide_clkdiv(),
+                WIDE_PIN_BASE, PINOUT_SPI_SCLK);
     }
+
+    // SCLK idles low in mode 0
+    pio_sm_set_pins_with_mask(pio, wide_sm, 0, 1u << PINOUT_SPI_SCLK);
+    pio_sm_set_pindirs_with_mask(pio, wide_sm, (1u << PINOUT_SPI_SCLK) | (out ? iomask : 0),
+            (1u << PINOUT_SPI_SCLK) | iomask);
+
+    pio_gpio_init(pio, PINOUT_SPI_SCLK);
+    for (size_t i = 0; i < width; ++i) pio_gpio_init(pio, wide_pins[i]);
+
+    pio_sm_set_enabled(pio, wide_sm, true);
 }
+// and give them back to the SPI peripheral once the PIO is idle again
+static void __not_in_flash_func(wide_end)(uint8_t width) {
+    PIO pio = PINOUT_SPI_PIO_DEV;
+
+    pio_sm_set_enabled(pio, wide_sm, false);
 
+    gpio_set_function(PINOUT_SPI_SCLK, GPIO_FUNC_SPI);
+    gpio_set_function(PINOUT_SPI_MOSI, GPIO_FUNC_SPI);
+    gpio_set_function(PINOUT_SPI_MISO, GPIO_FUNC_SPI);
+    if (width == 4) {
+        gpio_set_function(PINOUT_SPI_IO2, GPIO_FUNC_SIO);
+        gpio_set_function(PINOUT_SPI_IO3, GPIO_FUNC_SIO);
+    }
+}
+
+void __not_in_flash_func(sp_spi_op_read_wide)(uint32_t len, void* read_data, uint8_t width) {
+    PIO pio = PINOUT_SPI_PIO_DEV;
+    io_ro_8* rx = (io_ro_8*)&pio->rxf[wide_sm] + 3;
+    uint8_t* d = read_data;
+    uint32_t spb = 8 / width; // samples per byte
+    uint8_t mask = (1u << width) - 1;
+
+    if (len == 0) return;
+
+    wide_begin(width, false);
+    pio_sm_put(pio, wide_sm, len * spb - 1);
+
+    for (uint32_t i = 0; i < len; ++i) {
+        uint8_t v = 0;
+
+        for (uint32_t j = 0; j < spb; ++j) {
+            while (pio_sm_is_rx_fifo_empty(pio, wide_sm)) tight_loop_contents();
+            v = (uint8_t)((v << width) | (wide_dec[*rx] & mask));
+        }
+
+        d[i] = v;
+    }
+
+    // wait until the SM is back at the start, with SCLK low
+    while (pio_sm_get_pc(pio, wide_sm) != wide_rxoff + spi_wide_rx_offset_start)
+        tight_loop_contents();
+
+    wide_end(width);
+}
+void __not_in_flash_func(sp_spi_op_write_wide)(uint32_t len, const void* write_data, uint8_t width) {
+    PIO pio = PINOUT_SPI_PIO_DEV;
+    io_wo_8* tx = (io_wo_8*)&pio->txf[wide_sm];
+    const uint8_t* d = write_data;
+    uint32_t spb = 8 / width; // samples per byte
+    uint8_t mask = (1u << width) - 1;
+    uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + wide_sm);
+
+    if (len == 0) return;
+
+    wide_begin(width, true);
+
+    for (uint32_t i = 0; i < len; ++i) {
+        for (uint32_t j = spb; j > 0; --j) {
+            while (pio_sm_is_tx_fifo_full(pio, wide_sm)) tight_loop_contents();
+            *tx = wide_enc[(d[i] >> ((j - 1) * width)) & mask];
+        }
+    }
+
+    // wait until the last sample has been clocked out
+    while (!pio_sm_is_tx_fifo_empty(pio, wide_sm)) tight_loop_contents();
+    pio->fdebug = stall;
+    while (!(pio->fdebug & stall)) tight_loop_contents();
+
+    wide_end(width);
+}
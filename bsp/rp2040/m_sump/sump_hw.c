@@ -8,17 +8,19 @@
 #include <hardware/sync.h>
 #include <hardware/vreg.h>
 #include <pico/binary_info.h>
+#include <pico/multicore.h>
 #include <pico/platform.h>
 #include <pico/stdlib.h>
 #include <stdio.h>
 
 #include "bsp-info.h"
+#include "spsc.h"
 #include "m_sump/sump.h"
 
 
 #include "m_sump/sump_hw.h"
 
-#define SAMPLING_GPIO_MASK (((1 << SAMPLING_BITS) - 1) << SAMPLING_GPIO_FIRST)
+#define SAMPLING_GPIO_MASK ((uint32_t)((1ull << SAMPLING_BITS) - 1) << SAMPLING_GPIO_FIRST)
 
 #define SAMPLING_GPIO_TEST 22
 
@@ -30,13 +32,10 @@
 
 #define sump_dma_set_irq_channel_mask_enabled dma_set_irq1_channel_mask_enabled
 
-#define SUMP_SAMPLE_MASK ((1 << SAMPLING_BITS) - 1)
+#define SUMP_SAMPLE_MASK ((uint32_t)((1ull << SAMPLING_BITS) - 1))
 #define SUMP_BYTE0_OR    ((~SUMP_SAMPLE_MASK) & 0xff)
 #define SUMP_BYTE1_OR    ((~SUMP_SAMPLE_MASK >> 8) & 0xff)
 
-#define SUMP_DMA_CH_FIRST 0
-#define SUMP_DMA_CH_LAST  7
-#define SUMP_DMA_CHANNELS (SUMP_DMA_CH_LAST - SUMP_DMA_CH_FIRST + 1)
 #define SUMP_DMA_MASK     (((1 << SUMP_DMA_CHANNELS) - 1) << SUMP_DMA_CH_FIRST)
 
 #define sump_irq_debug(format, ...)  ((void)0)
@@ -44,7 +43,7 @@
 #define picoprobe_debug(format, ...) ((void)0)
 #define picoprobe_dump(format, ...)  ((void)0)
 
-static uint16_t prog[2];
+static uint16_t prog[4];
 // clang-format off
 static const struct pio_program program = {
     .instructions = prog,
@@ -53,50 +52,153 @@ static const struct pio_program program = {
 };
 // clang-format on
 
-static uint32_t pio_prog_offset;
+/* transitional mode: only changes of the inputs are pushed, as a (timestamp,
+ * value) pair of words. the timestamp counts down from 0xffffffff, one per
+ * sample, and is kept in OSR, while Y holds the last value. both paths take
+ * 12 cycles per sample. the IN instruction is patched to the sample width. */
+#define TRANS_PC_IN    1
+#define TRANS_PC_VALUE 11  /* 11, 12: the timestamp is pushed, the value not yet */
+static uint16_t prog_trans[16];
+// clang-format off
+static const struct pio_program program_trans = {
+    .instructions = prog_trans,
+    .length = count_of(prog_trans),
+    .origin = -1
+};
+// clang-format on
+
+static uint32_t pio_prog_offset, pio_trans_offset;
 static uint32_t dma_curr_idx = 0;
 static uint32_t oldprio;
 
-static bool overclock = false;
+/* clock profiles, the first one is the stock clock. only integer MHz values,
+ * as the divider maths depend on that. everything above 133 MHz is beyond
+ * the RP2040 datasheet; the 240 and 250 MHz profiles at 1.20 V haven't been
+ * tried on hardware at all, so they are opt-in only (see overclock) */
+struct sump_clk_profile {
+    uint32_t          khz;
+    uint16_t          mv;
+    enum vreg_voltage vreg;
+};
+static const struct sump_clk_profile clk_profiles[] = {
+    {125000, 1100, VREG_VOLTAGE_DEFAULT},
+    {200000, 1150, VREG_VOLTAGE_1_15},
+    {240000, 1200, VREG_VOLTAGE_1_20},
+    {250000, 1200, VREG_VOLTAGE_1_20},
+};
+
+static uint8_t overclock = 0;  // selected (fastest allowed) profile
+
+/* the capture (DMA IRQ, trigger matching, RLE compression, stream producer)
+ * runs on core 1, so that it doesn't have to compete with USB servicing on
+ * core 0. core 0 asks core 1 to start/stop capturing through a command
+ * queue, and waits for the acknowledgement on a second queue. */
+enum sump_core1_cmd {
+    sump_core1_capture_start,
+    sump_core1_capture_start_trans,
+    sump_core1_capture_stop,
+    sump_core1_capture_stop_trans,
+    sump_core1_capture_finish,
+    sump_core1_stop,
+};
+struct sump_core1_msg {
+    uint8_t  cmd;
+    uint8_t  bits;
+    int      flags;
+    uint32_t chunk_size;
+    uint8_t* destbuf;
+};
+
+static struct spsc core1_cmdq, core1_ackq;
+static uint8_t    core1_cmdbuf[sizeof(struct sump_core1_msg)];
+static uint8_t    core1_ackbuf[1];
+static uint32_t   core1_ret;  // return value of the last command
 
 uint32_t sump_hw_get_sysclk(void) { return clock_get_hz(clk_sys); }
+uint32_t sump_hw_get_max_sysclk(void) { return clk_profiles[overclock].khz * 1000; }
+uint32_t sump_hw_get_time_us(void) { return time_us_32(); }
 
 void sump_hw_get_cpu_name(char cpu[32]) {
     snprintf(cpu, 32, INFO_BOARDNAME " @ %lu MHz",
-            sump_hw_get_sysclk() / (ONE_MHZ * SAMPLING_DIVIDER));
+            sump_hw_get_max_sysclk() / (ONE_MHZ * SAMPLING_DIVIDER));
 }
 void sump_hw_get_hw_name(char hw[32]) {
     snprintf(hw, 32, INFO_BOARDNAME " rev%hhu, ROM v%hhu", rp2040_chip_version(),
             rp2040_rom_version());
 }
 
-static void sump_pio_init(uint8_t width, bool nogr0) {
+// DMA transfer size: a word holds 8 samples in 4-channel mode
+static inline uint8_t sump_dma_unit(uint8_t bits) {
+    return (bits == 4) ? 4 : (bits / 8);
+}
+
+static void sump_pio_init(uint8_t bits, bool nogr0, bool trans) {
     uint32_t gpio = SAMPLING_GPIO_FIRST;
+    uint32_t off;
 
 #if SAMPLING_BITS > 8
-    if (width == 1 && nogr0) gpio += 8;
+    if (bits <= 8 && nogr0) gpio += 8;
 #endif
-    // loop the IN instruction forewer (8-bit and 16-bit version)
     pio_sm_config c = pio_get_default_sm_config();
     sm_config_set_in_pins(&c, gpio);
-    uint32_t off = pio_prog_offset + (width - 1);
-    sm_config_set_wrap(&c, off, off);
+    if (trans) {
+        off = pio_trans_offset;
+        SAMPLING_PIO->instr_mem[off + TRANS_PC_IN] = pio_encode_in(pio_pins, bits);
+        sm_config_set_wrap(&c, off, off + count_of(prog_trans) - 1);
+        sm_config_set_in_shift(&c, false, false, 32);
+    } else {
+        // loop the IN instruction forewer (4-, 8-, 16- and 32-bit version)
+        off = pio_prog_offset + (__builtin_ctz(bits) - 2);
+        sm_config_set_wrap(&c, off, off);
+        sm_config_set_in_shift(&c, true, true, 32);
+    }
 
     uint32_t divider = sump_calc_sysclk_divider();
     sm_config_set_clkdiv_int_frac(&c, divider >> 8, divider & 0xff);
-    sm_config_set_in_shift(&c, true, true, 32);
     sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
 
     pio_sm_init(SAMPLING_PIO, SAMPLING_PIO_SM, off, &c);
+    if (trans) {
+        // no last value yet (so the first sample is always pushed), and the
+        // timestamp of the first sample
+        pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_mov_not(pio_y, pio_null));
+        pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_mov_not(pio_osr, pio_null));
+    }
     picoprobe_debug("%s(): pc=0x%02x [0x%02x], gpio=%u\n", __func__, off, pio_prog_offset, gpio);
 }
 
 static void sump_pio_program(void) {
-    prog[0] = pio_encode_in(pio_pins, 8);
-    prog[1] = pio_encode_in(pio_pins, 16);
-
-    picoprobe_debug("%s(): 0x%04x 0x%04x len=%u\n", __func__, prog[0], prog[1], program.length);
+    // 24-bit samples are captured using the 32-bit program
+    prog[0] = pio_encode_in(pio_pins, 4);
+    prog[1] = pio_encode_in(pio_pins, 8);
+    prog[2] = pio_encode_in(pio_pins, 16);
+    prog[3] = pio_encode_in(pio_pins, 32);
+
+    picoprobe_debug("%s(): 0x%04x 0x%04x 0x%04x 0x%04x len=%u\n", __func__, prog[0], prog[1],
+            prog[2], prog[3], program.length);
     pio_prog_offset = pio_add_program(SAMPLING_PIO, &program);
+
+    // transitional mode, see above
+    prog_trans[0]  = pio_encode_mov(pio_isr, pio_null);
+    prog_trans[1]  = pio_encode_in(pio_pins, 8);  // patched
+    prog_trans[2]  = pio_encode_mov(pio_x, pio_isr);
+    prog_trans[3]  = pio_encode_jmp_x_ne_y(8);
+    // unchanged: count down the timestamp
+    prog_trans[4]  = pio_encode_mov(pio_x, pio_osr) | pio_encode_delay(4);
+    prog_trans[5]  = pio_encode_jmp_x_dec(6);
+    prog_trans[6]  = pio_encode_mov(pio_osr, pio_x);
+    prog_trans[7]  = pio_encode_jmp(0);
+    // changed: push timestamp and value, then count down the timestamp
+    prog_trans[8]  = pio_encode_mov(pio_y, pio_x);
+    prog_trans[9]  = pio_encode_mov(pio_isr, pio_osr);
+    prog_trans[10] = pio_encode_push(false, true);
+    prog_trans[11] = pio_encode_mov(pio_isr, pio_y);
+    prog_trans[12] = pio_encode_push(false, true);
+    prog_trans[13] = pio_encode_mov(pio_x, pio_osr);
+    prog_trans[14] = pio_encode_jmp_x_dec(15);
+    prog_trans[15] = pio_encode_mov(pio_osr, pio_x);
+
+    pio_trans_offset = pio_add_program(SAMPLING_PIO, &program_trans);
 }
 
 static uint32_t sump_pwm_slice_init(uint32_t gpio, uint32_t clock, bool swap_levels) {
@@ -207,12 +309,13 @@ void sump_hw_capture_setup_next(
         sump_dma_chain_to_self(ch);
         ch = (ch + 1) % SUMP_DMA_CHANNELS;
     } else {
+        // round up, in 4-channel mode the count isn't a multiple of a word
         ch = (mask + dma_curr_idx) % SUMP_DMA_CHANNELS;
-        dma_channel_set_trans_count(
-                ch + SUMP_DMA_CH_FIRST, (next_count % chunk_size) / width, false);
+        dma_channel_set_trans_count(ch + SUMP_DMA_CH_FIRST,
+                ((next_count % chunk_size) + width - 1) / width, false);
     }
     sump_irq_debug("%s(): %u: t=0x%08x\n", __func__, ch + SUMP_DMA_CH_FIRST,
-            (next_count % chunk_size) / width);
+            ((next_count % chunk_size) + width - 1) / width);
 
     // break chain, reset unused DMA chunks
     // clear all chains for high-speed DMAs
@@ -260,7 +363,8 @@ static void sump_dma_program(
     channel_config_set_write_increment(&cfg, true);
     channel_config_set_dreq(&cfg, pio_get_dreq(SAMPLING_PIO, SAMPLING_PIO_SM, false));
     channel_config_set_chain_to(&cfg, SUMP_DMA_CH_FIRST + ((ch + 1) % SUMP_DMA_CHANNELS));
-    channel_config_set_transfer_data_size(&cfg, width == 1 ? DMA_SIZE_8 : DMA_SIZE_16);
+    channel_config_set_transfer_data_size(
+            &cfg, width == 1 ? DMA_SIZE_8 : (width == 2 ? DMA_SIZE_16 : DMA_SIZE_32));
 
     dma_channel_configure(SUMP_DMA_CH_FIRST + ch, &cfg, destbuf + pos,
             &SAMPLING_PIO->rxf[SAMPLING_PIO_SM], chunk_size / width, false);
@@ -270,9 +374,12 @@ static void sump_dma_program(
             SUMP_DMA_CH_FIRST + ((ch + 1) % SUMP_DMA_CHANNELS));
 }
 
-/*uint64_t*/ void sump_hw_capture_start(
-        uint8_t width, int flags, uint32_t chunk_size, uint8_t* destbuf) {
-    sump_pio_init(width, flags & SUMP_FLAG1_GR0_DISABLE);
+static void sump_capture_start_local(
+        uint8_t bits, int flags, uint32_t chunk_size, uint8_t* destbuf, bool trans) {
+    // transitional mode pushes pairs of words
+    uint8_t width = trans ? 4 : sump_dma_unit(bits);
+
+    sump_pio_init(bits, flags & SUMP_FLAG1_GR0_DISABLE, trans);
 
     dma_curr_idx = 0;
 
@@ -298,16 +405,151 @@ static void sump_dma_program(
 
     // return time_us_64();
 }
-void sump_hw_capture_stop(void) {
+static void sump_capture_stop_local(void) {
     pio_sm_set_enabled(SAMPLING_PIO, SAMPLING_PIO_SM, false);
     irq_set_enabled(SAMPLING_DMA_IRQ, false);
 }
 
-void sump_hw_init(void) {
-    if (overclock) {
-        vreg_set_voltage(VREG_VOLTAGE_1_15);
-        set_sys_clock_khz(200000, true);
+static uint32_t sump_capture_stop_trans_local(void) {
+    pio_sm_set_enabled(SAMPLING_PIO, SAMPLING_PIO_SM, false);
+
+    // finish a half-pushed event, so the pairs stay aligned
+    uint32_t pc = pio_sm_get_pc(SAMPLING_PIO, SAMPLING_PIO_SM) - pio_trans_offset;
+    if (pc == TRANS_PC_VALUE || pc == TRANS_PC_VALUE + 1) {
+        pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_mov(pio_isr, pio_y));
+        pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_push(false, true));
     }
+    // closing event: the current timestamp and value, marks where it ended
+    pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_mov(pio_isr, pio_osr));
+    pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_push(false, true));
+    pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_mov(pio_isr, pio_y));
+    pio_sm_exec(SAMPLING_PIO, SAMPLING_PIO_SM, pio_encode_push(false, true));
+
+    // let the DMA drain the FIFO, then account for the chunks it completed
+    while (!pio_sm_is_rx_fifo_empty(SAMPLING_PIO, SAMPLING_PIO_SM)) tight_loop_contents();
+    busy_wait_us_32(1);
+    irq_set_enabled(SAMPLING_DMA_IRQ, false);
+    sump_hw_dma_irq_handler();
+
+    // the next channel was triggered by the chain when the last chunk
+    // completed, so this is the fill level of the current chunk
+    uint32_t ch = SUMP_DMA_CH_FIRST + dma_curr_idx;
+    return dma_channel_hw_addr(ch)->write_addr - (uint32_t)sump_capture_get_next_dest(0);
+}
+
+static void sump_stop_local(void) {
+    // IRQ and PIO fast stop
+    irq_set_enabled(SAMPLING_DMA_IRQ, false);
+    pio_sm_set_enabled(SAMPLING_PIO, SAMPLING_PIO_SM, false);
+
+    // DMA abort
+    for (uint32_t i = SUMP_DMA_CH_FIRST; i <= SUMP_DMA_CH_LAST; i++) dma_channel_abort(i);
+
+    // IRQ status cleanup
+    sump_dma_ints = SUMP_DMA_MASK;
+
+    // PIO cleanup
+    pio_sm_clear_fifos(SAMPLING_PIO, SAMPLING_PIO_SM);
+    pio_sm_restart(SAMPLING_PIO, SAMPLING_PIO_SM);
+
+    // test
+    sump_test_done();
+}
+
+static void sump_core1_main(void) {
+    struct sump_core1_msg msg;
+
+    while (1) {
+        if (!spsc_read(&core1_cmdq, &msg, sizeof(msg))) {
+            // a command sent between the read and here sets the event flag,
+            // so this doesn't miss it
+            __wfe();
+            continue;
+        }
+
+        // the DMA IRQ gets enabled in this core's NVIC, so it's serviced here
+        switch (msg.cmd) {
+            case sump_core1_capture_start:
+            case sump_core1_capture_start_trans:
+                sump_capture_start_local(msg.bits, msg.flags, msg.chunk_size, msg.destbuf,
+                        msg.cmd == sump_core1_capture_start_trans);
+                break;
+            case sump_core1_capture_stop: sump_capture_stop_local(); break;
+            case sump_core1_capture_stop_trans: core1_ret = sump_capture_stop_trans_local(); break;
+            case sump_core1_capture_finish: {
+                // keep the DMA IRQ from running the capture callbacks meanwhile
+                uint32_t irq_state = save_and_disable_interrupts();
+                sump_capture_callback_finish();
+                restore_interrupts(irq_state);
+                } break;
+            case sump_core1_stop: sump_stop_local(); break;
+        }
+
+        // also a barrier: everything done above is visible to core 0 once
+        // it sees the ack
+        spsc_write(&core1_ackq, &msg.cmd, 1);
+        __sev();
+    }
+}
+
+static uint32_t sump_core1_call(const struct sump_core1_msg* msg) {
+    uint8_t ack;
+
+    // only one command is in flight at a time, so there's always room
+    spsc_write(&core1_cmdq, msg, sizeof(*msg));
+    __sev();
+
+    while (!spsc_read(&core1_ackq, &ack, 1)) __wfe();
+    return core1_ret;
+}
+
+/*uint64_t*/ void sump_hw_capture_start(
+        uint8_t bits, int flags, uint32_t chunk_size, uint8_t* destbuf) {
+    struct sump_core1_msg msg = {
+        .cmd        = sump_core1_capture_start,
+        .bits       = bits,
+        .flags      = flags,
+        .chunk_size = chunk_size,
+        .destbuf    = destbuf,
+    };
+
+    sump_core1_call(&msg);
+}
+void sump_hw_capture_start_trans(uint8_t bits, int flags, uint32_t chunk_size, uint8_t* destbuf) {
+    struct sump_core1_msg msg = {
+        .cmd        = sump_core1_capture_start_trans,
+        .bits       = bits,
+        .flags      = flags,
+        .chunk_size = chunk_size,
+        .destbuf    = destbuf,
+    };
+
+    sump_core1_call(&msg);
+}
+void sump_hw_capture_stop(void) {
+    // called from the capture callback when sampling is done
+    if (get_core_num() == 1) {
+        sump_capture_stop_local();
+        return;
+    }
+
+    struct sump_core1_msg msg = {.cmd = sump_core1_capture_stop};
+    sump_core1_call(&msg);
+}
+uint32_t sump_hw_capture_stop_trans(void) {
+    if (get_core_num() == 1) return sump_capture_stop_trans_local();
+
+    struct sump_core1_msg msg = {.cmd = sump_core1_capture_stop_trans};
+    return sump_core1_call(&msg);
+}
+
+void sump_hw_capture_finish(void) {
+    struct sump_core1_msg msg = {.cmd = sump_core1_capture_finish};
+    sump_core1_call(&msg);
+}
+
+void sump_hw_init(void) {
+    sump_hw_set_clock_profile(overclock);
 
     // claim DMA channels
     dma_claim_mask(SUMP_DMA_MASK);
@@ -338,35 +580,27 @@ void sump_hw_init(void) {
     irq_set_exclusive_handler(SAMPLING_DMA_IRQ, sump_hw_dma_irq_handler);
     sump_dma_set_irq_channel_mask_enabled(SUMP_DMA_MASK, true);
 
+    // start the capture core
+    spsc_init(&core1_cmdq, core1_cmdbuf, sizeof(core1_cmdbuf));
+    spsc_init(&core1_ackq, core1_ackbuf, sizeof(core1_ackbuf));
+    multicore_reset_core1();
+    multicore_launch_core1(sump_core1_main);
+
     /*bi_decl(bi_pin_mask_with_name(SAMPLING_GPIO_MASK, "SUMP logic analyzer input"));
     bi_decl(bi_1pin_with_name(SAMPLING_GPIO_TEST, "SUMP logic analyzer: test PWM"));*/
     bi_decl(bi_program_feature("Mode 4: SUMP"));
 }
 
 void sump_hw_stop(void) {
-    // IRQ and PIO fast stop
-    irq_set_enabled(SAMPLING_DMA_IRQ, false);
-    pio_sm_set_enabled(SAMPLING_PIO, SAMPLING_PIO_SM, false);
-
-    // DMA abort
-    for (uint32_t i = SUMP_DMA_CH_FIRST; i <= SUMP_DMA_CH_LAST; i++) dma_channel_abort(i);
-
-    // IRQ status cleanup
-    sump_dma_ints = SUMP_DMA_MASK;
-
-    // PIO cleanup
-    pio_sm_clear_fifos(SAMPLING_PIO, SAMPLING_PIO_SM);
-    pio_sm_restart(SAMPLING_PIO, SAMPLING_PIO_SM);
-
-    // test
-    sump_test_done();
+    struct sump_core1_msg msg = {.cmd = sump_core1_stop};
+    sump_core1_call(&msg);
 }
 
 void sump_hw_deinit(void) {
-    set_sys_clock_khz(133333, false);
-    vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+    sump_hw_set_clock_profile(0);
 
     sump_hw_stop();
+    multicore_reset_core1();
 
     sump_dma_set_irq_channel_mask_enabled(SUMP_DMA_MASK, false);
 
@@ -376,24 +610,46 @@ void sump_hw_deinit(void) {
     bus_ctrl_hw->priority = oldprio;
 
     pio_remove_program(SAMPLING_PIO, &program, pio_prog_offset);
+    pio_remove_program(SAMPLING_PIO, &program_trans, pio_trans_offset);
     pio_sm_unclaim(SAMPLING_PIO, SAMPLING_PIO_SM);
 
     for (uint32_t i = SUMP_DMA_CH_FIRST; i <= SUMP_DMA_CH_LAST; ++i) dma_channel_unclaim(i);
 }
 
 uint8_t sump_hw_get_overclock(void) {
-    return overclock ? 1 : 0;
+    return overclock;
+}
+bool sump_hw_set_overclock(uint8_t v) {
+    if (v >= count_of(clk_profiles)) return false;
+
+    overclock = v;
+    sump_hw_set_clock_profile(v);
+    return true;
 }
-void sump_hw_set_overclock(uint8_t v) {
-    overclock = v != 0;
 
-    if (overclock) {
-        // TODO: make this configurable
-        vreg_set_voltage(VREG_VOLTAGE_1_15);
-        set_sys_clock_khz(200000, true);
+bool sump_hw_get_clock_profile(uint8_t i, uint32_t* khz, uint16_t* mv) {
+    if (i >= count_of(clk_profiles)) return false;
+
+    if (khz) *khz = clk_profiles[i].khz;
+    if (mv) *mv = clk_profiles[i].mv;
+    return true;
+}
+void sump_hw_set_clock_profile(uint8_t i) {
+    const struct sump_clk_profile* p   = &clk_profiles[i];
+    uint32_t                       cur = clock_get_hz(clk_sys);
+
+    // going through the PLL again would only glitch the clocks. nothing else
+    // sets the clock or the voltage, so the latter is already right then
+    if (p->khz * 1000 == cur) return;
+
+    // raise the core voltage before speeding up, lower it after slowing down
+    if (p->khz * 1000 > cur) {
+        vreg_set_voltage(p->vreg);
+        busy_wait_us_32(1000);  // let it settle
+        set_sys_clock_khz(p->khz, true);
     } else {
-        set_sys_clock_khz(133333, false);
-        vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+        set_sys_clock_khz(p->khz, true);
+        vreg_set_voltage(p->vreg);
     }
 }
 
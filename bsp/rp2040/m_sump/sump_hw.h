@@ -16,4 +16,8 @@
 //#endif
 #define SUMP_MAX_CHUNK_SIZE	4096
 
+#define SUMP_DMA_CH_FIRST	0
+#define SUMP_DMA_CH_LAST	7
+#define SUMP_DMA_CHANNELS	(SUMP_DMA_CH_LAST-SUMP_DMA_CH_FIRST+1)
+
 #endif
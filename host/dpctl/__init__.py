@@ -38,19 +38,57 @@ def dpctl_do(args: Any) -> int:
             print("Error: none of '--get', '--set' or '--disable' specified.")
             return 1
         return devcmds.tempsensor_set(conn, tsen)
+    def dap_stats(conn, args):
+        return devcmds.dap_stats(conn, args.reset)
     def jtag_scan(conn, args):
         return devcmds.jtag_scan(conn, args.type, args.start, args.end)
     def sump_ovclk(conn, args):
         if args.get: return devcmds.sump_overclock_get(conn)
+        if args.list: return devcmds.sump_overclock_list(conn)
         oven = args.set
         if isinstance(oven, list): oven = oven[0]
         if oven is None:
             if args.enable: oven = 1
             elif args.disable: oven = 0
         if oven is None:
-            print("Error: none of '--get', '--set', '--enable' or '--disable' specified.")
+            print("Error: none of '--get', '--list', '--set', '--enable' or '--disable' specified.")
             return 1
         return devcmds.sump_overclock_set(conn, oven)
+    def sump_stream(conn, args):
+        if args.get: return devcmds.sump_stream_get(conn)
+        sten = args.set
+        if isinstance(sten, list): sten = sten[0]
+        if sten is None:
+            if args.enable: sten = True
+            elif args.disable: sten = False
+        if sten is None:
+            print("Error: none of '--get', '--set', '--enable' or '--disable' specified.")
+            return 1
+        return devcmds.sump_stream_set(conn, sten)
+    def sump_tx_stats(conn, args):
+        return devcmds.sump_tx_stats(conn)
+    def sump_packed(conn, args):
+        if args.get: return devcmds.sump_packed_get(conn)
+        paen = args.set
+        if isinstance(paen, list): paen = paen[0]
+        if paen is None:
+            if args.enable: paen = True
+            elif args.disable: paen = False
+        if paen is None:
+            print("Error: none of '--get', '--set', '--enable' or '--disable' specified.")
+            return 1
+        return devcmds.sump_packed_set(conn, paen)
+    def sump_trans(conn, args):
+        if args.get: return devcmds.sump_trans_get(conn)
+        tren = args.set
+        if isinstance(tren, list): tren = tren[0]
+        if tren is None:
+            if args.enable: tren = True
+            elif args.disable: tren = False
+        if tren is None:
+            print("Error: none of '--get', '--set', '--enable' or '--disable' specified.")
+            return 1
+        return devcmds.sump_trans_set(conn, tren)
 
 
     #print(repr(args))
@@ -62,8 +100,13 @@ def dpctl_do(args: Any) -> int:
 
         'uart-cts-rts': uart_hw_flowctl,
         'tempsensor': tempsensor,
+        'dap-stats': dap_stats,
         'jtag-scan': jtag_scan,
         'sump-overclock': sump_ovclk,
+        'sump-stream': sump_stream,
+        'sump-tx-stats': sump_tx_stats,
+        'sump-packed': sump_packed,
+        'sump-transitional': sump_trans,
     }
 
     if args.subcmd is None:
@@ -99,6 +142,7 @@ def main() -> int:
     #   * 0x16 0x??: usb hwflowctl on/off, 0x??=0xc3: get current value
     #   * 0x15 0x00: get tempsensor active/address
     #   * 0x15 0x01 0x??: set tempsensor active/address
+    #   * 0x17 0x??: get CMSIS-DAP command timing statistics (0x??=1: and reset them)
     #
     # * mode 2 (isp/jtag/...): probably nothing
     #
@@ -108,8 +152,16 @@ def main() -> int:
     #   * 0x32 0xNN 0xMM: start scan (pins 0xNN..0xMM)
     #
     # * mode 4 (sump logic analyzer):
-    #   * 0x40: get overclock
-    #   * 0x41: set overclock
+    #   * 0x43: get overclock profile
+    #   * 0x44 0x??: set overclock profile (0 = stock clock)
+    #   * 0x45: get streaming mode
+    #   * 0x46 0x??: set streaming mode
+    #   * 0x47: get transfer statistics (bytes, microseconds) of the last dump
+    #   * 0x48: get 4-channel packed mode
+    #   * 0x49 0x??: set 4-channel packed mode
+    #   * 0x4a: get overclock profiles (sysclk in kHz, core voltage in mV)
+    #   * 0x4b: get transitional capture mode
+    #   * 0x4c 0x??: set transitional capture mode
     #
     # * mode 5 (ftdi/fx2 emul): probably nothing
 
@@ -171,6 +223,12 @@ def main() -> int:
                         help="Disable emulated I2C temperature sensor, "+\
                              "short for --set true")
 
+    dapstats = subcmds.add_parser("dap-stats", help="Show how many CPU "+\
+                                  "cycles the probe spent executing "+\
+                                  "CMSIS-DAP commands and transfers")
+    dapstats.add_argument('--reset', default=False, action='store_true',
+                          help="Reset the statistics after reading them")
+
     jtagscan = subcmds.add_parser("jtag-scan", help="JTAG pinout scanner")
     jtagscan.add_argument("type", type=str, help="Pinout type to check for.",
                           choices=['jtag', 'swd'])  # TODO: SBW etc
@@ -183,14 +241,63 @@ def main() -> int:
                                 help="SUMP logic analyzer overclock")
     sumpopts = sumpla.add_mutually_exclusive_group()
     sumpopts.add_argument('--get', default=False, action='store_true',
-                          help="Get current overclocking state")
+                          help="Get current overclocking profile")
+    sumpopts.add_argument('--list', default=False, action='store_true',
+                          help="List the available overclocking profiles")
     sumpopts.add_argument('--set', default=None, type=int, nargs=1,
-                          help="Set current overclocking state")
+                          help="Set the fastest overclocking profile captures "+\
+                          "may use (0 = stock clock)")
     sumpopts.add_argument('--enable', default=False, action='store_true',
                           help="Enable overclocking, short for --set 1")
     sumpopts.add_argument('--disable', default=False, action='store_true',
                           help="Disable overclocking, short for --set 0")
 
+    sumpstream = subcmds.add_parser("sump-stream", help="Get, enable/disable "+\
+                                    "SUMP logic analyzer streaming capture. "+\
+                                    "Streamed samples are sent oldest first "+\
+                                    "(chronological), unlike the newest-first "+\
+                                    "order of a regular SUMP dump. Captures "+\
+                                    "with RLE enabled are never streamed")
+    streamopts = sumpstream.add_mutually_exclusive_group()
+    streamopts.add_argument('--get', default=False, action='store_true',
+                            help="Get current streaming mode setting")
+    streamopts.add_argument('--set', default=None, type=int, nargs=1,
+                            help="Set streaming mode (0 or 1)")
+    streamopts.add_argument('--enable', default=False, action='store_true',
+                            help="Enable streaming mode, short for --set 1")
+    streamopts.add_argument('--disable', default=False, action='store_true',
+                            help="Disable streaming mode, short for --set 0")
+
+    sumptxstats = subcmds.add_parser("sump-tx-stats", help="Show the "+\
+                                     "throughput of the last SUMP data "+\
+                                     "transfer to the host")
+
+    sumppacked = subcmds.add_parser("sump-packed", help="Get, enable/disable "+\
+                                    "SUMP logic analyzer 4-channel packed "+\
+                                    "capture (double capture depth)")
+    packedopts = sumppacked.add_mutually_exclusive_group()
+    packedopts.add_argument('--get', default=False, action='store_true',
+                            help="Get current 4-channel mode setting")
+    packedopts.add_argument('--set', default=None, type=int, nargs=1,
+                            help="Set 4-channel mode (0 or 1)")
+    packedopts.add_argument('--enable', default=False, action='store_true',
+                            help="Enable 4-channel mode, short for --set 1")
+    packedopts.add_argument('--disable', default=False, action='store_true',
+                            help="Disable 4-channel mode, short for --set 0")
+
+    sumptrans = subcmds.add_parser("sump-transitional", help="Get, "+\
+                                   "enable/disable SUMP logic analyzer "+\
+                                   "transitional capture (only store changes)")
+    transopts = sumptrans.add_mutually_exclusive_group()
+    transopts.add_argument('--get', default=False, action='store_true',
+                           help="Get current transitional mode setting")
+    transopts.add_argument('--set', default=None, type=int, nargs=1,
+                           help="Set transitional mode (0 or 1)")
+    transopts.add_argument('--enable', default=False, action='store_true',
+                           help="Enable transitional mode, short for --set 1")
+    transopts.add_argument('--disable', default=False, action='store_true',
+                           help="Disable transitional mode, short for --set 0")
+
     args = parser.parse_args()
     return dpctl_do(args)
 
@@ -133,6 +133,26 @@ def tempsensor_set(dev: DPDevice, v: int) -> int:
         return 1
 
 
+def dap_stats(dev: DPDevice, reset: bool) -> int:
+    try:
+        ncmds, nxfers, cycles, maxcyc, hz = dev.m1_dap_stats(reset)
+        if ncmds == 0:
+            print("No CMSIS-DAP commands executed yet")
+            return 0
+
+        print("%d CMSIS-DAP commands, %d transfers, in %d cycles (%.1f us)" % \
+              (ncmds, nxfers, cycles, cycles * 1e6 / hz))
+        print("per command: %d cycles (%.2f us) on average, %d cycles (%.2f us) max" % \
+              (cycles // ncmds, cycles * 1e6 / hz / ncmds, maxcyc, maxcyc * 1e6 / hz))
+        if nxfers != 0:
+            print("per transfer: %d cycles (%.2f us) on average" % \
+                  (cycles // nxfers, cycles * 1e6 / hz / nxfers))
+        return 0
+    except Exception as e:
+        print("Could not get CMSIS-DAP statistics: %s" % str(e))
+        return 1
+
+
 # ---
 
 
@@ -238,3 +258,86 @@ def sump_overclock_set(dev: DPDevice, v: int) -> int:
         print("Could not set SUMP overclocking: %s" % str(e))
         return 1
 
+
+
+def sump_overclock_list(dev: DPDevice) -> int:
+    try:
+        cur = dev.m4_sump_overclock_get()
+        for i, (khz, mv) in enumerate(dev.m4_sump_overclock_profiles()):
+            print("%c %d: %d.%03d MHz @ %d.%02d V" % ('*' if i == cur else ' ', i,
+                  khz // 1000, khz % 1000, mv // 1000, (mv % 1000) // 10))
+        return 0
+    except Exception as e:
+        print("Could not get SUMP overclocking profiles: %s" % str(e))
+        return 1
+
+
+def sump_stream_get(dev: DPDevice) -> int:
+    try:
+        res = dev.m4_sump_stream_get()
+        print("SUMP streaming mode %sabled" % ("en" if res else "dis"))
+        return 0
+    except Exception as e:
+        print("Could not get SUMP streaming mode: %s" % str(e))
+        return 1
+
+
+def sump_stream_set(dev: DPDevice, v: bool) -> int:
+    try:
+        dev.m4_sump_stream_set(v)
+        return 0
+    except Exception as e:
+        print("Could not set SUMP streaming mode: %s" % str(e))
+        return 1
+
+
+def sump_tx_stats(dev: DPDevice) -> int:
+    try:
+        nbytes, usec = dev.m4_sump_tx_stats()
+        if usec == 0:
+            print("No SUMP data transfer done yet")
+        else:
+            print("Last SUMP data transfer: %d bytes in %d.%06d s (%.1f KiB/s)" % \
+                  (nbytes, usec // 1000000, usec % 1000000, nbytes * 1e6 / usec / 1024))
+        return 0
+    except Exception as e:
+        print("Could not get SUMP transfer statistics: %s" % str(e))
+        return 1
+
+
+def sump_packed_get(dev: DPDevice) -> int:
+    try:
+        res = dev.m4_sump_packed_get()
+        print("SUMP 4-channel packed mode %sabled" % ("en" if res else "dis"))
+        return 0
+    except Exception as e:
+        print("Could not get SUMP 4-channel packed mode: %s" % str(e))
+        return 1
+
+
+def sump_packed_set(dev: DPDevice, v: bool) -> int:
+    try:
+        dev.m4_sump_packed_set(v)
+        return 0
+    except Exception as e:
+        print("Could not set SUMP 4-channel packed mode: %s" % str(e))
+        return 1
+
+
+def sump_trans_get(dev: DPDevice) -> int:
+    try:
+        res = dev.m4_sump_trans_get()
+        print("SUMP transitional capture mode %sabled" % ("en" if res else "dis"))
+        return 0
+    except Exception as e:
+        print("Could not get SUMP transitional capture mode: %s" % str(e))
+        return 1
+
+
+def sump_trans_set(dev: DPDevice, v: bool) -> int:
+    try:
+        dev.m4_sump_trans_set(v)
+        return 0
+    except Exception as e:
+        print("Could not set SUMP transitional capture mode: %s" % str(e))
+        return 1
@@ -268,6 +268,15 @@ class DPDevice:
 
         return tuple(None if p == 0xff else p for p in pl)
 
+    def m1_dap_stats(self, reset: bool) -> Tuple[int, int, int, int, int]:
+        cmd = bytearray(b'\x17\x00')
+        cmd[1] = 1 if reset else 0
+        self.write(cmd)
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m1: get dap stats", 24, 24)
+
+        return struct.unpack('<IIQII', pl)
+
     # mode 2 commands
 
     # ...
@@ -330,6 +339,63 @@ class DPDevice:
         stat, pl = self.read_resp()
         check_statpl(stat, pl, "m4: sump overclock set", 0, 0)
 
+    def m4_sump_overclock_profiles(self) -> List[Tuple[int, int]]:
+        self.write(b'\x4a')
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump overclock profiles")
+
+        # (sysclk in kHz, core voltage in mV)
+        return [struct.unpack('<IH', pl[i:i+6]) for i in range(0, len(pl) - 5, 6)]
+
+    def m4_sump_stream_get(self) -> bool:
+        self.write(b'\x45')
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump stream get", 1, 1)
+
+        return pl[0] != 0
+
+    def m4_sump_stream_set(self, enabled: bool):
+        cmd = bytearray(b'\x46\xff')
+        cmd[1] = 1 if enabled else 0
+        self.write(cmd)
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump stream set", 0, 0)
+
+    def m4_sump_tx_stats(self) -> Tuple[int, int]:
+        self.write(b'\x47')
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump tx stats", 8, 8)
+
+        return struct.unpack('<II', pl)
+
+    def m4_sump_packed_get(self) -> bool:
+        self.write(b'\x48')
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump packed get", 1, 1)
+
+        return pl[0] != 0
+
+    def m4_sump_packed_set(self, enabled: bool):
+        cmd = bytearray(b'\x49\xff')
+        cmd[1] = 1 if enabled else 0
+        self.write(cmd)
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump packed set", 0, 0)
+
+    def m4_sump_trans_get(self) -> bool:
+        self.write(b'\x4b')
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump transitional get", 1, 1)
+
+        return pl[0] != 0
+
+    def m4_sump_trans_set(self, enabled: bool):
+        cmd = bytearray(b'\x4c\xff')
+        cmd[1] = 1 if enabled else 0
+        self.write(cmd)
+        stat, pl = self.read_resp()
+        check_statpl(stat, pl, "m4: sump transitional set", 0, 0)
+
     # helper methods
 
     def init_info(self):
@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+
+# Host side of the on-probe CMSIS-DAP sampler: configures which target
+# addresses to sample and at what rate, and prints or profiles the resulting
+# stream. The target needs to be connected over SWD already (e.g. by having a
+# debugger attached), with the debug power domain on.
+
+import argparse
+import collections
+import struct
+import sys
+
+from typing import *
+
+
+DWT_PCSR = 0xE000101C
+
+_SUBCLASS = ord('D')
+_PROTOCOL = ord('S')
+
+CMD_STOP  = 0x00
+CMD_START = 0x01
+
+MAX_ADDR = 8
+
+
+class Sample(NamedTuple):
+    timestamp: int
+    ack: int
+    lost: int
+    values: List[int]
+
+
+def find_itf(vidpid: str) -> Tuple[Any, Any]:
+    import usb, usb.core, usb.util
+
+    vid, pid = (int(x, 16) for x in vidpid.split(':'))
+    dev = usb.core.find(idVendor=vid, idProduct=pid)
+    if dev is None:
+        raise Exception("No device %04x:%04x found" % (vid, pid))
+
+    cfg = dev.get_active_configuration()
+    itf = [i for i in cfg.interfaces()
+           if i.bInterfaceClass == usb.CLASS_VENDOR_SPEC and
+              i.bInterfaceSubClass == _SUBCLASS and
+              i.bInterfaceProtocol == _PROTOCOL]
+    if len(itf) != 1:
+        raise Exception("No sampler interface found, wrong mode?")
+    itf = itf[0]
+
+    epout = usb.util.find_descriptor(itf, custom_match =
+        lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+    epin  = usb.util.find_descriptor(itf, custom_match =
+        lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+
+    return epout, epin
+
+
+def start(epout, interval: int, select: int, csw: int, addrs: List[int]):
+    cmd = struct.pack('<BIIIB', CMD_START, interval, select, csw, len(addrs))
+    cmd += b''.join(struct.pack('<I', a) for a in addrs)
+    epout.write(cmd)
+
+
+def stop(epout, epin):
+    import usb.core
+
+    epout.write(bytes([CMD_STOP]))
+    # drain whatever was still buffered on the device
+    try:
+        while len(epin.read(4096, timeout=100)) != 0: pass
+    except usb.core.USBTimeoutError:
+        pass
+
+
+def samples(epin, naddr: int) -> Iterator[Sample]:
+    import usb.core
+
+    reclen = 8 + 4 * naddr
+    buf = bytearray()
+
+    while True:
+        try:
+            buf += epin.read(4096, timeout=1000)
+        except usb.core.USBTimeoutError:
+            continue
+
+        nrec = len(buf) // reclen
+        for i in range(nrec):
+            ts, ack, n, lost = struct.unpack_from('<IBBH', buf, i * reclen)
+            vals = list(struct.unpack_from('<%dI' % n, buf, i * reclen + 8))
+            yield Sample(ts, ack, lost, vals)
+        del buf[:nrec * reclen]
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(prog="dpsample",
+                                     description="Stream target memory "+\
+                                     "samples (e.g. the PC, for profiling) "+\
+                                     "from a Dragon Probe")
+
+    def auto_int(x):
+        return int(x, 0)
+
+    parser.add_argument('--dev', type=str, default="cafe:1312",
+                        help="USB VID:PID of the device, default cafe:1312")
+    parser.add_argument('--interval', type=int, default=50,
+                        help="Sampling interval in microseconds (timestamp "+\
+                        "clock ticks), 0 for as fast as possible. Default 50")
+    parser.add_argument('--select', type=auto_int, default=0,
+                        help="DP SELECT value of the MEM-AP to use, default 0")
+    parser.add_argument('--csw', type=auto_int, default=0xA2000002,
+                        help="MEM-AP CSW value (32-bit accesses, no "+\
+                        "auto-increment), default 0xA2000002")
+    parser.add_argument('--count', type=int, default=0,
+                        help="Stop after this many samples (0 = until ^C)")
+    parser.add_argument('--profile', type=int, default=None, metavar='N',
+                        help="Instead of printing every sample, print the N "+\
+                        "most common values of the first address at the end")
+    parser.add_argument('addr', type=auto_int, nargs='*', default=[DWT_PCSR],
+                        help="Target addresses to sample, default DWT_PCSR")
+
+    args = parser.parse_args()
+
+    if len(args.addr) > MAX_ADDR:
+        print("At most %d addresses can be sampled" % MAX_ADDR)
+        return 1
+
+    try:
+        epout, epin = find_itf(args.dev)
+    except Exception as e:
+        print("Could not open sampler interface: %s" % str(e))
+        return 1
+
+    hist = collections.Counter()
+    nsmp, nlost, nerr = 0, 0, 0
+
+    start(epout, args.interval, args.select, args.csw, args.addr)
+    try:
+        for s in samples(epin, len(args.addr)):
+            nsmp += 1
+            nlost += s.lost
+            if s.ack != 1:
+                nerr += 1
+            elif args.profile is not None:
+                hist[s.values[0]] += 1
+            else:
+                print("%10d %s" % (s.timestamp, ' '.join("%08x" % v for v in s.values)))
+
+            if args.count != 0 and nsmp >= args.count:
+                break
+    except KeyboardInterrupt:
+        pass
+    finally:
+        stop(epout, epin)
+
+    if args.profile is not None:
+        ok = nsmp - nerr
+        for v, c in hist.most_common(args.profile):
+            print("%08x %8d %6.2f%%" % (v, c, c * 100.0 / ok))
+    print("%d samples, %d failed, %d lost" % (nsmp, nerr, nlost), file=sys.stderr)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
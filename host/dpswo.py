@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+
+# Host side of the SWO streaming trace: starts SWO capture through the
+# CMSIS-DAP bulk interface, with the streaming transport, and dumps the raw
+# trace data from the SWO trace interface to a file or stdout. The target
+# needs to be set up to emit SWO data (TPIU/ITM configured) already.
+
+import argparse
+import struct
+import sys
+
+from typing import *
+
+
+_SUBCLASS = ord('D')
+_PROTOCOL = ord('W')
+
+ID_DAP_SWO_Transport = 0x17
+ID_DAP_SWO_Mode      = 0x18
+ID_DAP_SWO_Baudrate  = 0x19
+ID_DAP_SWO_Control   = 0x1A
+
+SWO_MODES = { 'uart': 1, 'manchester': 2 }
+
+
+def find_itfs(vidpid: str) -> Tuple[Any, Any, Any]:
+    import usb, usb.core, usb.util
+
+    vid, pid = (int(x, 16) for x in vidpid.split(':'))
+    dev = usb.core.find(idVendor=vid, idProduct=pid)
+    if dev is None:
+        raise Exception("No device %04x:%04x found" % (vid, pid))
+
+    def find_ep(itf, dir):
+        return usb.util.find_descriptor(itf, custom_match =
+            lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == dir)
+
+    cfg = dev.get_active_configuration()
+    dap = [i for i in cfg.interfaces()
+           if i.bInterfaceClass == usb.CLASS_VENDOR_SPEC and
+              i.bInterfaceSubClass == 0 and i.bInterfaceProtocol == 0 and
+              i.iInterface != 0 and
+              "CMSIS-DAP" in usb.util.get_string(dev, i.iInterface)]
+    swo = [i for i in cfg.interfaces()
+           if i.bInterfaceClass == usb.CLASS_VENDOR_SPEC and
+              i.bInterfaceSubClass == _SUBCLASS and
+              i.bInterfaceProtocol == _PROTOCOL]
+    if len(dap) != 1 or len(swo) != 1:
+        raise Exception("No CMSIS-DAP or SWO trace interface found, wrong mode?")
+
+    return find_ep(dap[0], usb.util.ENDPOINT_OUT), \
+           find_ep(dap[0], usb.util.ENDPOINT_IN), \
+           find_ep(swo[0], usb.util.ENDPOINT_IN)
+
+
+def dap_cmd(epout, epin, cmd: int, data: bytes) -> bytes:
+    epout.write(bytes([cmd]) + data)
+    resp = bytes(epin.read(512, timeout=1000))
+    if len(resp) < 2 or resp[0] != cmd:
+        raise Exception("Bad response to DAP command 0x%02x" % cmd)
+    return resp[1:]
+
+
+def swo_start(epout, epin, mode: int, baudrate: int) -> int:
+    dap_cmd(epout, epin, ID_DAP_SWO_Control, bytes([0]))
+    if dap_cmd(epout, epin, ID_DAP_SWO_Transport, bytes([2]))[0] != 0:
+        raise Exception("SWO streaming transport not supported")
+    if dap_cmd(epout, epin, ID_DAP_SWO_Mode, bytes([mode]))[0] != 0:
+        raise Exception("SWO mode not supported")
+    actual = struct.unpack('<I', dap_cmd(epout, epin, ID_DAP_SWO_Baudrate,
+                                         struct.pack('<I', baudrate))[:4])[0]
+    if actual == 0:
+        raise Exception("SWO baudrate not supported")
+    if dap_cmd(epout, epin, ID_DAP_SWO_Control, bytes([1]))[0] != 0:
+        raise Exception("Could not start SWO capture")
+    return actual
+
+
+def swo_stop(epout, epin):
+    dap_cmd(epout, epin, ID_DAP_SWO_Control, bytes([0]))
+    dap_cmd(epout, epin, ID_DAP_SWO_Mode, bytes([0]))
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(prog="dpswo",
+                                     description="Stream SWO trace data "+\
+                                     "from a Dragon Probe")
+
+    parser.add_argument('--dev', type=str, default="cafe:1312",
+                        help="USB VID:PID of the device, default cafe:1312")
+    parser.add_argument('--mode', type=str, default='uart',
+                        choices=SWO_MODES.keys(), help="SWO encoding, "+\
+                        "default uart")
+    parser.add_argument('--baudrate', type=int, default=1000000,
+                        help="SWO baudrate, default 1000000")
+    parser.add_argument('--no-setup', default=False, action='store_true',
+                        help="Don't configure SWO capture, only read the "+\
+                        "stream (e.g. when a debugger has started it)")
+    parser.add_argument('output', type=str, nargs='?', default='-',
+                        help="File to write the trace data to, default stdout")
+
+    args = parser.parse_args()
+
+    import usb.core
+
+    try:
+        epout, epin, epswo = find_itfs(args.dev)
+    except Exception as e:
+        print("Could not open SWO trace interface: %s" % str(e))
+        return 1
+
+    if not args.no_setup:
+        try:
+            actual = swo_start(epout, epin, SWO_MODES[args.mode], args.baudrate)
+        except Exception as e:
+            print("Could not start SWO capture: %s" % str(e))
+            return 1
+        print("SWO capture started at %d baud" % actual, file=sys.stderr)
+
+    out = sys.stdout.buffer if args.output == '-' else open(args.output, 'wb')
+    total = 0
+    try:
+        while True:
+            try:
+                data = epswo.read(4096, timeout=1000)
+            except usb.core.USBTimeoutError:
+                continue
+            out.write(data)
+            out.flush()
+            total += len(data)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if not args.no_setup:
+            swo_stop(epout, epin)
+        if out is not sys.stdout.buffer:
+            out.close()
+
+    print("%d bytes received" % total, file=sys.stderr)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
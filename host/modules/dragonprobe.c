@@ -15,6 +15,7 @@
 #include <linux/usb.h>
 #include <linux/i2c.h>
 #include <linux/mutex.h>
+#include <linux/completion.h>
 #include <linux/platform_device.h>
 #include <linux/mfd/core.h>
 #include <linux/rculist.h>
@@ -32,6 +33,10 @@
 
 #define DP_RESP_HDR_SIZE 4
 
+/* when resynchronizing after an error, the device is considered done sending
+ * once nothing came in for this long */
+#define DP_PIPE_DRAIN_TIMEOUT 50
+
 /* endpoint indices, not addresses */
 #define DP_VND_CFG_EP_OUT 0
 #define DP_VND_CFG_EP_IN  1
@@ -41,10 +46,26 @@ struct dp_dev {
 	struct usb_interface *interface;
 	uint8_t ep_in;
 	uint8_t ep_out;
+	uint16_t ep_in_mps;
 
 	spinlock_t disconnect_lock;
 	bool disconnect;
 
+	/* one request-response exchange (or pipeline thereof) at a time */
+	struct mutex xfer_lock;
+
+	/* pipelined transfers: preallocated OUT URBs, used round-robin */
+	struct dp_pipe_slot {
+		struct urb *urb;
+		uint8_t *buf;
+		struct completion done;
+	} pipe[DP_PIPE_DEPTH];
+	int pipe_next;
+	/* responses aren't aligned to USB packets anymore when several are
+	 * underway, so whatever was read past the current one is kept here */
+	uint8_t *rxbuf;
+	int rxpos, rxlen;
+
 	uint8_t dp_mode, dp_m1feature;
 };
 
@@ -295,12 +316,260 @@ int dp_transfer(struct platform_device *pdev, int cmd, int recvflags,
 {
 	struct dp_dev *dp;
 
+	int ret;
+
 	dp = dev_get_drvdata(pdev->dev.parent);
 
-	return dp_xfer_internal(dp, cmd, recvflags, wbuf, wbufsize, rbuf, rbufsize);
+	mutex_lock(&dp->xfer_lock);
+	ret = dp_xfer_internal(dp, cmd, recvflags, wbuf, wbufsize, rbuf, rbufsize);
+	mutex_unlock(&dp->xfer_lock);
+
+	return ret;
 }
 EXPORT_SYMBOL(dp_transfer);
 
+/* pipelined transfers */
+
+static void dp_pipe_out_complete(struct urb *urb)
+{
+	struct dp_pipe_slot *slot = urb->context;
+
+	complete(&slot->done);
+}
+
+static int dp_pipe_alloc(struct dp_dev *dp)
+{
+	struct dp_pipe_slot *slot;
+	int i;
+
+	dp->rxbuf = kmalloc(2 * dp->ep_in_mps, GFP_KERNEL);
+	if (!dp->rxbuf) return -ENOMEM;
+
+	for (i = 0; i < DP_PIPE_DEPTH; ++i) {
+		slot = &dp->pipe[i];
+
+		slot->urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!slot->urb) return -ENOMEM;
+
+		slot->buf = usb_alloc_coherent(dp->usb_dev, DP_PIPE_BUFSIZE, GFP_KERNEL,
+				&slot->urb->transfer_dma);
+		if (!slot->buf) return -ENOMEM;
+
+		/* 'done' means free to use */
+		init_completion(&slot->done);
+		complete(&slot->done);
+	}
+
+	return 0;
+}
+static void dp_pipe_free(struct dp_dev *dp)
+{
+	struct dp_pipe_slot *slot;
+	int i;
+
+	for (i = 0; i < DP_PIPE_DEPTH; ++i) {
+		slot = &dp->pipe[i];
+		if (!slot->urb) continue;
+
+		usb_kill_urb(slot->urb);
+		if (slot->buf)
+			usb_free_coherent(dp->usb_dev, DP_PIPE_BUFSIZE, slot->buf,
+					slot->urb->transfer_dma);
+		usb_free_urb(slot->urb);
+	}
+
+	kfree(dp->rxbuf);
+}
+
+/* make sure at least n (< ep_in_mps) unread bytes are in the RX buffer */
+static int dp_pipe_rx_fill(struct dp_dev *dp, int n)
+{
+	int ret, actual;
+
+	if (dp->rxlen - dp->rxpos >= n) return 0;
+
+	memmove(dp->rxbuf, dp->rxbuf + dp->rxpos, dp->rxlen - dp->rxpos);
+	dp->rxlen -= dp->rxpos;
+	dp->rxpos = 0;
+
+	/* one packet at a time: asking for more could block until the
+	 * timeout, as the device may be waiting for the next request */
+	while (dp->rxlen < n) {
+		ret = usb_bulk_msg(dp->usb_dev, usb_rcvbulkpipe(dp->usb_dev, dp->ep_in),
+				dp->rxbuf + dp->rxlen, dp->ep_in_mps, &actual, DP_USB_TIMEOUT);
+		if (ret < 0) return ret;
+
+		dp->rxlen += actual;
+	}
+
+	return 0;
+}
+
+static void dp_pipe_drain(struct dp_dev *dp)
+{
+	int ret, actual;
+
+	do {
+		ret = usb_bulk_msg(dp->usb_dev, usb_rcvbulkpipe(dp->usb_dev, dp->ep_in),
+				dp->rxbuf, dp->ep_in_mps, &actual, DP_PIPE_DRAIN_TIMEOUT);
+	} while (ret == 0);
+
+	dp->rxpos = dp->rxlen = 0;
+}
+
+int dp_pipe_begin(struct platform_device *pdev)
+{
+	struct dp_dev *dp = dev_get_drvdata(pdev->dev.parent);
+	int ret = 0;
+
+	mutex_lock(&dp->xfer_lock);
+
+	spin_lock(&dp->disconnect_lock);
+	if (dp->disconnect) ret = -ENODEV;
+	spin_unlock(&dp->disconnect_lock);
+
+	if (ret) mutex_unlock(&dp->xfer_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(dp_pipe_begin);
+
+int dp_pipe_send(struct platform_device *pdev, int cmd, const void *wbuf, int wbufsize)
+{
+	struct dp_dev *dp = dev_get_drvdata(pdev->dev.parent);
+	struct dp_pipe_slot *slot = &dp->pipe[dp->pipe_next];
+	int ret, len = 0;
+
+	if (wbufsize + 1 > DP_PIPE_BUFSIZE) return -EMSGSIZE;
+
+	/* the request sent DP_PIPE_DEPTH places earlier has to be out first */
+	if (!wait_for_completion_timeout(&slot->done, msecs_to_jiffies(DP_USB_TIMEOUT)))
+		return -ETIMEDOUT;
+
+	if (cmd >= 0 && cmd <= 0xff) slot->buf[len++] = (uint8_t)cmd;
+	if (wbuf && wbufsize) {
+		memcpy(&slot->buf[len], wbuf, wbufsize);
+		len += wbufsize;
+	}
+
+	usb_fill_bulk_urb(slot->urb, dp->usb_dev, usb_sndbulkpipe(dp->usb_dev, dp->ep_out),
+			slot->buf, len, dp_pipe_out_complete, slot);
+	slot->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+	ret = usb_submit_urb(slot->urb, GFP_KERNEL);
+	if (ret < 0) {
+		complete(&slot->done);
+		return ret;
+	}
+
+	dp->pipe_next = (dp->pipe_next + 1) % DP_PIPE_DEPTH;
+
+	return 0;
+}
+EXPORT_SYMBOL(dp_pipe_send);
+
+int dp_pipe_recv(struct platform_device *pdev, void *rbuf, int rbufsize, int *rlen)
+{
+	struct dp_dev *dp = dev_get_drvdata(pdev->dev.parent);
+	struct device *dev = &dp->interface->dev;
+	int ret, actual, n, hdrlen = 2, off = 0, mps = dp->ep_in_mps;
+	uint32_t pl_len;
+	uint8_t *hdr, respstat;
+
+	*rlen = -1;
+
+	/* response header: status, and 1..3 bytes of payload length */
+	ret = dp_pipe_rx_fill(dp, hdrlen);
+	if (ret < 0) return ret;
+	hdr = dp->rxbuf + dp->rxpos;
+	if (hdr[1] & 0x80) {
+		ret = dp_pipe_rx_fill(dp, ++hdrlen);
+		if (ret < 0) return ret;
+		hdr = dp->rxbuf + dp->rxpos;
+		if (hdr[2] & 0x80) {
+			ret = dp_pipe_rx_fill(dp, ++hdrlen);
+			if (ret < 0) return ret;
+			hdr = dp->rxbuf + dp->rxpos;
+		}
+	}
+
+	respstat = hdr[0];
+	pl_len = (uint32_t)(hdr[1] & 0x7f);
+	if (hdrlen > 2) pl_len |= (uint32_t)(hdr[2] & 0x7f) << 7;
+	if (hdrlen > 3) pl_len |= (uint32_t)hdr[3] << 14;
+	dp->rxpos += hdrlen;
+
+	dev_dbg(dev, "got pipelined hdr: status %02x, payload len 0x%x\n",
+			respstat, pl_len);
+
+	if (pl_len > rbufsize) {
+		dev_err(dev, "pipelined response too long (0x%x > 0x%x)\n", pl_len, rbufsize);
+		return -EMSGSIZE;
+	}
+
+	/* what has already been read, then whole packets straight into rbuf,
+	 * and the last partial packet through the RX buffer again */
+	n = min_t(int, pl_len, dp->rxlen - dp->rxpos);
+	memcpy(rbuf, dp->rxbuf + dp->rxpos, n);
+	dp->rxpos += n;
+	off = n;
+
+	while (pl_len - off >= mps) {
+		ret = usb_bulk_msg(dp->usb_dev, usb_rcvbulkpipe(dp->usb_dev, dp->ep_in),
+				rbuf + off, rounddown(pl_len - off, mps), &actual, DP_USB_TIMEOUT);
+		if (ret < 0) return ret;
+
+		off += actual;
+	}
+
+	if (off < pl_len) {
+		n = pl_len - off;
+		ret = dp_pipe_rx_fill(dp, n);
+		if (ret < 0) return ret;
+
+		memcpy(rbuf + off, dp->rxbuf + dp->rxpos, n);
+		dp->rxpos += n;
+	}
+
+	*rlen = (int)pl_len;
+	return respstat;
+}
+EXPORT_SYMBOL(dp_pipe_recv);
+
+void dp_pipe_end(struct platform_device *pdev, bool resync)
+{
+	struct dp_dev *dp = dev_get_drvdata(pdev->dev.parent);
+	struct device *dev = &dp->interface->dev;
+	struct dp_pipe_slot *slot;
+	int i;
+
+	if (!resync && dp->rxpos != dp->rxlen) {
+		dev_warn(dev, "%d stray bytes after pipelined responses\n", dp->rxlen - dp->rxpos);
+		resync = true;
+	}
+
+	/* the device might be blocked on sending responses nobody is going to
+	 * read, which keeps it from taking in the rest of the requests */
+	if (resync) dp_pipe_drain(dp);
+
+	for (i = 0; i < DP_PIPE_DEPTH; ++i) {
+		slot = &dp->pipe[i];
+
+		if (!wait_for_completion_timeout(&slot->done, msecs_to_jiffies(DP_USB_TIMEOUT))) {
+			dev_warn(dev, "pipelined request stuck, cancelling\n");
+			usb_kill_urb(slot->urb);
+			wait_for_completion(&slot->done);
+		}
+		complete(&slot->done);
+	}
+
+	/* and what was sent in response to those */
+	if (resync) dp_pipe_drain(dp);
+
+	mutex_unlock(&dp->xfer_lock);
+}
+EXPORT_SYMBOL(dp_pipe_end);
+
 /* stuff on init */
 
 static int dp_check_hw(struct dp_dev *dp)
@@ -484,11 +753,19 @@ static int dp_probe(struct usb_interface *itf, const struct usb_device_id *usb_i
 
 	dp->ep_out = epout->bEndpointAddress;
 	dp->ep_in = epin->bEndpointAddress;
+	dp->ep_in_mps = usb_endpoint_maxp(epin);
 	dp->usb_dev = usb_get_dev(interface_to_usbdev(itf));
 	dp->interface = itf;
 	usb_set_intfdata(itf, dp);
 
 	spin_lock_init(&dp->disconnect_lock);
+	mutex_init(&dp->xfer_lock);
+
+	ret = dp_pipe_alloc(dp);
+	if (ret < 0) {
+		dev_err(dev, "failed to allocate transfer buffers\n");
+		goto out_free;
+	}
 
 	ret = dp_hw_init(dp);
 	if (ret < 0) {
@@ -529,6 +806,7 @@ static int dp_probe(struct usb_interface *itf, const struct usb_device_id *usb_i
 	return 0;
 
 out_free:
+	dp_pipe_free(dp);
 	usb_put_dev(dp->usb_dev);
 	kfree(dp);
 
@@ -544,6 +822,7 @@ static void dp_disconnect(struct usb_interface *itf)
 
 	mfd_remove_devices(&itf->dev);
 
+	dp_pipe_free(dp);
 	usb_put_dev(dp->usb_dev);
 
 	kfree(dp);
@@ -74,6 +74,28 @@ inline static int dp_check_retval(int ret, int len, struct device *dev,
 int dp_transfer(struct platform_device *pdev, int cmd, int recvflags,
 		const void *wbuf, int wbufsize, void **rbuf, int *rbufsize);
 
+/*
+ * Pipelined transfers: requests are sent out without waiting for the response
+ * to the previous one, so that the USB round-trip latency is only paid once.
+ * No other transfers go to the device between dp_pipe_begin() and
+ * dp_pipe_end(). Responses have to be read back in order with dp_pipe_recv(),
+ * which returns the response status, like dp_transfer() does. rbuf has to be
+ * DMA-capable.
+ *
+ * dp_pipe_send() waits for the request sent DP_PIPE_DEPTH places earlier to
+ * have left the host. The device might not take that one in before its
+ * earlier responses have been read, so callers should never have more than
+ * DP_PIPE_DEPTH requests waiting for a response.
+ */
+#define DP_PIPE_DEPTH   8
+#define DP_PIPE_BUFSIZE 1024 /* max. request length, including the cmd byte */
+
+int dp_pipe_begin(struct platform_device *pdev);
+int dp_pipe_send(struct platform_device *pdev, int cmd, const void *wbuf, int wbufsize);
+int dp_pipe_recv(struct platform_device *pdev, void *rbuf, int rbufsize, int *rlen);
+/* with resync set (e.g. after an error), responses still coming in are dropped */
+void dp_pipe_end(struct platform_device *pdev, bool resync);
+
 inline static int dp_read(struct platform_device *pdev, int recvflags,
 		void **rbuf, int *rbufsize)
 {
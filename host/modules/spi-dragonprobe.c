@@ -10,9 +10,12 @@
 
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/delay.h>
 #include <linux/platform_device.h>
 #include <linux/spi/spi.h>
+#include <linux/spi/spi-mem.h>
 #include <linux/pm_runtime.h>
+#include <linux/version.h>
 #include <asm/unaligned.h>
 
 #if 0
@@ -54,6 +57,10 @@
 #define DP_SPI_CMD_SPI_READ    0x45
 #define DP_SPI_CMD_SPI_WRITE   0x46
 #define DP_SPI_CMD_SPI_RDWR    0x47
+#define DP_SPI_CMD_SPI_READ_WIDE  0x48
+#define DP_SPI_CMD_SPI_WRITE_WIDE 0x49
+#define DP_SPI_CMD_SPI_WRPOLL  0x4a
+#define DP_SPI_CMD_SPI_POLL    0x4b
 
 #define SERPROG_IFACE_VERSION 0x0001
 
@@ -91,8 +98,14 @@ static const uint8_t reqd_cmds[] = {
 #define DP_SPI_S_CAP_LSBFST  (1<<8)
 #define DP_SPI_S_CAP_CSACHI  (1<<9)
 #define DP_SPI_S_CAP_3WIRE   (1<<10)
+#define DP_SPI_S_CAP_DUAL    (1<<11)
+#define DP_SPI_S_CAP_QUAD    (1<<12)
 
 #define DP_PINST_AUTOSUSPEND_TIMEOUT 2000
+/* max. time the device polls in one go, must stay well below the USB timeout */
+#define DP_SPI_POLL_SLICE_MS 250
+/* limits the length of a single read request */
+#define DP_SPI_RXBUF_SIZE 0x8000
 
 struct dp_spi_caps {
 	uint32_t freq_min, freq_max;
@@ -101,7 +114,7 @@ struct dp_spi_caps {
 };
 struct dp_spi_dev_sett {
 	/* does not have to be guarded with a spinlock, as the kernel already
-	 * serializes transfer_one/set_cs calls */
+	 * serializes transfer_one_message calls */
 	uint32_t freq;
 	uint8_t flags, bpw;
 	uint8_t cs, pinst;
@@ -110,7 +123,18 @@ struct dp_spi {
 	struct platform_device *pdev;
 	struct spi_controller *spictl;
 
-	uint8_t *txbuf;
+	/* requests are built in txbuf, responses read into rxbuf */
+	uint8_t *txbuf, *rxbuf;
+	/* requests sent, waiting for their response */
+	struct dp_spi_pend {
+		const char *what;
+		void *data;    /* where the data read goes, if any */
+		uint32_t len;  /* response length, including the ACK */
+		uint8_t bpw;
+	} pend[DP_PIPE_DEPTH];
+	int pend_first, pend_num;
+	/* the response stream can't be followed anymore, and has to be drained */
+	bool pipe_broken;
 	struct dp_spi_caps caps;
 	uint8_t csmask;
 	struct dp_spi_dev_sett devsettings[8];
@@ -159,7 +183,7 @@ static uint8_t kernmode_to_flags(uint16_t caps, int mode)
 
 	return ret;
 }
-static int devcaps_to_kernmode(uint16_t caps)
+static int devcaps_to_kernmode(struct dp_spi *dps, uint16_t caps)
 {
 	int ret;
 
@@ -169,6 +193,11 @@ static int devcaps_to_kernmode(uint16_t caps)
 	if (caps & DP_SPI_S_CAP_CSACHI) ret |= SPI_CS_HIGH;
 	if (caps & DP_SPI_S_CAP_3WIRE) ret |= SPI_3WIRE;
 
+	if (has_cmd(dps, DP_SPI_CMD_SPI_READ_WIDE) && has_cmd(dps, DP_SPI_CMD_SPI_WRITE_WIDE)) {
+		if (caps & DP_SPI_S_CAP_DUAL) ret |= SPI_RX_DUAL | SPI_TX_DUAL;
+		if (caps & DP_SPI_S_CAP_QUAD) ret |= SPI_RX_QUAD | SPI_TX_QUAD;
+	}
+
 	return ret;
 }
 static void caps_to_binfo(struct dp_spi *dps, int busnum)
@@ -266,22 +295,23 @@ static int dp_spi_csmask_set_one(struct dp_spi *dps, uint8_t cs)
 {
 	return dp_spi_csmask_set(dps, BIT(cs));
 }
-static int dp_spi_cs_set(struct dp_spi *dps, int ind, bool lvl)
+/* the device selects the chip on a 1, regardless of the CS polarity */
+static int dp_spi_cs_set(struct dp_spi *dps, int ind, bool sel)
 {
 	struct device *dev = &dps->pdev->dev;
-	uint8_t wbuf[] = { DP_SPI_CMD_S_SPI_SETCS, lvl ? 1 : 0 };
+	uint8_t wbuf[] = { DP_SPI_CMD_S_SPI_SETCS, sel ? 1 : 0 };
 	uint8_t *rbuf;
 	int ret, rlen;
 
-	if (dps->devsettings[ind].cs == (lvl ? 1 : 0)) return 0;
+	if (dps->devsettings[ind].cs == (sel ? 1 : 0)) return 0;
 
-	dev_dbg(dev, "set cs %s\n", lvl?"hi":"lo");
+	dev_dbg(dev, "set cs %s\n", sel?"select":"deselect");
 	ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
 			wbuf, sizeof(wbuf), (void**)&rbuf, &rlen);
 	ret = dp_check_retval_sp(ret, rlen, dev, "set CS", true, 1, 1, rbuf);
 
 	if (!ret) {
-		dps->devsettings[ind].cs = lvl ? 1 : 0;
+		dps->devsettings[ind].cs = sel ? 1 : 0;
 	}
 	if (rbuf) kfree(rbuf);
 
@@ -536,7 +566,7 @@ static int dp_spi_check_hw(struct dp_spi *dps)
 		}
 		if (rbuf) kfree(rbuf);
 		if (ret) return ret;
-	} else dps->rdnmaxlen = 512;
+	} else dps->wrnmaxlen = 512;
 	dev_info(dev, "  wrnmaxlen = 0x%x\n", dps->wrnmaxlen);
 
 	if (has_cmd(dps, DP_SPI_CMD_Q_RDNMAXLEN)) {
@@ -557,12 +587,105 @@ static int dp_spi_check_hw(struct dp_spi *dps)
 	return 0;
 }
 
-static int dp_spi_do_read(struct dp_spi *dps, void *data, size_t len, uint8_t bpw)
+static int dp_spi_recv_one(struct dp_spi *dps)
 {
 	struct device *dev = &dps->pdev->dev;
-	uint8_t *rbuf;
+	struct dp_spi_pend *p = &dps->pend[dps->pend_first];
 	int ret, rlen;
 
+	ret = dp_pipe_recv(dps->pdev, dps->rxbuf, DP_SPI_RXBUF_SIZE, &rlen);
+	if (ret < 0) dps->pipe_broken = true;
+	ret = dp_check_retval_sp(ret, rlen, dev, p->what, true, p->len, p->len, dps->rxbuf);
+
+	if (!ret && p->data) bufconv_from_le(p->data, &dps->rxbuf[1], p->len - 1, p->bpw);
+
+	dps->pend_first = (dps->pend_first + 1) % DP_PIPE_DEPTH;
+	--dps->pend_num;
+
+	return ret;
+}
+static int dp_spi_flush(struct dp_spi *dps)
+{
+	int ret;
+
+	while (dps->pend_num) {
+		ret = dp_spi_recv_one(dps);
+		if (ret < 0) return ret;
+	}
+
+	return 0;
+}
+/* sends the request in txbuf, the data it reads is stored in 'data' once its
+ * response has come in */
+static int dp_spi_send(struct dp_spi *dps, int reqlen, const char *what,
+		void *data, uint32_t resplen, uint8_t bpw)
+{
+	struct device *dev = &dps->pdev->dev;
+	struct dp_spi_pend *p;
+	int ret;
+
+	while (dps->pend_num == DP_PIPE_DEPTH) {
+		ret = dp_spi_recv_one(dps);
+		if (ret < 0) return ret;
+	}
+
+	ret = dp_pipe_send(dps->pdev, DP_CMD_MODE1_SPI, dps->txbuf, reqlen);
+	if (ret < 0) {
+		dev_err(dev, "%s: USB fail: %d\n", what, ret);
+		dps->pipe_broken = true;
+		return ret;
+	}
+
+	p = &dps->pend[(dps->pend_first + dps->pend_num) % DP_PIPE_DEPTH];
+	p->what = what;
+	p->data = data;
+	p->len = resplen;
+	p->bpw = bpw;
+	++dps->pend_num;
+
+	return 0;
+}
+/*
+ * waits for all responses, and lets other transfers through again. The device
+ * carries on with the requests queued after a failed (NAKed) one, so their
+ * responses are still read back, and only a broken stream has to be drained.
+ */
+static int dp_spi_pipe_end(struct dp_spi *dps, int ret)
+{
+	int ret2;
+
+	while (dps->pend_num && !dps->pipe_broken) {
+		ret2 = dp_spi_recv_one(dps);
+		if (!ret) ret = ret2;
+	}
+
+	dp_pipe_end(dps->pdev, dps->pipe_broken);
+	dps->pend_num = 0;
+	dps->pipe_broken = false;
+
+	return ret;
+}
+
+static int dp_spi_queue_cs(struct dp_spi *dps, int ind, bool sel)
+{
+	int ret;
+
+	if (dps->devsettings[ind].cs == (sel ? 1 : 0)) return 0;
+
+	dev_dbg(&dps->pdev->dev, "queue cs %s\n", sel?"select":"deselect");
+	dps->txbuf[0] = DP_SPI_CMD_S_SPI_SETCS;
+	dps->txbuf[1] = sel ? 1 : 0;
+
+	ret = dp_spi_send(dps, 2, "set CS", NULL, 1, 8);
+	if (!ret) dps->devsettings[ind].cs = sel ? 1 : 0;
+
+	return ret;
+}
+
+static int dp_spi_queue_read(struct dp_spi *dps, void *data, size_t len, uint8_t bpw)
+{
+	struct device *dev = &dps->pdev->dev;
+
 	if (len > INT_MAX-4) return -EINVAL;
 
 	if (has_cmd(dps, DP_SPI_CMD_SPI_READ)) {
@@ -573,13 +696,7 @@ static int dp_spi_do_read(struct dp_spi *dps, void *data, size_t len, uint8_t bp
 		dps->txbuf[2] = (len >>  8) & 0xff;
 		dps->txbuf[3] = (len >> 16) & 0xff;
 
-		ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
-				dps->txbuf, 4, (void**)&rbuf, &rlen);
-		ret = dp_check_retval_sp(ret, rlen, dev, "do read", true, (int)len+1, (int)len+1, rbuf);
-
-		if (!ret) bufconv_from_le(data, &rbuf[1], len, bpw);
-
-		if (rbuf) kfree(rbuf);
+		return dp_spi_send(dps, 4, "do read", data, (int)len+1, bpw);
 	} else if (has_cmd(dps, DP_SPI_CMD_SPIOP)) {
 		dev_dbg(dev, "do spiop read len=0x%zx\n", len);
 
@@ -591,13 +708,7 @@ static int dp_spi_do_read(struct dp_spi *dps, void *data, size_t len, uint8_t bp
 		dps->txbuf[5] = (len >>  8) & 0xff;
 		dps->txbuf[6] = (len >> 16) & 0xff;
 
-		ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
-				dps->txbuf, 7, (void**)&rbuf, &rlen);
-		ret = dp_check_retval_sp(ret, rlen, dev, "do spiop read", true, (int)len+1, (int)len+1, rbuf);
-
-		if (!ret) bufconv_from_le(data, &rbuf[1], len, bpw);
-
-		if (rbuf) kfree(rbuf);
+		return dp_spi_send(dps, 7, "do spiop read", data, (int)len+1, bpw);
 	} else if (has_cmd(dps, DP_SPI_CMD_SPI_RDWR)) {
 		dev_dbg(dev, "do rdwr read len=0x%zx\n", len);
 
@@ -611,24 +722,14 @@ static int dp_spi_do_read(struct dp_spi *dps, void *data, size_t len, uint8_t bp
 		 * in most places apparently? */
 		memset(&dps->txbuf[4], 0, len);
 
-		ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
-				dps->txbuf, (int)len+4, (void**)&rbuf, &rlen);
-		ret = dp_check_retval_sp(ret, rlen, dev, "do rdwr read", true, (int)len+1, (int)len+1, rbuf);
-
-		if (!ret) bufconv_from_le(data, &rbuf[1], len, bpw);
-
-		if (rbuf) kfree(rbuf);
+		return dp_spi_send(dps, (int)len+4, "do rdwr read", data, (int)len+1, bpw);
 	} else {
 		return -EXDEV;
 	}
-
-	return 0;
 }
-static int dp_spi_do_write(struct dp_spi *dps, const void *data, size_t len, uint8_t bpw)
+static int dp_spi_queue_write(struct dp_spi *dps, const void *data, size_t len, uint8_t bpw)
 {
 	struct device *dev = &dps->pdev->dev;
-	uint8_t *rbuf;
-	int ret, rlen;
 
 	if (len > INT_MAX-7) return -EINVAL;
 
@@ -642,11 +743,7 @@ static int dp_spi_do_write(struct dp_spi *dps, const void *data, size_t len, uin
 
 		bufconv_to_le(&dps->txbuf[4], data, len, bpw);
 
-		ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
-				dps->txbuf, (int)len+4, (void**)&rbuf, &rlen);
-		ret = dp_check_retval_sp(ret, rlen, dev, "do write", true, 1, 1, rbuf);
-
-		if (rbuf) kfree(rbuf);
+		return dp_spi_send(dps, (int)len+4, "do write", NULL, 1, bpw);
 	} else if (has_cmd(dps, DP_SPI_CMD_SPIOP)) {
 		dev_dbg(dev, "do spiop write len=0x%zx\n", len);
 
@@ -660,11 +757,7 @@ static int dp_spi_do_write(struct dp_spi *dps, const void *data, size_t len, uin
 
 		bufconv_to_le(&dps->txbuf[7], data, len, bpw);
 
-		ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
-				dps->txbuf, (int)len+7, (void**)&rbuf, &rlen);
-		ret = dp_check_retval_sp(ret, rlen, dev, "do spiop write", true, 1, 1, rbuf);
-
-		if (rbuf) kfree(rbuf);
+		return dp_spi_send(dps, (int)len+7, "do spiop write", NULL, 1, bpw);
 	} else if (has_cmd(dps, DP_SPI_CMD_SPI_RDWR)) {
 		dev_dbg(dev, "do rdwr write len=0x%zx\n", len);
 
@@ -675,23 +768,16 @@ static int dp_spi_do_write(struct dp_spi *dps, const void *data, size_t len, uin
 
 		bufconv_to_le(&dps->txbuf[4], data, len, bpw);
 
-		ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
-				dps->txbuf, (int)len+4, (void**)&rbuf, &rlen);
-		ret = dp_check_retval_sp(ret, rlen, dev, "do rdwr write", true, (int)len+1, (int)len+1, rbuf);
 		/* we just don't look at the returned bytes in this case */
-		if (rbuf) kfree(rbuf);
+		return dp_spi_send(dps, (int)len+4, "do rdwr write", NULL, (int)len+1, bpw);
 	} else {
 		return -EXDEV;
 	}
-
-	return 0;
 }
 /* should only be called if it already has the cmd anyway (cf. spi_controller->flags) */
-static int dp_spi_do_rdwr(struct dp_spi *dps, void *rdata, const void *wdata, size_t len, uint8_t bpw)
+static int dp_spi_queue_rdwr(struct dp_spi *dps, void *rdata, const void *wdata, size_t len, uint8_t bpw)
 {
 	struct device *dev = &dps->pdev->dev;
-	uint8_t *rbuf;
-	int ret, rlen;
 
 	if (len > INT_MAX-4) return -EINVAL;
 	if (!has_cmd(dps, DP_SPI_CMD_SPI_RDWR)) return -EXDEV;
@@ -705,24 +791,153 @@ static int dp_spi_do_rdwr(struct dp_spi *dps, void *rdata, const void *wdata, si
 
 	bufconv_to_le(&dps->txbuf[4], wdata, len, bpw);
 
-	ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
-			dps->txbuf, (int)len+4, (void**)&rbuf, &rlen);
-	ret = dp_check_retval_sp(ret, rlen, dev, "do rdwr", true, (int)len+1, -1, rbuf);
+	return dp_spi_send(dps, (int)len+4, "do rdwr", rdata, (int)len+1, bpw);
+}
 
-	if (!ret) bufconv_from_le(rdata, &rbuf[1], len, bpw);
+/* dual/quad data phases, only used for transfers with tx_nbits/rx_nbits > 1 */
+static int dp_spi_queue_read_wide(struct dp_spi *dps, void *data, size_t len, uint8_t nbits)
+{
+	struct device *dev = &dps->pdev->dev;
 
-	if (rbuf) kfree(rbuf);
+	if (len > INT_MAX-5) return -EINVAL;
+	if (!has_cmd(dps, DP_SPI_CMD_SPI_READ_WIDE)) return -EXDEV;
+
+	dev_dbg(dev, "do spi read x%hhu len=0x%zx\n", nbits, len);
+
+	dps->txbuf[0] = DP_SPI_CMD_SPI_READ_WIDE;
+	dps->txbuf[1] = nbits;
+	dps->txbuf[2] =  len        & 0xff;
+	dps->txbuf[3] = (len >>  8) & 0xff;
+	dps->txbuf[4] = (len >> 16) & 0xff;
+
+	return dp_spi_send(dps, 5, "do wide read", data, (int)len+1, 8);
+}
+static int dp_spi_queue_write_wide(struct dp_spi *dps, const void *data, size_t len, uint8_t nbits)
+{
+	struct device *dev = &dps->pdev->dev;
+
+	if (len > INT_MAX-5) return -EINVAL;
+	if (!has_cmd(dps, DP_SPI_CMD_SPI_WRITE_WIDE)) return -EXDEV;
+
+	dev_dbg(dev, "do spi write x%hhu len=0x%zx\n", nbits, len);
+
+	dps->txbuf[0] = DP_SPI_CMD_SPI_WRITE_WIDE;
+	dps->txbuf[1] = nbits;
+	dps->txbuf[2] =  len        & 0xff;
+	dps->txbuf[3] = (len >>  8) & 0xff;
+	dps->txbuf[4] = (len >> 16) & 0xff;
+
+	memcpy(&dps->txbuf[5], data, len);
+
+	return dp_spi_send(dps, (int)len+5, "do wide write", NULL, 1, 8);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,16,0)
+/* let the device poll the flash status register, instead of doing one USB
+ * round-trip per poll */
+static int dp_spi_mem_poll_status(struct spi_mem *mem, const struct spi_mem_op *op,
+		u16 mask, u16 match, unsigned long initial_delay_us,
+		unsigned long polling_rate_us, unsigned long timeout_ms)
+{
+	struct spi_device *spidev = mem->spi;
+	struct dp_spi *dps = spi_controller_get_devdata(spidev->controller);
+	struct device *dev = &spidev->dev;
+	uint8_t wbuf[8];
+	uint8_t *rbuf;
+	unsigned long slice;
+	int ret, rlen;
+
+	if (!has_cmd(dps, DP_SPI_CMD_SPI_POLL)) return -EOPNOTSUPP;
+
+	/* only "send opcode, read one status byte", everything else is left to
+	 * the regular spi-mem polling */
+	if (op->cmd.nbytes != 1 || op->cmd.buswidth > 1 || op->addr.nbytes
+			|| op->dummy.nbytes || op->data.dir != SPI_MEM_DATA_IN
+			|| op->data.nbytes != 1 || op->data.buswidth > 1 || mask > 0xff)
+		return -EOPNOTSUPP;
+
+	ret = dp_spi_set_flags(dps, spidev->chip_select,
+			kernmode_to_flags(dps->caps.flgcaps, spidev->mode));
+	if (!ret) ret = dp_spi_set_freq(dps, spidev->chip_select, spidev->max_speed_hz);
+	if (!ret) ret = dp_spi_set_bpw(dps, spidev->chip_select, 8);
+	if (!ret) ret = dp_spi_csmask_set_one(dps, spidev->chip_select);
+	if (ret < 0) return ret;
+
+	/* the device polls as fast as it can */
+	(void)polling_rate_us;
+	if (initial_delay_us) fsleep(initial_delay_us);
+
+	do {
+		slice = timeout_ms;
+		if (slice > DP_SPI_POLL_SLICE_MS) slice = DP_SPI_POLL_SLICE_MS;
+		timeout_ms -= slice;
+
+		dev_dbg(dev, "poll status op=%02x mask=%02x match=%02x\n",
+				op->cmd.opcode, mask, match);
+
+		wbuf[0] = DP_SPI_CMD_SPI_POLL;
+		wbuf[1] = op->cmd.opcode;
+		wbuf[2] = mask;
+		wbuf[3] = match;
+		wbuf[4] =  slice        & 0xff;
+		wbuf[5] = (slice >>  8) & 0xff;
+		wbuf[6] = (slice >> 16) & 0xff;
+		wbuf[7] = (slice >> 24) & 0xff;
+
+		ret = dp_transfer(dps->pdev, DP_CMD_MODE1_SPI, DP_XFER_FLAGS_PARSE_RESP,
+				wbuf, sizeof(wbuf), (void**)&rbuf, &rlen);
+		ret = dp_check_retval(ret, rlen, dev, "poll status", true, 2, 2);
+
+		if (!ret) {
+			*(uint8_t *)op->data.buf.in = rbuf[1];
+			/* NAK means the device timed out */
+			if (rbuf[0] != DP_SPI_ACK) ret = -ETIMEDOUT;
+		}
+		if (rbuf) kfree(rbuf);
+	} while (ret == -ETIMEDOUT && timeout_ms > 0);
 
 	return ret;
 }
 
+#endif
+
+/* the device can only do the data phase with several lines (1-1-2, 1-1-4),
+ * and only in SPI mode 0 */
+static bool dp_spi_mem_supports_op(struct spi_mem *mem, const struct spi_mem_op *op)
+{
+	if (op->cmd.buswidth > 1 || op->addr.buswidth > 1 || op->dummy.buswidth > 1)
+		return false;
+	if (op->data.buswidth > 1 && (mem->spi->mode & (SPI_CPOL | SPI_CPHA)))
+		return false;
+
+	return spi_mem_default_supports_op(mem, op);
+}
+
+static const struct spi_controller_mem_ops dp_spi_mem_ops = {
+	.supports_op = dp_spi_mem_supports_op,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,16,0)
+	.poll_status = dp_spi_mem_poll_status,
+#endif
+};
+
 static int dp_spi_prepare_message(struct spi_controller *spictl, struct spi_message *msg)
 {
 	struct dp_spi *dps = spi_controller_get_devdata(spictl);
 	struct spi_device *spidev = msg->spi;
 	struct device *dev = &spidev->dev;
+	struct spi_transfer *xfer;
 	int ret;
 
+	/* the dual/quad data phases are only implemented for SPI mode 0 */
+	if (spidev->mode & (SPI_CPOL | SPI_CPHA)) {
+		list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+			if (xfer->tx_nbits > 1 || xfer->rx_nbits > 1) {
+				dev_err(dev, "dual/quad transfers need SPI mode 0\n");
+				return -EINVAL;
+			}
+		}
+	}
+
 	ret = dp_spi_set_flags(dps, spidev->chip_select,
 			kernmode_to_flags(dps->caps.flgcaps, spidev->mode));
 	if (ret < 0) {
@@ -738,45 +953,12 @@ static int dp_spi_prepare_message(struct spi_controller *spictl, struct spi_mess
 
 	return ret;
 }
-static void dp_spi_set_cs(struct spi_device *spidev, bool enable)
-{
-	struct spi_controller *spictl = spidev->controller;
-	struct dp_spi *dps = spi_controller_get_devdata(spictl);
-	struct device *dev = &spidev->dev;
-	int ret;
-
-	ret = dp_spi_csmask_set_one(dps, spidev->chip_select);
-	if (ret < 0) {
-		dev_err(dev, "Failed to set CS mask\n");
-		return;
-	}
-
-	ret = dp_spi_cs_set(dps, spidev->chip_select, enable);
-	if (ret < 0) {
-		dev_err(dev, "Failed to set chip select line\n");
-		return;
-	}
-
-	/*return 0;*/
-}
-static int dp_spi_transfer_one(struct spi_controller *spictl, struct spi_device *spidev, struct spi_transfer *xfer)
+static int dp_spi_queue_xfer(struct dp_spi *dps, struct spi_device *spidev, struct spi_transfer *xfer)
 {
-	struct dp_spi *dps = spi_controller_get_devdata(spictl);
 	struct device *dev = &spidev->dev;
 	int ret;
 	uint32_t cksize, todo, off = 0;
-
-	ret = dp_spi_set_freq(dps, spidev->chip_select, xfer->speed_hz);
-	if (ret < 0) {
-		dev_err(dev, "Failed to set SPI frequency to %d Hz\n", xfer->speed_hz);
-		return ret;
-	}
-
-	ret = dp_spi_set_bpw(dps, spidev->chip_select, xfer->bits_per_word);
-	if (ret < 0) {
-		dev_err(dev, "Failed to set SPI bits-per-word to %d\n", xfer->bits_per_word);
-		return ret;
-	}
+	uint8_t nbits;
 
 	if (xfer->tx_buf && xfer->rx_buf) {
 		cksize = dps->wrnmaxlen;
@@ -785,24 +967,41 @@ static int dp_spi_transfer_one(struct spi_controller *spictl, struct spi_device
 		cksize = dps->wrnmaxlen;
 	} else if (xfer->rx_buf) {
 		cksize = dps->rdnmaxlen;
+		/* reads done with RDWR have to send the same amount of data */
+		if (!has_cmd(dps, DP_SPI_CMD_SPI_READ) && !has_cmd(dps, DP_SPI_CMD_SPIOP)
+				&& cksize > dps->wrnmaxlen)
+			cksize = dps->wrnmaxlen;
 	} else return -EINVAL;
 
+	/* dual/quad transfers can only be half-duplex */
+	nbits = xfer->rx_buf ? xfer->rx_nbits : xfer->tx_nbits;
+	if (xfer->tx_buf && xfer->rx_buf && (xfer->tx_nbits > 1 || xfer->rx_nbits > 1)) {
+		dev_err(dev, "full-duplex transfers need a single data line\n");
+		return -EINVAL;
+	}
+	if (nbits > 1 && xfer->bits_per_word != 8) {
+		dev_err(dev, "%d-bit words not supported with %hhu data lines\n",
+				xfer->bits_per_word, nbits);
+		return -EINVAL;
+	}
+
 	todo = xfer->len;
 	do {
 		if (todo < cksize) cksize = todo;
 
-		if (xfer->tx_buf && xfer->rx_buf) {
-			ret = dp_spi_do_rdwr(dps, xfer->rx_buf + off, xfer->tx_buf + off, cksize, xfer->bits_per_word);
+		if (nbits > 1 && xfer->rx_buf) {
+			ret = dp_spi_queue_read_wide(dps, xfer->rx_buf + off, cksize, nbits);
+		} else if (nbits > 1) {
+			ret = dp_spi_queue_write_wide(dps, xfer->tx_buf + off, cksize, nbits);
+		} else if (xfer->tx_buf && xfer->rx_buf) {
+			ret = dp_spi_queue_rdwr(dps, xfer->rx_buf + off, xfer->tx_buf + off, cksize, xfer->bits_per_word);
 		} else if (xfer->tx_buf) {
-			ret = dp_spi_do_write(dps, xfer->tx_buf + off, cksize, xfer->bits_per_word);
+			ret = dp_spi_queue_write(dps, xfer->tx_buf + off, cksize, xfer->bits_per_word);
 		} else /*if (xfer->rx_buf)*/ {
-			ret = dp_spi_do_read(dps, xfer->rx_buf + off, cksize, xfer->bits_per_word);
+			ret = dp_spi_queue_read(dps, xfer->rx_buf + off, cksize, xfer->bits_per_word);
 		}
 
-		if (ret < 0) {
-			dev_err(dev, "SPI transfer failed! %d\n", ret);
-			return ret;
-		}
+		if (ret < 0) return ret;
 
 		todo -= cksize;
 		off  += cksize;
@@ -810,6 +1009,104 @@ static int dp_spi_transfer_one(struct spi_controller *spictl, struct spi_device
 
 	return 0;
 }
+/*
+ * All requests of a message are sent out back-to-back, and the responses are
+ * collected while the device is working on the next ones. Only changes of the
+ * transfer speed or word size, and transfer delays, wait for everything
+ * before them to be done.
+ */
+static int dp_spi_transfer_one_message(struct spi_controller *spictl, struct spi_message *msg)
+{
+	struct dp_spi *dps = spi_controller_get_devdata(spictl);
+	struct spi_device *spidev = msg->spi;
+	struct device *dev = &spidev->dev;
+	struct spi_transfer *xfer;
+	int ind = spidev->chip_select, ret;
+	bool piped = false, keep_cs = false;
+
+	ret = dp_spi_csmask_set_one(dps, ind);
+	if (ret < 0) {
+		dev_err(dev, "Failed to set CS mask\n");
+		goto out;
+	}
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		/* not pipelined, so that the values applied can still be checked */
+		if (dps->devsettings[ind].freq != xfer->speed_hz
+				|| dps->devsettings[ind].bpw != xfer->bits_per_word) {
+			if (piped) {
+				piped = false;
+				ret = dp_spi_pipe_end(dps, 0);
+				if (ret < 0) goto out;
+			}
+
+			ret = dp_spi_set_freq(dps, ind, xfer->speed_hz);
+			if (ret < 0) {
+				dev_err(dev, "Failed to set SPI frequency to %d Hz\n", xfer->speed_hz);
+				goto out;
+			}
+
+			ret = dp_spi_set_bpw(dps, ind, xfer->bits_per_word);
+			if (ret < 0) {
+				dev_err(dev, "Failed to set SPI bits-per-word to %d\n", xfer->bits_per_word);
+				goto out;
+			}
+		}
+
+		if (!piped) {
+			ret = dp_pipe_begin(dps->pdev);
+			if (ret < 0) goto out;
+			piped = true;
+		}
+
+		ret = dp_spi_queue_cs(dps, ind, true);
+		if (!ret) ret = dp_spi_queue_xfer(dps, spidev, xfer);
+		if (ret < 0) goto out;
+
+		msg->actual_length += xfer->len;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+		if (xfer->delay.value) {
+			ret = dp_spi_flush(dps);
+			if (ret < 0) goto out;
+			spi_transfer_delay_exec(xfer);
+		}
+#else
+		if (xfer->delay_usecs) {
+			ret = dp_spi_flush(dps);
+			if (ret < 0) goto out;
+			udelay(xfer->delay_usecs);
+		}
+#endif
+
+		if (xfer->cs_change) {
+			if (list_is_last(&xfer->transfer_list, &msg->transfers)) {
+				keep_cs = true;
+			} else {
+				ret = dp_spi_queue_cs(dps, ind, false);
+				if (ret < 0) goto out;
+			}
+		}
+	}
+
+	if (piped && !keep_cs) ret = dp_spi_queue_cs(dps, ind, false);
+
+out:
+	if (piped) ret = dp_spi_pipe_end(dps, ret);
+
+	if (ret < 0) {
+		dev_err(dev, "SPI transfer failed! %d\n", ret);
+
+		/* no idea what state the line is in now */
+		dps->devsettings[ind].cs = 0xff;
+		dp_spi_cs_set(dps, ind, false);
+	}
+
+	msg->status = ret;
+	spi_finalize_current_message(spictl);
+
+	return ret;
+}
 
 static int dp_spi_probe(struct platform_device *pdev)
 {
@@ -843,10 +1140,17 @@ static int dp_spi_probe(struct platform_device *pdev)
 		goto err_free_ctl;
 	}
 
-	dps->txbuf = devm_kmalloc(&pdev->dev, dps->wrnmaxlen + 0x10, GFP_KERNEL);
-	if (!dps->txbuf) {
+	/* a request has to fit in one pipeline slot, with its headers */
+	if (dps->wrnmaxlen > DP_PIPE_BUFSIZE - 0x10)
+		dps->wrnmaxlen = DP_PIPE_BUFSIZE - 0x10;
+	if (dps->rdnmaxlen > DP_SPI_RXBUF_SIZE - 1)
+		dps->rdnmaxlen = DP_SPI_RXBUF_SIZE - 1;
+
+	dps->txbuf = devm_kmalloc(&pdev->dev, DP_PIPE_BUFSIZE, GFP_KERNEL);
+	dps->rxbuf = devm_kmalloc(&pdev->dev, DP_SPI_RXBUF_SIZE, GFP_KERNEL);
+	if (!dps->txbuf || !dps->rxbuf) {
 		ret = -ENOMEM;
-		dev_err(dev, "No memory left for TX buffer of length 0x%x\n", dps->wrnmaxlen);
+		dev_err(dev, "No memory left for transfer buffers\n");
 		goto err_free_ctl;
 	}
 
@@ -860,17 +1164,18 @@ static int dp_spi_probe(struct platform_device *pdev)
 	spictl->max_speed_hz = dps->caps.freq_max;
 	spictl->bits_per_word_mask = SPI_BPW_RANGE_MASK(dps->caps.min_bpw, dps->caps.max_bpw);
 	spictl->num_chipselect = dps->caps.num_cs;
-	spictl->mode_bits = devcaps_to_kernmode(dps->caps.flgcaps);
+	spictl->mode_bits = devcaps_to_kernmode(dps, dps->caps.flgcaps);
 
 	spictl->bus_num = -1;
 	spictl->prepare_message = dp_spi_prepare_message;
-	spictl->transfer_one = dp_spi_transfer_one;
-	spictl->set_cs = dp_spi_set_cs;
+	spictl->transfer_one_message = dp_spi_transfer_one_message;
 
 	spictl->flags = 0;
 	if (!has_cmd(dps, DP_SPI_CMD_SPI_RDWR))
 		spictl->flags |= SPI_CONTROLLER_HALF_DUPLEX;
 
+	spictl->mem_ops = &dp_spi_mem_ops;
+
 	pm_runtime_set_autosuspend_delay(dev, DP_PINST_AUTOSUSPEND_TIMEOUT);
 	pm_runtime_use_autosuspend(dev);
 	pm_runtime_set_active(dev);
@@ -1,8 +1,16 @@
 #!/usr/bin/env python3
 
+# Xilinx Virtual Cable (XVC 1.0) server for a Dragon Probe. By default, the
+# shift commands are forwarded as-is to the probe's XVC interface, which
+# shifts them through the PIO and returns TDO in one go. With --cmsis-dap, any
+# CMSIS-DAP probe can be used instead, at the cost of a CMSIS-DAP round-trip
+# per 64 bits of constant TMS.
+
 import argparse
 import socket
 import struct
+import threading
+import time
 
 from typing import *
 
@@ -37,7 +45,7 @@ def dap_split_jseq(nbits: int, tms: bytes, tdi: bytes) -> List[JtagSeq]:
         return (l[byteind] >> bitind) & 1
 
     if nbits == 1:
-        return [JtagSeq(nbits=1, tms=bitat(tms, 0), tdi=bitat(tdi, 1))]
+        return [JtagSeq(nbits=1, tms=bitat(tms, 0), tdi=bitat(tdi, 0))]
 
     res = []
 
@@ -65,24 +73,185 @@ def dap_split_jseq(nbits: int, tms: bytes, tdi: bytes) -> List[JtagSeq]:
     return res
 
 
-def get_dap(serial: Optional[str]) -> Any:  #DAPAccess:
-    import pyocd.probe.pydapaccess as pydap
+class XvcNative:
+    """The probe's own XVC interface, see src/m_default/dap_xvc.h"""
+
+    _SUBCLASS = ord('D')
+    _PROTOCOL = ord('X')
+
+    CMD_INFO   = 0x00
+    CMD_SETTCK = 0x01
+    CMD_SHIFT  = 0x02
+
+    REQ_RESET  = 0x58
+
+    # the probe handles any length, this only limits what is buffered here
+    MAX_VECTOR_LEN = 32768
+
+    def __init__(self, vidpid: str):
+        import usb, usb.core, usb.util
+
+        vid, pid = (int(x, 16) for x in vidpid.split(':'))
+        dev = usb.core.find(idVendor=vid, idProduct=pid)
+        if dev is None:
+            raise Exception("No device %04x:%04x found" % (vid, pid))
+
+        cfg = dev.get_active_configuration()
+        itf = [i for i in cfg.interfaces()
+               if i.bInterfaceClass == usb.CLASS_VENDOR_SPEC and
+                  i.bInterfaceSubClass == XvcNative._SUBCLASS and
+                  i.bInterfaceProtocol == XvcNative._PROTOCOL]
+        if len(itf) != 1:
+            raise Exception("No XVC interface found, wrong mode?")
+        itf = itf[0]
+
+        self.epout = usb.util.find_descriptor(itf, custom_match =
+            lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+        self.epin  = usb.util.find_descriptor(itf, custom_match =
+            lambda e: usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_IN)
 
-    if serial is not None:
+        # a previous session may have been cut off in the middle of a shift:
+        # get the probe out of it, and throw away the TDO it still had queued
+        dev.ctrl_transfer(usb.util.build_request_type(usb.util.CTRL_OUT,
+                usb.util.CTRL_TYPE_VENDOR, usb.util.CTRL_RECIPIENT_INTERFACE),
+            XvcNative.REQ_RESET, 0, itf.bInterfaceNumber)
         try:
-            return pydap.DAPAccess.get_device(serial)
-        except Exception:# as e:
-            raise Exception("Could not find CMSIS-DAP device %s" % serial)
-    else:
-        devs = pydap.DAPAccess.get_connected_devices()
-        if len(devs) == 1:
-            return devs[0]
-        elif len(devs) == 0:
-            raise Exception("No CMSIS-DAP devices found.")
+            while True:
+                self.epin.read(self.epin.wMaxPacketSize, timeout=50)
+        except usb.core.USBTimeoutError:
+            pass
+
+        self.epout.write(bytes([XvcNative.CMD_INFO]))
+        self.chunk = struct.unpack('<I', self._read(4))[0]
+        # a period of 0 keeps the clock, and tells what it is
+        self.settck(0)
+
+    def _timeout(self, nbits: int) -> int:
+        # in ms: twice the time the bits take at the current TCK, plus a
+        # second for USB and everything else
+        return 1000 + 2 * nbits * self.period // 1000000
+
+    def _read(self, n: int, timeout: int = 1000,
+              failed: Optional[List[BaseException]] = None) -> bytes:
+        import usb.core
+
+        # wait at most a second at a time, so that a writer that gave up is
+        # noticed before the whole timeout has passed
+        deadline = time.monotonic() + timeout / 1000
+        r = bytearray()
+        while len(r) < n:
+            if failed: raise failed[0]
+
+            left = int((deadline - time.monotonic()) * 1000)
+            try:
+                r += self.epin.read(n - len(r), timeout=max(1, min(left, 1000)))
+            except usb.core.USBTimeoutError:
+                if left <= 1000: raise
+        return bytes(r)
+
+    def close(self):
+        pass
+
+    def settck(self, period: int) -> int:
+        self.epout.write(struct.pack('<BI', XvcNative.CMD_SETTCK, period))
+        self.period = struct.unpack('<I', self._read(4))[0]
+        return self.period
+
+    def shift(self, nbits: int, tms: bytes, tdi: bytes) -> bytes:
+        nbytes = (nbits + 7) // 8
+
+        cmd = bytearray(struct.pack('<BI', XvcNative.CMD_SHIFT, nbits))
+        for off in range(0, nbytes, self.chunk):
+            cmd += tms[off:off+self.chunk]
+            cmd += tdi[off:off+self.chunk]
+
+        # the probe only takes in the next chunk once the TDO of the previous
+        # one has been read out, so both directions have to run at once, and
+        # both take as long as the shift itself
+        timeout = self._timeout(nbits)
+        failed: List[BaseException] = []
+
+        def write():
+            try:
+                self.epout.write(cmd, timeout=timeout)
+            except BaseException as e:
+                failed.append(e)
+
+        wr = threading.Thread(target=write)
+        wr.start()
+        try:
+            tdo = self._read(nbytes, timeout, failed)
+        finally:
+            wr.join()
+            # a failed write is why the read didn't get anything
+            if failed: raise failed[0]
+        return tdo
+
+
+class XvcCmsisDap:
+    """Any CMSIS-DAP probe, through pyocd"""
+
+    # pydapaccess can only do JTAG sequences in chunks of 64 bits, so the
+    # splitting and combining is done here
+    MAX_VECTOR_LEN = 2048*8
+
+    def __init__(self, serial: Optional[str], irlen: Optional[List[int]]):
+        import pyocd.probe.pydapaccess as pydap
+
+        if serial is not None:
+            try:
+                self.dap = pydap.DAPAccess.get_device(serial)
+            except Exception:# as e:
+                raise Exception("Could not find CMSIS-DAP device %s" % serial)
         else:
-            raise Exception("Multiple CMSIS-DAP devices found, please specify"+\
-                            " a serial number to connect to a specific one. "+\
-                            "Devices found: %s" % ', '.join(d.unique_id for d in devs))
+            devs = pydap.DAPAccess.get_connected_devices()
+            if len(devs) == 1:
+                self.dap = devs[0]
+            elif len(devs) == 0:
+                raise Exception("No CMSIS-DAP devices found.")
+            else:
+                raise Exception("Multiple CMSIS-DAP devices found, please specify"+\
+                                " a serial number to connect to a specific one. "+\
+                                "Devices found: %s" % ', '.join(d.unique_id for d in devs))
+
+        self.dap.open()
+        self.dap.connect()
+        self.dap.configure_jtag(irlen)
+
+    def close(self):
+        self.dap.close()
+
+    def settck(self, period: int) -> int:
+        # CMSIS-DAP's clock setting is only a hint for JTAG sequences, so
+        # don't do much...
+        self.dap.set_clock(50*1000) # 50 kHz for now
+        return period
+
+    def shift(self, nbits: int, tms: bytes, tdi: bytes) -> bytes:
+        # a CMSIS-DAP JTAG sequence has the following constraints:
+        # * max block length is 64 bits (8 bytes)
+        # * TMS must be constant over a single JTAG sequence
+        #
+        # so we now have to split the received bits into sequences usable for
+        # CMSIS-DAP
+        ntdo = 0
+        tdov = 0
+        for seq in dap_split_jseq(nbits, tms, tdi):
+            rv = self.dap.jtag_sequence(cycles=seq.nbits, tms=seq.tms, read_tdo=True, tdi=seq.tdi)
+            tdov |= rv << ntdo
+            ntdo += seq.nbits
+
+        assert ntdo == nbits
+        return bigint2bytes(nbits, tdov)
+
+
+def xvc_recv(f, n: int) -> bytes:
+    r = bytearray()
+    while len(r) < n:
+        bv = f.recv(n - len(r))
+        if len(bv) == 0: raise EndOfStreamException()
+        r += bv
+    return bytes(r)
 
 
 def xvc_read_cmd(f) -> bytes:
@@ -97,79 +266,39 @@ def xvc_read_cmd(f) -> bytes:
             r += bv
 
 
-def xvc_do_cmd(cmd: bytes, f, dap):
+def xvc_do_cmd(cmd: bytes, f, cable, verbose: bool):
     if cmd == b"getinfo":
-        # parameter is max vector len (in bits)
-        # we use some value here (2k should be good enough), though in reality
-        # we'll handle pretty much anything. except, pydapaccess can only do
-        # JTAG sequences in chunks of 64 bits, which is a bit small (and would
-        # cause some network overhead), so we'll do the splitting and combining
-        # ourselves.
+        # parameter is the max vector length (in bytes), longer shifts are
+        # split up by the XVC client.
         # we only support v1.0, because CMSIS-DAP itself doesn't know much
         # about memory address spaces, so we're just not going to bother here.
-        # we could technically use the rest of pyocd, but, meh
-        f.send(b'xvcServer_v1.0:%d\n' % (2048*8))
-        pass
+        f.send(b'xvcServer_v1.0:%d\n' % cable.MAX_VECTOR_LEN)
     elif cmd == b"settck":
-        inv = f.recv(4)
-        if len(inv) < 3: raise EndOfStreamException()
-
-        freq_wanted = struct.unpack('<I', inv)[0]
-        print("settck comand for %d ns" % freq_wanted)
-        dap.set_clock(50*1000) # 50 kHz for now
-        # not supported by CMSIS-DAP, so don't do much...
-        #f.send(b'\0\0\0\0')  #f.write(struct.pack('<I', 0))
-        f.send(inv)
+        period = struct.unpack('<I', xvc_recv(f, 4))[0]
+        actual = cable.settck(period)
+        if verbose: print("settck: %d ns -> %d ns" % (period, actual))
+        f.send(struct.pack('<I', actual))
     elif cmd == b"shift":
-        inv = f.recv(4)
-        if len(inv) < 3: raise EndOfStreamException()
-
-        nbits = struct.unpack('<I', inv)[0]
+        nbits = struct.unpack('<I', xvc_recv(f, 4))[0]
         nbytes = (nbits + 7) // 8
+        if verbose: print("shift: 0x%x bits (0x%x bytes)" % (nbits, nbytes))
 
-        print("shift command: 0x%x bits (0x%x bytes)" % (nbits, nbytes))
-
+        tmsbytes = xvc_recv(f, nbytes)
+        tdibytes = xvc_recv(f, nbytes)
         if nbytes == 0: return
 
-        tmsbytes = f.recv(nbytes)
-        if len(tmsbytes) < nbytes: raise EndOfStreamException()
-        tdibytes = f.recv(nbytes)
-        if len(tdibytes) < nbytes: raise EndOfStreamException()
-
-        #print("tms:", tmsbytes)
-        #print("tdi:", tdibytes)
-
-        # a CMSIS-DAP JTAG sequence has the following constraints:
-        # * max block length is 64 bits (8 bytes)
-        # * TMS must be constant over a single JTAG sequence
-        #
-        # so we now have to split the received bits into sequences usable for
-        # CMSIS-DAP
-        splitres = dap_split_jseq(nbits, tmsbytes, tdibytes)
-        print("split result:", splitres)
-
-        ntdo = 0
-        tdov = 0
-        for seq in splitres:
-            rv = dap.jtag_sequence(cycles=seq.nbits, tms=seq.tms, read_tdo=True, tdi=seq.tdi)
-            print("rv:", rv)
-            tdov |= rv << ntdo
-            ntdo += seq.nbits
-
-        assert ntdo == nbits
-        f.send(bigint2bytes(nbits, tdov))  # write zeros
+        f.sendall(cable.shift(nbits, tmsbytes, tdibytes))
     else:
         print("Unknown command!", cmd)
 
 
 def xvc2dap_do(args: Any) -> int:
-    dap = get_dap(args.serial)
-    dap.open()
-    try:
-        dap.connect()
-
-        dap.configure_jtag(args.irlen)
+    if args.cmsis_dap:
+        cable = XvcCmsisDap(args.serial, args.irlen)
+    else:
+        cable = XvcNative(args.dev)
 
+    try:
         with socket.socket() as sock:
             sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
             sock.bind((args.address, args.port))
@@ -179,37 +308,46 @@ def xvc2dap_do(args: Any) -> int:
             while True:
                 print("waiting for conn")
                 f, addr = sock.accept()
+                f.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
                 print("got conn!", addr)
 
                 try:
                     while True:
                         cmd = xvc_read_cmd(f)
-                        print("cmd:", cmd)
+                        if args.verbose: print("cmd:", cmd)
 
-                        xvc_do_cmd(cmd, f, dap)
+                        xvc_do_cmd(cmd, f, cable, args.verbose)
                 except EndOfStreamException:
                     pass # continue to next iteration
+                finally:
+                    f.close()
     finally:
-        dap.close()
+        cable.close()
 
 
 def main() -> int:
-    try:
-        import pyocd.probe.pydapaccess
-    except ImportError:
-        print("WARNING: pyocd module not found (not installed?), xvc2dap.py "+\
-              "will not work.")
-
     parser = argparse.ArgumentParser()
 
+    parser.add_argument('--dev', type=str, default="cafe:1312",
+                        help="USB VID:PID of the device, default cafe:1312")
+    parser.add_argument('--cmsis-dap', default=False, action='store_true',
+                        help="Use plain CMSIS-DAP JTAG sequences (through "+\
+                        "pyocd) instead of the probe's XVC interface. Slower, "+\
+                        "but works with any CMSIS-DAP probe.")
+
     parser.add_argument('--serial', type=str, default=None,
-                        help="Connect to the CMSIS-DAP device with the "+\
-                        "specified serial number, defaults to the first device found.")
+                        help="With --cmsis-dap: connect to the CMSIS-DAP device "+\
+                        "with the specified serial number, defaults to the "+\
+                        "first device found.")
 
     parser.add_argument('--irlen', type=int, default=None, nargs='+',
-                        help="devices and IRLEN configuration, defaults to "+\
-                             "CMSIS-DAP-specific value (usually 1 dev, irlen "+\
-                             "4). Use multiple --irlen args for multiple devices.")
+                        help="With --cmsis-dap: devices and IRLEN "+\
+                             "configuration, defaults to CMSIS-DAP-specific "+\
+                             "value (usually 1 dev, irlen 4). Use multiple "+\
+                             "--irlen args for multiple devices.")
+
+    parser.add_argument('--verbose', default=False, action='store_true',
+                        help="Print every XVC command")
 
     parser.add_argument('address', type=str, default='localhost', nargs='?',
                         help="Host to bind to, for the XVC server, default "+\
@@ -218,6 +356,14 @@ def main() -> int:
                         help="Port to bind to, for the XVC server, default 2542")
 
     args = parser.parse_args()
+
+    if args.cmsis_dap:
+        try:
+            import pyocd.probe.pydapaccess
+        except ImportError:
+            print("WARNING: pyocd module not found (not installed?), "+\
+                  "--cmsis-dap will not work.")
+
     return xvc2dap_do(args)
 
 
@@ -228,4 +374,3 @@ if __name__ == '__main__':
         import traceback
         traceback.print_exc()
         exit(1)
-
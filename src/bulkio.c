@@ -0,0 +1,158 @@
+// vim: set et:
+
+#include <string.h>
+
+#include <tusb.h>
+
+#include "bulkio.h"
+#include "thread.h"
+
+#if CFG_TUD_CDC > 0
+const struct bulkio_ops bulkio_cdc_ops = {
+    .ready           = tud_cdc_n_connected,
+    .available       = tud_cdc_n_available,
+    .read            = tud_cdc_n_read,
+    .write_available = tud_cdc_n_write_available,
+    .write           = tud_cdc_n_write,
+    .flush           = tud_cdc_n_write_flush,
+};
+#endif
+#if CFG_TUD_VENDOR > 0
+const struct bulkio_ops bulkio_vendor_ops = {
+    .ready           = tud_vendor_n_mounted,
+    .available       = tud_vendor_n_available,
+    .read            = tud_vendor_n_read,
+    .write_available = tud_vendor_n_write_available,
+    .write           = tud_vendor_n_write,
+    .flush           = NULL, // written data is sent out immediately
+};
+#endif
+
+void bulkio_init(struct bulkio* io, const struct bulkio_ops* ops, uint8_t itf,
+        void* rxbuf, uint32_t rxsize, void* txbuf, uint32_t txsize) {
+    io->ops = ops;
+    io->itf = itf;
+
+    io->rxbuf   = rxbuf;
+    io->rxsize  = rxsize;
+    io->rxpos   = 0;
+    io->rxavail = 0;
+    io->txbuf   = txbuf;
+    io->txsize  = txsize;
+    io->txpos   = 0;
+}
+
+// read at most len bytes directly from the USB stack, waiting until there
+// is at least one
+static uint32_t rx_some(struct bulkio* io, void* dst, uint32_t len) {
+    while (true) {
+        if (io->ops->ready(io->itf) && io->ops->available(io->itf)) {
+            uint32_t n = io->ops->read(io->itf, dst, len);
+            if (n != 0) return n;
+        }
+
+        thread_yield();
+    }
+}
+
+uint8_t bulkio_read_byte(struct bulkio* io) {
+    if (io->rxavail == 0) {
+        io->rxpos   = 0;
+        io->rxavail = rx_some(io, io->rxbuf, io->rxsize);
+    }
+
+    uint8_t rv = io->rxbuf[io->rxpos];
+    ++io->rxpos;
+    --io->rxavail;
+
+    return rv;
+}
+
+void bulkio_read(struct bulkio* io, void* dst, uint32_t len) {
+    uint8_t* d = dst;
+
+    // whatever is still buffered comes first
+    uint32_t n = (io->rxavail < len) ? io->rxavail : len;
+    memcpy(d, &io->rxbuf[io->rxpos], n);
+    io->rxpos   += n;
+    io->rxavail -= n;
+    d   += n;
+    len -= n;
+
+    while (len > 0) {
+        n = rx_some(io, d, len);
+        d   += n;
+        len -= n;
+    }
+}
+
+void bulkio_skip(struct bulkio* io, uint32_t len) {
+    uint32_t n = (io->rxavail < len) ? io->rxavail : len;
+    io->rxpos   += n;
+    io->rxavail -= n;
+    len -= n;
+
+    while (len > 0) {
+        n = rx_some(io, io->rxbuf, (len < io->rxsize) ? len : io->rxsize);
+        len -= n;
+    }
+}
+
+void bulkio_drop_incoming(struct bulkio* io) {
+    io->rxavail = 0;
+    io->rxpos   = 0;
+
+    // empty tinyusb internal buffer
+    if (io->ops->ready(io->itf)) {
+        while (io->ops->available(io->itf)) {
+            io->ops->read(io->itf, io->rxbuf, io->rxsize);
+        }
+    }
+}
+
+// hand all of src to the USB stack, waiting for room if needed
+static void tx_all(struct bulkio* io, const uint8_t* src, uint32_t len) {
+    while (len > 0) {
+        uint32_t space = io->ops->write_available(io->itf);
+
+        if (space == 0) {
+            if (io->ops->flush) io->ops->flush(io->itf);
+            thread_yield();
+            continue;
+        }
+
+        uint32_t n = io->ops->write(io->itf, src, (len < space) ? len : space);
+        src += n;
+        len -= n;
+    }
+}
+
+void bulkio_write_byte(struct bulkio* io, uint8_t v) {
+    if (io->txpos == io->txsize) {
+        tx_all(io, io->txbuf, io->txpos);
+        io->txpos = 0;
+    }
+
+    io->txbuf[io->txpos] = v;
+    ++io->txpos;
+}
+
+void bulkio_write(struct bulkio* io, const void* src, uint32_t len) {
+    // small writes are gathered, larger ones go to the USB stack directly
+    if (io->txpos + len <= io->txsize) {
+        memcpy(&io->txbuf[io->txpos], src, len);
+        io->txpos += len;
+        return;
+    }
+
+    tx_all(io, io->txbuf, io->txpos);
+    io->txpos = 0;
+    tx_all(io, src, len);
+}
+
+void bulkio_flush(struct bulkio* io) {
+    tx_all(io, io->txbuf, io->txpos);
+    io->txpos = 0;
+
+    if (io->ops->flush) io->ops->flush(io->itf);
+}
@@ -0,0 +1,54 @@
+// vim: set et:
+
+#ifndef BULKIO_H_
+#define BULKIO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Blocking reader/writer on top of a TinyUSB CDC or vendor interface, for
+ * protocol handlers running in their own thread. Waiting for data (or for
+ * room to send it) yields the thread.
+ *
+ * Single bytes go through a small buffer, so parsing command headers byte by
+ * byte stays cheap. Payloads should use bulkio_read and bulkio_write: they
+ * only copy what is still buffered, and move the rest directly between the
+ * caller's buffer and the USB stack's FIFO, in FIFO-sized blocks.
+ */
+struct bulkio_ops {
+    bool     (*ready)(uint8_t itf); // connected/mounted
+    uint32_t (*available)(uint8_t itf);
+    uint32_t (*read)(uint8_t itf, void* buf, uint32_t len);
+    uint32_t (*write_available)(uint8_t itf);
+    uint32_t (*write)(uint8_t itf, const void* buf, uint32_t len);
+    uint32_t (*flush)(uint8_t itf); // may be NULL
+};
+
+extern const struct bulkio_ops bulkio_cdc_ops, bulkio_vendor_ops;
+
+struct bulkio {
+    const struct bulkio_ops* ops;
+    uint8_t itf;
+
+    uint8_t* rxbuf;
+    uint32_t rxsize, rxpos, rxavail;
+    uint8_t* txbuf;
+    uint32_t txsize, txpos;
+};
+
+void bulkio_init(struct bulkio* io, const struct bulkio_ops* ops, uint8_t itf,
+        void* rxbuf, uint32_t rxsize, void* txbuf, uint32_t txsize);
+
+uint8_t bulkio_read_byte(struct bulkio* io);
+void    bulkio_read(struct bulkio* io, void* dst, uint32_t len);
+// skip len incoming bytes
+void    bulkio_skip(struct bulkio* io, uint32_t len);
+// drop everything that has been received and not read yet
+void    bulkio_drop_incoming(struct bulkio* io);
+
+void bulkio_write_byte(struct bulkio* io, uint8_t v);
+void bulkio_write(struct bulkio* io, const void* src, uint32_t len);
+void bulkio_flush(struct bulkio* io);
+
+#endif
@@ -12,6 +12,10 @@
 /* CMSIS-DAP */
 #include "DAP_config.h" /* ARM code *assumes* this is included prior to DAP.h */
 #include "DAP.h"
+#include "m_default/dap_queue.h"
+#include "m_default/dap_sample.h"
+#include "m_default/dap_swo_stream.h"
+#include "m_default/dap_xvc.h"
 /* I2C */
 #include "m_default/i2ctinyusb.h"
 /* CDC UART */
@@ -30,6 +34,7 @@ enum m_default_cmds {
     mdef_cmd_i2c,
     mdef_cmd_tempsense,
     mdef_cmd_uart_flowcnt,
+    mdef_cmd_dap_stats,
 };
 enum m_default_feature {
     mdef_feat_uart      = 1<<0,
@@ -78,7 +83,8 @@ static void enter_cb(void) {
 #endif
     vnd_cfg_set_itf_num(VND_N_CFG);
 
-    // TODO: CMSISDAP?
+    dap_queue_reset();
+    dap_sample_stop();
 #ifdef DBOARD_HAS_I2C
     i2ctu_init();
 #endif
@@ -93,6 +99,7 @@ static void enter_cb(void) {
 }
 static void leave_cb(void) {
     // TODO: CMSISDAP?
+    dap_sample_stop();
 #ifdef DBOARD_HAS_I2C
     i2ctu_deinit();
 #endif
@@ -104,41 +111,6 @@ static void leave_cb(void) {
 #endif
 }
 
-void dap_do_bulk_stuff(int itf) {
-    // FIXME: move to a separate file, maybe
-    /*static*/ uint8_t rx_buf[DAP_PACKET_SIZE];
-    /*static*/ uint8_t tx_buf[DAP_PACKET_SIZE];
-    //static uint32_t rxpos = 0;
-    const uint32_t rxpos=0;
-
-    if (tud_vendor_n_mounted(itf) && tud_vendor_n_available(itf)) {
-        memset(rx_buf, 0, DAP_PACKET_SIZE);
-        uint32_t avail = tud_vendor_n_read(itf, &rx_buf[rxpos], sizeof rx_buf - rxpos);
-        uint32_t pos2 = rxpos + avail;
-
-        if (avail) {
-            memset(tx_buf, 0, DAP_PACKET_SIZE);
-            uint32_t res = DAP_ExecuteCommand(&rx_buf[rxpos], tx_buf);
-
-            uint16_t respcount = (uint16_t)res,
-                     reqcount = (uint16_t)(res>>16);
-            //printf("avail=%04lx resp=%04x req=%04x rxpos=%lx\n", avail, respcount, reqcount, rxpos);
-
-            if (reqcount > pos2) { // command requires more data than available, so, welp
-                tx_buf[0] = rx_buf[0]; // something
-                tx_buf[1] = 0xff;
-                tud_vendor_n_write(itf, tx_buf, 2);
-                //rxpos=0;//pos2;
-            } else {
-                tud_vendor_n_write(itf, tx_buf, respcount);
-                //memmove(rx_buf, &rx_buf[rxpos+reqcount], DAP_PACKET_SIZE - reqcount);
-                //rxpos = 0;
-            }
-            //printf("->rxpos=%lx\n", rxpos);
-        }
-    }
-}
-
 static void task_cb(void) {
 #ifdef DBOARD_HAS_UART
     tud_task();
@@ -150,10 +122,19 @@ static void task_cb(void) {
 #endif
 
     dap_do_bulk_stuff(VND_N_CMSISDAP);
+#ifdef DBOARD_HAS_CMSISDAP
+    dap_sample_task(VND_N_DAPSAMPLE);
+    dap_swo_stream_task(VND_N_DAPSWO);
+    dap_xvc_task(VND_N_DAPXVC);
+#endif
 }
 
 static void handle_cmd_cb(uint8_t cmd) {
     uint8_t resp = 0;
+#ifdef DBOARD_HAS_CMSISDAP
+    struct dap_stats st;
+    uint8_t stats[24];
+#endif
 
     switch (cmd) {
     case mode_cmd_get_features:
@@ -209,6 +190,22 @@ static void handle_cmd_cb(uint8_t cmd) {
         }
 #else
         vnd_cfg_write_str(cfg_resp_illcmd, "UART not implemented on this device");
+#endif
+        break;
+    case mdef_cmd_dap_stats:
+#ifdef DBOARD_HAS_CMSISDAP
+        // argument: reset the statistics after reading them if nonzero
+        dap_queue_get_stats(&st, vnd_cfg_read_byte() != 0);
+        for (size_t i = 0; i < 4; ++i) {
+            stats[i +  0] = (st.commands   >> (i * 8)) & 0xff;
+            stats[i +  4] = (st.transfers  >> (i * 8)) & 0xff;
+            stats[i + 16] = (st.max_cycles >> (i * 8)) & 0xff;
+            stats[i + 20] = (st.clock_hz   >> (i * 8)) & 0xff;
+        }
+        for (size_t i = 0; i < 8; ++i) stats[i + 8] = (st.cycles >> (i * 8)) & 0xff;
+        vnd_cfg_write_resp(cfg_resp_ok, sizeof stats, stats);
+#else
+        vnd_cfg_write_str(cfg_resp_illcmd, "CMSIS-DAP not implemented on this device");
 #endif
         break;
     default:
@@ -232,6 +229,9 @@ enum {
     STRID_IF_VND_CFG,
     STRID_IF_HID_CMSISDAP,
     STRID_IF_VND_CMSISDAP,
+    STRID_IF_VND_DAPSAMPLE,
+    STRID_IF_VND_DAPSWO,
+    STRID_IF_VND_DAPXVC,
     STRID_IF_VND_I2CTINYUSB,
     STRID_IF_CDC_UART,
     STRID_IF_CDC_SERPROG,
@@ -244,6 +244,11 @@ enum {
 #if CFG_TUD_VENDOR > 0
     ITF_NUM_VND_CFG,
 #endif
+#ifdef DBOARD_HAS_CMSISDAP
+    ITF_NUM_VND_DAPSAMPLE,
+    ITF_NUM_VND_DAPSWO,
+    ITF_NUM_VND_DAPXVC,
+#endif
 #if defined(DBOARD_HAS_I2C) && defined(MODE_ENABLE_I2CTINYUSB)
     ITF_NUM_VND_I2CTINYUSB,
 #endif
@@ -275,6 +280,9 @@ enum {
         + TUD_I2CTINYUSB_LEN
 #endif
 #ifdef DBOARD_HAS_CMSISDAP
+        + TUD_VENDOR_DESC_LEN
+        + TUD_VENDOR_DESC_LEN
+        + TUD_VENDOR_DESC_LEN
         + TUD_VENDOR_DESC_LEN
         + TUD_HID_INOUT_DESC_LEN
 #endif
@@ -303,6 +311,12 @@ enum {
 #define EPNUM_CDC_STDIO_OUT     0x08/*-1*/
 #define EPNUM_CDC_STDIO_IN      0x88/*-1*/
 #define EPNUM_CDC_STDIO_NOTIF   0x89/*-1*/
+#define EPNUM_VND_DAPSAMPLE_OUT 0x0a/*-1*/
+#define EPNUM_VND_DAPSAMPLE_IN  0x8a/*-1*/
+#define EPNUM_VND_DAPSWO_OUT    0x0b/*-1*/
+#define EPNUM_VND_DAPSWO_IN     0x8b/*-1*/
+#define EPNUM_VND_DAPXVC_OUT    0x0c/*-1*/
+#define EPNUM_VND_DAPXVC_IN     0x8c/*-1*/
 
 // clang-format off
 #if CFG_TUD_HID > 0
@@ -325,6 +339,15 @@ static const uint8_t desc_configuration[] = {
         EPNUM_VND_CFG_IN, CFG_TUD_VENDOR_RX_BUFSIZE, VND_CFG_SUBCLASS, VND_CFG_PROTOCOL),
 #endif
 
+#ifdef DBOARD_HAS_CMSISDAP
+    TUD_VENDOR_DESCRIPTOR_EX(ITF_NUM_VND_DAPSAMPLE, STRID_IF_VND_DAPSAMPLE, EPNUM_VND_DAPSAMPLE_OUT,
+        EPNUM_VND_DAPSAMPLE_IN, CFG_TUD_VENDOR_RX_BUFSIZE, DAP_SAMPLE_SUBCLASS, DAP_SAMPLE_PROTOCOL),
+    TUD_VENDOR_DESCRIPTOR_EX(ITF_NUM_VND_DAPSWO, STRID_IF_VND_DAPSWO, EPNUM_VND_DAPSWO_OUT,
+        EPNUM_VND_DAPSWO_IN, CFG_TUD_VENDOR_RX_BUFSIZE, DAP_SWO_SUBCLASS, DAP_SWO_PROTOCOL),
+    TUD_VENDOR_DESCRIPTOR_EX(ITF_NUM_VND_DAPXVC, STRID_IF_VND_DAPXVC, EPNUM_VND_DAPXVC_OUT,
+        EPNUM_VND_DAPXVC_IN, CFG_TUD_VENDOR_RX_BUFSIZE, DAP_XVC_SUBCLASS, DAP_XVC_PROTOCOL),
+#endif
+
 #if defined(DBOARD_HAS_I2C) && defined(MODE_ENABLE_I2CTINYUSB)
     TUD_I2CTINYUSB_DESCRIPTOR(ITF_NUM_VND_I2CTINYUSB, STRID_IF_VND_I2CTINYUSB),
 #endif
@@ -364,6 +387,9 @@ static const char* string_desc_arr[] = {
     [STRID_IF_VND_CFG  ]      = "Device cfg/ctl interface",
     [STRID_IF_HID_CMSISDAP]   = "CMSIS-DAP HID interface",
     [STRID_IF_VND_CMSISDAP]   = "CMSIS-DAP bulk interface",
+    [STRID_IF_VND_DAPSAMPLE]  = "Debug sampler interface",
+    [STRID_IF_VND_DAPSWO]     = "SWO trace stream interface",
+    [STRID_IF_VND_DAPXVC]     = "Xilinx Virtual Cable interface",
     [STRID_IF_VND_I2CTINYUSB] = "I2C-Tiny-USB interface",
     [STRID_IF_CDC_UART]       = "UART CDC interface",
     [STRID_IF_CDC_SERPROG]    = "Serprog CDC interface",
@@ -393,17 +419,12 @@ static const uint8_t* my_hid_descriptor_report_cb(uint8_t instance) {
 
 static void my_hid_set_report_cb(uint8_t instance, uint8_t report_id,
         hid_report_type_t report_type, uint8_t const* rx_buffer, uint16_t bufsize) {
-    static uint8_t tx_buffer[CFG_TUD_HID_EP_BUFSIZE];
-    uint32_t       response_size = TU_MIN(CFG_TUD_HID_EP_BUFSIZE, bufsize);
-
     (void)instance;
     (void)report_id;
     (void)report_type;
 
-    memset(tx_buffer, 0, CFG_TUD_HID_EP_BUFSIZE);
-    DAP_ProcessCommand(rx_buffer, tx_buffer);
-
-    tud_hid_report(0, tx_buffer, response_size);
+    // executed and answered from the task callback
+    dap_queue_hid_report(rx_buffer, bufsize);
 }
 #endif
 
@@ -429,13 +450,29 @@ static void my_cdc_line_coding_cb(uint8_t itf, cdc_line_coding_t const* line_cod
 }
 #endif
 
-#if defined(DBOARD_HAS_I2C) && defined(MODE_ENABLE_I2CTINYUSB)
-static bool my_vendor_control_xfer_cb(uint8_t rhport, uint8_t ep_addr,
+static bool my_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage,
         tusb_control_request_t const* req) {
-    return i2ctu_ctl_req(rhport, ep_addr, req);
-}
+#ifdef DBOARD_HAS_CMSISDAP
+    if (req->bmRequestType_bit.type == TUSB_REQ_TYPE_VENDOR &&
+            req->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE &&
+            req->bRequest == DAP_XVC_REQ_RESET && req->wIndex == ITF_NUM_VND_DAPXVC) {
+        if (stage != CONTROL_STAGE_SETUP) return true;
+
+        dap_xvc_reset(VND_N_DAPXVC);
+        return tud_control_status(rhport, req);
+    }
 #endif
 
+#if defined(DBOARD_HAS_I2C) && defined(MODE_ENABLE_I2CTINYUSB)
+    return i2ctu_ctl_req(rhport, stage, req);
+#else
+    (void)rhport;
+    (void)stage;
+    (void)req;
+    return false;
+#endif
+}
+
 extern struct mode m_01_default;
 // clang-format off
 struct mode m_01_default = {
@@ -463,9 +500,7 @@ struct mode m_01_default = {
     .tud_cdc_line_coding_cb = my_cdc_line_coding_cb,
 #endif
 
-#if defined(DBOARD_HAS_I2C) && defined(MODE_ENABLE_I2CTINYUSB)
-    .tud_vendor_control_xfer_cb = i2ctu_ctl_req,
-#endif
+    .tud_vendor_control_xfer_cb = my_vendor_control_xfer_cb,
 };
 // clang-format on
 
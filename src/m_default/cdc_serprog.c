@@ -9,6 +9,7 @@
 
 #ifdef DBOARD_HAS_SPI
 
+#include "bulkio.h"
 #include "info.h"
 #include "util.h"
 #include "thread.h"
@@ -27,30 +28,45 @@ static const uint8_t serprog_cmdmap[32] = {
     0,         // 30..37
     0,         // 38..3f
     0xff,      // cmd 40..47
+    0x0f,      // cmd 48..4b
     0,         // rest is 0
 };
 // clang-format on
 static const char serprog_pgmname[16] = INFO_PRODUCT_BARE;
 
+// max. length of a read command, much larger than the buffers, as the data
+// is streamed out while it is read
+#define SP_SPI_RDNMAXLEN 0x10000
+// SPI transfers are done in chunks of this size, double-buffered
+#define SP_SPI_CHUNK 512
+
+// SPI NOR flash commands used by S_CMD_SPI_WRPOLL
+#define SP_FLASH_WREN   0x06
+#define SP_FLASH_RDSR   0x05
+#define SP_FLASH_SR_WIP 0x01
+
 static uint8_t rx_buf[CFG_TUD_CDC_RX_BUFSIZE];
 static uint8_t tx_buf[CFG_TUD_CDC_TX_BUFSIZE];
+static uint8_t io_txbuf[64]; // only for gathering small writes
+static uint8_t spi_buf[2][SP_SPI_CHUNK];
 
-static uint32_t rxavail, rxpos;
+static struct bulkio sp_io;
 static uint8_t selchip;
+static uint8_t spi_bpw;
 
 void cdc_serprog_init(void) {
-    rxavail = 0;
-    rxpos   = 0;
+    bulkio_init(&sp_io, &bulkio_cdc_ops, CDC_N_SERPROG, rx_buf, sizeof rx_buf,
+            io_txbuf, sizeof io_txbuf);
     selchip = 1;
+    spi_bpw = 8;
 
     sp_spi_init();
 }
 void cdc_serprog_deinit(void) {
     sp_spi_deinit();
 
-    rxavail = 0;
-    rxpos   = 0;
     selchip = 1;
+    spi_bpw = 8;
 }
 
 __attribute__((__const__))
@@ -58,32 +74,83 @@ uint32_t sp_spi_get_buf_limit(void) {
     return sizeof(rx_buf) - 1;
 }
 
-// TODO: this is duplicated several times over the codebase, maybe reduce this
-static uint8_t read_byte_cdc(void) {
-    while (rxavail <= 0) {
-        if (!tud_cdc_n_connected(CDC_N_SERPROG) || !tud_cdc_n_available(CDC_N_SERPROG)) {
-            thread_yield();
-            continue;
-        }
+static uint32_t read_u32(struct bulkio* io) {
+    uint32_t v;
+
+    // clang-format off
+    v  = (uint32_t)bulkio_read_byte(io);
+    v |= (uint32_t)bulkio_read_byte(io) << 8;
+    v |= (uint32_t)bulkio_read_byte(io) << 16;
+    v |= (uint32_t)bulkio_read_byte(io) << 24;
+    // clang-format on
+
+    return v;
+}
+static uint32_t read_u24(struct bulkio* io) {
+    uint32_t v;
+
+    // clang-format off
+    v  = (uint32_t)bulkio_read_byte(io);
+    v |= (uint32_t)bulkio_read_byte(io) << 8;
+    v |= (uint32_t)bulkio_read_byte(io) << 16;
+    // clang-format on
+
+    return v;
+}
+
+// write slen bytes from the host to SPI. the next batch is received while the
+// previous one is still being sent out over SPI. returns the index of the
+// spi_buf that is not in use by the still ongoing transfer.
+static uint32_t write_stream(struct bulkio* io, uint32_t slen) {
+    uint32_t cur = 0;
+
+    while (slen > 0) {
+        size_t this_batch = SP_SPI_CHUNK;
+        if (this_batch > slen) this_batch = slen;
+
+        bulkio_read(io, spi_buf[cur], this_batch);
+        sp_spi_op_start(this_batch, NULL, spi_buf[cur]);
+        cur ^= 1;
 
-        rxpos   = 0;
-        rxavail = tud_cdc_n_read(CDC_N_SERPROG, rx_buf, sizeof rx_buf);
+        slen -= this_batch;
+    }
+
+    return cur;
+}
 
-        if (rxavail == 0) thread_yield();
+// send op, read one status byte, until (status & mask) == match
+static bool flash_poll(uint8_t op, uint8_t mask, uint8_t match, uint32_t timeout_ms,
+        uint8_t* status) {
+    // the op and status are single bytes, which aren't clocked out as words
+    // of any other size
+    if (spi_bpw != 8) {
+        *status = 0;
+        return false;
     }
 
-    uint8_t rv = rx_buf[rxpos];
-    ++rxpos;
-    --rxavail;
-    return rv;
+    sp_spi_timer_start(timeout_ms);
+
+    while (true) {
+        sp_spi_op_begin(selchip);
+        sp_spi_op_write(1, &op);
+        sp_spi_op_read(1, status);
+        sp_spi_op_end(selchip);
+
+        if ((*status & mask) == match) return true;
+        if (sp_spi_timer_reached()) return false;
+
+        // let the other interfaces do their thing in the meantime
+        thread_yield();
+    }
 }
 
 static uint32_t nresp = 0;
-static void handle_cmd(uint8_t cmd, uint8_t ud, uint8_t (*read_byte)(void),
-        uint32_t (*writepkt)(uint8_t ud, const void* buf, uint32_t len),
-        uint32_t (*flushpkt)(uint8_t ud),
+// set when the command isn't known, so the length of its arguments isn't either
+static bool unknown_cmd = false;
+static void handle_cmd(uint8_t cmd, struct bulkio* io,
         void (*writehdr)(enum cfg_resp stat, uint32_t len, const void* data)) {
     nresp = 0;
+    unknown_cmd = false;
 
     switch (cmd) {
         case S_CMD_NOP:
@@ -131,7 +198,7 @@ static void handle_cmd(uint8_t cmd, uint8_t ud, uint8_t (*read_byte)(void),
             nresp     = 4;
             break;
         case S_CMD_Q_RDNMAXLEN:
-            nresp = sp_spi_get_buf_limit();
+            nresp = SP_SPI_RDNMAXLEN;
             tx_buf[0] = S_ACK;
             tx_buf[1] = nresp & 0xff;
             tx_buf[2] = (nresp >> 8) & 0xff;
@@ -139,7 +206,7 @@ static void handle_cmd(uint8_t cmd, uint8_t ud, uint8_t (*read_byte)(void),
             nresp     = 4;
             break;
         case S_CMD_S_BUSTYPE:
-            if (read_byte() /* bus type to set */ == (1 << 3)) {
+            if (bulkio_read_byte(io) /* bus type to set */ == (1 << 3)) {
                 tx_buf[0] = S_ACK;
             } else {
                 tx_buf[0] = S_NAK;
@@ -148,14 +215,7 @@ static void handle_cmd(uint8_t cmd, uint8_t ud, uint8_t (*read_byte)(void),
             break;
 
         case S_CMD_S_SPI_FREQ: {
-            uint32_t freq;
-            // clang-format off
-            freq  = (uint32_t)read_byte();
-            freq |= (uint32_t)read_byte() << 8;
-            freq |= (uint32_t)read_byte() << 16;
-            freq |= (uint32_t)read_byte() << 24;
-            // clang-format on
-
+            uint32_t freq = read_u32(io);
             uint32_t nfreq = sp_spi_set_freq(freq);
 
             tx_buf[0] = S_ACK;
@@ -167,7 +227,7 @@ static void handle_cmd(uint8_t cmd, uint8_t ud, uint8_t (*read_byte)(void),
         } break;
         case S_CMD_S_PINSTATE:
             // that's not what this command is supposed to do, so, aaa
-            /*if (read_byte() == 0)
+            /*if (bulkio_read_byte(io) == 0)
                 sp_spi_cs_deselect(selchip);
             else
                 sp_spi_cs_select(selchip);*/
@@ -196,12 +256,12 @@ static void handle_cmd(uint8_t cmd, uint8_t ud, uint8_t (*read_byte)(void),
             nresp     = 14;
             } break;
         case S_CMD_S_SPI_CHIPN:
-            selchip   = read_byte();
+            selchip   = bulkio_read_byte(io);
             tx_buf[0] = S_ACK;
             nresp     = 1;
             break;
         case S_CMD_S_SPI_SETCS:
-            if (read_byte() == 0)
+            if (bulkio_read_byte(io) == 0)
                 sp_spi_cs_deselect(selchip);
             else
                 sp_spi_cs_select(selchip);
@@ -211,158 +271,214 @@ static void handle_cmd(uint8_t cmd, uint8_t ud, uint8_t (*read_byte)(void),
         break;
         case S_CMD_S_SPI_FLAGS:
             tx_buf[0] = S_ACK;
-            tx_buf[1] = sp_spi_set_flags(read_byte());
-            nresp     = 1;
+            tx_buf[1] = sp_spi_set_flags(bulkio_read_byte(io));
+            nresp     = 2;
             break;
         case S_CMD_S_SPI_BPW:
             tx_buf[0] = S_ACK;
-            tx_buf[1] = sp_spi_set_bpw(read_byte());
-            nresp     = 1;
+            tx_buf[1] = spi_bpw = sp_spi_set_bpw(bulkio_read_byte(io));
+            nresp     = 2;
             break;
 
         case S_CMD_SPIOP: case S_CMD_SPI_READ: case S_CMD_SPI_WRITE: {
             uint32_t slen = 0, rlen = 0;
 
-            // clang-format off
-            if (cmd == S_CMD_SPIOP || cmd == S_CMD_SPI_WRITE) {
-                slen  = (uint32_t)read_byte();
-                slen |= (uint32_t)read_byte() << 8;
-                slen |= (uint32_t)read_byte() << 16;
-            }
-            if (cmd == S_CMD_SPIOP || cmd == S_CMD_SPI_READ) {
-                rlen  = (uint32_t)read_byte();
-                rlen |= (uint32_t)read_byte() << 8;
-                rlen |= (uint32_t)read_byte() << 16;
-            }
-            // clang-format on
+            if (cmd == S_CMD_SPIOP || cmd == S_CMD_SPI_WRITE) slen = read_u24(io);
+            if (cmd == S_CMD_SPIOP || cmd == S_CMD_SPI_READ ) rlen = read_u24(io);
 
             if (writehdr)
                 writehdr(cfg_resp_ok, rlen+1, NULL);
 
             sp_spi_op_begin(selchip);
             size_t this_batch;
+            uint32_t cur = 0;
 
             // 1. write slen data bytes
-            // we're going to use the tx buf for all operations here
-            if (cmd == S_CMD_SPIOP || cmd == S_CMD_SPI_WRITE) {
-                while (slen > 0) {
-                    this_batch = sizeof(tx_buf);
-                    if (this_batch > slen) this_batch = slen;
-
-                    for (size_t i = 0; i < this_batch; ++i) tx_buf[i] = read_byte();
-                    sp_spi_op_write(this_batch, tx_buf);
-
-                    slen -= this_batch;
-                }
-            }
+            if (cmd == S_CMD_SPIOP || cmd == S_CMD_SPI_WRITE)
+                cur = write_stream(io, slen);
 
             // 2. read data
-            // first, do a batch of 63, because we also need to send an ACK byte
+            // the next batch is read over SPI while the previous one is being
+            // sent to the host
             if (cmd == S_CMD_SPIOP || cmd == S_CMD_SPI_READ) {
-                this_batch = sizeof(tx_buf) - 1;
+                bulkio_write_byte(io, S_ACK);
+
+                this_batch = SP_SPI_CHUNK;
                 if (this_batch > rlen) this_batch = rlen;
-                sp_spi_op_read(this_batch, &tx_buf[1]);
-                tx_buf[0] = S_ACK;
-                writepkt(ud, tx_buf, this_batch + 1);
-                rlen -= this_batch;
+                sp_spi_op_start(this_batch, spi_buf[cur], NULL);
 
-                // now do in batches of 64
                 while (rlen > 0) {
-                    this_batch = sizeof(tx_buf);
-                    if (this_batch > rlen) this_batch = rlen;
+                    const uint8_t* done = spi_buf[cur];
+                    size_t ndone = this_batch;
 
-                    sp_spi_op_read(this_batch, tx_buf);
-                    writepkt(ud, tx_buf, this_batch);
+                    sp_spi_op_wait();
+                    rlen -= ndone;
+                    cur ^= 1;
 
-                    rlen -= this_batch;
+                    if (rlen > 0) {
+                        this_batch = SP_SPI_CHUNK;
+                        if (this_batch > rlen) this_batch = rlen;
+                        sp_spi_op_start(this_batch, spi_buf[cur], NULL);
+                    }
+
+                    bulkio_write(io, done, ndone);
                 }
-                flushpkt(ud);
+                bulkio_flush(io);
             }
 
             // that's it!
             sp_spi_op_end(selchip);
+
+            // plain writes are acknowledged once the data is out, so that the
+            // host can queue up more requests behind them
+            if (cmd == S_CMD_SPI_WRITE) {
+                bulkio_write_byte(io, S_ACK);
+                bulkio_flush(io);
+            }
             nresp = 0;  // we sent our own response manually
             } break;
         case S_CMD_SPI_RDWR: {
-            uint32_t len;
+            uint32_t len = read_u24(io);
 
-            // clang-format off
-            len  = (uint32_t)read_byte();
-            len |= (uint32_t)read_byte() << 8;
-            len |= (uint32_t)read_byte() << 16;
-            // clang-format on
+            if (writehdr)
+                writehdr(cfg_resp_ok, len+1, NULL);
 
             sp_spi_op_begin(selchip);
             size_t this_batch;
 
-            // first, do a batch of 63, because we also need to send an ACK byte
-            this_batch = sizeof(tx_buf) - 1;
-            if (this_batch > len) this_batch = len;
-            for (size_t i = 0; i < this_batch; ++i) rx_buf[i] = read_byte();
-            sp_spi_op_read_write(this_batch, &tx_buf[1], rx_buf);
-            tx_buf[0] = S_ACK;
-            writepkt(ud, tx_buf, this_batch + 1);
-            len -= this_batch;
+            bulkio_write_byte(io, S_ACK);
 
-            // now do in batches of 64
             while (len > 0) {
-                this_batch = sizeof(tx_buf);
+                this_batch = SP_SPI_CHUNK;
                 if (this_batch > len) this_batch = len;
 
-                for (size_t i = 0; i < this_batch; ++i) rx_buf[i] = read_byte();
-                sp_spi_op_read_write(this_batch, tx_buf, rx_buf);
-                writepkt(ud, tx_buf, this_batch);
+                bulkio_read(io, spi_buf[0], this_batch);
+                sp_spi_op_read_write(this_batch, spi_buf[1], spi_buf[0]);
+                bulkio_write(io, spi_buf[1], this_batch);
 
                 len -= this_batch;
             }
+            bulkio_flush(io);
 
             sp_spi_op_end(selchip);
             } break;
+        case S_CMD_SPI_READ_WIDE: case S_CMD_SPI_WRITE_WIDE: {
+            uint8_t width = bulkio_read_byte(io);
+            uint32_t len  = read_u24(io);
+
+            if (!sp_spi_wide_ok(width)) {
+                if (cmd == S_CMD_SPI_WRITE_WIDE) bulkio_skip(io, len);
+
+                tx_buf[0] = S_NAK;
+                nresp     = 1;
+                break;
+            }
+
+            if (writehdr)
+                writehdr(cfg_resp_ok, (cmd == S_CMD_SPI_READ_WIDE) ? (len+1) : 1, NULL);
+
+            sp_spi_op_begin(selchip);
+            size_t this_batch;
+
+            // the PIO is fed by the CPU, so there's no overlap with USB here
+            if (cmd == S_CMD_SPI_READ_WIDE) {
+                bulkio_write_byte(io, S_ACK);
+
+                while (len > 0) {
+                    this_batch = SP_SPI_CHUNK;
+                    if (this_batch > len) this_batch = len;
+
+                    sp_spi_op_read_wide(this_batch, spi_buf[0], width);
+                    bulkio_write(io, spi_buf[0], this_batch);
+
+                    len -= this_batch;
+                }
+            } else {
+                while (len > 0) {
+                    this_batch = SP_SPI_CHUNK;
+                    if (this_batch > len) this_batch = len;
+
+                    bulkio_read(io, spi_buf[0], this_batch);
+                    sp_spi_op_write_wide(this_batch, spi_buf[0], width);
+
+                    len -= this_batch;
+                }
+
+                bulkio_write_byte(io, S_ACK);
+            }
+            bulkio_flush(io);
+
+            sp_spi_op_end(selchip);
+            nresp = 0;  // we sent our own response manually
+            } break;
+        case S_CMD_SPI_WRPOLL: {
+            uint32_t timeout = read_u32(io);
+            uint32_t slen = read_u24(io);
+            uint8_t op = SP_FLASH_WREN, status = 0;
+            bool done = false;
+
+            if (writehdr)
+                writehdr(cfg_resp_ok, 2, NULL);
+
+            if (spi_bpw == 8) {
+                sp_spi_op_begin(selchip);
+                sp_spi_op_write(1, &op);
+                sp_spi_op_end(selchip);
+
+                sp_spi_op_begin(selchip);
+                write_stream(io, slen);
+                sp_spi_op_end(selchip);
+
+                done = flash_poll(SP_FLASH_RDSR, SP_FLASH_SR_WIP, 0, timeout, &status);
+            } else {
+                // don't send a program command in words it wasn't meant for
+                bulkio_skip(io, slen);
+            }
+
+            bulkio_write_byte(io, done ? S_ACK : S_NAK);
+            bulkio_write_byte(io, status);
+            bulkio_flush(io);
+            nresp = 0;  // we sent our own response manually
+            } break;
+        case S_CMD_SPI_POLL: {
+            uint8_t op    = bulkio_read_byte(io);
+            uint8_t mask  = bulkio_read_byte(io);
+            uint8_t match = bulkio_read_byte(io);
+            uint32_t timeout = read_u32(io);
+
+            tx_buf[0] = flash_poll(op, mask, match, timeout, &tx_buf[1]) ? S_ACK : S_NAK;
+            nresp     = 2;
+            } break;
 
         default:
             tx_buf[0] = S_NAK;
             nresp     = 1;
+            unknown_cmd = true;
             break;
     }
 }
 
 void cdc_serprog_task(void) {
-    uint8_t cmd = read_byte_cdc();
-    handle_cmd(cmd, CDC_N_SERPROG, read_byte_cdc,
-            tud_cdc_n_write, tud_cdc_n_write_flush, NULL);
+    uint8_t cmd = bulkio_read_byte(&sp_io);
+    handle_cmd(cmd, &sp_io, NULL);
 
     if (nresp > 0) {
-        tud_cdc_n_write(CDC_N_SERPROG, tx_buf, nresp);
-        tud_cdc_n_write_flush(CDC_N_SERPROG);
+        bulkio_write(&sp_io, tx_buf, nresp);
+        bulkio_flush(&sp_io);
     }
 }
 
-
-static uint32_t vnd_writepkt(uint8_t ud, const void* buf, uint32_t len) {
-    (void)ud;
-
-    for (size_t i = 0; i < len; ++i) vnd_cfg_write_byte(((const uint8_t*)buf)[i]);
-
-    return len;
-}
-static uint32_t vnd_flushpkt(uint8_t ud) {
-    (void)ud;
-
-    vnd_cfg_write_flush();
-
-    return 0;
-}
 void sp_spi_bulk_cmd(void) {
     uint8_t cmd = vnd_cfg_read_byte();
-    handle_cmd(cmd, VND_N_CFG, vnd_cfg_read_byte, vnd_writepkt, vnd_flushpkt,
-            vnd_cfg_write_resp);
-
-    if (nresp > 0) {
-        enum cfg_resp stat = cfg_resp_ok;
-        if (nresp == 1 && tx_buf[0] == S_NAK) // invalid cmd
-            stat = cfg_resp_illcmd;
-
-        vnd_cfg_write_resp(stat, nresp, tx_buf);
+    handle_cmd(cmd, vnd_cfg_get_io(), vnd_cfg_write_resp_no_drop);
+
+    if (unknown_cmd) {
+        // can't tell where the next request starts, so drop what's queued up
+        vnd_cfg_write_resp(cfg_resp_illcmd, nresp, tx_buf);
+    } else if (nresp > 0) {
+        // the request has been read in full, even when it's NAKed, so the
+        // ones pipelined after it are still good
+        vnd_cfg_write_resp_no_drop(cfg_resp_ok, nresp, tx_buf);
     } else {
         // hanlded using the writehdr callback
     }
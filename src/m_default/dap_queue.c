@@ -0,0 +1,320 @@
+// vim: set et:
+
+#include <string.h>
+
+#include <tusb.h>
+
+#include "DAP_config.h" /* ARM code *assumes* this is included prior to DAP.h */
+#include "DAP.h"
+
+#include "m_default/dap_queue.h"
+#include "m_default/dap_sample.h"
+
+#if (DAP_PACKET_COUNT & (DAP_PACKET_COUNT - 1)) != 0
+#error "DAP_PACKET_COUNT must be a power of two"
+#endif
+
+struct dap_packet {
+    uint8_t  req[DAP_PACKET_SIZE];
+    uint8_t  resp[DAP_PACKET_SIZE];
+    uint16_t req_len;
+    uint16_t resp_len;
+    uint16_t resp_pos; // bytes of the response already handed to the FIFO
+    bool     hid;  // came in through (and goes back out over) HID
+};
+
+// size of a single USB packet on the bulk endpoints
+#define DAP_BULK_EP_SIZE CFG_TUD_VENDOR_RX_BUFSIZE
+
+#if (DAP_PACKET_SIZE % DAP_BULK_EP_SIZE) != 0
+#error "DAP_PACKET_SIZE must be a multiple of the bulk endpoint size"
+#endif
+
+/* slots go through three stages: received (up to 'head'), executed (up to
+ * 'exec'), and sent (up to 'tail'). the counters wrap, only their
+ * differences matter */
+static struct dap_packet dap_q[DAP_PACKET_COUNT];
+static uint8_t dap_head, dap_exec, dap_tail;
+// bytes of the bulk request currently being assembled in the 'head' slot
+static uint16_t dap_rx_len;
+// bytes of the current USB transfer, and whether the rest of it is dropped
+static uint16_t dap_rx_xfer;
+static bool dap_rx_skip;
+
+static struct dap_stats dap_st;
+
+void dap_queue_reset(void) {
+    dap_head = dap_exec = dap_tail = 0;
+    dap_rx_len = 0;
+    dap_rx_xfer = 0;
+    dap_rx_skip = false;
+}
+
+static struct dap_packet* dap_queue_slot(uint8_t i) {
+    return &dap_q[i % DAP_PACKET_COUNT];
+}
+static bool dap_queue_full(void) {
+    return (uint8_t)(dap_head - dap_tail) >= DAP_PACKET_COUNT;
+}
+
+void dap_queue_hid_report(uint8_t const* buf, uint16_t bufsize) {
+    // the host shouldn't send more than DAP_PACKET_COUNT packets at once,
+    // nor use both interfaces at the same time
+    if (dap_queue_full() || dap_rx_len) return;
+
+    struct dap_packet* p = dap_queue_slot(dap_head);
+    if (bufsize > CFG_TUD_HID_EP_BUFSIZE) bufsize = CFG_TUD_HID_EP_BUFSIZE;
+
+    memset(p->req, 0, sizeof p->req);
+    memcpy(p->req, buf, bufsize);
+    p->req_len = bufsize;
+    p->hid     = true;
+    ++dap_head;
+}
+
+// dap_request_len() of a command whose length isn't known
+#define DAP_REQ_BAD 0xffffffffu
+
+/* total length of the request in req, or 0 if more of it is needed to tell.
+ * bulk transfers don't end with a short packet when their length is a
+ * multiple of the endpoint size (and hosts don't send a ZLP), so this is how
+ * the end of a request that spans several USB packets is found. */
+static uint32_t dap_request_len(uint8_t const* req, uint32_t len) {
+    uint32_t pos, n, i, l;
+
+    if (len < 1) return 0;
+
+    switch (req[0]) {
+    case ID_DAP_Disconnect:
+    case ID_DAP_TransferAbort:
+    case ID_DAP_ResetTarget:
+    case ID_DAP_SWO_Status:
+    case ID_DAP_UART_Status:
+        return 1;
+    case ID_DAP_Info:
+    case ID_DAP_Connect:
+    case ID_DAP_SWD_Configure:
+    case ID_DAP_JTAG_IDCODE:
+    case ID_DAP_SWO_Transport:
+    case ID_DAP_SWO_Mode:
+    case ID_DAP_SWO_Control:
+    case ID_DAP_SWO_ExtendedStatus:
+    case ID_DAP_UART_Transport:
+    case ID_DAP_UART_Control:
+        return 2;
+    case ID_DAP_HostStatus:
+    case ID_DAP_Delay:
+    case ID_DAP_SWO_Data:
+        return 3;
+    case ID_DAP_SWJ_Clock:
+    case ID_DAP_SWO_Baudrate:
+        return 5;
+    case ID_DAP_TransferConfigure:
+    case ID_DAP_WriteABORT:
+    case ID_DAP_UART_Configure:
+        return 6;
+    case ID_DAP_SWJ_Pins:
+        return 7;
+
+    case ID_DAP_SWJ_Sequence:
+        if (len < 2) return 0;
+        n = req[1] ? req[1] : 256;
+        return 2 + (n + 7) / 8;
+    case ID_DAP_JTAG_Configure:
+        if (len < 2) return 0;
+        return 2 + req[1];
+    case ID_DAP_UART_Transfer:
+        if (len < 5) return 0;
+        return 5 + (req[3] | ((uint32_t)req[4] << 8));
+
+    case ID_DAP_Transfer:
+        if (len < 3) return 0;
+        for (i = 0, pos = 3; i < req[2]; ++i) {
+            if (pos >= len) return 0;
+            // writes and value matches carry a data word
+            if (!(req[pos] & DAP_TRANSFER_RnW) || (req[pos] & DAP_TRANSFER_MATCH_VALUE))
+                pos += 4;
+            ++pos;
+        }
+        return pos;
+    case ID_DAP_TransferBlock:
+        if (len < 5) return 0;
+        if (req[4] & DAP_TRANSFER_RnW) return 5;
+        return 5 + 4 * (req[2] | ((uint32_t)req[3] << 8));
+
+    case ID_DAP_SWD_Sequence:
+    case ID_DAP_JTAG_Sequence:
+        if (len < 2) return 0;
+        for (i = 0, pos = 2; i < req[1]; ++i) {
+            if (pos >= len) return 0;
+            n = req[pos] & 0x3f;
+            if (!n) n = 64;
+            // SWD input sequences carry no data
+            if (req[0] == ID_DAP_JTAG_Sequence || !(req[pos] & SWD_SEQUENCE_DIN))
+                pos += (n + 7) / 8;
+            ++pos;
+        }
+        return pos;
+
+    case ID_DAP_ExecuteCommands:
+        if (len < 2) return 0;
+        for (i = 0, pos = 2; i < req[1]; ++i) {
+            l = dap_request_len(&req[pos], pos < len ? (len - pos) : 0);
+            if (!l || l == DAP_REQ_BAD) return l;
+            pos += l;
+        }
+        return pos;
+
+    default: // none of the vendor commands are implemented either
+        return DAP_REQ_BAD;
+    }
+}
+
+static void dap_queue_rx(int itf) {
+    if (dap_queue_full()) return;
+
+    struct dap_packet* p = dap_queue_slot(dap_head);
+
+    while (tud_vendor_n_available(itf)) {
+        if (!dap_rx_len) memset(p->req, 0, sizeof p->req);
+
+        // the vendor RX FIFO is as large as the endpoint, so it holds exactly
+        // one USB packet at a time. a request can span several of them.
+        uint32_t n = tud_vendor_n_read(itf, &p->req[dap_rx_len], DAP_BULK_EP_SIZE);
+        if (!n) break;
+        // a transfer ends at a short packet, or at DAP_PACKET_SIZE bytes
+        dap_rx_xfer += n;
+        bool xfer_end = n < DAP_BULK_EP_SIZE || dap_rx_xfer >= DAP_PACKET_SIZE;
+
+        // hosts that pad their requests to the packet size send the padding in
+        // the same transfer. it would otherwise run as more commands (zeros
+        // as DAP_Info), and answering those desyncs the host. a full packet
+        // of zeros can't start a request either, DAP_Info needs an ID.
+        bool padding = dap_rx_skip;
+        if (!dap_rx_len && n == DAP_BULK_EP_SIZE) {
+            padding = true;
+            for (uint32_t i = 0; i < n && padding; ++i) padding = !p->req[i];
+        }
+        if (padding) {
+            dap_rx_skip = !xfer_end;
+            if (xfer_end) dap_rx_xfer = 0;
+            continue;
+        }
+        dap_rx_len += n;
+
+        uint32_t want = dap_request_len(p->req, dap_rx_len);
+        // unknown commands, and ones that don't fit in a packet
+        bool bad = want == DAP_REQ_BAD || want > DAP_PACKET_SIZE
+                || (!want && dap_rx_len >= DAP_PACKET_SIZE);
+        if (!bad && !xfer_end && !(want && want <= dap_rx_len)) continue;
+
+        if (bad) { // answered with ID_DAP_Invalid
+            p->req[0]  = ID_DAP_Invalid;
+            p->req_len = 1;
+        } else {
+            p->req_len = dap_rx_len;
+        }
+        p->resp_pos = 0;
+        p->hid      = false;
+        ++dap_head;
+
+        // anything after the request, up to the end of the transfer, is padding
+        dap_rx_skip = !xfer_end && (bad || want < dap_rx_len);
+        if (!dap_rx_skip) dap_rx_xfer = 0;
+        dap_rx_len = 0;
+        break;
+    }
+}
+
+static void dap_queue_execute(void) {
+    if (dap_exec == dap_head) return;
+
+    struct dap_packet* p = dap_queue_slot(dap_exec);
+
+    dap_sample_release();
+
+    memset(p->resp, 0, sizeof p->resp);
+    uint32_t t0  = DAP_CYCLES_GET();
+    uint32_t res = DAP_ExecuteCommand(p->req, p->resp);
+    // the counter wraps quickly (2^24 cycles on the RP2040), but that's long
+    // enough for anything but transfers waiting on a slow target
+    uint32_t dt  = (DAP_CYCLES_GET() - t0) & DAP_CYCLES_MASK;
+
+    ++dap_st.commands;
+    dap_st.cycles += dt;
+    if (dt > dap_st.max_cycles) dap_st.max_cycles = dt;
+    if (p->resp[0] == ID_DAP_Transfer) dap_st.transfers += p->resp[1];
+    else if (p->resp[0] == ID_DAP_TransferBlock)
+        dap_st.transfers += p->resp[1] | ((uint32_t)p->resp[2] << 8);
+
+    uint16_t respcount = (uint16_t)res,
+             reqcount  = (uint16_t)(res >> 16);
+
+    if (reqcount > p->req_len) { // command requires more data than available, so, welp
+        p->resp[0]  = p->req[0]; // something
+        p->resp[1]  = DAP_ERROR;
+        p->resp_len = 2;
+    } else {
+        p->resp_len = respcount;
+    }
+
+    if (p->hid) {
+        // HID reports stay at their endpoint size, unlike bulk packets
+        if (p->req[0] == ID_DAP_Info && p->req[1] == DAP_ID_PACKET_SIZE) {
+            p->resp[2] = (uint8_t)(CFG_TUD_HID_EP_BUFSIZE >> 0);
+            p->resp[3] = (uint8_t)(CFG_TUD_HID_EP_BUFSIZE >> 8);
+        }
+    } else if (p->resp_len < DAP_PACKET_SIZE && !(p->resp_len % DAP_BULK_EP_SIZE)) {
+        // the host reads DAP_PACKET_SIZE bytes, which only ends early at a
+        // short packet, so add a padding byte instead of relying on a ZLP
+        ++p->resp_len;
+    }
+
+    ++dap_exec;
+}
+
+void dap_queue_get_stats(struct dap_stats* st, bool reset) {
+    *st = dap_st;
+    st->clock_hz = DAP_CYCLES_CLOCK();
+    if (reset) memset(&dap_st, 0, sizeof dap_st);
+}
+
+static void dap_queue_tx(int itf) {
+    if (dap_tail == dap_exec) return;
+
+    struct dap_packet* p = dap_queue_slot(dap_tail);
+
+    if (p->hid) {
+#if CFG_TUD_HID > 0
+        if (!tud_hid_ready()) return;
+
+        tud_hid_report(0, p->resp, CFG_TUD_HID_EP_BUFSIZE);
+#endif
+    } else {
+        if (!tud_vendor_n_mounted(itf)) return;
+
+        uint32_t avail = tud_vendor_n_write_available(itf);
+        // only start a response once the previous one has left the FIFO,
+        // otherwise both could end up in a single USB packet
+        if (!p->resp_pos && avail < CFG_TUD_VENDOR_TX_BUFSIZE) return;
+
+        // also, only the last packet of a response may be a short one
+        uint32_t left = p->resp_len - p->resp_pos;
+        if (avail < left && avail < DAP_BULK_EP_SIZE) return;
+        if (avail > left) avail = left;
+
+        p->resp_pos += tud_vendor_n_write(itf, &p->resp[p->resp_pos], avail);
+        if (p->resp_pos < p->resp_len) return;
+    }
+
+    ++dap_tail;
+}
+
+void dap_do_bulk_stuff(int itf) {
+    if (tud_vendor_n_mounted(itf)) dap_queue_rx(itf);
+
+    // execute the next request while the previous response is being sent
+    dap_queue_execute();
+    dap_queue_tx(itf);
+}
+
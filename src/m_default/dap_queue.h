@@ -0,0 +1,37 @@
+// vim: set et:
+
+#ifndef DAP_QUEUE_H_
+#define DAP_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* CMSIS-DAP request queue, shared by the HID and the bulk interface. Up to
+ * DAP_PACKET_COUNT requests can be in flight: a request is executed as soon
+ * as it comes in, while the responses to earlier ones are still being sent
+ * out, so the host can keep the link busy instead of waiting for a full
+ * round-trip per packet. */
+
+void dap_queue_reset(void);
+
+// enqueue a request that came in through the HID interface
+void dap_queue_hid_report(uint8_t const* buf, uint16_t bufsize);
+
+// receive requests from the bulk interface, execute them, and send out the
+// responses. call this from the mode's task callback.
+void dap_do_bulk_stuff(int itf);
+
+/* execution time statistics of the DAP commands, to measure the probe-side
+ * overhead per command and per SWD/JTAG transfer */
+struct dap_stats {
+    uint32_t commands;  // commands executed
+    uint32_t transfers; // transfers done by DAP_Transfer and DAP_TransferBlock
+    uint64_t cycles;    // clk_sys cycles spent executing commands
+    uint32_t max_cycles;
+    uint32_t clock_hz;  // frequency of the cycle counter
+};
+
+void dap_queue_get_stats(struct dap_stats* st, bool reset);
+
+#endif
+
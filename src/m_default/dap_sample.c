@@ -0,0 +1,230 @@
+// vim: set et:
+
+#include <string.h>
+
+#include <tusb.h>
+
+#include "DAP_config.h" /* ARM code *assumes* this is included prior to DAP.h */
+#include "DAP.h"
+
+#include "spsc.h"
+#include "m_default/dap_sample.h"
+
+// SWD transfer requests for the registers used
+#define REQ_DP_SELECT  (0x08u)
+#define REQ_DP_RDBUFF  (DAP_TRANSFER_RnW | 0x0Cu)
+#define REQ_AP_CSW     (DAP_TRANSFER_APnDP | 0x00u)
+#define REQ_AP_TAR     (DAP_TRANSFER_APnDP | 0x04u)
+#define REQ_AP_CSW_RD  (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | 0x00u)
+#define REQ_AP_TAR_RD  (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | 0x04u)
+#define REQ_AP_DRW_RD  (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | 0x0Cu)
+
+#define CSW_ADDRINC_MASK 0x30u
+
+#define REC_HDR_LEN 8
+
+static struct {
+    uint32_t interval, select, csw;
+    uint32_t addr[DAP_SAMPLE_MAX_ADDR];
+    uint8_t  naddr;
+    bool     running;
+
+    bool     owned;       // SELECT and CSW are set up for sampling
+    bool     host_saved;  // the host's CSW and TAR have been read back
+    bool     tar_valid;   // TAR still points to addr[0]
+    uint32_t host_select, host_csw, host_tar;
+    uint32_t next;        // timestamp of the next round
+    uint16_t lost;
+} smp;
+
+static uint8_t     smp_buf[2048];
+static struct spsc smp_q;
+
+// a single transfer, retried on WAIT like DAP_Transfer does
+static uint8_t dap_sample_xfer(uint32_t request, uint32_t* data) {
+    uint32_t retry = DAP_Data.transfer.retry_count;
+    uint8_t  ack;
+
+    do {
+        ack = SWD_Transfer(request, data);
+    } while (ack == DAP_TRANSFER_WAIT && retry-- && !DAP_TransferAbort);
+
+    return ack;
+}
+
+void dap_sample_release(void) {
+    uint32_t data;
+
+    if (!smp.owned) return;
+    smp.owned = false;
+    if (DAP_Data.debug_port != DAP_PORT_SWD) return;
+
+    // nothing to be done about it if these fail, the host will find out
+    if (smp.host_saved) {
+        data = smp.host_csw;
+        dap_sample_xfer(REQ_AP_CSW, &data);
+        data = smp.host_tar;
+        dap_sample_xfer(REQ_AP_TAR, &data);
+    }
+    data = smp.host_select;
+    dap_sample_xfer(REQ_DP_SELECT, &data);
+}
+
+void dap_sample_stop(void) {
+    dap_sample_release();
+    smp.running = false;
+}
+
+static void dap_sample_start(const uint8_t* cmd, uint32_t len) {
+    uint32_t n = (len >= 13) ? cmd[12] : 0;
+    if (n == 0 || n > DAP_SAMPLE_MAX_ADDR || len < 13 + 4 * n) return;
+
+    smp.interval = cmd[0] | ((uint32_t)cmd[1] << 8) | ((uint32_t)cmd[ 2] << 16) | ((uint32_t)cmd[ 3] << 24);
+    smp.select   = cmd[4] | ((uint32_t)cmd[5] << 8) | ((uint32_t)cmd[ 6] << 16) | ((uint32_t)cmd[ 7] << 24);
+    smp.csw      = cmd[8] | ((uint32_t)cmd[9] << 8) | ((uint32_t)cmd[10] << 16) | ((uint32_t)cmd[11] << 24);
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint8_t* a = &cmd[13 + 4 * i];
+        smp.addr[i] = a[0] | ((uint32_t)a[1] << 8) | ((uint32_t)a[2] << 16) | ((uint32_t)a[3] << 24);
+    }
+    smp.naddr = n;
+
+    dap_sample_release();
+    spsc_init(&smp_q, smp_buf, sizeof smp_buf);
+    smp.lost    = 0;
+    smp.next    = TIMESTAMP_GET();
+    smp.running = true;
+}
+
+static uint8_t dap_sample_round(uint32_t* vals) {
+    uint32_t data;
+    uint8_t  ack;
+
+    // the setup stays in place until the next DAP command, which gets the
+    // host's values back first (see dap_sample_release)
+    if (!smp.owned) {
+        smp.host_select = swd_dp_select;
+        smp.host_saved  = smp.tar_valid = false;
+
+        data = smp.select;
+        ack  = dap_sample_xfer(REQ_DP_SELECT, &data);
+        if (ack != DAP_TRANSFER_OK) return ack;
+        smp.owned = true;
+
+        // AP reads are posted, each one returns the previous one's value
+        ack = dap_sample_xfer(REQ_AP_CSW_RD, NULL);
+        if (ack != DAP_TRANSFER_OK) return ack;
+        ack = dap_sample_xfer(REQ_AP_TAR_RD, &smp.host_csw);
+        if (ack != DAP_TRANSFER_OK) return ack;
+        ack = dap_sample_xfer(REQ_DP_RDBUFF, &smp.host_tar);
+        if (ack != DAP_TRANSFER_OK) return ack;
+        smp.host_saved = true;
+
+        data = smp.csw;
+        ack  = dap_sample_xfer(REQ_AP_CSW, &data);
+        if (ack != DAP_TRANSFER_OK) return ack;
+    }
+
+    for (uint32_t i = 0; i < smp.naddr; ++i) {
+        // with a single address and no auto-increment, TAR can stay as-is
+        if (!smp.tar_valid) {
+            data = smp.addr[i];
+            ack  = dap_sample_xfer(REQ_AP_TAR, &data);
+            if (ack != DAP_TRANSFER_OK) return ack;
+            smp.tar_valid = smp.naddr == 1 && !(smp.csw & CSW_ADDRINC_MASK);
+        }
+
+        // AP reads are posted, the value comes out of RDBUFF afterwards
+        ack = dap_sample_xfer(REQ_AP_DRW_RD, NULL);
+        if (ack != DAP_TRANSFER_OK) return ack;
+        ack = dap_sample_xfer(REQ_DP_RDBUFF, &vals[i]);
+        if (ack != DAP_TRANSFER_OK) return ack;
+    }
+
+    return DAP_TRANSFER_OK;
+}
+
+static void dap_sample_do(void) {
+    uint32_t vals[DAP_SAMPLE_MAX_ADDR];
+    uint8_t  rec[REC_HDR_LEN + sizeof vals];
+    uint32_t now = TIMESTAMP_GET();
+
+    if (smp.interval) {
+        if ((int32_t)(now - smp.next) < 0) return;
+
+        smp.next += smp.interval;
+        // fell behind by more than a round: skip ahead instead of bursting
+        if ((int32_t)(now - smp.next) >= 0) {
+            uint32_t behind = (now - smp.next) / smp.interval + 1;
+            smp.lost += (behind > 0xffffu - smp.lost) ? (0xffffu - smp.lost) : behind;
+            smp.next += behind * smp.interval;
+        }
+    }
+
+    uint32_t len = REC_HDR_LEN + 4 * smp.naddr;
+    if (spsc_free(&smp_q) < len) {
+        if (smp.lost != 0xffff) ++smp.lost;
+        return;
+    }
+
+    uint8_t ack;
+    if (DAP_Data.debug_port != DAP_PORT_SWD) {
+        ack = 0; // not connected
+    } else {
+        ack = dap_sample_round(vals);
+        if (ack != DAP_TRANSFER_OK) dap_sample_release();
+    }
+    if (ack != DAP_TRANSFER_OK) memset(vals, 0, sizeof vals);
+
+    rec[0] = (uint8_t)(now >>  0);
+    rec[1] = (uint8_t)(now >>  8);
+    rec[2] = (uint8_t)(now >> 16);
+    rec[3] = (uint8_t)(now >> 24);
+    rec[4] = ack;
+    rec[5] = smp.naddr;
+    rec[6] = (uint8_t)(smp.lost >> 0);
+    rec[7] = (uint8_t)(smp.lost >> 8);
+    for (uint32_t i = 0; i < smp.naddr; ++i) {
+        uint8_t* v = &rec[REC_HDR_LEN + 4 * i];
+        v[0] = (uint8_t)(vals[i] >>  0);
+        v[1] = (uint8_t)(vals[i] >>  8);
+        v[2] = (uint8_t)(vals[i] >> 16);
+        v[3] = (uint8_t)(vals[i] >> 24);
+    }
+
+    spsc_write(&smp_q, rec, len);
+    smp.lost = 0;
+}
+
+static void dap_sample_tx(int itf) {
+    const uint8_t* ptr;
+    uint32_t avail, space;
+
+    while ((avail = spsc_read_ptr(&smp_q, &ptr)) != 0
+            && (space = tud_vendor_n_write_available(itf)) != 0) {
+        if (avail > space) avail = space;
+        spsc_release(&smp_q, tud_vendor_n_write(itf, ptr, avail));
+    }
+}
+
+void dap_sample_task(int itf) {
+    uint8_t cmd[CFG_TUD_VENDOR_RX_BUFSIZE];
+
+    if (!tud_vendor_n_mounted(itf)) {
+        // leave the target the way the host's own commands expect it
+        dap_sample_stop();
+        return;
+    }
+
+    if (tud_vendor_n_available(itf)) {
+        uint32_t len = tud_vendor_n_read(itf, cmd, sizeof cmd);
+
+        if (len > 0 && cmd[0] == dap_sample_cmd_start) {
+            dap_sample_start(&cmd[1], len - 1);
+        } else if (len > 0 && cmd[0] == dap_sample_cmd_stop) {
+            dap_sample_stop();
+        }
+    }
+
+    if (smp.running) dap_sample_do();
+    if (smp_q.buf) dap_sample_tx(itf);
+}
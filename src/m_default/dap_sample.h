@@ -0,0 +1,52 @@
+// vim: set et:
+
+#ifndef DAP_SAMPLE_H_
+#define DAP_SAMPLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* On-probe sampler: periodically reads a list of target memory addresses
+ * (e.g. DWT_PCSR for statistical profiling) through the MEM-AP, and streams
+ * the timestamped values out over its own bulk interface, so that the host
+ * doesn't need a CMSIS-DAP round-trip per sample.
+ *
+ * Protocol on the sampler interface, all values little-endian:
+ * - OUT 0x01 <interval:4> <select:4> <csw:4> <n:1> <addr:4>*n: start
+ *   sampling the n addresses every 'interval' timestamp clock ticks (0 = as
+ *   fast as possible), using the given DP SELECT and MEM-AP CSW values.
+ * - OUT 0x00: stop sampling.
+ * - IN: one record per sample round: <timestamp:4> <ack:1> <n:1> <lost:2>
+ *   <value:4>*n. 'ack' is 1 (OK) if the round succeeded, else the SWD ack of
+ *   the failing transfer, or 0 if the target isn't connected in SWD mode (the
+ *   values are 0 then). 'lost' is the number of rounds that were skipped
+ *   (late or no buffer space) since the previous record.
+ *
+ * The target must already be connected in SWD mode, with the debug domain
+ * powered up. CMSIS-DAP commands may still be issued while sampling: the
+ * DP SELECT, and the MEM-AP CSW and TAR values the sampler replaced are put
+ * back before each of them, so the host can keep relying on cached values.
+ * Sampling stops, and the values are put back, when the interface goes away
+ * or the mode is left. */
+
+#define DAP_SAMPLE_SUBCLASS 'D'
+#define DAP_SAMPLE_PROTOCOL 'S'
+
+#define DAP_SAMPLE_MAX_ADDR 8
+
+enum dap_sample_cmd {
+    dap_sample_cmd_stop  = 0x00,
+    dap_sample_cmd_start = 0x01,
+};
+
+void dap_sample_stop(void);
+
+// put back the host's SELECT, CSW and TAR values. call this before executing
+// a CMSIS-DAP command.
+void dap_sample_release(void);
+
+// handle commands, sample, and send out records. call this from the mode's
+// task callback.
+void dap_sample_task(int itf);
+
+#endif
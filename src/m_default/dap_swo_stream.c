@@ -0,0 +1,49 @@
+// vim: set et:
+
+#include <tusb.h>
+
+#include "DAP_config.h" /* ARM code *assumes* this is included prior to DAP.h */
+#include "DAP.h"
+
+#include "m_default/dap_swo_stream.h"
+
+#if (SWO_STREAM_POLL != 0)
+
+static const uint8_t* swo_ptr;
+static uint32_t swo_left;
+
+void SWO_QueueTransfer(uint8_t* buf, uint32_t num) {
+    swo_ptr  = buf;
+    swo_left = num;
+}
+
+void SWO_AbortTransfer(void) {
+    swo_left = 0;
+}
+
+void dap_swo_stream_task(int itf) {
+    uint8_t  dummy[CFG_TUD_VENDOR_RX_BUFSIZE];
+    uint32_t space, n;
+
+    if (!tud_vendor_n_mounted(itf)) return;
+
+    // nothing is expected on the OUT endpoint, don't let it stall
+    if (tud_vendor_n_available(itf)) tud_vendor_n_read(itf, dummy, sizeof dummy);
+
+    if (swo_left != 0 && (space = tud_vendor_n_write_available(itf)) != 0) {
+        n = (swo_left > space) ? space : swo_left;
+        n = tud_vendor_n_write(itf, swo_ptr, n);
+        swo_ptr  += n;
+        swo_left -= n;
+
+        if (swo_left == 0) SWO_TransferComplete();
+    }
+
+    SWO_StreamPoll();
+}
+
+#else
+
+void dap_swo_stream_task(int itf) { (void)itf; }
+
+#endif
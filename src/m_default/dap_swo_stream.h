@@ -0,0 +1,20 @@
+// vim: set et:
+
+#ifndef DAP_SWO_STREAM_H_
+#define DAP_SWO_STREAM_H_
+
+/* SWO streaming trace (DAP_SWO_Transport 2): the captured SWO data is sent
+ * out over its own bulk interface as soon as it comes in, instead of having
+ * the host poll it with DAP_SWO_Data. The CMSIS-DAP v2 spec puts this stream
+ * on a third endpoint of the CMSIS-DAP bulk interface, but TinyUSB's vendor
+ * class only handles endpoint pairs, so it gets an interface of its own here.
+ * Its OUT endpoint is unused. */
+
+#define DAP_SWO_SUBCLASS 'D'
+#define DAP_SWO_PROTOCOL 'W'
+
+// send out queued trace data, and queue more. call this from the mode's task
+// callback.
+void dap_swo_stream_task(int itf);
+
+#endif
@@ -0,0 +1,215 @@
+// vim: set et:
+
+#include <string.h>
+
+#include <tusb.h>
+
+#include "DAP_config.h" /* ARM code *assumes* this is included prior to DAP.h */
+#include "DAP.h"
+
+#include "m_default/dap_xvc.h"
+
+static struct {
+    enum { st_cmd, st_settck, st_shift_len, st_shift_data } state;
+    uint8_t  hdr[4];
+    uint32_t hdrlen;
+
+    uint32_t bits_left; // of the current shift
+    uint32_t chunk;     // TMS (and TDI) bytes in the current chunk
+    uint32_t got;       // TMS+TDI bytes of the current chunk received
+
+    uint32_t out_len, out_pos; // response bytes in xvc_tdo still to send
+} xvc;
+
+// one extra byte, for reading past the end when extracting unaligned runs
+static uint8_t xvc_tms[DAP_XVC_CHUNK], xvc_tdi[DAP_XVC_CHUNK + 1], xvc_tdo[DAP_XVC_CHUNK];
+static uint8_t run_tdi[DAP_XVC_CHUNK], run_tdo[DAP_XVC_CHUNK];
+
+static uint32_t get_u32(const uint8_t* b) {
+    return b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+static void resp_u32(uint32_t v) {
+    xvc_tdo[0] = (uint8_t)(v >>  0);
+    xvc_tdo[1] = (uint8_t)(v >>  8);
+    xvc_tdo[2] = (uint8_t)(v >> 16);
+    xvc_tdo[3] = (uint8_t)(v >> 24);
+    xvc.out_len = 4;
+    xvc.out_pos = 0;
+}
+
+// go through the regular command handlers, so that the CMSIS-DAP state stays
+// consistent with what was done here
+static void xvc_connect(void) {
+    uint8_t req[2] = { ID_DAP_Connect, DAP_PORT_JTAG }, resp[2];
+
+    if (DAP_Data.debug_port != DAP_PORT_JTAG) DAP_ExecuteCommand(req, resp);
+}
+static uint32_t xvc_settck(uint32_t period) {
+    uint32_t freq = period ? (1000000000u / period) : 0;
+    uint8_t req[5] = { ID_DAP_SWJ_Clock,
+        (uint8_t)(freq >>  0), (uint8_t)(freq >>  8),
+        (uint8_t)(freq >> 16), (uint8_t)(freq >> 24) };
+    uint8_t resp[2];
+
+    // too slow to express in Hz: leave the clock as it is
+    if (freq != 0) DAP_ExecuteCommand(req, resp);
+
+    // what the PIO divider actually gives, not what was asked for
+    return dap_jtag_period_ns(DAP_Data.clock_freq);
+}
+
+// dst[0..n) = src[off..off+n), bits LSB-first
+static void bits_extract(uint8_t* dst, const uint8_t* src, uint32_t off, uint32_t n) {
+    uint32_t s = off & 7;
+
+    src += off >> 3;
+    for (uint32_t i = 0; i < n; i += 8, ++src, ++dst)
+        *dst = (uint8_t)((src[0] >> s) | (src[1] << (8 - s)));
+}
+// dst[off..off+n) = src[0..n), leaving the other bits of dst alone
+static void bits_merge(uint8_t* dst, uint32_t off, const uint8_t* src, uint32_t n) {
+    uint32_t s = off & 7;
+
+    dst += off >> 3;
+    for (uint32_t i = 0; i < n; i += 8, ++src, ++dst) {
+        uint32_t k    = (n - i < 8) ? (n - i) : 8;
+        uint32_t mask = ((1u << k) - 1) << s;
+        uint32_t val  = ((uint32_t)*src << s) & mask;
+
+        dst[0] = (uint8_t)((dst[0] & ~mask) | val);
+        if (s + k > 8) dst[1] = (uint8_t)((dst[1] & ~(mask >> 8)) | (val >> 8));
+    }
+}
+
+// shift n bits of the current chunk, one PIO run per stretch of constant TMS
+static void xvc_shift(uint32_t n) {
+    uint32_t j;
+
+    for (uint32_t i = 0; i < n; i = j) {
+        bool tms = (xvc_tms[i >> 3] >> (i & 7)) & 1;
+        uint8_t same = tms ? 0xff : 0x00;
+
+        // find the end of the run, skipping whole bytes where possible
+        for (j = i + 1; j < n; ) {
+            if ((j & 7) == 0 && j + 8 <= n && xvc_tms[j >> 3] == same) j += 8;
+            else if (((xvc_tms[j >> 3] >> (j & 7)) & 1) == tms) ++j;
+            else break;
+        }
+
+        if (tms) PIN_SWDIO_TMS_SET();
+        else PIN_SWDIO_TMS_CLR();
+
+        if ((i & 7) == 0) {
+            // later runs overwrite the rest of the last TDO byte
+            jtag_shift(j - i, &xvc_tdi[i >> 3], &xvc_tdo[i >> 3]);
+        } else {
+            bits_extract(run_tdi, xvc_tdi, i, j - i);
+            jtag_shift(j - i, run_tdi, run_tdo);
+            bits_merge(xvc_tdo, i, run_tdo, j - i);
+        }
+    }
+}
+
+static void xvc_next_chunk(void) {
+    uint32_t bytes = (xvc.bits_left + 7) >> 3;
+
+    xvc.chunk = (bytes > DAP_XVC_CHUNK) ? DAP_XVC_CHUNK : bytes;
+    xvc.got   = 0;
+    xvc.state = xvc.chunk ? st_shift_data : st_cmd;
+}
+
+static void xvc_do_chunk(void) {
+    uint32_t n = xvc.chunk << 3;
+    if (n > xvc.bits_left) n = xvc.bits_left;
+
+    // the unused bits of the last TDO byte are zero
+    xvc_tdo[xvc.chunk - 1] = 0;
+    xvc_shift(n);
+    xvc.bits_left -= n;
+    xvc.out_len = xvc.chunk;
+    xvc.out_pos = 0;
+
+    xvc_next_chunk();
+}
+
+// returns false when no more input should be handled until the response has
+// been sent out
+static bool xvc_rx(int itf) {
+    uint8_t cmd;
+    uint32_t len;
+
+    switch (xvc.state) {
+    case st_cmd:
+        if (tud_vendor_n_read(itf, &cmd, 1) != 1) return false;
+
+        xvc.hdrlen = 0;
+        switch (cmd) {
+        case dap_xvc_cmd_info:
+            resp_u32(DAP_XVC_CHUNK);
+            return false;
+        case dap_xvc_cmd_settck: xvc.state = st_settck;     break;
+        case dap_xvc_cmd_shift:  xvc.state = st_shift_len;  break;
+        default: break; // ignore
+        }
+        return true;
+    case st_settck:
+    case st_shift_len:
+        xvc.hdrlen += tud_vendor_n_read(itf, &xvc.hdr[xvc.hdrlen], sizeof xvc.hdr - xvc.hdrlen);
+        if (xvc.hdrlen < sizeof xvc.hdr) return true;
+
+        xvc_connect();
+        if (xvc.state == st_settck) {
+            xvc.state = st_cmd;
+            resp_u32(xvc_settck(get_u32(xvc.hdr)));
+            return false;
+        }
+        xvc.bits_left = get_u32(xvc.hdr);
+        xvc_next_chunk();
+        return true;
+    case st_shift_data:
+        if (xvc.got < xvc.chunk) {
+            len = tud_vendor_n_read(itf, &xvc_tms[xvc.got], xvc.chunk - xvc.got);
+        } else {
+            len = tud_vendor_n_read(itf, &xvc_tdi[xvc.got - xvc.chunk], 2 * xvc.chunk - xvc.got);
+        }
+        xvc.got += len;
+        if (xvc.got < 2 * xvc.chunk) return len != 0;
+
+        xvc_do_chunk();
+        return false;
+    }
+
+    return false;
+}
+
+static void xvc_tx(int itf) {
+    uint32_t space, len;
+
+    while (xvc.out_pos < xvc.out_len && (space = tud_vendor_n_write_available(itf)) != 0) {
+        len = xvc.out_len - xvc.out_pos;
+        if (len > space) len = space;
+        xvc.out_pos += tud_vendor_n_write(itf, &xvc_tdo[xvc.out_pos], len);
+    }
+}
+
+void dap_xvc_reset(int itf) {
+    uint8_t junk[64];
+
+    memset(&xvc, 0, sizeof xvc);
+    // drop whatever was left of a command from a previous session
+    while (tud_vendor_n_available(itf)) tud_vendor_n_read(itf, junk, sizeof junk);
+}
+
+void dap_xvc_task(int itf) {
+    if (!tud_vendor_n_mounted(itf)) {
+        memset(&xvc, 0, sizeof xvc);
+        return;
+    }
+
+    // the TDO buffer is reused for the next chunk, so send it out first
+    xvc_tx(itf);
+    if (xvc.out_pos < xvc.out_len) return;
+
+    while (tud_vendor_n_available(itf) && xvc_rx(itf)) ;
+    xvc_tx(itf);
+}
@@ -0,0 +1,58 @@
+// vim: set et:
+
+#ifndef DAP_XVC_H_
+#define DAP_XVC_H_
+
+#include <stdint.h>
+
+/* Xilinx Virtual Cable backend: shifts raw XVC TMS/TDI vectors of arbitrary
+ * length on the JTAG pins, and returns TDO over its own bulk interface. The
+ * vector is split into runs of constant TMS on the probe, each of which is
+ * shifted by the PIO in one go, so that the host only has to forward the XVC
+ * 'shift:' commands instead of doing a CMSIS-DAP round-trip per 64 bits.
+ *
+ * Protocol on the XVC interface, all values little-endian:
+ * - OUT 0x00: get info. IN <chunk:4>: the size of a TMS or TDI chunk, see
+ *   below.
+ * - OUT 0x01 <period:4>: set the TCK period in nanoseconds. IN <period:4>:
+ *   the period actually applied, which is never shorter than the requested
+ *   one. A period of 0 keeps the current clock.
+ * - OUT 0x02 <nbits:4>: shift nbits bits. The TMS and TDI vectors follow in
+ *   chunks of 'chunk' bytes (the last ones possibly shorter): first the TMS
+ *   bytes of a chunk, then the TDI bytes of the same chunk, then the next
+ *   chunk. IN: the TDO bytes, (nbits+7)/8 in total, sent out chunk by chunk.
+ *
+ * The JTAG port is switched to JTAG mode by the first command, which also
+ * disconnects any CMSIS-DAP SWD session.
+ *
+ * A host that went away in the middle of a shift leaves the probe waiting for
+ * the rest of its vectors, which would be taken for the commands of the next
+ * session. So a session starts with the vendor control request
+ * DAP_XVC_REQ_RESET (OUT, recipient interface, wIndex the XVC interface
+ * number, no data), which drops the partial command and any input still
+ * buffered. TDO bytes that were already queued for sending are not taken
+ * back, the host has to read those out and discard them. */
+
+#define DAP_XVC_SUBCLASS 'D'
+#define DAP_XVC_PROTOCOL 'X'
+
+#define DAP_XVC_CHUNK 512
+
+// bRequest of the reset control request, outside of the range that the
+// I2C-Tiny-USB interface uses
+#define DAP_XVC_REQ_RESET 0x58
+
+enum dap_xvc_cmd {
+    dap_xvc_cmd_info   = 0x00,
+    dap_xvc_cmd_settck = 0x01,
+    dap_xvc_cmd_shift  = 0x02,
+};
+
+// go back to waiting for a command. call this on DAP_XVC_REQ_RESET
+void dap_xvc_reset(int itf);
+
+// handle commands and send out their responses. call this from the mode's
+// task callback.
+void dap_xvc_task(int itf);
+
+#endif
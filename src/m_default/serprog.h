@@ -39,6 +39,21 @@ enum serprog_cmd {
     S_CMD_SPI_WRITE   = 0x46,
     // as opposed to S_CMD_SPIOP, this one is full-duplex instead of half-duplex
     S_CMD_SPI_RDWR    = 0x47,
+    // dual/quad versions of S_CMD_SPI_READ and S_CMD_SPI_WRITE, for the data
+    // phase of multi-IO flash commands: <width:1> <len:3> [data]
+    S_CMD_SPI_READ_WIDE  = 0x48,
+    S_CMD_SPI_WRITE_WIDE = 0x49,
+    // SPI flash helpers, polling the status register on the device instead
+    // of with one USB round-trip per poll. CS is toggled between the steps, so
+    // it must not be held with S_CMD_S_SPI_SETCS. 8 bits per word only, NAKed
+    // with a status of 0 otherwise.
+    // response: ACK <status:1> when done, NAK <status:1> on timeout
+    // write enable, send <slen> bytes (program/erase command), poll WIP:
+    //   <timeout_ms:4> <slen:3> <sdata>
+    S_CMD_SPI_WRPOLL  = 0x4a,
+    // send <op>, read 1 byte until (status & mask) == match:
+    //   <op:1> <mask:1> <match:1> <timeout_ms:4>
+    S_CMD_SPI_POLL    = 0x4b,
 };
 
 enum serprog_response { S_ACK = 0x06, S_NAK = 0x15 };
@@ -67,6 +82,8 @@ enum serprog_caps {
     S_CAP_LSBFST  = 1<<8,
     S_CAP_CSACHI  = 1<<9,
     S_CAP_3WIRE   = 1<<10,
+    S_CAP_DUAL    = 1<<11, // S_CMD_SPI_*_WIDE with 2 data lines
+    S_CAP_QUAD    = 1<<12, // S_CMD_SPI_*_WIDE with 4 data lines
 };
 
 #define SERPROG_IFACE_VERSION 0x0001
@@ -111,6 +128,8 @@ edges.
 uint32_t /*freq_applied*/ sp_spi_set_freq(uint32_t freq_wanted);
 enum serprog_flags sp_spi_set_flags(enum serprog_flags flags);
 uint8_t sp_spi_set_bpw(uint8_t bpw);
+void sp_spi_timer_start(uint32_t ms);
+bool sp_spi_timer_reached(void);
 
 struct sp_spi_caps {
     uint32_t freq_min, freq_max;
@@ -127,6 +146,17 @@ void sp_spi_cs_select(uint8_t csflags);
 void sp_spi_op_write(uint32_t write_len, const void* write_data);
 void sp_spi_op_read(uint32_t read_len, void* read_data);
 void sp_spi_op_read_write(uint32_t len, void* read_data, const void* write_data);
+/* asynchronous version of the above: starts the transfer and returns
+ * immediately, sp_spi_op_wait() waits for it to finish. read_data may be NULL
+ * to discard the data read, write_data NULL to send zeroes. the buffers must
+ * stay valid until the transfer is done. */
+void sp_spi_op_start(uint32_t len, void* read_data, const void* write_data);
+void sp_spi_op_wait(void);
+/* dual/quad data phases, MSB first, always 8 bits per word. only available
+ * if sp_spi_wide_ok(width) returns true for the current settings */
+bool sp_spi_wide_ok(uint8_t width);
+void sp_spi_op_read_wide(uint32_t len, void* read_data, uint8_t width);
+void sp_spi_op_write_wide(uint32_t len, const void* write_data, uint8_t width);
 
 /* serprog-specific */
 void sp_spi_op_begin(uint8_t csflags);
@@ -141,7 +171,7 @@ void sp_spi_op_end(uint8_t csflags);
 }*/
 
 /* protocol handling functions */
-__attribute__((__const__)) uint32_t sp_spi_get_buf_limit(void); // rdnmaxlen, wrnmaxlen
+__attribute__((__const__)) uint32_t sp_spi_get_buf_limit(void); // wrnmaxlen
 void cdc_serprog_init(void);
 void cdc_serprog_deinit(void);
 void cdc_serprog_task(void);
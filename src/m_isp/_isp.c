@@ -15,6 +15,7 @@
 /* CMSIS-DAP */
 #include "DAP_config.h" /* ARM code *assumes* this is included prior to DAP.h */
 #include "DAP.h"
+#include "m_default/dap_queue.h"
 /* CDC UART */
 #include "m_default/cdc.h" /* yeah just reuse this one */
 /* MehFET */
@@ -68,7 +69,7 @@ static void enter_cb(void) {
 #endif
     vnd_cfg_set_itf_num(VND_N_CFG);
 
-    // TODO: CMSISDAP?
+    dap_queue_reset();
 
     // HACK: we init UART stuff first: UART inits gpio 10,11 pinmux fn to UART
     //       flow control signals, which is ok for mode1, but conflicts with
@@ -93,8 +94,6 @@ static void leave_cb(void) {
 #endif
 }
 
-void dap_do_bulk_stuff(int itf);
-
 static void task_cb(void) {
 #ifdef DBOARD_HAS_UART
     tud_task();
@@ -287,17 +286,12 @@ static const uint8_t* my_hid_descriptor_report_cb(uint8_t instance) {
 
 static void my_hid_set_report_cb(uint8_t instance, uint8_t report_id,
         hid_report_type_t report_type, uint8_t const* rx_buffer, uint16_t bufsize) {
-    static uint8_t tx_buffer[CFG_TUD_HID_EP_BUFSIZE];
-    uint32_t       response_size = TU_MIN(CFG_TUD_HID_EP_BUFSIZE, bufsize);
-
     (void)instance;
     (void)report_id;
     (void)report_type;
 
-    memset(tx_buffer, 0, CFG_TUD_HID_EP_BUFSIZE);
-    DAP_ProcessCommand(rx_buffer, tx_buffer);
-
-    tud_hid_report(0, tx_buffer, response_size);
+    // executed and answered from the task callback
+    dap_queue_hid_report(rx_buffer, bufsize);
 }
 #endif
 
@@ -4,6 +4,7 @@
 
 #include <tusb.h>
 
+#include "bulkio.h"
 #include "info.h"
 #include "thread.h"
 
@@ -20,69 +21,20 @@ struct cmdlen {
 static uint8_t rx_buf[BUFSIZE];
 static uint8_t tx_buf[BUFSIZE];
 
-static uint32_t rxavail, rxpos, txpos;
-
-// TODO: this is duplicated several times over the codebase, maybe reduce this
-static uint8_t read_byte(void) {
-    while (rxavail <= 0) {
-        if (!tud_vendor_n_mounted(VND_N_MEHFET) || !tud_vendor_n_available(VND_N_MEHFET)) {
-            thread_yield();
-            continue;
-        }
-
-        rxpos   = 0;
-        rxavail = tud_vendor_n_read(VND_N_MEHFET, rx_buf, sizeof rx_buf);
-
-        if (rxavail == 0) thread_yield();
-    }
-
-    uint8_t rv = rx_buf[rxpos];
-    ++rxpos;
-    --rxavail;
-
-    return rv;
-}
-/*static void drop_incoming(void) {
-    rxavail = 0;
-    rxpos = 0;
-
-    // empty tinyusb internal buffer
-    if (tud_vendor_n_mounted(VND_N_MEHFET)) {
-        while (tud_vendor_n_available(VND_N_MEHFET)) {
-            tud_vendor_n_read(VND_N_MEHFET, rx_buf, sizeof rx_buf);
-        }
-    }
-}*/
-static void write_flush(void) {
-    // TODO: is this needed?
-    while (tud_vendor_n_write_available(VND_N_MEHFET) < txpos) {
-        thread_yield();
-    }
-
-    tud_vendor_n_write(VND_N_MEHFET, tx_buf, txpos);
-    txpos = 0;
-}
-static void write_byte(uint8_t v) {
-    if (txpos == sizeof tx_buf) {
-        write_flush();
-    }
-
-    tx_buf[txpos] = v;
-    ++txpos;
-}
+static struct bulkio mf_io;
 
 ////////////////
 
 static uint32_t plpos;
 static struct cmdlen read_cmd_len(void) {
-    uint8_t cmd = read_byte(),
+    uint8_t cmd = bulkio_read_byte(&mf_io),
             lastbyte = cmd;
     uint32_t l = 0;
 
     //printf("cmd=%02x\n", cmd);
 
     for (size_t i = 0; (i < 4) && (lastbyte & 0x80); ++i) {
-        lastbyte = read_byte();
+        lastbyte = bulkio_read_byte(&mf_io);
         //printf("lenbyte=%02x\n");
 
         uint8_t mask = (i == 3) ? 0xff : 0x7f;
@@ -96,16 +48,21 @@ static struct cmdlen read_cmd_len(void) {
 
 static inline uint8_t read_pl(void) {
     ++plpos;
-    return read_byte();
+    return bulkio_read_byte(&mf_io);
+}
+static void read_pl_buf(uint8_t* buf, size_t len) {
+    plpos += len;
+    bulkio_read(&mf_io, buf, len);
 }
 static void flush_pl(uint32_t len) {
-    while (plpos < len) read_byte();
+    if (plpos < len) bulkio_skip(&mf_io, len - plpos);
+    plpos = len;
 }
 
 static void write_resp(enum mehfet_status stat, size_t resplen, const uint8_t* resp) {
     //if (stat != mehfet_ok) drop_incoming();
 
-    write_byte((stat & 0x7f) | (resplen ? 0x80 : 0));
+    bulkio_write_byte(&mf_io, (stat & 0x7f) | (resplen ? 0x80 : 0));
 
     for (size_t i = 0, len2 = resplen; (i < 4) && len2; ++i) {
         uint8_t nextv;
@@ -117,13 +74,11 @@ static void write_resp(enum mehfet_status stat, size_t resplen, const uint8_t* r
         }
         len2 >>= 7;
 
-        write_byte(nextv);
+        bulkio_write_byte(&mf_io, nextv);
     }
 
-    for (size_t i = 0; i < resplen; ++i)
-        write_byte(resp[i]);
-
-    write_flush();
+    bulkio_write(&mf_io, resp, resplen);
+    bulkio_flush(&mf_io);
 }
 static void write_resp_str(enum mehfet_status stat, const char* str) {
     write_resp(stat, strlen(str)+1 /* include null terminator */, (const uint8_t*)str);
@@ -134,10 +89,9 @@ static void write_resp_str(enum mehfet_status stat, const char* str) {
 static uint8_t connstat;
 
 void mehfet_init(void) {
-    rxavail = 0;
-    rxpos   = 0;
-    txpos   = 0;
-    plpos   = 0;
+    bulkio_init(&mf_io, &bulkio_vendor_ops, VND_N_MEHFET, rx_buf, sizeof rx_buf,
+            tx_buf, sizeof tx_buf);
+    plpos = 0;
 
     connstat = mehfet_conn_none;
 
@@ -315,7 +269,7 @@ void mehfet_task(void) {
             } else {
                 uint8_t tdi_stuff[nbytes], tdo_stuff[nbytes];
 
-                for (size_t i = 0; i < nbytes; ++i) tdi_stuff[i] = read_pl();
+                read_pl_buf(tdi_stuff, nbytes);
 
                 mehfet_hw_tdio_seq(ncyc, tmslvl, tdi_stuff, tdo_stuff);
 
@@ -345,7 +299,7 @@ void mehfet_task(void) {
             } else {
                 uint8_t tms_stuff[nbytes];
 
-                for (size_t i = 0; i < nbytes; ++i) tms_stuff[i] = read_pl();
+                read_pl_buf(tms_stuff, nbytes);
 
                 mehfet_hw_tms_seq(ncyc, tdilvl, tms_stuff);
 
@@ -416,7 +370,7 @@ void mehfet_task(void) {
             } else {
                 uint8_t newdr[nbytes], olddr[nbytes];
 
-                for (size_t i = 0; i < nbytes; ++i) newdr[i] = read_pl();
+                read_pl_buf(newdr, nbytes);
 
                 mehfet_hw_shift_dr(nbits, newdr, olddr);
 
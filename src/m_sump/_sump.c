@@ -14,7 +14,15 @@
 
 enum m_sump_cmds {
     msump_cmd_getovclk = mode_cmd__specific,
-    msump_cmd_setovclk
+    msump_cmd_setovclk,
+    msump_cmd_getstream,
+    msump_cmd_setstream,
+    msump_cmd_gettxstats,
+    msump_cmd_getpacked,
+    msump_cmd_setpacked,
+    msump_cmd_getovclkprofs,
+    msump_cmd_gettrans,
+    msump_cmd_settrans,
 };
 enum m_sump_feature {
     msump_feat_sump      = 1<<0,
@@ -59,7 +67,12 @@ static void task_cb(void) {
 }
 
 static void handle_cmd_cb(uint8_t cmd) {
-    uint8_t resp = 0;
+    uint8_t  resp = 0;
+    uint32_t bytes, usec;
+    uint8_t  stats[8];
+    uint8_t  profs[16 * 6];
+    uint32_t khz, n;
+    uint16_t mv;
 
     switch (cmd) {
     case mode_cmd_get_features:
@@ -73,7 +86,51 @@ static void handle_cmd_cb(uint8_t cmd) {
         vnd_cfg_write_resp(cfg_resp_ok, 1, &resp);
         break;
     case msump_cmd_setovclk:
-        sump_hw_set_overclock(vnd_cfg_read_byte());
+        resp = vnd_cfg_read_byte();
+        if (sump_hw_set_overclock(resp))
+            vnd_cfg_write_resp(cfg_resp_ok, 0, NULL);
+        else
+            vnd_cfg_write_strf(cfg_resp_badarg, "no overclock profile %hhu", resp);
+        break;
+    case msump_cmd_getstream:
+        resp = sump_get_stream() ? 1 : 0;
+        vnd_cfg_write_resp(cfg_resp_ok, 1, &resp);
+        break;
+    case msump_cmd_setstream:
+        sump_set_stream(vnd_cfg_read_byte() != 0);
+        vnd_cfg_write_resp(cfg_resp_ok, 0, NULL);
+        break;
+    case msump_cmd_gettxstats:
+        sump_get_tx_stats(&bytes, &usec);
+        for (size_t i = 0; i < 4; ++i) {
+            stats[i + 0] = (bytes >> (i * 8)) & 0xff;
+            stats[i + 4] = (usec  >> (i * 8)) & 0xff;
+        }
+        vnd_cfg_write_resp(cfg_resp_ok, sizeof stats, stats);
+        break;
+    case msump_cmd_getovclkprofs:
+        // sysclk in kHz (4 bytes) and core voltage in mV (2 bytes) per profile
+        for (n = 0; n < sizeof profs / 6 && sump_hw_get_clock_profile(n, &khz, &mv); ++n) {
+            for (size_t i = 0; i < 4; ++i) profs[n * 6 + i] = (khz >> (i * 8)) & 0xff;
+            profs[n * 6 + 4] = mv & 0xff;
+            profs[n * 6 + 5] = mv >> 8;
+        }
+        vnd_cfg_write_resp(cfg_resp_ok, n * 6, profs);
+        break;
+    case msump_cmd_getpacked:
+        resp = sump_get_packed() ? 1 : 0;
+        vnd_cfg_write_resp(cfg_resp_ok, 1, &resp);
+        break;
+    case msump_cmd_setpacked:
+        sump_set_packed(vnd_cfg_read_byte() != 0);
+        vnd_cfg_write_resp(cfg_resp_ok, 0, NULL);
+        break;
+    case msump_cmd_gettrans:
+        resp = sump_get_trans() ? 1 : 0;
+        vnd_cfg_write_resp(cfg_resp_ok, 1, &resp);
+        break;
+    case msump_cmd_settrans:
+        sump_set_trans(vnd_cfg_read_byte() != 0);
         vnd_cfg_write_resp(cfg_resp_ok, 0, NULL);
         break;
     default:
@@ -32,6 +32,7 @@
 
 #include "alloc.h"
 #include "info.h"
+#include "spsc.h"
 #include "m_sump/bsp-feature.h"
 #include "m_sump/sump.h"
 #include "m_sump/sump_hw.h"
@@ -41,8 +42,8 @@
 
 #define CDC_INTF CDC_N_SUMP
 
-#if SAMPLING_BITS != 8 && SAMPLING_BITS != 16
-#error "Correct sampling width (8 or 16 bits)"
+#if SAMPLING_BITS != 8 && SAMPLING_BITS != 16 && SAMPLING_BITS != 24 && SAMPLING_BITS != 32
+#error "Correct sampling width (8, 16, 24 or 32 bits)"
 #endif
 
 // TODO: runtime errors?
@@ -78,9 +79,10 @@ static struct _sump {
     bool     cdc_connected;
     uint8_t  cmd[5];   // command
     uint8_t  cmd_pos;  // command buffer position
-    uint8_t  state;    // SUMP_STATE_*
-    uint8_t  width;    // in bytes, 1 = 8 bits, 2 = 16 bits
-    uint8_t  trigger_index;
+    volatile uint8_t state;  // SUMP_STATE_*
+    uint8_t  width;    // in bytes in sump_buffer, 1 = 8 bits, 2 = 16 bits, 4 = 24/32 bits
+    uint8_t  wire;     // in bytes sent to the host (3 for 24 bits)
+    bool     packed;   // 4-channel mode, two samples per byte in sump_buffer
     // uint32_t pio_prog_offset;
     uint32_t read_start;
     // uint64_t timestamp_start;
@@ -93,22 +95,99 @@ static struct _sump {
 
     struct _trigger trigger[4];
 
+    /* trigger engine state, reset on every run */
+    uint8_t  trigger_level;    // current trigger level (0..3)
+    uint8_t  trigger_used;     // bitmask of configured stages
+    uint8_t  trigger_serial;   // bitmask of configured serial-mode stages
+    uint8_t  trigger_pending;  // bitmask of stages with a delayed action
+    uint32_t trigger_sample;   // running sample counter
+    uint32_t trigger_fire[4];  // sample at which a delayed action takes effect
+    uint32_t trigger_shift[4]; // serial-mode shift registers
+
     /* DMA buffer */
     uint32_t chunk_size;  // in bytes
     uint32_t dma_start;
     uint32_t dma_count;
     // uint32_t dma_curr_idx;	// current DMA channel (index)
     uint32_t dma_pos;
+    uint32_t dma_abs;    // number of bytes captured before the chunk at dma_pos
     uint32_t next_count;
+    uint32_t ring_size;  // size of the DMA ring at the start of sump_buffer
     //uint8_t  buffer[SUMP_MEMORY_SIZE];
+
+    /* RLE store: when RLE is enabled, the DMA ring only spans
+     * SUMP_DMA_CHANNELS chunks, and every chunk is compressed into a ring of
+     * RLE entries (in libsigrok format) taking up the rest of sump_buffer as
+     * soon as it has been captured */
+    bool     rle;
+    uint8_t* rle_buf;
+    uint32_t rle_entries;  // capacity, in entries
+    uint32_t rle_head;     // number of entries written (wraps around rle_entries)
+    uint32_t rle_val;      // encoder: current run
+    uint32_t rle_cnt;
+    uint32_t rle_encoded;  // encoder: number of bytes compressed
+    uint32_t rle_end;      // byte offset of the end of the sample window
+    uint32_t rle_rd;       // dump: next entry to read (counting down)
+    uint32_t rle_rd_val;
+    uint32_t rle_rd_left;
+    uint32_t rle_skip;     // dump: samples after the window still to skip
+
+    /* streaming: the DMA ring is used as an SPSC queue, with the capture side
+     * (DMA IRQ, on the other core if available) as the producer, and
+     * cdc_sump_task() as the consumer */
+    bool        stream;
+    struct spsc stream_q;
+
+    /* transitional mode: the DMA ring holds (timestamp, value) pairs of
+     * words, pushed by the PIO on every change of the inputs, which the dump
+     * expands back into samples. the timestamp counts down from 0xffffffff,
+     * so its complement is the sample index */
+    bool     trans;
+    bool     trans_wrapped;  // the ring got overwritten at least once
+    uint32_t trans_start;    // capture start, in us
+    uint32_t trans_len;      // capture length, in us
+    uint32_t trans_rd;       // dump: byte offset after the next event to read
+    uint32_t trans_left;     // dump: number of events left in the ring
+    uint32_t trans_next;     // dump: sample index after the current run
+    uint32_t trans_val;
+    uint32_t trans_run;
+
+    /* dump data in sump_tx_buf not yet written to the CDC FIFO */
+    uint32_t tx_pos, tx_len;
+
+    /* transfer statistics of the current dump */
+    bool     tx_active;
+    uint32_t tx_bytes;
+    uint32_t tx_start;
 } sump;
 
 // not in the main sump struct, as the latter gets cleared every so often
 size_t sump_memory_size;
 uint8_t* sump_buffer;
+static bool sump_stream_mode;
+static bool sump_packed_mode;
+static bool sump_trans_mode;
+static uint32_t sump_tx_stat_bytes, sump_tx_stat_usec;
+// staging buffer for dumps: it is filled in one go, and then handed to the CDC
+// FIFO as room frees up, so that the sample conversion isn't done in FIFO-sized
+// bits
+#define SUMP_TX_BUF_SIZE 1024
+static uint8_t sump_tx_buf[SUMP_TX_BUF_SIZE] __attribute__((__aligned__(4)));
 
 /* utility functions ======================================================= */
 
+// conversion between sample counts and sump_buffer sizes
+static inline uint32_t sump_bytes(uint32_t samples) {
+    return sump.packed ? (samples / 2) : (samples * sump.width);
+}
+static inline uint32_t sump_samples(uint32_t bytes) {
+    return sump.packed ? (bytes * 2) : (bytes / sump.width);
+}
+// the DMA transfers whole words in 4-channel mode
+static inline uint8_t sump_dma_unit(void) {
+    return sump.packed ? 4 : sump.width;
+}
+
 /*static void picoprobe_debug_hexa(uint8_t *buf, uint32_t len) {
     uint32_t l;
     for (l = 0; len > 0; len--, l++) {
@@ -150,64 +229,269 @@ static uint8_t* sump_add_meta4(uint8_t* buf, uint8_t tag, uint32_t val) {
     return buf + 5;
 }
 
-static void* sump_analyze_trigger8(void* ptr, uint32_t size) {
-    (void)size;
+/*
+ * The trigger scanners run in the DMA IRQ, so they have to keep up with the
+ * sample rate. Instead of testing one sample per iteration, mask and value
+ * are replicated into every lane of a 32-bit word, so that a word with no
+ * matching sample can be rejected with a handful of ALU ops (8 samples at
+ * once for 4-channel mode, 4 for 8-bit, 2 for 16-bit). Only the word
+ * containing a potential match is then rescanned per-sample.
+ *
+ * A lane is zero after '(w & mask) ^ value' iff it matches, which is detected
+ * using the classic 'haszero' trick. That can report false positives in lanes
+ * above a real zero lane (due to the borrow), but never misses one, and the
+ * rescan takes care of the rest.
+ */
+static const uint8_t* sump_find8(
+        const uint8_t* src, const uint8_t* end, uint8_t tmask, uint8_t tvalue) {
+    while (src < end && ((uintptr_t)src & 3)) {
+        if ((*src & tmask) == tvalue) return src;
+        ++src;
+    }
 
-    uint8_t* src    = ptr;
-    uint8_t  tmask  = sump.trigger[sump.trigger_index].mask;
-    uint8_t  tvalue = sump.trigger[sump.trigger_index].value;
-    uint32_t count  = sump.chunk_size;
+    const uint32_t m4 = tmask * 0x01010101u, v4 = tvalue * 0x01010101u;
+    for (; end - src >= 4; src += 4) {
+        uint32_t x = (*(const uint32_t*)src & m4) ^ v4;
+        if ((x - 0x01010101u) & ~x & 0x80808080u) break;
+    }
 
-    for (count = sump.chunk_size; count > 0; count--) {
-        uint32_t v = *src++;
-        if ((v & tmask) != tvalue) continue;
+    for (; src < end; ++src)
+        if ((*src & tmask) == tvalue) return src;
 
-        while (1) {
-            if (sump.trigger[sump.trigger_index].start) return src;
+    return NULL;
+}
 
-            sump.trigger_index++;
-            tmask  = sump.trigger[sump.trigger_index].mask;
-            tvalue = sump.trigger[sump.trigger_index].value;
+static const uint16_t* sump_find16(
+        const uint16_t* src, const uint16_t* end, uint16_t tmask, uint16_t tvalue) {
+    if (src < end && ((uintptr_t)src & 2)) {
+        if ((*src & tmask) == tvalue) return src;
+        ++src;
+    }
 
-            if (tmask != 0 || tvalue != 0) break;
-        }
+    const uint32_t m2 = tmask * 0x00010001u, v2 = tvalue * 0x00010001u;
+    for (; end - src >= 2; src += 2) {
+        uint32_t x = (*(const uint32_t*)src & m2) ^ v2;
+        if ((x - 0x00010001u) & ~x & 0x80008000u) break;
     }
+
+    for (; src < end; ++src)
+        if ((*src & tmask) == tvalue) return src;
+
     return NULL;
 }
 
-static void* sump_analyze_trigger16(void* ptr, uint32_t size) {
-    (void)size;
+// 4-channel mode: 8 samples per word, the oldest in the low nibble
+static uint32_t sump_find4(
+        const uint8_t* chunk, uint32_t k, uint32_t e, uint8_t tmask, uint8_t tvalue) {
+    while (k < e && (k & 7)) {
+        if ((((chunk[k >> 1] >> ((k & 1) * 4)) & tmask) == tvalue)) return k;
+        ++k;
+    }
 
-    uint16_t* src    = ptr;
-    uint16_t  tmask  = sump.trigger[0].mask;
-    uint16_t  tvalue = sump.trigger[0].value;
-    uint32_t  count  = sump.chunk_size;
+    const uint32_t m8 = tmask * 0x11111111u, v8 = tvalue * 0x11111111u;
+    for (; e - k >= 8; k += 8) {
+        uint32_t x = (*(const uint32_t*)(chunk + (k >> 1)) & m8) ^ v8;
+        if ((x - 0x11111111u) & ~x & 0x88888888u) break;
+    }
+
+    for (; k < e; ++k)
+        if ((((chunk[k >> 1] >> ((k & 1) * 4)) & tmask) == tvalue)) return k;
 
-    for (count = sump.chunk_size / 2; count > 0; count--) {
-        uint32_t v = *src++;
-        if ((v & tmask) != tvalue) continue;
+    return e;
+}
 
-        while (1) {
-            if (sump.trigger[sump.trigger_index].start) return src;
+static const uint32_t* sump_find32(
+        const uint32_t* src, const uint32_t* end, uint32_t tmask, uint32_t tvalue) {
+    for (; src < end; ++src)
+        if ((*src & tmask) == tvalue) return src;
 
-            sump.trigger_index++;
-            tmask  = sump.trigger[sump.trigger_index].mask;
-            tvalue = sump.trigger[sump.trigger_index].value;
+    return NULL;
+}
+
+/*
+ * Trigger engine, following the semantics of the OLS basic trigger: the four
+ * stages run in parallel, and a stage is armed when the current trigger level
+ * is at least its configured level. When an armed stage matches, its action
+ * takes effect 'delay' samples later: either the capture starts (if the start
+ * flag is set), or the trigger level is incremented. Serial-mode stages shift
+ * the sample bit of their channel into a 32-bit shift register, and match on
+ * that instead of the sample itself.
+ *
+ * Sample positions are tracked using a running sample counter, so delays can
+ * span multiple DMA chunks. When no serial stages are in use, the chunk is
+ * scanned using the word-at-a-time finders above, one pass per armed stage.
+ */
 
-            if (tmask != 0 || tvalue != 0) break;
+static inline uint32_t sump_sample(const uint8_t* chunk, uint32_t i) {
+    if (sump.packed) return (chunk[i >> 1] >> ((i & 1) * 4)) & 0xf;
+
+    switch (sump.width) {
+        case 1: return chunk[i];
+        case 2: return ((const uint16_t*)chunk)[i];
+        default: return ((const uint32_t*)chunk)[i];
+    }
+}
+
+static uint32_t sump_trigger_armed(void) {
+    uint32_t armed = 0;
+
+    for (uint32_t i = 0; i < count_of(sump.trigger); ++i) {
+        const struct _trigger* t = &sump.trigger[i];
+
+        if (!(sump.trigger_used & (1u << i))) continue;
+        if (sump.trigger_pending & (1u << i)) continue;
+        if (t->level > sump.trigger_level) continue;
+        // the level saturates, so incrementing it any further is a no-op
+        if (!t->start && sump.trigger_level == 3) continue;
+
+        armed |= 1u << i;
+    }
+
+    return armed;
+}
+
+static bool sump_trigger_hit(uint32_t i, uint32_t v) {
+    const struct _trigger* t = &sump.trigger[i];
+
+    if (t->serial) v = sump.trigger_shift[i];
+
+    return (v & t->mask) == t->value;
+}
+
+// returns true when the capture should start
+static bool sump_trigger_action(uint32_t i) {
+    if (sump.trigger[i].start) return true;
+
+    if (sump.trigger_level < 3) ++sump.trigger_level;
+    return false;
+}
+
+// returns the position of the first sample in [k, e) on which an armed stage
+// matches, or e if there is none
+static uint32_t sump_trigger_scan(const uint8_t* chunk, uint32_t k, uint32_t e, uint32_t armed) {
+    if (sump.trigger_serial == 0) {
+        for (uint32_t i = 0; i < count_of(sump.trigger) && armed; ++i, armed >>= 1) {
+            if (!(armed & 1)) continue;
+
+            uint32_t mask = sump.trigger[i].mask, value = sump.trigger[i].value;
+            if (sump.packed) {
+                e = sump_find4(chunk, k, e, mask, value);
+            } else if (sump.width == 1) {
+                const uint8_t* p = sump_find8(chunk + k, chunk + e, mask, value);
+                if (p) e = p - chunk;
+            } else if (sump.width == 2) {
+                const uint16_t* c = (const uint16_t*)chunk;
+                const uint16_t* p = sump_find16(c + k, c + e, mask, value);
+                if (p) e = p - c;
+            } else {
+                const uint32_t* c = (const uint32_t*)chunk;
+                const uint32_t* p = sump_find32(c + k, c + e, mask, value);
+                if (p) e = p - c;
+            }
         }
+
+        return e;
     }
-    return NULL;
+
+    for (; k < e; ++k) {
+        uint32_t v = sump_sample(chunk, k);
+
+        for (uint32_t i = 0; i < count_of(sump.trigger); ++i) {
+            if (sump.trigger_serial & (1u << i))
+                sump.trigger_shift[i] = (sump.trigger_shift[i] << 1)
+                    | ((v >> sump.trigger[i].channel) & 1);
+        }
+        for (uint32_t i = 0; i < count_of(sump.trigger); ++i) {
+            if ((armed & (1u << i)) && sump_trigger_hit(i, v)) return k;
+        }
+    }
+
+    return e;
 }
 
 static void* sump_analyze_trigger(void* ptr, uint32_t size) {
-    if (sump.width == 1)
-        return sump_analyze_trigger8(ptr, size);
-    else
-        return sump_analyze_trigger16(ptr, size);
+    uint8_t* chunk = ptr;
+    uint32_t n     = sump_samples(size);
+    uint32_t base  = sump.trigger_sample;
+    uint32_t k     = 0;
+
+    sump.trigger_sample += n;
+
+    while (1) {
+        // find the earliest delayed action in this chunk, if any
+        uint32_t e   = n;
+        int      act = -1;
+        for (uint32_t i = 0; i < count_of(sump.trigger); ++i) {
+            if (!(sump.trigger_pending & (1u << i))) continue;
+
+            uint32_t f = sump.trigger_fire[i] - base;
+            if (f < e) {
+                e   = f;
+                act = i;
+            }
+        }
+
+        // the sample on which the action happens is still matched against
+        // the current state
+        uint32_t armed    = sump_trigger_armed();
+        uint32_t scan_end = (act >= 0) ? (e + 1) : n;
+        uint32_t m        = scan_end;
+        if (k < scan_end) m = sump_trigger_scan(chunk, k, scan_end, armed);
+
+        if (m < scan_end) {
+            uint32_t v     = sump_sample(chunk, m);
+            bool     start = false;
+
+            for (uint32_t i = 0; i < count_of(sump.trigger); ++i) {
+                if (!(armed & (1u << i)) || !sump_trigger_hit(i, v)) continue;
+
+                if (sump.trigger[i].delay == 0) {
+                    start |= sump_trigger_action(i);
+                } else {
+                    sump.trigger_pending |= 1u << i;
+                    sump.trigger_fire[i] = base + m + sump.trigger[i].delay;
+                }
+            }
+
+            if (start) return chunk + sump_bytes(m + 1);
+
+            k = m + 1;
+            continue;
+        }
+
+        if (act < 0) break;
+
+        sump.trigger_pending &= ~(1u << act);
+        if (sump_trigger_action(act)) return chunk + sump_bytes(e + 1);
+
+        k = e + 1;
+    }
+
+    return NULL;
 }
 
-uint32_t sump_calc_sysclk_divider() {
+static void sump_trigger_init(void) {
+    sump.trigger_level   = 0;
+    sump.trigger_used    = 0;
+    sump.trigger_serial  = 0;
+    sump.trigger_pending = 0;
+    sump.trigger_sample  = 0;
+
+    for (uint32_t i = 0; i < count_of(sump.trigger); ++i) {
+        const struct _trigger* t = &sump.trigger[i];
+
+        sump.trigger_shift[i] = 0;
+
+        // stages without a mask, value or start flag are unused
+        if (t->mask == 0 && t->value == 0 && !t->start) continue;
+
+        sump.trigger_used |= 1u << i;
+        if (t->serial) sump.trigger_serial |= 1u << i;
+    }
+}
+
+// PIO clock divider (with 8 bits of fraction) for the given sysclk, unclamped
+static uint32_t sump_calc_divider(uint32_t sysclk) {
     const uint32_t common_divisor = 4;
     uint32_t       divider        = sump.divider;
 
@@ -221,11 +505,19 @@ uint32_t sump_calc_sysclk_divider() {
         divider *= 256 / common_divisor;
     }
 
-    uint32_t v = sump_hw_get_sysclk();
+    uint32_t v = sysclk;
     assert((v % ONE_MHZ) == 0);
     // conversion from 100Mhz to sysclk
     v = ((v / ONE_MHZ) * divider) / ((100 / common_divisor) * SAMPLING_DIVIDER);
-    v *= sump.width;
+    // the PIO pushes a word per sample (a word per 8 samples in 4-channel
+    // mode), so it has to run faster for narrower samples. the transitional
+    // mode program takes SUMP_TRANS_CYCLES per sample instead
+    if (sump.trans) return v * SAMPLING_DIVIDER / SUMP_TRANS_CYCLES;
+    return v * (sump.packed ? 4 : sump.width);
+}
+
+uint32_t sump_calc_sysclk_divider() {
+    uint32_t v = sump_calc_divider(sump_hw_get_sysclk());
 
     if (v > 65535 * 256)
         v = 65535 * 256;
@@ -237,11 +529,34 @@ uint32_t sump_calc_sysclk_divider() {
     return v;
 }
 
+/*
+ * The fractional PIO divider adds jitter to the sample clock. Run the capture
+ * on the fastest clock profile (up to the selected one) on which the requested
+ * rate is an integer division of sysclk, and fall back to the selected profile
+ * when there is none. The latter also happens when the rate is too high.
+ */
+static void sump_select_clock(void) {
+    uint8_t best = sump_hw_get_overclock();
+
+    for (int i = best; i >= 0; --i) {
+        uint32_t khz;
+        sump_hw_get_clock_profile(i, &khz, NULL);
+
+        uint32_t v = sump_calc_divider(khz * 1000);
+        if ((v & 0xff) == 0 && v >= 256 && v <= 65535 * 256) {
+            best = i;
+            break;
+        }
+    }
+
+    sump_hw_set_clock_profile(best);
+}
+
 static void sump_set_chunk_size(void) {
     uint32_t clk_hz = sump_hw_get_sysclk() / (sump_calc_sysclk_divider() / 256);
     // the goal is to transfer around 125 DMA chunks per second
-    // for slow sampling rates
-    sump.chunk_size = 1;
+    // for slow sampling rates. the DMA transfers up to a word at a time
+    sump.chunk_size = 4;
 
     while (clk_hz > 125 && sump.chunk_size < SUMP_MAX_CHUNK_SIZE) {
         sump.chunk_size *= 2;
@@ -251,13 +566,140 @@ static void sump_set_chunk_size(void) {
     picoprobe_debug("%s(): 0x%04x\n", __func__, sump.chunk_size);
 }
 
+/* RLE store ================================================================ */
+
+static void sump_rle_push(uint32_t val, uint32_t cnt) {
+    uint32_t slot = sump.rle_head % sump.rle_entries;
+
+    if (sump.width == 1)
+        ((uint16_t*)sump.rle_buf)[slot] = (cnt - 1) | 0x80 | (val << 8);
+    else
+        ((uint32_t*)sump.rle_buf)[slot] = (cnt - 1) | 0x8000 | (val << 16);
+
+    ++sump.rle_head;
+}
+
+/*
+ * Runs are extended a word at a time while the samples keep matching the
+ * current run, so long runs (the case where RLE helps) cost one compare per
+ * 4 (or 2) samples. Runs are stored oldest-first, and the top channel is
+ * dropped, as it is used for the RLE mark.
+ */
+static void sump_rle_encode8(const uint8_t* src, uint32_t size) {
+    const uint8_t* end = src + size;
+    uint32_t       val = sump.rle_val, cnt = sump.rle_cnt;
+
+    while (src < end) {
+        if (!((uintptr_t)src & 3)) {
+            const uint32_t rep = val * 0x01010101u;
+
+            while (end - src >= 4 && cnt <= 0x80 - 4
+                    && (*(const uint32_t*)src & 0x7f7f7f7fu) == rep) {
+                src += 4;
+                cnt += 4;
+            }
+            if (src == end) break;
+        }
+
+        uint32_t v = *src++ & 0x7f;
+        if (v == val && cnt < 0x80) {
+            ++cnt;
+            continue;
+        }
+
+        if (cnt) sump_rle_push(val, cnt);
+        val = v;
+        cnt = 1;
+    }
+
+    sump.rle_val = val;
+    sump.rle_cnt = cnt;
+}
+
+static void sump_rle_encode16(const uint16_t* src, uint32_t size) {
+    const uint16_t* end = src + size / 2;
+    uint32_t        val = sump.rle_val, cnt = sump.rle_cnt;
+
+    while (src < end) {
+        if (!((uintptr_t)src & 2)) {
+            const uint32_t rep = val * 0x00010001u;
+
+            while (end - src >= 2 && cnt <= 0x8000 - 2
+                    && (*(const uint32_t*)src & 0x7fff7fffu) == rep) {
+                src += 2;
+                cnt += 2;
+            }
+            if (src == end) break;
+        }
+
+        uint32_t v = *src++ & 0x7fff;
+        if (v == val && cnt < 0x8000) {
+            ++cnt;
+            continue;
+        }
+
+        if (cnt) sump_rle_push(val, cnt);
+        val = v;
+        cnt = 1;
+    }
+
+    sump.rle_val = val;
+    sump.rle_cnt = cnt;
+}
+
+static void sump_rle_encode(const uint8_t* src, uint32_t size) {
+    if (sump.width == 1)
+        sump_rle_encode8(src, size);
+    else
+        sump_rle_encode16((const uint16_t*)src, size);
+
+    sump.rle_encoded += size;
+}
+
+// close the last run and set up the dump state
+static void sump_rle_finish(void) {
+    if (sump.rle_cnt) sump_rle_push(sump.rle_val, sump.rle_cnt);
+    sump.rle_cnt = 0;
+
+    sump.rle_rd      = sump.rle_head;
+    sump.rle_rd_val  = 0;
+    sump.rle_rd_left = 0;
+    sump.rle_skip    = 0;
+    if (sump.rle_encoded > sump.rle_end)
+        sump.rle_skip = sump_samples(sump.rle_encoded - sump.rle_end);
+}
+
+/* transitional mode ======================================================= */
+
+// set up the dump state, 'part' being the fill level of the current chunk
+static void sump_trans_finish(uint32_t part) {
+    uint32_t end = sump.dma_pos + part;
+
+    sump.trans_rd   = end;
+    sump.trans_left = (sump.trans_wrapped ? sump.ring_size : end) / 8;
+    sump.trans_val  = 0;
+    sump.trans_run  = 0;
+
+    // the newest event is the closing one, stamped with the last sample
+    const uint32_t* ev = (const uint32_t*)(sump_buffer + (end + sump.ring_size - 8) % sump.ring_size);
+    sump.trans_next    = ~ev[0] + 1;
+}
+
 /* data capture ============================================================ */
 
 static void sump_capture_done(void) {
-    sump_hw_capture_stop();
+    if (sump.trans) {
+        sump_trans_finish(sump_hw_capture_stop_trans());
+    } else {
+        sump_hw_capture_stop();
+        if (sump.rle) sump_rle_finish();
+    }
     /*uint64_t us = time_us_64() - sump.timestamp_start;
     picoprobe_debug("%s(): sampling time = %llu.%llu\n", __func__, us / 1000000ull, us %
     1000000ull);*/
+    // publish the capture results before the state change, as this can run on
+    // the capture core while the dump is done by the USB core
+    __atomic_thread_fence(__ATOMIC_RELEASE);
     sump.state = SUMP_STATE_DUMP;
 }
 
@@ -277,12 +719,13 @@ static int sump_capture_next(uint32_t pos) {
     sump.state = SUMP_STATE_SAMPLING;
 
     // calculate read start
-    uint32_t tmp    = (sump.read_count - sump.delay_count) * sump.width;
+    uint32_t tmp         = sump_bytes(sump.read_count - sump.delay_count);
+    uint32_t delay_bytes = sump_bytes(sump.delay_count);
+    sump.rle_end    = sump.dma_abs + (ptr - (sump_buffer + pos)) + delay_bytes;
     pos             = ptr - sump_buffer;
-    sump.read_start = (pos - tmp) % sump_memory_size;//SUMP_MEMORY_SIZE;
+    sump.read_start = (pos + sump.ring_size - tmp % sump.ring_size) % sump.ring_size;
 
     // calculate the samples after trigger
-    uint32_t delay_bytes = sump.delay_count * sump.width;
     tmp                  = sump.chunk_size - (pos % sump.chunk_size);
     if (tmp >= delay_bytes) {
         sump_capture_done();
@@ -292,15 +735,74 @@ static int sump_capture_next(uint32_t pos) {
 }
 
 uint8_t* sump_capture_get_next_dest(uint32_t numch) {
-    return sump_buffer + (sump.dma_pos + numch * sump.chunk_size) % sump_memory_size;//SUMP_MEMORY_SIZE;
+    return sump_buffer + (sump.dma_pos + numch * sump.chunk_size) % sump.ring_size;//SUMP_MEMORY_SIZE;
 }
 
 void sump_capture_callback_cancel(void) {
+    // the events are allowed to go around the ring in transitional mode
+    if (sump.trans) return;
+
     sump_capture_done();
-    sump.state = SUMP_STATE_ERROR;
+    // in streaming mode, still send out what has been captured so far
+    if (!sump.stream) sump.state = SUMP_STATE_ERROR;
+}
+
+static void sump_stream_next(uint32_t numch) {
+    struct spsc* q         = &sump.stream_q;
+    uint32_t     chunk_end = sump.dma_abs + sump.chunk_size;
+
+    if (sump.state == SUMP_STATE_TRIGGER) {
+        uint8_t* chunk = sump_buffer + sump.dma_pos;
+        uint8_t* ptr   = sump_analyze_trigger(chunk, sump.chunk_size);
+
+        if (ptr != NULL) {
+            // start streaming at the requested amount of pre-trigger samples,
+            // or as far back as the ring still has data that isn't about to
+            // be overwritten by the DMA channels in flight. the consumer
+            // isn't running yet, so the queue can be moved there.
+            uint32_t pre   = sump_bytes(sump.read_count - sump.delay_count);
+            uint32_t back  = pre + sump.chunk_size - (ptr - chunk);  // up to the chunk end
+            uint32_t avail = sump.ring_size - numch * sump.chunk_size;
+            if (avail > chunk_end) avail = chunk_end;
+            if (back > avail) back = avail;
+
+            spsc_reset(q, sump.dma_pos + sump.chunk_size + sump.ring_size - back);
+            spsc_commit(q, back);
+            sump.state = SUMP_STATE_SAMPLING;
+        }
+    } else {
+        spsc_commit(q, sump.chunk_size);
+
+        // the DMA channel that just got rearmed writes to the ring 'numch'
+        // chunks ahead. if that overlaps with data not yet sent over USB,
+        // we're overrunning the host: stop sampling, the consumer will send
+        // out what's left and go back to the config state afterwards
+        if (spsc_free(q) < numch * sump.chunk_size) sump_capture_done();
+    }
+
+    sump.dma_pos += sump.chunk_size;
+    sump.dma_pos %= sump.ring_size;
+    sump.dma_abs += sump.chunk_size;
 }
 
 void sump_capture_callback(uint32_t ch, uint32_t numch) {
+    if (sump.stream) {
+        sump_stream_next(numch);
+        return;
+    }
+    if (sump.trans) {
+        // nothing to do until the capture is over
+        sump.dma_pos += sump.chunk_size;
+        if (sump.dma_pos >= sump.ring_size) {
+            sump.dma_pos       = 0;
+            sump.trans_wrapped = true;
+        }
+        return;
+    }
+
+    // compress the chunk right away, before the DMA ring wraps around to it
+    if (sump.rle) sump_rle_encode(sump_buffer + sump.dma_pos, sump.chunk_size);
+
     // reprogram the current DMA channel to the tail
     if (sump.next_count <= sump.chunk_size) {
         sump.next_count = sump_capture_next(sump.dma_pos);
@@ -311,14 +813,15 @@ void sump_capture_callback(uint32_t ch, uint32_t numch) {
     // sump_irq_debug("%s(): next=0x%x\n", __func__, sump.next_count);
 
     sump.dma_pos += sump.chunk_size;
-    sump.dma_pos %= sump_memory_size;//SUMP_MEMORY_SIZE;
+    sump.dma_pos %= sump.ring_size;//SUMP_MEMORY_SIZE;
+    sump.dma_abs += sump.chunk_size;
 
     if (sump.state == SUMP_STATE_SAMPLING && sump.next_count >= sump.chunk_size &&
             sump.next_count < numch * sump.chunk_size) {
         // set the last DMA segment to correct size to avoid overwrites
         uint32_t mask = sump.next_count / sump.chunk_size;
 
-        sump_hw_capture_setup_next(ch, mask, sump.chunk_size, sump.next_count, sump.width);
+        sump_hw_capture_setup_next(ch, mask, sump.chunk_size, sump.next_count, sump_dma_unit());
     }
 }
 
@@ -327,6 +830,11 @@ void sump_capture_callback(uint32_t ch, uint32_t numch) {
 static void sump_xfer_start(uint8_t state) {
     sump.dma_start = 0;
     sump.dma_pos   = 0;
+    // the stream is sent out raw and oldest first, which isn't what a host
+    // that asked for RLE (newest first) would expect: do a buffered capture
+    sump.stream    = sump_stream_mode && !(sump.flags & SUMP_FLAG1_ENABLE_RLE);
+    sump.trans     = sump_trans_mode && !sump.stream && !sump.packed && sump.width <= 2;
+    if (sump.trans) state = SUMP_STATE_SAMPLING;  // no triggers
 
     picoprobe_debug("%s(): read=0x%08x delay=0x%08x divider=%u\n", __func__, sump.read_count,
             sump.delay_count, sump.divider);
@@ -339,19 +847,54 @@ static void sump_xfer_start(uint8_t state) {
         sump.next_count = sump.read_count;
     else
         sump.next_count = sump.read_count - sump.delay_count;
-    sump.next_count *= sump.width;
+    sump.next_count = sump_bytes(sump.next_count);
     sump.read_start = 0;
 
     picoprobe_debug("%s(): buffer = 0x%08x, dma_count=0x%08x next_count=0x%08x\n", __func__,
             sump_buffer, sump.dma_count, sump.next_count);
 
     // limit chunk size for slow sampling
+    sump_select_clock();
     sump_set_chunk_size();
 
-    /*sump.timestamp_start =*/sump_hw_capture_start(
-            sump.width, sump.flags, sump.chunk_size, sump_buffer);
+    sump.dma_abs   = 0;
+    sump.ring_size = sump_memory_size;
+    // the RLE store only handles 8- and 16-bit samples
+    sump.rle       = !sump.trans && (sump.flags & SUMP_FLAG1_ENABLE_RLE)
+               && !sump.packed && sump.width <= 2;
+    if (sump.rle) {
+        uint32_t entsize = sump.width * 2;
+
+        sump.ring_size   = SUMP_DMA_CHANNELS * sump.chunk_size;
+        sump.rle_buf     = sump_buffer + sump.ring_size;
+        sump.rle_entries = (sump_memory_size - sump.ring_size) / entsize;
+        sump.rle_head    = 0;
+        sump.rle_val     = 0;
+        sump.rle_cnt     = 0;
+        sump.rle_encoded = 0;
+        sump.rle_end     = sump_bytes(sump.read_count);
+    }
+    if (sump.stream) spsc_init(&sump.stream_q, sump_buffer, sump.ring_size);
+    if (sump.trans) {
+        // events only trickle in, so the chunks don't have to be small. the
+        // capture lasts as long as sampling read_count samples would take
+        sump.chunk_size    = SUMP_MAX_CHUNK_SIZE;
+        sump.ring_size     = sump_memory_size - sump_memory_size % sump.chunk_size;
+        sump.trans_wrapped = false;
+        sump.trans_len     = (uint64_t)sump.read_count * sump_calc_sysclk_divider()
+                * SUMP_TRANS_CYCLES / 256 / (sump_hw_get_sysclk() / ONE_MHZ);
+    }
 
+    // the capture side takes ownership of the state from here on
     sump.state = state;
+
+    if (sump.trans) {
+        sump.trans_start = sump_hw_get_time_us();
+        sump_hw_capture_start_trans(sump.width * 8, sump.flags, sump.chunk_size, sump_buffer);
+    } else {
+        /*sump.timestamp_start =*/sump_hw_capture_start(
+                sump.packed ? 4 : (sump.width * 8), sump.flags, sump.chunk_size, sump_buffer);
+    }
 }
 
 /* SUMP proto command handling ============================================= */
@@ -365,8 +908,10 @@ static void sump_do_meta(void) {
     ptr = sump_add_metas(ptr, SUMP_META_FPGA_VERSION, cpu);
     sump_hw_get_cpu_name(cpu);
     ptr    = sump_add_metas(ptr, SUMP_META_CPU_VERSION, cpu);
-    ptr    = sump_add_meta4(ptr, SUMP_META_SAMPLE_RATE, sump_hw_get_sysclk() / SAMPLING_DIVIDER);
-    ptr    = sump_add_meta4(ptr, SUMP_META_SAMPLE_RAM, sump_memory_size);
+    ptr    = sump_add_meta4(ptr, SUMP_META_SAMPLE_RATE, sump_hw_get_max_sysclk() / SAMPLING_DIVIDER);
+    // in transitional mode, the sample count is only limited by the protocol
+    ptr    = sump_add_meta4(ptr, SUMP_META_SAMPLE_RAM,
+               sump_trans_mode ? 0x40000 * SAMPLING_BYTES : sump_memory_size);
     ptr    = sump_add_meta1(ptr, SUMP_META_PROBES_B, SAMPLING_BITS);
     ptr    = sump_add_meta1(ptr, SUMP_META_PROTOCOL_B, 2);
     *ptr++ = SUMP_META_END;
@@ -388,9 +933,15 @@ static void sump_do_run(void) {
     uint32_t tmask  = 0;
     bool     tstart = false;
 
+    // drop what is left of an earlier dump
+    sump.tx_pos = sump.tx_len = 0;
+
     if (sump.width == 0) {
         // invalid config, dump something nice
-        sump.state = SUMP_STATE_DUMP;
+        sump.stream = false;
+        sump.rle    = false;
+        sump.trans  = false;
+        sump.state  = SUMP_STATE_DUMP;
         return;
     }
 
@@ -400,8 +951,8 @@ static void sump_do_run(void) {
     }
 
     if (tstart && tmask) {
-        state              = SUMP_STATE_TRIGGER;
-        sump.trigger_index = 0;
+        state = SUMP_STATE_TRIGGER;
+        sump_trigger_init();
     } else {
         state = SUMP_STATE_SAMPLING;
     }
@@ -409,10 +960,16 @@ static void sump_do_run(void) {
     sump_xfer_start(state);
 }
 
-static void sump_do_finish(void) {
+void sump_capture_callback_finish(void) {
+    // the capture might have ended on its own in the meantime
     if (sump.state == SUMP_STATE_TRIGGER || sump.state == SUMP_STATE_SAMPLING) {
-        sump.state = SUMP_STATE_DUMP;
         sump_capture_done();
+    }
+}
+
+static void sump_do_finish(void) {
+    if (sump.state == SUMP_STATE_TRIGGER || sump.state == SUMP_STATE_SAMPLING) {
+        sump_hw_capture_finish();
         return;
     }
 }
@@ -423,7 +980,8 @@ static void sump_do_stop(void) {
     sump_hw_stop();
 
     // protocol state
-    sump.state = SUMP_STATE_INIT;
+    sump.state  = SUMP_STATE_INIT;
+    sump.tx_pos = sump.tx_len = 0;
 }
 
 static void sump_do_reset(void) {
@@ -432,16 +990,28 @@ static void sump_do_reset(void) {
 }
 
 static void sump_set_flags(uint32_t flags) {
-    uint32_t width = 2;
-    sump.flags     = flags;
+    uint32_t groups = (~flags >> 2) & 0xf;  // enabled channel groups
+    uint32_t width  = 0;
+    sump.flags      = flags;
+
+    // supported are group 0 or 1 alone, and groups 0 to 1, 0 to 2 or 0 to 3.
+    // 24-bit samples are stored as 32-bit words
+    switch (groups) {
+        case 0x1:
+        case 0x2: width = 1; break;
+        case 0x3: width = 2; break;
+        case 0x7:
+        case 0xf: width = 4; break;
+        default: break;
+    }
+    sump.wire = (groups == 0x7) ? 3 : width;
+    if (sump.wire > SAMPLING_BYTES) width = 0;
 
-    if (flags & SUMP_FLAG1_GR0_DISABLE) width--;
-    if (flags & SUMP_FLAG1_GR1_DISABLE) width--;
-    // we don't support 24-bit or 32-bit capture - sorry
-    if ((flags & SUMP_FLAG1_GR2_DISABLE) == 0) width = 0;
-    if ((flags & SUMP_FLAG1_GR3_DISABLE) == 0) width = 0;
+    // 4-channel mode (low half of the selected group) for 8-bit captures
+    sump.packed = sump_packed_mode && width == 1;
 
-    picoprobe_debug("%s(): sample %u bytes\n", __func__, width);
+    picoprobe_debug("%s(): sample %u bytes (%u on the wire)%s\n", __func__, width, sump.wire,
+            sump.packed ? ", packed" : "");
 
     sump.width = width;
 }
@@ -639,103 +1209,243 @@ static uint32_t sump_tx_empty(uint8_t* buf, uint32_t len) {
     return i;
 }
 
+/*
+ * Copy 'n' samples ending at 'src' into 'dst' in reverse order (the SUMP
+ * protocol sends the newest sample first). Whole words are byte- or
+ * halfword-swapped at once when source and destination alignment allow it.
+ */
+static void sump_copy_rev8(uint8_t* dst, const uint8_t* src, uint32_t n) {
+    if ((((uintptr_t)dst + (uintptr_t)src) & 3) == 0) {
+        for (; n > 0 && ((uintptr_t)src & 3); --n) *dst++ = *(--src);
+        for (; n >= 4; n -= 4, dst += 4) {
+            src -= 4;
+            *(uint32_t*)dst = __builtin_bswap32(*(const uint32_t*)src);
+        }
+    }
+    for (; n > 0; --n) *dst++ = *(--src);
+}
+
+static void sump_copy_rev16(uint16_t* dst, const uint16_t* src, uint32_t n) {
+    if ((((uintptr_t)dst + (uintptr_t)src) & 3) == 0) {
+        if (n > 0 && ((uintptr_t)src & 2)) {
+            *dst++ = *(--src);
+            --n;
+        }
+        for (; n >= 2; n -= 2, dst += 2) {
+            src -= 2;
+            uint32_t v      = *(const uint32_t*)src;
+            *(uint32_t*)dst = (v >> 16) | (v << 16);
+        }
+    }
+    for (; n > 0; --n) *dst++ = *(--src);
+}
+
+// RLE captures are sent by sump_tx_rle(), so these only deal with raw samples
 static uint32_t sump_tx8(uint8_t* buf, uint32_t len) {
     uint32_t i;
     uint32_t count = sump.read_count;
     // picoprobe_debug("%s: count=%u, start=%u\n", __func__, count);
-    uint8_t* ptr   = sump_buffer + (sump.read_start + count) % sump_memory_size;//SUMP_MEMORY_SIZE;
+    uint8_t* ptr   = sump_buffer + (sump.read_start + count) % sump.ring_size;
 
-    if (sump.flags & SUMP_FLAG1_ENABLE_RLE) {
-        uint8_t b, rle_last = 0x80, rle_count = 0;
+    for (i = 0; i < len && count > 0;) {
+        if (ptr == sump_buffer) ptr = sump_buffer + sump.ring_size;
 
-        for (i = 0; i + 1 < len && count > 0; count--) {
-            if (ptr == sump_buffer) ptr = sump_buffer + sump_memory_size;//SUMP_MEMORY_SIZE;
+        // contiguous part up to the start of the ring
+        uint32_t n = ptr - sump_buffer;
+        if (n > len - i) n = len - i;
+        if (n > count) n = count;
 
-            b = *(--ptr) & 0x7f;
+        sump_copy_rev8(buf, ptr, n);
+        buf += n;
+        ptr -= n;
+        i += n;
+        count -= n;
+    }
 
-            if (b != rle_last) {
-                if (rle_count > 0) {
-                    *((uint16_t*)buf) = (rle_count - 1) | 0x80 | ((uint16_t)rle_last << 8);
-                    buf += 2;
-                    i += 2;
-                    sump.read_count -= rle_count;
-                }
+    sump.read_count -= i;
 
-                rle_last  = b;
-                rle_count = 1;
-                continue;
-            }
-            if (++rle_count == 0x80) {
-                *((uint16_t*)buf) = (rle_count - 1) | 0x80 | ((uint16_t)rle_last << 8);
-                buf += 2;
-                i += 2;
-                sump.read_count -= rle_count;
-                rle_count = 0;
-            }
-        }
-    } else {
-        for (i = 0; i < len && count > 0; i++, count--) {
-            if (ptr == sump_buffer) ptr = sump_buffer + sump_memory_size;//SUMP_MEMORY_SIZE;
+    // picoprobe_debug("%s: ret=%u\n", __func__, i);
+    return i;
+}
 
-            *buf++ = *(--ptr);
-        }
+static uint32_t sump_tx16(uint8_t* buf, uint32_t len) {
+    uint32_t i;
+    uint32_t count = sump.read_count;
+    // picoprobe_debug("%s: count=%u, start=%u\n", __func__, count, sump.read_count);
+    uint8_t* ptr   = sump_buffer + (sump.read_start + count * 2) % sump.ring_size;
+
+    for (i = 0; i + 1 < len && count > 0;) {
+        if (ptr == sump_buffer) ptr = sump_buffer + sump.ring_size;
+
+        // contiguous part up to the start of the ring
+        uint32_t n = (ptr - sump_buffer) / 2;
+        if (n > (len - i) / 2) n = (len - i) / 2;
+        if (n > count) n = count;
 
-        sump.read_count -= i;
+        sump_copy_rev16((uint16_t*)buf, (const uint16_t*)ptr, n);
+        buf += n * 2;
+        ptr -= n * 2;
+        i += n * 2;
+        count -= n;
     }
 
+    sump.read_count -= i / 2;
+
     // picoprobe_debug("%s: ret=%u\n", __func__, i);
     return i;
 }
 
-static uint32_t sump_tx16(uint8_t* buf, uint32_t len) {
-    uint32_t          i;
-    uint32_t          count = sump.read_count;
-    // picoprobe_debug("%s: count=%u, start=%u\n", __func__, count, sump.read_count);
-    volatile uint8_t* ptr   = sump_buffer + (sump.read_start + count * 2) % sump_memory_size;//SUMP_MEMORY_SIZE;
+// 4-channel mode: every byte holds two samples, the newer one in the high
+// nibble, and each of them is sent as a byte of its own
+static uint32_t sump_tx4(uint8_t* buf, uint32_t len) {
+    uint32_t i;
+    uint32_t count = sump.read_count;
+    uint8_t* ptr   = sump_buffer + (sump.read_start + count / 2) % sump.ring_size;
 
-    if (sump.flags & SUMP_FLAG1_ENABLE_RLE) {
-        uint16_t rle_last = 0x8000, rle_count = 0;
+    for (i = 0; i + 1 < len && count > 1; count -= 2, i += 2) {
+        if (ptr == sump_buffer) ptr = sump_buffer + sump.ring_size;
 
-        for (i = 0; i + 3 < len && count > 0; count--) {
-            if (ptr == sump_buffer) ptr = sump_buffer + sump_memory_size;//SUMP_MEMORY_SIZE;
+        uint8_t b = *(--ptr);
+        *buf++    = b >> 4;
+        *buf++    = b & 0xf;
+    }
+
+    sump.read_count -= i;
+    return i;
+}
 
-            ptr -= 2;
+// 24- and 32-bit samples, the former are sent as 3 bytes
+static uint32_t sump_tx32(uint8_t* buf, uint32_t len) {
+    uint32_t  i;
+    uint32_t  count = sump.read_count;
+    uint32_t* ptr   = (uint32_t*)(sump_buffer + (sump.read_start + count * 4) % sump.ring_size);
+    // the top channel is used for the RLE mark, so it has to be dropped
+    uint32_t mask = (sump.flags & SUMP_FLAG1_ENABLE_RLE) ? 0x7fffffffu : 0xffffffffu;
 
-            uint32_t b = *((uint16_t*)ptr) & 0x7fff;
+    if (sump.wire == 3) mask >>= 8;
 
-            if (b != rle_last) {
-                if (rle_count > 0) {
-                    *((uint32_t*)buf) = (rle_count - 1) | 0x8000 | ((uint32_t)rle_last << 16);
-                    buf += 4;
-                    i += 4;
-                    sump.read_count -= rle_count;
+    for (i = 0; i + sump.wire <= len && count > 0; count--, i += sump.wire) {
+        if (ptr == (uint32_t*)sump_buffer) ptr = (uint32_t*)(sump_buffer + sump.ring_size);
+
+        uint32_t v = *(--ptr) & mask;
+        *buf++     = v;
+        *buf++     = v >> 8;
+        *buf++     = v >> 16;
+        if (sump.wire == 4) *buf++ = v >> 24;
+    }
+
+    sump.read_count -= i / sump.wire;
+    return i;
+}
+
+static uint32_t sump_tx_rle(uint8_t* buf, uint32_t len) {
+    const uint32_t entsize = sump.width * 2;
+    const uint32_t maxrun  = (sump.width == 1) ? 0x80 : 0x8000;
+    const uint32_t oldest  =
+            (sump.rle_head > sump.rle_entries) ? (sump.rle_head - sump.rle_entries) : 0;
+    uint32_t i = 0;
+
+    // runs are sent newest-first, skipping anything captured after the window
+    while (i + entsize <= len && sump.read_count > 0) {
+        if (sump.rle_rd_left == 0) {
+            if (sump.rle_rd == oldest) {
+                // the window goes back further than the store does, pad it
+                // by repeating the oldest sample
+                sump.rle_rd_left = sump.read_count;
+            } else {
+                --sump.rle_rd;
+
+                uint32_t slot = sump.rle_rd % sump.rle_entries;
+                if (sump.width == 1) {
+                    uint16_t e       = ((const uint16_t*)sump.rle_buf)[slot];
+                    sump.rle_rd_val  = e >> 8;
+                    sump.rle_rd_left = (e & 0x7f) + 1;
+                } else {
+                    uint32_t e       = ((const uint32_t*)sump.rle_buf)[slot];
+                    sump.rle_rd_val  = e >> 16;
+                    sump.rle_rd_left = (e & 0x7fff) + 1;
                 }
 
-                rle_last  = b;
-                rle_count = 1;
+                uint32_t n = sump.rle_skip;
+                if (n > sump.rle_rd_left) n = sump.rle_rd_left;
+                sump.rle_skip -= n;
+                sump.rle_rd_left -= n;
                 continue;
             }
-            if (++rle_count == 0x8000) {
-                *((uint32_t*)buf) = (rle_count - 1) | 0x8000 | ((uint32_t)rle_last << 16);
-                buf += 4;
-                i += 4;
-                sump.read_count -= rle_count;
-                rle_count = 0;
+        }
+
+        uint32_t n = sump.rle_rd_left;
+        if (n > maxrun) n = maxrun;
+        if (n > sump.read_count) n = sump.read_count;
+
+        if (sump.width == 1) {
+            *((uint16_t*)(buf + i)) = (n - 1) | 0x80 | (sump.rle_rd_val << 8);
+        } else {
+            *((uint32_t*)(buf + i)) = (n - 1) | 0x8000 | (sump.rle_rd_val << 16);
+        }
+
+        sump.rle_rd_left -= n;
+        sump.read_count -= n;
+        i += entsize;
+    }
+
+    return i;
+}
+
+// transitional mode: expand the events into runs, newest-first
+static uint32_t sump_tx_trans(uint8_t* buf, uint32_t len) {
+    const bool     rle     = sump.flags & SUMP_FLAG1_ENABLE_RLE;
+    const uint32_t entsize = rle ? sump.width * 2 : sump.width;
+    const uint32_t maxrun  = (sump.width == 1) ? 0x80 : 0x8000;
+    uint32_t       i       = 0;
+
+    while (i + entsize <= len && sump.read_count > 0) {
+        if (sump.trans_run == 0) {
+            if (sump.trans_left == 0) {
+                // the window goes back further than the events do, pad it
+                // by repeating the oldest value
+                sump.trans_run = sump.read_count;
+            } else {
+                if (sump.trans_rd == 0) sump.trans_rd = sump.ring_size;
+                sump.trans_rd -= 8;
+                --sump.trans_left;
+
+                // the value holds from its sample up to the next event
+                const uint32_t* ev = (const uint32_t*)(sump_buffer + sump.trans_rd);
+                uint32_t        s  = ~ev[0];
+                sump.trans_run     = sump.trans_next - s;
+                sump.trans_next    = s;
+                sump.trans_val     = ev[1];
+                continue;
             }
         }
-    } else {
-        for (i = 0; i + 1 < len && count > 0; i += 2, count--) {
-            if (ptr == sump_buffer) ptr = sump_buffer + sump_memory_size;//SUMP_MEMORY_SIZE;
 
-            ptr -= 2;
-            *((uint16_t*)buf) = *((uint16_t*)ptr);
-            buf += 2;
+        uint32_t n = sump.trans_run;
+        if (n > sump.read_count) n = sump.read_count;
+
+        if (rle) {
+            if (n > maxrun) n = maxrun;
+
+            if (sump.width == 1)
+                *((uint16_t*)(buf + i)) = (n - 1) | 0x80 | ((sump.trans_val & 0x7f) << 8);
+            else
+                *((uint32_t*)(buf + i)) = (n - 1) | 0x8000 | ((sump.trans_val & 0x7fff) << 16);
+            i += entsize;
+        } else {
+            if (n > (len - i) / sump.width) n = (len - i) / sump.width;
+
+            if (sump.width == 1) {
+                memset(buf + i, sump.trans_val, n);
+            } else {
+                for (uint32_t k = 0; k < n; ++k) ((uint16_t*)(buf + i))[k] = sump.trans_val;
+            }
+            i += n * sump.width;
         }
 
-        sump.read_count -= i / 2;
+        sump.trans_run -= n;
+        sump.read_count -= n;
     }
 
-    // picoprobe_debug("%s: ret=%u\n", __func__, i);
     return i;
 }
 
@@ -749,10 +1459,19 @@ static uint32_t sump_fill_tx(uint8_t* buf, uint32_t len) {
     }
 
     if (sump.state == SUMP_STATE_DUMP) {
-        if (sump.width == 1) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);  // pairs with sump_capture_done()
+        if (sump.trans) {
+            ret = sump_tx_trans(buf, len);
+        } else if (sump.rle) {
+            ret = sump_tx_rle(buf, len);
+        } else if (sump.packed) {
+            ret = sump_tx4(buf, len);
+        } else if (sump.width == 1) {
             ret = sump_tx8(buf, len);
         } else if (sump.width == 2) {
             ret = sump_tx16(buf, len);
+        } else if (sump.width == 4) {
+            ret = sump_tx32(buf, len);
         } else {
             // invalid
             ret = sump_tx_empty(buf, len);
@@ -767,10 +1486,121 @@ static uint32_t sump_fill_tx(uint8_t* buf, uint32_t len) {
     return ret;
 }
 
+static uint32_t sump_stream_tx(void) {
+    // check this before looking at the queue, as the final chunk gets
+    // committed before the capture side switches to the dump state
+    bool done = sump.state == SUMP_STATE_DUMP;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // samples are sent out in chronological order, straight from the ring
+    const uint8_t* ptr;
+    uint32_t       avail = spsc_read_ptr(&sump.stream_q, &ptr);
+
+    if (avail == 0) {
+        // capture stopped and everything has been sent out
+        if (done) sump.state = SUMP_STATE_CONFIG;
+        return 0;
+    }
+
+    uint32_t space = tud_cdc_n_write_available(CDC_INTF);
+
+    if (sump.packed || sump.wire != sump.width) {
+        // samples need to be unpacked or narrowed first
+        uint32_t sent = 0;
+        if (space > sizeof(sump_tx_buf)) space = sizeof(sump_tx_buf);
+
+        if (sump.packed) {
+            if (avail > space / 2) avail = space / 2;
+            for (uint32_t i = 0; i < avail; ++i) {
+                sump_tx_buf[sent++] = ptr[i] & 0xf;
+                sump_tx_buf[sent++] = ptr[i] >> 4;
+            }
+        } else {
+            avail &= ~3u;
+            if (avail > space / 3 * 4) avail = space / 3 * 4;
+            for (uint32_t i = 0; i < avail; i += 4, sent += 3) memcpy(&sump_tx_buf[sent], &ptr[i], 3);
+        }
+        if (avail == 0) return 0;
+
+        tud_cdc_n_write(CDC_INTF, sump_tx_buf, sent);
+        spsc_release(&sump.stream_q, avail);
+        tud_cdc_n_write_flush(CDC_INTF);
+
+        return sent;
+    }
+
+    if (avail > space) avail = space;
+    if (avail == 0) return 0;
+
+    avail = tud_cdc_n_write(CDC_INTF, ptr, avail);
+    spsc_release(&sump.stream_q, avail);
+    tud_cdc_n_write_flush(CDC_INTF);
+
+    return avail;
+}
+
+static uint32_t sump_dump_tx(void) {
+    if (sump.tx_pos == sump.tx_len) {
+        if (sump.state != SUMP_STATE_DUMP && sump.state != SUMP_STATE_ERROR) return 0;
+
+        sump.tx_pos = 0;
+        sump.tx_len = sump_fill_tx(sump_tx_buf, sizeof(sump_tx_buf));
+        if (sump.tx_len == 0) return 0;
+    }
+
+    uint32_t sent = tud_cdc_n_write(CDC_INTF, &sump_tx_buf[sump.tx_pos], sump.tx_len - sump.tx_pos);
+    sump.tx_pos += sent;
+    tud_cdc_n_write_flush(CDC_INTF);
+
+    return sent;
+}
+
+static void sump_tx_account(uint32_t sent) {
+    if (sent) {
+        if (!sump.tx_active) {
+            sump.tx_active = true;
+            sump.tx_bytes  = 0;
+            sump.tx_start  = sump_hw_get_time_us();
+        }
+        sump.tx_bytes += sent;
+    }
+
+    if (sump.tx_active && sump.state == SUMP_STATE_CONFIG && sump.tx_pos == sump.tx_len) {
+        sump.tx_active     = false;
+        sump_tx_stat_bytes = sump.tx_bytes;
+        sump_tx_stat_usec  = sump_hw_get_time_us() - sump.tx_start;
+    }
+}
+
+void sump_get_tx_stats(uint32_t* bytes, uint32_t* usec) {
+    *bytes = sump_tx_stat_bytes;
+    *usec  = sump_tx_stat_usec;
+}
+
+bool sump_get_stream(void) { return sump_stream_mode; }
+void sump_set_stream(bool v) {
+    sump_do_stop();
+    sump_stream_mode = v;
+}
+
+bool sump_get_packed(void) { return sump_packed_mode; }
+void sump_set_packed(bool v) {
+    sump_do_stop();
+    sump_packed_mode = v;
+    sump.packed      = sump_packed_mode && sump.width == 1;
+}
+
+bool sump_get_trans(void) { return sump_trans_mode; }
+void sump_set_trans(bool v) {
+    sump_do_stop();
+    sump_trans_mode = v;
+}
+
 static void sump_init_connect(void) {
     memset(&sump, 0, sizeof(sump));
     memset(sump_buffer, 0, sump_memory_size);
     sump.width       = 1;
+    sump.wire        = 1;
     sump.divider     = 1000;  // a safe value
     sump.read_count  = 256;
     sump.delay_count = 256;
@@ -802,12 +1632,15 @@ void cdc_sump_task(void) {
             sump.cdc_connected = true;
         }
 
-        if (sump.state == SUMP_STATE_DUMP || sump.state == SUMP_STATE_ERROR) {
-            if (tud_cdc_n_write_available(CDC_INTF) >= sizeof(buf)) {
-                uint32_t tx_len = sump_fill_tx(buf, sizeof(buf));
-                tud_cdc_n_write(CDC_INTF, buf, tx_len);
-                tud_cdc_n_write_flush(CDC_INTF);
-            }
+        if (sump.stream) {
+            if (sump.state == SUMP_STATE_SAMPLING || sump.state == SUMP_STATE_DUMP)
+                sump_tx_account(sump_stream_tx());
+        } else if (sump.trans && sump.state == SUMP_STATE_SAMPLING) {
+            // there's no sample count to wait for, so stop on time
+            if (sump_hw_get_time_us() - sump.trans_start >= sump.trans_len) sump_do_finish();
+        } else if (sump.state == SUMP_STATE_DUMP || sump.state == SUMP_STATE_ERROR
+                || sump.tx_pos != sump.tx_len) {
+            sump_tx_account(sump_dump_tx());
         }
         if (tud_cdc_n_available(CDC_INTF)) {
             uint32_t cmd_len = tud_cdc_n_read(CDC_INTF, buf, sizeof(buf));
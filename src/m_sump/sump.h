@@ -65,6 +65,34 @@ uint32_t sump_calc_sysclk_divider();
 uint8_t *sump_capture_get_next_dest(uint32_t numch);
 void sump_capture_callback_cancel(void);
 void sump_capture_callback(uint32_t ch, uint32_t numch);
+// runs on the capture side, see sump_hw_capture_finish()
+void sump_capture_callback_finish(void);
+
+/* streaming mode: instead of capturing into the ring buffer and dumping it
+ * afterwards, samples are sent to the host (in chronological order, without
+ * RLE) while sampling continues, until the host sends SUMP_CMD_FINISH or
+ * SUMP_CMD_RESET, or until USB can't keep up with the sample rate. */
+bool sump_get_stream(void);
+void sump_set_stream(bool v);
+
+/* 4-channel mode: 8-bit captures only sample the low 4 channels of the
+ * group, packing two samples per byte, for twice the capture depth. The
+ * samples are still sent to the host as bytes. */
+bool sump_get_packed(void);
+void sump_set_packed(bool v);
+
+/* transitional mode: instead of sampling at a fixed rate into sump_buffer,
+ * only changes of the inputs are stored, with a timestamp, so sparse
+ * activity takes up a lot less memory. the dump expands them back into
+ * uniform samples (or RLE). there are no triggers in this mode, and it only
+ * works for 8- and 16-bit captures, at up to sysclk/12. */
+#define SUMP_TRANS_CYCLES 12  /* PIO cycles per sample */
+bool sump_get_trans(void);
+void sump_set_trans(bool v);
+
+/* statistics of the last completed data transfer to the host (dump or
+ * stream), for measuring USB throughput */
+void sump_get_tx_stats(uint32_t* bytes, uint32_t* usec);
 
 void cdc_sump_init(void);
 void cdc_sump_deinit(void);
@@ -76,16 +104,32 @@ void sump_hw_get_cpu_name(char cpu[32]);
 void sump_hw_get_hw_name(char hw[32]);
 
 uint32_t sump_hw_get_sysclk(void);
+// sysclk of the selected overclock profile, i.e. the maximal one
+uint32_t sump_hw_get_max_sysclk(void);
+uint32_t sump_hw_get_time_us(void);
 
 void sump_hw_init(void);
 void sump_hw_deinit(void);
 
+/* width: DMA transfer size in bytes, bits: sample width (4, 8, 16 or 32) */
 void sump_hw_capture_setup_next(uint32_t ch, uint32_t mask, uint32_t chunk_size, uint32_t next_count, uint8_t width);
-void sump_hw_capture_start(uint8_t width, int flags, uint32_t chunk_size, uint8_t *destbuf);
+void sump_hw_capture_start(uint8_t bits, int flags, uint32_t chunk_size, uint8_t *destbuf);
 void sump_hw_capture_stop(void);
+/* transitional mode, see above. stop returns the number of bytes written to
+ * the current chunk, including a closing event with the current timestamp */
+void sump_hw_capture_start_trans(uint8_t bits, int flags, uint32_t chunk_size, uint8_t *destbuf);
+uint32_t sump_hw_capture_stop_trans(void);
+/* ends the capture early (SUMP_CMD_FINISH): calls sump_capture_callback_finish()
+ * on the capture side, where it can't race with sump_capture_callback() */
+void sump_hw_capture_finish(void);
 void sump_hw_stop(void);
 
+/* overclock profiles: (sysclk, core voltage) pairs, 0 is the stock clock.
+ * sump_hw_set_overclock() selects the fastest profile captures may use, a
+ * capture then runs at the one that gives the most exact sample rate */
 uint8_t sump_hw_get_overclock(void);
-void sump_hw_set_overclock(uint8_t v);
+bool sump_hw_set_overclock(uint8_t v);
+bool sump_hw_get_clock_profile(uint8_t i, uint32_t *khz, uint16_t *mv);
+void sump_hw_set_clock_profile(uint8_t i);
 
 #endif
@@ -0,0 +1,102 @@
+// vim: set et:
+
+#include <string.h>
+
+#include "spsc.h"
+
+/* the acquire/release pairs compile to plain loads and stores with a DMB on
+ * ARMv6-M, which is all that's needed for ordering between the two cores */
+#define LOAD_ACQ(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* head and tail run from 0 to 2*size-1, which tells a full queue apart from
+ * an empty one without needing a power-of-two size */
+static inline uint32_t spsc_wrap(const struct spsc* q, uint32_t p) {
+    return (p >= 2 * q->size) ? (p - 2 * q->size) : p;
+}
+static inline uint32_t spsc_off(const struct spsc* q, uint32_t p) {
+    return (p >= q->size) ? (p - q->size) : p;
+}
+static inline uint32_t spsc_count(const struct spsc* q, uint32_t head, uint32_t tail) {
+    return (head >= tail) ? (head - tail) : (head + 2 * q->size - tail);
+}
+
+void spsc_init(struct spsc* q, void* buf, uint32_t size) {
+    q->buf  = buf;
+    q->size = size;
+    spsc_reset(q, 0);
+}
+void spsc_reset(struct spsc* q, uint32_t pos) {
+    pos %= q->size;
+    STORE_REL(&q->tail, pos);
+    STORE_REL(&q->head, pos);
+}
+
+uint32_t spsc_used(const struct spsc* q) {
+    uint32_t tail = LOAD_ACQ(&q->tail);
+    return spsc_count(q, LOAD_ACQ(&q->head), tail);
+}
+uint32_t spsc_free(const struct spsc* q) {
+    return q->size - spsc_used(q);
+}
+
+static void spsc_copy_in(struct spsc* q, uint32_t pos, const uint8_t* src, uint32_t len) {
+    uint32_t off = spsc_off(q, pos);
+    uint32_t n   = q->size - off;
+
+    if (n > len) n = len;
+    memcpy(q->buf + off, src, n);
+    memcpy(q->buf, src + n, len - n);
+}
+static void spsc_copy_out(const struct spsc* q, uint32_t pos, uint8_t* dst, uint32_t len) {
+    uint32_t off = spsc_off(q, pos);
+    uint32_t n   = q->size - off;
+
+    if (n > len) n = len;
+    memcpy(dst, q->buf + off, n);
+    memcpy(dst + n, q->buf, len - n);
+}
+
+bool spsc_write(struct spsc* q, const void* src, uint32_t len) {
+    uint32_t head = q->head;
+
+    if (q->size - spsc_count(q, head, LOAD_ACQ(&q->tail)) < len) return false;
+
+    spsc_copy_in(q, head, src, len);
+    STORE_REL(&q->head, spsc_wrap(q, head + len));
+    return true;
+}
+uint32_t spsc_write_ptr(const struct spsc* q, uint8_t** ptr) {
+    uint32_t head  = q->head;
+    uint32_t off   = spsc_off(q, head);
+    uint32_t avail = q->size - spsc_count(q, head, LOAD_ACQ(&q->tail));
+
+    if (avail > q->size - off) avail = q->size - off;
+    *ptr = q->buf + off;
+    return avail;
+}
+void spsc_commit(struct spsc* q, uint32_t len) {
+    STORE_REL(&q->head, spsc_wrap(q, q->head + len));
+}
+
+bool spsc_read(struct spsc* q, void* dst, uint32_t len) {
+    uint32_t tail = q->tail;
+
+    if (spsc_count(q, LOAD_ACQ(&q->head), tail) < len) return false;
+
+    spsc_copy_out(q, tail, dst, len);
+    STORE_REL(&q->tail, spsc_wrap(q, tail + len));
+    return true;
+}
+uint32_t spsc_read_ptr(const struct spsc* q, const uint8_t** ptr) {
+    uint32_t tail  = q->tail;
+    uint32_t off   = spsc_off(q, tail);
+    uint32_t avail = spsc_count(q, LOAD_ACQ(&q->head), tail);
+
+    if (avail > q->size - off) avail = q->size - off;
+    *ptr = q->buf + off;
+    return avail;
+}
+void spsc_release(struct spsc* q, uint32_t len) {
+    STORE_REL(&q->tail, spsc_wrap(q, q->tail + len));
+}
@@ -0,0 +1,48 @@
+// vim: set et:
+
+#ifndef SPSC_H_
+#define SPSC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Lock-free single-producer single-consumer byte queue, usable between
+ * interrupt handlers and thread code, or between the two cores of a
+ * multicore MCU.
+ *
+ * The head and tail are written only by the producer and the consumer,
+ * respectively. The size does not have to be a power of two, and a queue
+ * can be filled up completely (i.e. it holds 'size' bytes, not size-1),
+ * as long as size is below 2^31. Data can
+ * either be copied in and out (spsc_write/spsc_read, all-or-nothing, meant
+ * for small fixed-size messages), or be produced and consumed in-place
+ * (spsc_write_ptr/spsc_commit, spsc_read_ptr/spsc_release), e.g. when the
+ * producer is a DMA engine.
+ */
+struct spsc {
+    uint8_t* buf;
+    uint32_t size;
+    uint32_t head; // written by the producer only
+    uint32_t tail; // written by the consumer only
+};
+
+void spsc_init(struct spsc* q, void* buf, uint32_t size);
+// empties the queue, continuing at buf[pos % size]. only allowed when
+// neither side is accessing the queue
+void spsc_reset(struct spsc* q, uint32_t pos);
+
+uint32_t spsc_used(const struct spsc* q);
+uint32_t spsc_free(const struct spsc* q);
+
+/* producer side */
+bool     spsc_write(struct spsc* q, const void* src, uint32_t len);
+uint32_t spsc_write_ptr(const struct spsc* q, uint8_t** ptr);
+void     spsc_commit(struct spsc* q, uint32_t len);
+
+/* consumer side */
+bool     spsc_read(struct spsc* q, void* dst, uint32_t len);
+uint32_t spsc_read_ptr(const struct spsc* q, const uint8_t** ptr);
+void     spsc_release(struct spsc* q, uint32_t len);
+
+#endif
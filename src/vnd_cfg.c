@@ -5,78 +5,47 @@
 #include <string.h>
 #include <tusb.h>
 
+#include "bulkio.h"
 #include "info.h"
 #include "mode.h"
 #include "vnd_cfg.h"
-#include "thread.h"
 
 #if CFG_TUD_VENDOR > 0
 static uint8_t rx_buf[CFG_TUD_VENDOR_TX_BUFSIZE];
 static uint8_t tx_buf[CFG_TUD_VENDOR_RX_BUFSIZE];
 
-static uint32_t rxavail, rxpos, txpos;
-
-static int VND_N_CFG = 0;
+static struct bulkio cfg_io;
 
 void vnd_cfg_init(void) {
-    rxavail = 0;
-    rxpos   = 0;
-    txpos   = 0;
-
-    VND_N_CFG = 0;
+    bulkio_init(&cfg_io, &bulkio_vendor_ops, 0, rx_buf, sizeof rx_buf,
+            tx_buf, sizeof tx_buf);
 }
 
 void vnd_cfg_set_itf_num(int itf) {
-    VND_N_CFG = itf;
+    cfg_io.itf = itf;
 }
 
-// TODO: this is duplicated several times over the codebase, maybe reduce this
-uint8_t vnd_cfg_read_byte(void) {
-    while (rxavail <= 0) {
-        if (!tud_vendor_n_mounted(VND_N_CFG) || !tud_vendor_n_available(VND_N_CFG)) {
-            thread_yield();
-            continue;
-        }
-
-        rxpos   = 0;
-        rxavail = tud_vendor_n_read(VND_N_CFG, rx_buf, sizeof rx_buf);
-
-        if (rxavail == 0) thread_yield();
-    }
-
-    uint8_t rv = rx_buf[rxpos];
-    ++rxpos;
-    --rxavail;
+struct bulkio* vnd_cfg_get_io(void) {
+    return &cfg_io;
+}
 
-    return rv;
+uint8_t vnd_cfg_read_byte(void) {
+    return bulkio_read_byte(&cfg_io);
+}
+void vnd_cfg_read(void* buf, uint32_t len) {
+    bulkio_read(&cfg_io, buf, len);
 }
 void vnd_cfg_drop_incoming(void) {
-    rxavail = 0;
-    rxpos = 0;
-
-    // empty tinyusb internal buffer
-    if (tud_vendor_n_mounted(VND_N_CFG)) {
-        while (tud_vendor_n_available(VND_N_CFG)) {
-            tud_vendor_n_read(VND_N_CFG, rx_buf, sizeof rx_buf);
-        }
-    }
+    bulkio_drop_incoming(&cfg_io);
 }
 void vnd_cfg_write_flush(void) {
-    // TODO: is this needed?
-    while (tud_vendor_n_write_available(VND_N_CFG) < txpos) {
-        thread_yield();
-    }
-
-    tud_vendor_n_write(VND_N_CFG, tx_buf, txpos);
-    txpos = 0;
+    bulkio_flush(&cfg_io);
 }
 void vnd_cfg_write_byte(uint8_t v) {
-    if (txpos == CFG_TUD_VENDOR_TX_BUFSIZE) {
-        vnd_cfg_write_flush();
-    }
-
-    tx_buf[txpos] = v;
-    ++txpos;
+    bulkio_write_byte(&cfg_io, v);
+}
+void vnd_cfg_write(const void* buf, uint32_t len) {
+    bulkio_write(&cfg_io, buf, len);
 }
 void vnd_cfg_write_resp_no_drop(enum cfg_resp stat, uint32_t len, const void* data) {
     if (len > 0x3fffff) {
@@ -96,11 +65,7 @@ void vnd_cfg_write_resp_no_drop(enum cfg_resp stat, uint32_t len, const void* da
         vnd_cfg_write_byte(((len >> 14) & 0x7f));
     }
 
-    if (data) {
-        for (size_t i = 0; i < len; ++i) {
-            vnd_cfg_write_byte(((const uint8_t*)data)[i]);
-        }
-    }
+    if (data) vnd_cfg_write(data, len);
 
     vnd_cfg_write_flush();
 }
@@ -200,10 +165,13 @@ void vnd_cfg_task(void) {
 }
 #else /* CFG_TUD_VENDOR == 0 */
 void vnd_cfg_init(void) { }
+struct bulkio* vnd_cfg_get_io(void) { return NULL; }
 uint8_t vnd_cfg_read_byte(void) { return 0xff; }
+void vnd_cfg_read(void* buf, uint32_t len) { memset(buf, 0xff, len); }
 void vnd_cfg_drop_incoming(void) { }
 void vnd_cfg_write_flush(void) { }
 void vnd_cfg_write_byte(uint8_t v) { (void)v; }
+void vnd_cfg_write(const void* buf, uint32_t len) { (void)buf; (void)len; }
 void vnd_cfg_write_resp(enum cfg_resp stat, uint16_t len, const void* data) {
     (void)stat; (void)len; (void)data;
 }
@@ -20,6 +20,8 @@
 
 #define VND_CFG_PROTO_VER 0x0010
 
+struct bulkio;
+
 void vnd_cfg_init(void);
 void vnd_cfg_task(void);
 
@@ -54,9 +56,14 @@ enum cfg_resp {
 
 void    vnd_cfg_set_itf_num(int itf);
 uint8_t vnd_cfg_read_byte (void);
+void    vnd_cfg_read(void* buf, uint32_t len);
 void    vnd_cfg_drop_incoming(void);
 void    vnd_cfg_write_flush(void);
 void    vnd_cfg_write_byte(uint8_t v);
+void    vnd_cfg_write(const void* buf, uint32_t len);
+// the underlying reader/writer, for handlers that can use the same code for
+// the cfg interface and their own
+struct bulkio* vnd_cfg_get_io(void);
 void    vnd_cfg_write_resp_no_drop(enum cfg_resp stat, uint32_t len, const void* data);
 void    vnd_cfg_write_resp(enum cfg_resp stat, uint32_t len, const void* data);
 void    vnd_cfg_write_str(enum cfg_resp stat, const char* str);
@@ -0,0 +1,34 @@
+// vim: set et:
+
+#ifndef __DAP_CONFIG_H__
+#define __DAP_CONFIG_H__
+
+/*
+ * Host stand-in for bsp/rp2040/DAP_config.h, with only what the JTAG scan
+ * engine (bsp/rp2040/m_default/dap_jtag_scan.c) uses. TMS and TDI are plain
+ * variables, jtag_shift() is up to the test.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DAP_SWD           0
+#define DAP_JTAG          1
+#define DAP_JTAG_DEV_CNT  8U
+
+extern uint8_t  host_tms, host_tdi;
+extern uint32_t host_tck_count;
+
+static inline void PIN_SWDIO_TMS_SET(void) { host_tms = 1; }
+static inline void PIN_SWDIO_TMS_CLR(void) { host_tms = 0; }
+static inline void PIN_TDI_OUT(uint32_t bit) { host_tdi = bit & 1; }
+
+static inline uint32_t TIMESTAMP_GET(void) { return host_tck_count; }
+
+void PORT_JTAG_CONFIGURE(void);
+
+// shift n bits through the JTAG state machine, with TMS left as it is. tdi
+// may be NULL for all-ones, tdo may be NULL if TDO isn't needed
+void jtag_shift(uint32_t n, const uint8_t* tdi, uint8_t* tdo);
+
+#endif /* __DAP_CONFIG_H__ */
@@ -0,0 +1,14 @@
+// vim: set et:
+
+#ifndef __CMSIS_COMPILER_H
+#define __CMSIS_COMPILER_H
+
+/* host stand-in for the CMSIS compiler abstraction used by DAP.h */
+
+#define __ASM                 __asm
+#define __STATIC_INLINE       static inline
+#define __STATIC_FORCEINLINE  static inline __attribute__((__always_inline__))
+#define __WEAK                __attribute__((__weak__))
+#define __NOP()               __asm__ volatile("")
+
+#endif
@@ -0,0 +1,38 @@
+// vim: set et:
+
+#ifndef TESTS_TUSB_H_
+#define TESTS_TUSB_H_
+
+/*
+ * Host stand-in for the parts of the TinyUSB device API that the code under
+ * test uses. The tests provide the functions themselves, so that they can
+ * play the host side of the USB link.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define TUD_OPT_HIGH_SPEED 0
+#include "tusb_config.h"
+
+#ifndef count_of
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+bool     tud_cdc_n_connected(uint8_t itf);
+uint32_t tud_cdc_n_available(uint8_t itf);
+uint32_t tud_cdc_n_read(uint8_t itf, void* buf, uint32_t len);
+uint32_t tud_cdc_n_write(uint8_t itf, const void* buf, uint32_t len);
+uint32_t tud_cdc_n_write_str(uint8_t itf, const char* str);
+uint32_t tud_cdc_n_write_flush(uint8_t itf);
+uint32_t tud_cdc_n_write_available(uint8_t itf);
+
+bool     tud_vendor_n_mounted(uint8_t itf);
+uint32_t tud_vendor_n_available(uint8_t itf);
+uint32_t tud_vendor_n_read(uint8_t itf, void* buf, uint32_t len);
+uint32_t tud_vendor_n_write(uint8_t itf, const void* buf, uint32_t len);
+uint32_t tud_vendor_n_write_available(uint8_t itf);
+
+#endif
@@ -0,0 +1,328 @@
+// vim: set et:
+
+/*
+ * The JTAG scan engine (JTAG_IR, JTAG_ReadIDCode, JTAG_Transfer and
+ * JTAG_WriteAbort) driving a model of a chain of TAPs. Random chains of up
+ * to DAP_JTAG_DEV_CNT TAPs get random accesses to random TAPs, and everything
+ * the TAPs see at Update-IR/Update-DR is logged, together with what the
+ * functions return. The log has to match jtag_scan.vec, which was made with
+ * '-g' from the implementation that built each scan out of JTAG_Sequence
+ * calls, before the padding was cached.
+ *
+ * The vectors only have OK acks, as the old code stopped the scan early on
+ * anything else. WAIT and FAULT are checked separately.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DAP_config.h"
+#include <DAP.h>
+
+DAP_Data_t DAP_Data;
+uint8_t    host_tms, host_tdi = 1;
+uint32_t   host_tck_count;
+
+/* TAP chain model ========================================================= */
+
+enum {
+    RESET, IDLE,
+    SELDR, CAPDR, SHDR, EX1DR, PAUDR, EX2DR, UPDR,
+    SELIR, CAPIR, SHIR, EX1IR, PAUIR, EX2IR, UPIR
+};
+
+// next state for TMS=0 and TMS=1
+static const uint8_t tap_next[16][2] = {
+    [RESET] = {IDLE, RESET},  [IDLE] = {IDLE, SELDR},
+    [SELDR] = {CAPDR, SELIR}, [CAPDR] = {SHDR, EX1DR},  [SHDR] = {SHDR, EX1DR},
+    [EX1DR] = {PAUDR, UPDR},  [PAUDR] = {PAUDR, EX2DR}, [EX2DR] = {SHDR, UPDR},
+    [UPDR] = {IDLE, SELDR},   [SELIR] = {CAPIR, RESET}, [CAPIR] = {SHIR, EX1IR},
+    [SHIR] = {SHIR, EX1IR},   [EX1IR] = {PAUIR, UPIR},  [PAUIR] = {PAUIR, EX2IR},
+    [EX2IR] = {SHIR, UPIR},   [UPIR] = {IDLE, SELDR},
+};
+
+static struct {
+    uint32_t ir, idcode;
+    uint64_t irsh, drsh;
+} taps[DAP_JTAG_DEV_CNT];
+static uint8_t  tap_state = IDLE;
+static uint32_t scan_seq;     // number of DR scans so far
+static uint32_t ack_capture;  // JTAG-DP ack the next DPACC/APACC scan captures
+
+static char   log_buf[1 << 18];
+static size_t log_len;
+
+static void log_printf(const char* fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    log_len += vsnprintf(log_buf + log_len, sizeof(log_buf) - log_len, fmt, ap);
+    va_end(ap);
+    if (log_len >= sizeof log_buf) {
+        fprintf(stderr, "log overflow\n");
+        abort();
+    }
+}
+
+static uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    return x ^ (x >> 16);
+}
+
+static uint32_t tap_dr_len(int t) {
+    switch (taps[t].ir) {
+        case JTAG_IDCODE: return 32;
+        case JTAG_ABORT:
+        case JTAG_DPACC:
+        case JTAG_APACC: return 35;
+        default: return 1;  // BYPASS, or anything we don't model
+    }
+}
+
+// TDI goes into the last TAP, index 0 is the one at TDO
+static void tap_shift(bool ir, int tdi) {
+    for (int t = DAP_Data.jtag_dev.count - 1; t >= 0; --t) {
+        uint32_t len = ir ? DAP_Data.jtag_dev.ir_length[t] : tap_dr_len(t);
+        uint64_t* sh = ir ? &taps[t].irsh : &taps[t].drsh;
+        int out = *sh & 1;
+
+        *sh = (*sh >> 1) | ((uint64_t)tdi << (len - 1));
+        tdi = out;
+    }
+}
+
+static void tap_update_dr(void) {
+    for (int t = 0; t < DAP_Data.jtag_dev.count; ++t) {
+        uint64_t dr = taps[t].drsh;
+
+        if (tap_dr_len(t) != 35) continue;
+        // the data of a read isn't used, and the old code didn't drive it
+        if (dr & 1)
+            log_printf(" dr t%d r %x\n", t, (unsigned)(dr >> 1) & 3);
+        else
+            log_printf(" dr t%d w %x %08x\n", t, (unsigned)(dr >> 1) & 3, (unsigned)(dr >> 3));
+    }
+}
+
+// one TCK cycle, returns TDO
+static int tap_clk(int tms, int tdi) {
+    int tdo = 0;
+
+    ++host_tck_count;
+    switch (tap_state) {
+        case CAPIR:
+            for (int t = 0; t < DAP_Data.jtag_dev.count; ++t) taps[t].irsh = 1;
+            break;
+        case SHIR:
+            tdo = taps[0].irsh & 1;
+            tap_shift(true, tdi);
+            break;
+        case CAPDR:
+            ++scan_seq;
+            for (int t = 0; t < DAP_Data.jtag_dev.count; ++t) {
+                uint32_t len = tap_dr_len(t);
+                if (len == 32)
+                    taps[t].drsh = taps[t].idcode;
+                else if (len == 35)
+                    taps[t].drsh = (uint64_t)hash32(scan_seq * 8 + t) << 3 | ack_capture;
+                else
+                    taps[t].drsh = 0;
+            }
+            break;
+        case SHDR:
+            tdo = taps[0].drsh & 1;
+            tap_shift(false, tdi);
+            break;
+    }
+
+    tap_state = tap_next[tap_state][tms];
+    if (tap_state == UPIR) {
+        log_printf(" ir");
+        for (int t = 0; t < DAP_Data.jtag_dev.count; ++t) {
+            uint32_t len = DAP_Data.jtag_dev.ir_length[t];
+            taps[t].ir = (uint32_t)(taps[t].irsh & ((1ull << len) - 1));
+            log_printf(" %x", taps[t].ir);
+        }
+        log_printf("\n");
+    } else if (tap_state == UPDR) {
+        tap_update_dr();
+    }
+
+    return tdo;
+}
+
+void jtag_shift(uint32_t n, const uint8_t* tdi, uint8_t* tdo) {
+    for (uint32_t i = 0; i < n; ++i) {
+        int bit = tdi ? (tdi[i >> 3] >> (i & 7)) & 1 : 1;
+
+        bit = tap_clk(host_tms, bit);
+        if (tdo) {
+            if (bit)
+                tdo[i >> 3] |= 1 << (i & 7);
+            else
+                tdo[i >> 3] &= ~(1 << (i & 7));
+        }
+    }
+}
+
+/* accesses ================================================================ */
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// what DAP_JTAG_Configure does
+static void chain_setup(uint32_t count, const uint8_t* lens) {
+    uint32_t bits = 0;
+
+    DAP_Data.jtag_dev.count = (uint8_t)count;
+    for (uint32_t n = 0; n < count; ++n) {
+        DAP_Data.jtag_dev.ir_length[n] = lens[n];
+        DAP_Data.jtag_dev.ir_before[n] = (uint16_t)bits;
+        bits += lens[n];
+    }
+    for (uint32_t n = 0; n < count; ++n) {
+        bits -= lens[n];
+        DAP_Data.jtag_dev.ir_after[n] = (uint16_t)bits;
+    }
+
+    PORT_JTAG_CONFIGURE();
+}
+
+static void run_chains(void) {
+    rng_state   = 1;
+    ack_capture = 2;  // OK
+    for (int c = 0; c < 20; ++c) {
+        uint8_t  lens[DAP_JTAG_DEV_CNT];
+        uint32_t count = 1 + rng() % DAP_JTAG_DEV_CNT;
+
+        log_printf("chain");
+        for (uint32_t t = 0; t < count; ++t) {
+            lens[t] = (rng() % 8 == 0) ? 32 : (4 + rng() % 9);
+            taps[t].idcode = hash32(c * 16 + t) | 1;
+            log_printf(" %u", lens[t]);
+        }
+        log_printf("\n");
+        chain_setup(count, lens);
+
+        for (int op = 0; op < 24; ++op) {
+            uint32_t index = rng() % count, request, data;
+
+            DAP_Data.jtag_dev.index         = (uint8_t)index;
+            DAP_Data.transfer.idle_cycles   = rng() % 4;
+            log_printf("t%u:", index);
+            switch (rng() % 4) {
+                case 0:
+                    log_printf(" idcode\n");
+                    JTAG_IR(JTAG_IDCODE);
+                    log_printf(" = %08x\n", JTAG_ReadIDCode());
+                    break;
+                case 1:
+                    data = rng();
+                    log_printf(" abort %08x\n", data);
+                    JTAG_IR(JTAG_ABORT);
+                    JTAG_WriteAbort(data);
+                    break;
+                default:
+                    request = rng() & (DAP_TRANSFER_APnDP | DAP_TRANSFER_RnW | DAP_TRANSFER_A2
+                            | DAP_TRANSFER_A3 | DAP_TRANSFER_TIMESTAMP);
+                    data    = rng();
+                    log_printf(" transfer %02x %08x\n", request, data);
+                    JTAG_IR((request & DAP_TRANSFER_APnDP) ? JTAG_APACC : JTAG_DPACC);
+                    // a couple of them on the same IR, as DAP_Transfer does
+                    for (int k = rng() % 3; k >= 0; --k) {
+                        uint32_t ack = JTAG_Transfer(request, &data);
+                        log_printf(" = %u %08x\n", ack, data);
+                    }
+                    break;
+            }
+        }
+    }
+}
+
+/* checks ================================================================== */
+
+static int check_vectors(const char* path) {
+    static char vec[sizeof log_buf];
+    size_t      vlen = 0;
+    char        line[256];
+    FILE*       f = fopen(path, "r");
+
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    while (fgets(line, sizeof line, f) != NULL) {
+        if (line[0] == '#') continue;
+        size_t l = strlen(line);
+        if (vlen + l >= sizeof vec) break;
+        memcpy(vec + vlen, line, l);
+        vlen += l;
+    }
+    fclose(f);
+
+    log_len = 0;
+    run_chains();
+
+    bool ok = tap_state == IDLE && log_len == vlen && !memcmp(log_buf, vec, vlen);
+    if (!ok) {
+        // point at the first line that differs
+        size_t i = 0, lineno = 1;
+        for (; i < log_len && i < vlen && log_buf[i] == vec[i]; ++i)
+            if (vec[i] == '\n') ++lineno;
+        printf("jtag vectors: FAIL at line %zu of the log (TAP state %d)\n", lineno, tap_state);
+        return 1;
+    }
+
+    printf("jtag vectors: ok\n");
+    return 0;
+}
+
+// JTAG-DP acks are OK/FAULT = 0b010 and WAIT = 0b001, the DAP wants them
+// as 1, 4 and 2. The scan is completed either way.
+static int check_acks(void) {
+    static const uint32_t jtag_ack[] = {2, 1, 4};
+    static const uint32_t dap_ack[]  = {DAP_TRANSFER_OK, DAP_TRANSFER_WAIT, DAP_TRANSFER_FAULT};
+    static const uint8_t  lens[]     = {5, 4, 9};
+    int                   bad        = 0;
+
+    chain_setup(3, lens);
+    for (uint32_t index = 0; index < 3; ++index) {
+        DAP_Data.jtag_dev.index = (uint8_t)index;
+        JTAG_IR(JTAG_DPACC);
+        for (int i = 0; i < 3; ++i) {
+            uint32_t data = 0x5a5a5a5a, seq = scan_seq;
+
+            ack_capture = jtag_ack[i];
+            uint32_t ack = JTAG_Transfer(DAP_TRANSFER_RnW, &data);
+            if (ack != dap_ack[i] || tap_state != IDLE || scan_seq != seq + 1) ++bad;
+            if (data != ((ack == DAP_TRANSFER_OK) ? hash32(scan_seq * 8 + index) : 0x5a5a5a5a))
+                ++bad;
+        }
+    }
+
+    printf("jtag acks: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "-g")) {
+        run_chains();
+        fwrite(log_buf, 1, log_len, stdout);
+        return 0;
+    }
+
+    if (check_vectors("jtag_scan.vec") || check_acks()) return 1;
+
+    return 0;
+}
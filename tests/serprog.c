@@ -0,0 +1,510 @@
+// vim: set et:
+
+/*
+ * The serprog command parser (cdc_serprog.c) on top of bulkio, driving a fake
+ * SPI device. The checks feed it commands through a USB stack that hands out
+ * and takes in random amounts at a time, and compare what the device and the
+ * host got with what was asked for, for both the CDC and the vendor (vnd_cfg)
+ * transports. With -b, the payload paths are timed with full-speed sized
+ * reads, next to the same payload read one bulkio_read_byte() at a time, as
+ * the parser used to. The numbers are host CPU time, for comparing the two.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <tusb.h>
+
+#include "m_default/bsp-feature.h"
+
+#include "bulkio.h"
+#include "thread.h"
+#include "vnd_cfg.h"
+
+#include "m_default/serprog.h"
+
+/* USB host side =========================================================== */
+
+static uint8_t  host_in[1 << 21];
+static uint32_t host_in_len, host_in_pos;
+static uint8_t  host_out[1 << 21];
+static uint32_t host_out_len;
+// random partial reads and writes, and keep what's written. otherwise the
+// USB stack hands out a packet at a time and only counts what it gets.
+static bool     host_random;
+static uint32_t idle_yields;
+
+static uint32_t usb_available(uint8_t itf) { return host_in_len - host_in_pos; }
+static uint32_t usb_read(uint8_t itf, void* buf, uint32_t len) {
+    uint32_t n = host_random ? (1 + rand() % 64) : 64;
+
+    if (n > len) n = len;
+    if (n > host_in_len - host_in_pos) n = host_in_len - host_in_pos;
+    memcpy(buf, host_in + host_in_pos, n);
+    host_in_pos += n;
+    idle_yields = 0;
+
+    return n;
+}
+static uint32_t usb_write_available(uint8_t itf) {
+    return host_random ? (rand() % 300) : CFG_TUD_CDC_TX_BUFSIZE;
+}
+static uint32_t usb_write(uint8_t itf, const void* buf, uint32_t len) {
+    if (host_random) {
+        if (host_out_len + len > sizeof host_out) {
+            fprintf(stderr, "host_out overflow\n");
+            abort();
+        }
+        memcpy(host_out + host_out_len, buf, len);
+    }
+    host_out_len += len;
+    idle_yields = 0;
+
+    return len;
+}
+
+bool     tud_cdc_n_connected(uint8_t itf) { return true; }
+uint32_t tud_cdc_n_available(uint8_t itf) { return usb_available(itf); }
+uint32_t tud_cdc_n_read(uint8_t itf, void* buf, uint32_t len) { return usb_read(itf, buf, len); }
+uint32_t tud_cdc_n_write_available(uint8_t itf) { return usb_write_available(itf); }
+uint32_t tud_cdc_n_write(uint8_t itf, const void* buf, uint32_t len) {
+    return usb_write(itf, buf, len);
+}
+uint32_t tud_cdc_n_write_flush(uint8_t itf) { return 0; }
+
+bool     tud_vendor_n_mounted(uint8_t itf) { return true; }
+uint32_t tud_vendor_n_available(uint8_t itf) { return usb_available(itf); }
+uint32_t tud_vendor_n_read(uint8_t itf, void* buf, uint32_t len) { return usb_read(itf, buf, len); }
+uint32_t tud_vendor_n_write_available(uint8_t itf) { return usb_write_available(itf); }
+uint32_t tud_vendor_n_write(uint8_t itf, const void* buf, uint32_t len) {
+    return usb_write(itf, buf, len);
+}
+
+void thread_yield(void) {
+    // only the USB side can make progress here
+    if (++idle_yields > 1000000) {
+        fprintf(stderr, "parser waits for more than the host sent\n");
+        abort();
+    }
+}
+
+static void host_reset(void) { host_in_len = host_in_pos = host_out_len = 0; }
+static void put8(uint32_t v) { host_in[host_in_len++] = (uint8_t)v; }
+static void put24(uint32_t v) {
+    put8(v);
+    put8(v >> 8);
+    put8(v >> 16);
+}
+static void put32(uint32_t v) {
+    put24(v);
+    put8(v >> 24);
+}
+
+/* vnd_cfg: the response header goes to resp_stat/resp_len, the rest of the
+ * response to the host like on the CDC interface */
+
+static struct bulkio cfg_io;
+static uint8_t       cfg_rxbuf[64], cfg_txbuf[64];
+static int           resp_stat;
+static uint32_t      resp_len;
+
+uint8_t        vnd_cfg_read_byte(void) { return bulkio_read_byte(&cfg_io); }
+struct bulkio* vnd_cfg_get_io(void) { return &cfg_io; }
+void vnd_cfg_write_resp_no_drop(enum cfg_resp stat, uint32_t len, const void* data) {
+    resp_stat = stat;
+    resp_len  = len;
+    if (data) bulkio_write(&cfg_io, data, len);
+    bulkio_flush(&cfg_io);
+}
+void vnd_cfg_write_resp(enum cfg_resp stat, uint32_t len, const void* data) {
+    if (stat != cfg_resp_ok) bulkio_drop_incoming(&cfg_io);
+    vnd_cfg_write_resp_no_drop(stat, len, data);
+}
+
+/* SPI device ============================================================== */
+
+// MISO is a function of the number of bytes clocked so far and of MOSI
+static inline uint8_t miso(uint32_t n, uint8_t mosi) { return (uint8_t)(n * 7 + 3) ^ mosi; }
+static inline uint8_t miso_wide(uint32_t n, uint8_t width) { return (uint8_t)(n * 5 + width); }
+
+static uint32_t       spi_count;  // bytes clocked
+static uint8_t        spi_mosi[1 << 21];
+static uint32_t       spi_mosi_len;
+static bool           spi_log = true;  // keep MOSI and make up MISO
+static bool           spi_busy, spi_selected;
+static uint32_t       op_len;
+static uint8_t*       op_rd;
+static const uint8_t* op_wr;
+static int            poll_left;
+
+void sp_spi_init(void) { }
+void sp_spi_deinit(void) { }
+void sp_spi_cs_deselect(uint8_t cs) { }
+void sp_spi_cs_select(uint8_t cs) { }
+uint32_t sp_spi_set_freq(uint32_t freq) { return freq; }
+enum serprog_flags sp_spi_set_flags(enum serprog_flags flags) { return flags; }
+uint8_t sp_spi_set_bpw(uint8_t bpw) { return bpw; }
+void sp_spi_timer_start(uint32_t ms) { poll_left = ms; }
+bool sp_spi_timer_reached(void) { return poll_left-- <= 0; }
+const struct sp_spi_caps* sp_spi_get_caps(void) {
+    static const struct sp_spi_caps caps = {1000, 62500000, S_CAP_DUAL | S_CAP_QUAD, 1, 8, 16};
+    return &caps;
+}
+
+void sp_spi_op_wait(void) {
+    if (!spi_busy) return;
+    spi_busy = false;
+
+    if (!spi_log) {
+        spi_count += op_len;
+        return;
+    }
+    for (uint32_t i = 0; i < op_len; ++i, ++spi_count) {
+        uint8_t o = op_wr ? op_wr[i] : 0;
+
+        spi_mosi[spi_mosi_len++] = o;
+        if (op_rd) op_rd[i] = miso(spi_count, o);
+    }
+}
+void sp_spi_op_start(uint32_t len, void* read_data, const void* write_data) {
+    if (!spi_selected) abort();
+
+    sp_spi_op_wait();
+    op_len   = len;
+    op_rd    = read_data;
+    op_wr    = write_data;
+    spi_busy = true;
+}
+void sp_spi_op_write(uint32_t len, const void* data) {
+    sp_spi_op_start(len, NULL, data);
+    sp_spi_op_wait();
+}
+void sp_spi_op_read(uint32_t len, void* data) {
+    sp_spi_op_start(len, data, NULL);
+    sp_spi_op_wait();
+}
+void sp_spi_op_read_write(uint32_t len, void* read_data, const void* write_data) {
+    sp_spi_op_start(len, read_data, write_data);
+    sp_spi_op_wait();
+}
+
+bool sp_spi_wide_ok(uint8_t width) { return width == 2 || width == 4; }
+void sp_spi_op_read_wide(uint32_t len, void* data, uint8_t width) {
+    for (uint32_t i = 0; i < len; ++i, ++spi_count)
+        ((uint8_t*)data)[i] = miso_wide(spi_count, width);
+}
+void sp_spi_op_write_wide(uint32_t len, const void* data, uint8_t width) {
+    memcpy(spi_mosi + spi_mosi_len, data, len);
+    spi_mosi_len += len;
+    spi_count += len;
+}
+
+void sp_spi_op_begin(uint8_t cs) {
+    if (spi_busy || spi_selected) abort();
+    spi_selected = true;
+}
+void sp_spi_op_end(uint8_t cs) {
+    sp_spi_op_wait();
+    spi_selected = false;
+}
+
+/* checks ================================================================== */
+
+// one random data transfer command, through the CDC or the vendor interface
+static bool check_one_payload(bool vendor) {
+    static const uint8_t cmds[] = {S_CMD_SPIOP, S_CMD_SPI_READ, S_CMD_SPI_WRITE, S_CMD_SPI_RDWR,
+            S_CMD_SPI_READ_WIDE, S_CMD_SPI_WRITE_WIDE};
+    static uint8_t data[1 << 14], want[1 << 14];
+
+    uint8_t  cmd   = cmds[rand() % sizeof cmds];
+    uint8_t  width = 1 << (rand() % 3);
+    uint32_t slen  = 0, rlen = 0, nwant = 0;
+
+    host_reset();
+    spi_mosi_len = 0;
+    uint32_t count0 = spi_count;
+
+    put8(cmd);
+    switch (cmd) {
+        case S_CMD_SPIOP:
+            slen = rand() % 3000;
+            rlen = rand() % 5000;
+            put24(slen);
+            put24(rlen);
+            break;
+        case S_CMD_SPI_READ: rlen = rand() % 5000; put24(rlen); break;
+        case S_CMD_SPI_WRITE:
+        case S_CMD_SPI_RDWR: slen = rand() % 5000; put24(slen); break;
+        case S_CMD_SPI_READ_WIDE: rlen = rand() % 5000; put8(width); put24(rlen); break;
+        case S_CMD_SPI_WRITE_WIDE: slen = rand() % 5000; put8(width); put24(slen); break;
+    }
+    for (uint32_t i = 0; i < slen; ++i) put8(data[i] = rand());
+    // pipelined behind it, which mustn't be touched
+    put8(S_CMD_NOP);
+
+    bool nak = (cmd == S_CMD_SPI_READ_WIDE || cmd == S_CMD_SPI_WRITE_WIDE)
+            && !sp_spi_wide_ok(width);
+    if (nak) {
+        want[nwant++] = S_NAK;
+    } else {
+        if (cmd != S_CMD_SPI_WRITE && cmd != S_CMD_SPI_WRITE_WIDE) want[nwant++] = S_ACK;
+        for (uint32_t i = 0; i < rlen; ++i) {
+            uint32_t n = count0 + slen + i;
+            want[nwant++] = (cmd == S_CMD_SPI_READ_WIDE) ? miso_wide(n, width) : miso(n, 0);
+        }
+        if (cmd == S_CMD_SPI_RDWR)
+            for (uint32_t i = 0; i < slen; ++i) want[nwant++] = miso(count0 + i, data[i]);
+        if (cmd == S_CMD_SPI_WRITE || cmd == S_CMD_SPI_WRITE_WIDE) want[nwant++] = S_ACK;
+    }
+
+    // the NOP after it has to be next in line, and answered on its own
+    void (*task)(void) = vendor ? sp_spi_bulk_cmd : cdc_serprog_task;
+    resp_stat = -1;
+    task();
+    if (vendor && (resp_stat != cfg_resp_ok || resp_len != nwant)) return false;
+    if (spi_busy || spi_selected) return false;
+    if (host_out_len != nwant || memcmp(host_out, want, nwant)) return false;
+    // reads clock out zeroes, and NAKed commands nothing at all
+    if (spi_mosi_len != (nak ? 0 : slen + (cmd == S_CMD_SPI_READ_WIDE ? 0 : rlen))) return false;
+    if (!nak && memcmp(spi_mosi, data, slen)) return false;
+    for (uint32_t i = slen; i < spi_mosi_len; ++i)
+        if (spi_mosi[i] != 0) return false;
+
+    task();
+    return host_in_pos == host_in_len && host_out_len == nwant + 1 && host_out[nwant] == S_ACK;
+}
+
+static int check_payloads(void) {
+    int bad = 0;
+
+    srand(1);
+    host_random = true;
+    for (int it = 0; it < 4000; ++it) {
+        if (!check_one_payload(it & 1) && bad++ < 5) printf("it=%d: mismatch\n", it);
+    }
+
+    printf("payloads: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+// sends what's in host_in as a single command, and compares the response
+static bool expect(const char* what, const uint8_t* want, uint32_t nwant) {
+    cdc_serprog_task();
+    if (host_in_pos == host_in_len && host_out_len == nwant && !memcmp(host_out, want, nwant))
+        return true;
+
+    printf("%s: got %u bytes:", what, host_out_len);
+    for (uint32_t i = 0; i < host_out_len && i < 8; ++i) printf(" %02x", host_out[i]);
+    printf("\n");
+    return false;
+}
+
+static int check_commands(void) {
+    int bad = 0;
+
+    srand(2);
+    host_random = true;
+
+    host_reset();
+    put8(S_CMD_Q_IFACE);
+    bad += !expect("Q_IFACE", (const uint8_t[]){S_ACK, SERPROG_IFACE_VERSION, 0}, 3);
+
+    host_reset();
+    put8(S_CMD_Q_CMDMAP);
+    cdc_serprog_task();
+    // with the write-and-poll and the POLL commands
+    if (host_out_len != 33 || host_out[0] != S_ACK || host_out[1 + 9] != 0x0f) {
+        printf("Q_CMDMAP: bad map\n");
+        ++bad;
+    }
+
+    host_reset();
+    put8(S_CMD_S_SPI_FLAGS);
+    put8(S_FLG_CPHA | S_FLG_CPOL);
+    bad += !expect("S_SPI_FLAGS", (const uint8_t[]){S_ACK, S_FLG_CPHA | S_FLG_CPOL}, 2);
+
+    // status polling: op out, status in, in one selection
+    host_reset();
+    spi_mosi_len = 0;
+    uint32_t n = spi_count;
+    put8(S_CMD_SPI_POLL);
+    put8(0x05);
+    put8(0x00);
+    put8(0x00);
+    put32(100);
+    bad += !expect("SPI_POLL", (const uint8_t[]){S_ACK, miso(n + 1, 0)}, 2);
+    if (spi_mosi_len != 2 || spi_mosi[0] != 0x05) {
+        printf("SPI_POLL: bad op\n");
+        ++bad;
+    }
+    // a status that never comes
+    host_reset();
+    put8(S_CMD_SPI_POLL);
+    put8(0x05);
+    put8(0xff);
+    put8(miso(spi_count + 1, 0) ^ 1);
+    put32(0);
+    bad += !expect("SPI_POLL timeout", (const uint8_t[]){S_NAK, miso(spi_count + 1, 0)}, 2);
+
+    // WREN, the program command, then RDSR until WIP clears
+    static const uint8_t pp[] = {0x02, 0x00, 0x10, 0x00, 0xa5, 0x5a};
+    host_reset();
+    spi_mosi_len = 0;
+    spi_count |= 1;  // then the status byte miso() makes up has WIP clear
+    put8(S_CMD_SPI_WRPOLL);
+    put32(100);
+    put24(sizeof pp);
+    for (uint32_t i = 0; i < sizeof pp; ++i) put8(pp[i]);
+    cdc_serprog_task();
+    bool ok = host_in_pos == host_in_len && host_out_len == 2 && host_out[0] == S_ACK
+            && !(host_out[1] & 1) && spi_mosi_len == 3 + sizeof pp && spi_mosi[0] == 0x06
+            && !memcmp(spi_mosi + 1, pp, sizeof pp) && spi_mosi[1 + sizeof pp] == 0x05;
+    if (!ok) {
+        printf("SPI_WRPOLL: bad sequence\n");
+        ++bad;
+    }
+
+    // not with other word sizes
+    host_reset();
+    put8(S_CMD_S_SPI_BPW);
+    put8(16);
+    bad += !expect("S_SPI_BPW 16", (const uint8_t[]){S_ACK, 16}, 2);
+    host_reset();
+    spi_mosi_len = 0;
+    put8(S_CMD_SPI_POLL);
+    put8(0x05);
+    put8(0x00);
+    put8(0x00);
+    put32(100);
+    bad += !expect("SPI_POLL at 16 bpw", (const uint8_t[]){S_NAK, 0}, 2);
+    host_reset();
+    put8(S_CMD_SPI_WRPOLL);
+    put32(100);
+    put24(sizeof pp);
+    for (uint32_t i = 0; i < sizeof pp; ++i) put8(pp[i]);
+    bad += !expect("SPI_WRPOLL at 16 bpw", (const uint8_t[]){S_NAK, 0}, 2);
+    bad += spi_mosi_len != 0;
+    host_reset();
+    put8(S_CMD_S_SPI_BPW);
+    put8(8);
+    bad += !expect("S_SPI_BPW 8", (const uint8_t[]){S_ACK, 8}, 2);
+
+    // on the vendor interface, an unknown command throws away what follows
+    host_reset();
+    put8(0x7f);
+    put8(S_CMD_NOP);
+    resp_stat = -1;
+    sp_spi_bulk_cmd();
+    if (resp_stat != cfg_resp_illcmd || host_in_pos != host_in_len || cfg_io.rxavail != 0) {
+        printf("vendor, unknown command: status %d\n", resp_stat);
+        ++bad;
+    }
+
+    printf("commands: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+/* benchmark =============================================================== */
+
+static double now_s(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// runs the commands in host_in 'reps' times, returns the time it took
+static double run_stream(void (*task)(void), uint32_t ncmds, uint32_t reps) {
+    double t0 = now_s();
+
+    for (uint32_t r = 0; r < reps; ++r) {
+        host_in_pos = 0;
+        for (uint32_t i = 0; i < ncmds; ++i) task();
+    }
+    if (host_in_pos != host_in_len) {
+        fprintf(stderr, "commands not read in full\n");
+        abort();
+    }
+
+    return now_s() - t0;
+}
+
+static void bench_payload(const char* name, uint8_t cmd, uint32_t len) {
+    const uint32_t ncmds = (1u << 20) / len, reps = 100;
+
+    host_reset();
+    for (uint32_t i = 0; i < ncmds; ++i) {
+        put8(cmd);
+        put24(len);
+        if (cmd == S_CMD_SPI_WRITE || cmd == S_CMD_SPI_RDWR)
+            for (uint32_t j = 0; j < len; ++j) put8(j);
+    }
+
+    double s = run_stream(cdc_serprog_task, ncmds, reps);
+    printf("%-30s %8.1f MB/s\n", name, (double)ncmds * len * reps / s / 1e6);
+}
+
+// what the parser did for every payload byte before bulkio_read
+static void bench_bytewise(uint32_t len) {
+    static struct bulkio io;
+    static uint8_t       rxbuf[CFG_TUD_CDC_RX_BUFSIZE];
+    static uint8_t       buf[4096];
+    const uint32_t       ncmds = (1u << 20) / len, reps = 100;
+
+    bulkio_init(&io, &bulkio_cdc_ops, CDC_N_SERPROG, rxbuf, sizeof rxbuf, NULL, 0);
+    host_reset();
+    for (uint32_t i = 0; i < ncmds * (4 + len); ++i) put8(i);
+
+    double t0 = now_s();
+    for (uint32_t r = 0; r < reps; ++r) {
+        host_in_pos = 0;
+        for (uint32_t i = 0; i < ncmds; ++i) {
+            for (int j = 0; j < 4; ++j) bulkio_read_byte(&io);
+            for (uint32_t j = 0; j < len; ++j) buf[j % sizeof buf] = bulkio_read_byte(&io);
+            __asm__ volatile("" : : "r"(buf) : "memory");
+        }
+    }
+    double s = now_s() - t0;
+
+    printf("%-30s %8.1f MB/s\n", "payload, bulkio_read_byte", (double)ncmds * len * reps / s / 1e6);
+}
+
+// a status read as flashrom does it, one byte out and one in
+static void bench_small(void) {
+    const uint32_t ncmds = 1 << 16, reps = 20;
+
+    host_reset();
+    for (uint32_t i = 0; i < ncmds; ++i) {
+        put8(S_CMD_SPIOP);
+        put24(1);
+        put24(1);
+        put8(0x05);
+    }
+
+    double s = run_stream(cdc_serprog_task, ncmds, reps);
+    printf("%-30s %8.1f k/s\n", "SPIOP 1+1 bytes", ncmds * reps / s / 1e3);
+}
+
+static void bench(void) {
+    host_random = false;
+    spi_log     = false;
+
+    bench_payload("SPI_WRITE 4 KiB", S_CMD_SPI_WRITE, 4096);
+    bench_bytewise(4096);
+    bench_payload("SPI_RDWR 4 KiB", S_CMD_SPI_RDWR, 4096);
+    bench_payload("SPI_READ 4 KiB", S_CMD_SPI_READ, 4096);
+    bench_payload("SPI_READ 64 KiB", S_CMD_SPI_READ, 65536);
+    bench_small();
+}
+
+int main(int argc, char** argv) {
+    cdc_serprog_init();
+    bulkio_init(&cfg_io, &bulkio_vendor_ops, VND_N_CFG, cfg_rxbuf, sizeof cfg_rxbuf, cfg_txbuf,
+            sizeof cfg_txbuf);
+
+    if (check_payloads() || check_commands()) return 1;
+    if (argc > 1 && !strcmp(argv[1], "-b")) bench();
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+// vim: set et:
+
+/*
+ * The SPSC queue, first against a model in a single thread, then with the
+ * producer and the consumer in threads of their own, as on the two cores.
+ * Queue sizes aren't powers of two, so that the wrap-around logic gets a
+ * workout. With -b, the threaded test reports its throughput.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spsc.h"
+
+// the bytes of the stream are a function of their position
+static inline uint8_t pattern(uint32_t pos) { return (uint8_t)(pos * 7 + (pos >> 8)); }
+
+static int check_model(void) {
+    static uint8_t buf[13];
+    struct spsc    q;
+    uint32_t       w = 0, r = 0;
+
+    srand(1);
+    spsc_init(&q, buf, sizeof buf);
+    for (int it = 0; it < 2000000; ++it) {
+        uint8_t  t[sizeof buf];
+        uint32_t len = rand() % (sizeof(buf) + 1);
+        bool     ok;
+
+        if (rand() & 1) {
+            for (uint32_t i = 0; i < len; ++i) t[i] = pattern(w + i);
+            ok = spsc_write(&q, t, len);
+            if (ok != (sizeof(buf) - (w - r) >= len)) break;
+            if (ok) w += len;
+        } else {
+            ok = spsc_read(&q, t, len);
+            if (ok != (w - r >= len)) break;
+            if (ok) {
+                for (uint32_t i = 0; i < len; ++i)
+                    if (t[i] != pattern(r + i)) ok = false;
+                if (!ok) break;
+                r += len;
+            }
+        }
+
+        if (spsc_used(&q) != w - r || spsc_free(&q) != sizeof(buf) - (w - r)) break;
+        if (it == 1000000) {
+            // start over somewhere else
+            spsc_reset(&q, 5);
+            w = r = 0;
+        }
+    }
+
+    bool ok = spsc_used(&q) == w - r;
+    printf("spsc model: %s\n", ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+/* two threads ============================================================= */
+
+#define STREAM_LEN 100000000u
+
+static struct spsc q;
+static uint8_t     qbuf[1000];
+static bool        use_copy;  // spsc_write/spsc_read instead of in-place access
+
+static void* producer(void* arg) {
+    uint32_t x = 0;
+
+    while (x < STREAM_LEN) {
+        if (use_copy) {
+            uint8_t  msg[16];
+            uint32_t n = 1 + x % sizeof msg;
+            if (n > STREAM_LEN - x) n = STREAM_LEN - x;
+
+            for (uint32_t i = 0; i < n; ++i) msg[i] = pattern(x + i);
+            if (spsc_write(&q, msg, n))
+                x += n;
+            else
+                sched_yield();
+            continue;
+        }
+
+        uint8_t* p;
+        uint32_t n = spsc_write_ptr(&q, &p);
+        if (n == 0) {
+            sched_yield();
+            continue;
+        }
+        if (n > STREAM_LEN - x) n = STREAM_LEN - x;
+
+        // commit a varying part of what's there
+        uint32_t c = (x * 2654435761u >> 7) % n + 1;
+        for (uint32_t i = 0; i < c; ++i) p[i] = pattern(x + i);
+        spsc_commit(&q, c);
+        x += c;
+    }
+
+    return NULL;
+}
+
+static int check_threads(bool copy, bool bench) {
+    struct timespec t0, t1;
+    pthread_t       th;
+    uint32_t        x = 0;
+
+    use_copy = copy;
+    spsc_init(&q, qbuf, sizeof qbuf);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_create(&th, NULL, producer, NULL);
+
+    while (x < STREAM_LEN) {
+        if (copy) {
+            uint8_t  msg[16];
+            uint32_t n = 1 + x % 11;
+            if (n > STREAM_LEN - x) n = STREAM_LEN - x;
+
+            if (!spsc_read(&q, msg, n)) {
+                sched_yield();
+                continue;
+            }
+            for (uint32_t i = 0; i < n; ++i)
+                if (msg[i] != pattern(x + i)) goto fail;
+            x += n;
+            continue;
+        }
+
+        const uint8_t* p;
+        uint32_t       n = spsc_read_ptr(&q, &p);
+        if (n == 0) {
+            sched_yield();
+            continue;
+        }
+
+        // release a varying part of what's there
+        uint32_t r = (n > 3) ? (n - x % 3) : n;
+        for (uint32_t i = 0; i < r; ++i)
+            if (p[i] != pattern(x + i)) goto fail;
+        spsc_release(&q, r);
+        x += r;
+    }
+
+    pthread_join(th, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("spsc threads, %s: ok", copy ? "copy" : "in-place");
+    if (bench) printf(" (%.1f MB/s)", STREAM_LEN / s / 1e6);
+    printf("\n");
+    return 0;
+
+fail:
+    printf("spsc threads, %s: FAIL at byte %u\n", copy ? "copy" : "in-place", x);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    bool bench = argc > 1 && !strcmp(argv[1], "-b");
+
+    if (check_model()) return 1;
+    if (check_threads(false, bench) || check_threads(true, bench)) return 1;
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+// vim: set et:
+
+#ifndef TESTS_SUMP_HOST_H_
+#define TESTS_SUMP_HOST_H_
+
+/*
+ * Builds the SUMP protocol/capture logic for the host, with its static state
+ * in reach of the test. The capture hardware is left out: tests play the DMA
+ * side by filling sump_buffer and calling sump_capture_callback(), and the USB
+ * host side through the CDC functions below.
+ */
+
+#include "m_sump/cdc_sump.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* USB host side: bytes written to the CDC FIFO end up in host_out (when set),
+ * as much as host_wavail allows */
+static uint8_t* host_out;
+static size_t   host_out_size, host_out_len;
+static uint32_t host_wavail;
+static uint32_t host_time_us;
+
+bool     tud_cdc_n_connected(uint8_t itf) { return true; }
+uint32_t tud_cdc_n_available(uint8_t itf) { return 0; }
+uint32_t tud_cdc_n_read(uint8_t itf, void* buf, uint32_t len) { return 0; }
+uint32_t tud_cdc_n_write_available(uint8_t itf) { return host_wavail; }
+uint32_t tud_cdc_n_write_flush(uint8_t itf) { return 0; }
+uint32_t tud_cdc_n_write(uint8_t itf, const void* buf, uint32_t len) {
+    if (len > host_wavail) len = host_wavail;
+    host_wavail -= len;
+
+    if (host_out != NULL) {
+        if (host_out_len + len > host_out_size) {
+            fprintf(stderr, "host_out overflow\n");
+            abort();
+        }
+        memcpy(host_out + host_out_len, buf, len);
+    }
+    host_out_len += len;
+
+    return len;
+}
+uint32_t tud_cdc_n_write_str(uint8_t itf, const char* str) {
+    return tud_cdc_n_write(itf, str, strlen(str));
+}
+
+void* m_alloc_all_remaining(size_t sizemult, size_t align, size_t* size) {
+    *size = 0;
+    return NULL;
+}
+
+/* an RP2040 at its stock clock, without any overclock profiles */
+void sump_hw_get_cpu_name(char cpu[32]) { strcpy(cpu, "host"); }
+void sump_hw_get_hw_name(char hw[32]) { strcpy(hw, "host"); }
+uint32_t sump_hw_get_sysclk(void) { return 125 * ONE_MHZ; }
+uint32_t sump_hw_get_max_sysclk(void) { return 125 * ONE_MHZ; }
+uint32_t sump_hw_get_time_us(void) { return host_time_us; }
+uint8_t sump_hw_get_overclock(void) { return 0; }
+bool sump_hw_set_overclock(uint8_t v) { return v == 0; }
+bool sump_hw_get_clock_profile(uint8_t i, uint32_t* khz, uint16_t* mv) {
+    if (khz) *khz = 125000;
+    if (mv) *mv = 1100;
+    return i == 0;
+}
+void sump_hw_set_clock_profile(uint8_t i) { }
+
+void sump_hw_init(void) { }
+void sump_hw_deinit(void) { }
+void sump_hw_stop(void) { }
+void sump_hw_capture_setup_next(uint32_t ch, uint32_t mask, uint32_t chunk_size,
+        uint32_t next_count, uint8_t width) { }
+void sump_hw_capture_start(uint8_t bits, int flags, uint32_t chunk_size, uint8_t* destbuf) { }
+void sump_hw_capture_stop(void) { }
+void sump_hw_capture_start_trans(uint8_t bits, int flags, uint32_t chunk_size, uint8_t* destbuf) { }
+uint32_t sump_hw_capture_stop_trans(void) { return 0; }
+void sump_hw_capture_finish(void) { sump_capture_callback_finish(); }
+
+#endif
@@ -0,0 +1,166 @@
+// vim: set et:
+
+/*
+ * Dumps of captures in the DMA ring. RLE captures are compressed chunk by
+ * chunk, as the capture callback does, and the dump is decoded like libsigrok
+ * does (ols driver: a sample with the top bit set is a count, the sample after
+ * it is repeated count+1 times, and the whole capture arrives newest-first).
+ * Raw dumps are checked for the order of the samples and for wrapping at the
+ * end of the ring.
+ */
+
+#include "sump_host.h"
+
+#define NSAMPLES_MAX 24000
+
+static uint8_t data[NSAMPLES_MAX * 2] __attribute__((__aligned__(4)));
+static uint8_t store[1 << 18] __attribute__((__aligned__(4)));
+static uint8_t out[1 << 20];
+
+// returns the number of samples decoded into 'dec', oldest first
+static uint32_t sigrok_decode(const uint8_t* buf, uint32_t len, int w, uint32_t* dec) {
+    uint32_t n = 0, cnt = 0;
+
+    for (uint32_t o = 0; o + w <= len; o += w) {
+        uint32_t v = (w == 1) ? buf[o] : (buf[o] | (uint32_t)buf[o + 1] << 8);
+        uint32_t top = (w == 1) ? 0x80 : 0x8000;
+
+        if (v & top) {
+            cnt = v & (top - 1);
+            continue;
+        }
+        for (uint32_t c = 0; c <= cnt; ++c) dec[n++] = v;
+        cnt = 0;
+    }
+
+    for (uint32_t i = 0; i < n / 2; ++i) {
+        uint32_t t     = dec[i];
+        dec[i]         = dec[n - 1 - i];
+        dec[n - 1 - i] = t;
+    }
+
+    return n;
+}
+
+static int check_rle(void) {
+    static uint32_t dec[1 << 20];
+    int             bad = 0;
+
+    srand(5);
+    for (int it = 0; it < 3000; ++it) {
+        int      w      = 1 + (it & 1);
+        bool     bursty = it & 2;
+        uint32_t nsamp  = 4096 + rand() % (NSAMPLES_MAX - 4096);
+        uint32_t mask   = (w == 1) ? 0x7f : 0x7fff;
+
+        uint32_t v = 0;
+        for (uint32_t i = 0; i < nsamp; ++i) {
+            if (!bursty || rand() % 200 == 0) v = rand();
+            if (w == 1)
+                data[i] = v;
+            else
+                ((uint16_t*)data)[i] = v;
+        }
+
+        // a small store drops the oldest runs, the window is then padded
+        bool small = it % 3 == 0;
+        memset(&sump, 0, sizeof sump);
+        sump.width       = w;
+        sump.rle_buf     = store;
+        sump.rle_entries = small ? 300 : sizeof(store) / (2 * w);
+
+        uint32_t chunk = 1u << (2 + rand() % 9);
+        uint32_t bytes = nsamp * w / chunk * chunk;
+        for (uint32_t p = 0; p < bytes; p += chunk) sump_rle_encode(data + p, chunk);
+
+        uint32_t total = bytes / w;
+        uint32_t end   = total - rand() % (total / 2);
+        uint32_t rc    = 1 + rand() % end;
+        sump.rle_end    = end * w;
+        sump.read_count = rc;
+        sump_rle_finish();
+        sump.state = SUMP_STATE_DUMP;
+
+        uint32_t olen = 0, l;
+        while ((l = sump_tx_rle(out + olen, 64)) > 0) olen += l;
+
+        uint32_t n  = sigrok_decode(out, olen, w, dec);
+        bool     ok = n == rc;
+        for (uint32_t i = 0; ok && !small && i < n; ++i) {
+            uint32_t k = end - rc + i;
+            uint32_t x = ((w == 1) ? data[k] : ((uint16_t*)data)[k]) & mask;
+            if (dec[i] != x) ok = false;
+        }
+
+        if (!ok && bad++ < 5)
+            printf("it=%d width=%d bursty=%d: decoded %u of %u samples\n", it, w, bursty, n, rc);
+    }
+
+    printf("rle round-trip: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+static uint32_t raw_tx(int kind, uint8_t* buf, uint32_t len) {
+    switch (kind) {
+        case 0: return sump_tx8(buf, len);
+        case 1: return sump_tx16(buf, len);
+        case 2: return sump_tx32(buf, len);
+        default: return sump_tx4(buf, len);
+    }
+}
+
+static int check_raw(void) {
+    static uint8_t mem[4096] __attribute__((__aligned__(4)));
+    int            bad = 0;
+
+    srand(9);
+    for (uint32_t i = 0; i < sizeof mem; ++i) mem[i] = rand();
+    sump_buffer      = mem;
+    sump_memory_size = sizeof mem;
+
+    for (int it = 0; it < 5000; ++it) {
+        int     kind = rand() % 4;  // 8, 16, 32 bits, 4-channel
+        uint8_t w    = (kind == 3) ? 1 : (1 << kind);
+
+        // the ring doesn't have to cover all of the buffer
+        memset(&sump, 0, sizeof sump);
+        sump.width     = w;
+        sump.wire      = w;
+        sump.packed    = kind == 3;
+        sump.ring_size = (64 + rand() % 60) * 32;
+        sump.state     = SUMP_STATE_DUMP;
+
+        uint32_t rs   = sump.ring_size;
+        uint32_t maxn = (kind == 3) ? (rs * 2) : (rs / w);
+        uint32_t rc   = 1 + rand() % maxn;
+        if (kind == 3) rc = (rc + 1) & ~1u;
+        sump.read_start = (rand() % (rs / 4)) * 4;
+        sump.read_count = rc;
+
+        uint32_t olen = 0, l;
+        while ((l = raw_tx(kind, out + olen, 4 * (1 + rand() % 20))) > 0) olen += l;
+
+        // newest first, from read_start + rc samples back to read_start
+        uint32_t o = 0;
+        for (int32_t k = rc - 1; k >= 0 && o <= olen; --k) {
+            if (kind == 3) {
+                uint8_t b = mem[(sump.read_start + k / 2) % rs];
+                if (out[o++] != ((k & 1) ? (b >> 4) : (b & 0xf))) ++bad;
+            } else {
+                for (int j = 0; j < w; ++j)
+                    if (out[o++] != mem[(sump.read_start + k * w + j) % rs]) ++bad;
+            }
+        }
+        if (o != olen) ++bad;
+    }
+
+    sump_buffer = NULL;
+    printf("raw dump: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+int main(void) {
+    if (check_rle() || check_raw()) return 1;
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+// vim: set et:
+
+/*
+ * Model of the SUMP streaming mode: the DMA side fills chunks of the ring and
+ * calls sump_capture_callback(), the USB side drains it with sump_stream_tx().
+ * The first part checks that the host gets the samples in order, starting at
+ * the requested pre-trigger position, and that a capture with RLE enabled
+ * isn't streamed. The second one looks for the highest
+ * sample rate that a full-speed link sustains without an overrun.
+ */
+
+#include <time.h>
+
+#include "sump_host.h"
+
+#define RING_SIZE (48 * SUMP_MAX_CHUNK_SIZE)
+
+static uint8_t ring[RING_SIZE] __attribute__((__aligned__(4)));
+
+static void stream_setup(uint8_t width, uint8_t wire, bool packed, uint32_t divider) {
+    memset(&sump, 0, sizeof sump);
+    sump.width   = width;
+    sump.wire    = wire;
+    sump.packed  = packed;
+    sump.divider = divider;
+
+    sump_buffer      = ring;
+    sump_memory_size = sizeof ring;
+    sump_stream_mode = true;
+}
+
+// the DMA channel rearmed by the callback for chunk n writes chunk n+numch.
+// writing all of it right away catches any overlap with unsent data
+static void dma_fill(uint32_t n) {
+    uint16_t* p = (uint16_t*)(ring + (uint64_t)n * sump.chunk_size % sump.ring_size);
+
+    for (uint32_t i = 0; i < sump.chunk_size / 2; ++i) p[i] = n * sump.chunk_size / 2 + i;
+}
+
+/* correctness ============================================================= */
+
+// a host that asked for RLE gets a buffered RLE capture, not a raw stream
+static int check_rle_flag(void) {
+    int bad = 0;
+
+    stream_setup(1, 1, false, 1);
+    sump.flags      = SUMP_FLAG1_ENABLE_RLE;
+    sump.read_count = 0x1000;
+    sump_xfer_start(SUMP_STATE_SAMPLING);
+    if (sump.stream || !sump.rle) ++bad;
+
+    stream_setup(1, 1, false, 1);
+    sump.read_count = 0x1000;
+    sump_xfer_start(SUMP_STATE_SAMPLING);
+    if (!sump.stream || sump.rle) ++bad;
+
+    printf("stream vs RLE: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+static int check_order(void) {
+    static uint16_t out[1 << 20];
+    int             bad = 0;
+
+    srand(5);
+    for (int it = 0; it < 2000; ++it) {
+        uint32_t trig = rand() % 20000;
+
+        stream_setup(2, 2, false, (rand() % 3) ? 1 : 1000);
+        sump.trigger[0].mask  = 0xffff;
+        sump.trigger[0].value = trig;
+        sump.trigger[0].start = true;
+        sump.read_count       = rand() % 8000 + 1;
+        sump.delay_count      = rand() % sump.read_count + 1;
+        sump_trigger_init();
+        sump_xfer_start(SUMP_STATE_TRIGGER);
+
+        host_out      = (uint8_t*)out;
+        host_out_size = sizeof out;
+        host_out_len  = 0;
+
+        uint32_t next = 0;
+        for (; next < SUMP_DMA_CHANNELS; ++next) dma_fill(next);
+
+        // a slow host makes the capture stop on an overrun, a fast one only
+        // ends it through SUMP_CMD_FINISH
+        bool slow = rand() % 4 == 0;
+        for (uint32_t k = 0; k < 100000 && sump.state != SUMP_STATE_CONFIG; ++k) {
+            if (sump.state == SUMP_STATE_TRIGGER || sump.state == SUMP_STATE_SAMPLING) {
+                if (k == 400) {
+                    sump_do_finish();
+                } else {
+                    sump_capture_callback(0, SUMP_DMA_CHANNELS);
+                    if (sump.state != SUMP_STATE_DUMP) dma_fill(next++);
+                }
+            }
+            for (int c = rand() % 3; c > 0; --c) {
+                host_wavail = (rand() % (slow ? 256 : 4096)) & ~1u;
+                sump_stream_tx();
+            }
+        }
+
+        size_t  nout = host_out_len / 2;
+        int32_t pre  = sump.read_count - sump.delay_count;
+        if (sump.state != SUMP_STATE_CONFIG) {
+            if (bad++ < 5) printf("it=%d: stream didn't end (state %d)\n", it, sump.state);
+            continue;
+        }
+        // the trigger position is just after the matching sample, so the
+        // stream starts 'pre' samples before that, or later if the ring
+        // didn't hold that much yet
+        if (nout == 0 || out[0] > trig + 1 || (int32_t)trig + 1 - pre > out[0]) {
+            if (bad++ < 5)
+                printf("it=%d: got %zu samples from %u, trigger after %u, %d before\n", it, nout,
+                        nout ? out[0] : 0, trig, pre);
+            continue;
+        }
+        for (size_t i = 1; i < nout; ++i) {
+            if (out[i] != (uint16_t)(out[0] + i)) {
+                if (bad++ < 5) printf("it=%d: sample %zu is %u, not %u\n", it, i, out[i],
+                        (uint16_t)(out[0] + i));
+                break;
+            }
+        }
+    }
+
+    host_out = NULL;
+    printf("stream order: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+/* throughput ============================================================== */
+
+/*
+ * Time goes by in USB frames of 1 ms, in each of which the host takes up to
+ * 'ppf' packets of 64 bytes from the CDC FIFO (19 is the full-speed maximum
+ * for bulk transfers on an otherwise idle bus). The main loop gets to refill
+ * the FIFO after every packet, and the DMA completes chunks at the sample
+ * rate in between.
+ */
+static bool sustains(uint8_t width, uint8_t wire, bool packed, uint32_t divider, uint32_t ppf,
+        uint32_t ms) {
+    const uint32_t pkt = 64;
+    uint32_t       fifo = 0;  // bytes in the CDC FIFO
+    // sample bytes per ms in units of 1/100000, as the rate is 100 MHz / divider
+    uint64_t per_ms = (uint64_t)(packed ? 1 : width) * 100000 * 100000 / divider;
+    if (packed) per_ms /= 2;
+    uint64_t acc = 0;
+
+    stream_setup(width, wire, packed, divider);
+    sump.read_count = 0x40000;
+    sump_xfer_start(SUMP_STATE_SAMPLING);
+
+    for (uint32_t t = 0; t < ms; ++t) {
+        for (uint32_t s = 0; s < ppf; ++s) {
+            for (acc += per_ms / ppf; acc >= (uint64_t)sump.chunk_size * 100000;
+                    acc -= (uint64_t)sump.chunk_size * 100000) {
+                sump_capture_callback(0, SUMP_DMA_CHANNELS);
+                if (sump.state != SUMP_STATE_SAMPLING) return false;  // overrun
+            }
+
+            fifo = (fifo > pkt) ? (fifo - pkt) : 0;
+            host_wavail  = CFG_TUD_CDC_TX_BUFSIZE - fifo;
+            host_out_len = 0;
+            sump_stream_tx();
+            fifo += host_out_len;
+        }
+    }
+
+    return true;
+}
+
+static void bench_rate(const char* name, uint8_t width, uint8_t wire, bool packed, uint32_t ppf) {
+    // dividers run from 1 (100 MHz) up, find the smallest that keeps up
+    uint32_t lo = 1, hi = 100000;
+
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (sustains(width, wire, packed, mid, ppf, 10000))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    printf("%-8s %2u pkt/frame: %8.1f kHz sustained (chunk %u bytes)\n", name, ppf,
+            100000.0 / lo, sump.chunk_size);
+}
+
+// CPU time spent on the USB side per byte, without any USB bottleneck
+static void bench_consumer(const char* name, uint8_t width, uint8_t wire, bool packed) {
+    static uint8_t  sink[4096];
+    const uint32_t  total = 256u << 20;
+    struct timespec t0, t1;
+
+    stream_setup(width, wire, packed, 1);
+    sump.read_count = 0x40000;
+    sump_xfer_start(SUMP_STATE_SAMPLING);
+    host_out      = sink;
+    host_out_size = sizeof sink;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (uint32_t done = 0; done < total;) {
+        spsc_commit(&sump.stream_q, spsc_free(&sump.stream_q));
+        while (spsc_used(&sump.stream_q)) {
+            host_out_len = 0;
+            host_wavail  = sizeof sink;
+            sump_stream_tx();
+            done += host_out_len;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    host_out = NULL;
+
+    double s = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%-8s consumer: %8.1f MB/s of host CPU\n", name, total / s / 1e6);
+}
+
+int main(int argc, char** argv) {
+    bool bench = argc > 1 && !strcmp(argv[1], "-b");
+
+    if (check_order() || check_rle_flag()) return 1;
+    if (!bench) return 0;
+
+    bench_rate("8-bit", 1, 1, false, 19);
+    bench_rate("8-bit", 1, 1, false, 13);
+    bench_rate("4-bit", 1, 1, true, 19);
+    bench_rate("16-bit", 2, 2, false, 19);
+    bench_rate("24-bit", 4, 3, false, 19);
+    bench_rate("32-bit", 4, 4, false, 19);
+
+    bench_consumer("8-bit", 1, 1, false);
+    bench_consumer("4-bit", 1, 1, true);
+    bench_consumer("24-bit", 4, 3, false);
+
+    return 0;
+}
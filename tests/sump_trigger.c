@@ -0,0 +1,237 @@
+// vim: set et:
+
+/*
+ * The word-at-a-time trigger finders and the trigger engine built on them,
+ * checked against a straightforward per-sample model of the OLS basic
+ * trigger. With -b, the finders are timed against the per-sample loop the
+ * trigger used before. The numbers are for the host CPU: they show the ratio
+ * between the two, not the rate an RP2040 reaches.
+ */
+
+#include <time.h>
+
+#include "sump_host.h"
+
+/* finders ================================================================= */
+
+static int check_finders(void) {
+    static uint8_t buf[256] __attribute__((__aligned__(4)));
+
+    srand(1);
+    for (int it = 0; it < 200000; ++it) {
+        int n = rand() % 64, off = rand() % 8;
+        for (int i = 0; i < n + off; ++i) buf[i] = rand() & ((it & 1) ? 0xff : 0x3);
+
+        uint8_t        m = rand(), v = rand() & m;
+        const uint8_t* r = sump_find8(buf + off, buf + off + n, m, v);
+        const uint8_t* e = NULL;
+        for (int i = off; i < off + n && !e; ++i)
+            if ((buf[i] & m) == v) e = buf + i;
+        if (r != e) {
+            printf("find8: mask=%02x value=%02x off=%d n=%d\n", m, v, off, n);
+            return 1;
+        }
+
+        const uint16_t* b16 = (const uint16_t*)buf;
+        uint16_t        m2 = rand(), v2;
+        int             n2 = n / 2, o2 = off / 2;
+        if (it & 2) m2 &= 3;
+        v2 = rand() & m2;
+        const uint16_t* r2 = sump_find16(b16 + o2, b16 + o2 + n2, m2, v2);
+        const uint16_t* e2 = NULL;
+        for (int i = o2; i < o2 + n2 && !e2; ++i)
+            if ((b16[i] & m2) == v2) e2 = b16 + i;
+        if (r2 != e2) {
+            printf("find16: mask=%04x value=%04x off=%d n=%d\n", m2, v2, o2, n2);
+            return 1;
+        }
+
+        // nibble positions within the buffer
+        uint8_t  m4 = rand() & 0xf, v4 = rand() & m4;
+        uint32_t k = off, end = off + 2 * n, r4 = sump_find4(buf, k, end, m4, v4), e4 = end;
+        for (uint32_t i = k; i < end && e4 == end; ++i)
+            if (((buf[i >> 1] >> ((i & 1) * 4)) & m4) == v4) e4 = i;
+        if (r4 != e4) {
+            printf("find4: mask=%x value=%x off=%d n=%d\n", m4, v4, off, 2 * n);
+            return 1;
+        }
+    }
+
+    printf("finders: ok\n");
+    return 0;
+}
+
+/* trigger engine ========================================================== */
+
+// per sample: returns the sample count up to and including the one on which
+// the capture starts, or -1
+static long trigger_model(const uint8_t* buf, long n, int w) {
+    int      level = 0, pend[4] = {0};
+    long     fire[4];
+    uint32_t sh[4] = {0};
+
+    for (long k = 0; k < n; ++k) {
+        uint32_t v = (w == 1) ? buf[k] : ((const uint16_t*)buf)[k];
+        int      armed[4], start = 0;
+
+        for (int i = 0; i < 4; ++i) {
+            const struct _trigger* t = &sump.trigger[i];
+            bool used = sump.trigger_used & (1u << i);
+
+            if (t->serial && used) sh[i] = (sh[i] << 1) | ((v >> t->channel) & 1);
+            armed[i] = used && !pend[i] && t->level <= level && !(!t->start && level == 3);
+        }
+        for (int i = 0; i < 4; ++i) {
+            const struct _trigger* t = &sump.trigger[i];
+            uint32_t x = t->serial ? sh[i] : v;
+
+            if (!armed[i] || (x & t->mask) != t->value) continue;
+            if (t->delay == 0) {
+                if (t->start)
+                    start = 1;
+                else if (level < 3)
+                    ++level;
+            } else {
+                pend[i] = 1;
+                fire[i] = k + t->delay;
+            }
+        }
+        if (start) return k + 1;
+
+        // delayed actions, in stage order
+        for (int i = 0; i < 4; ++i) {
+            if (!pend[i] || fire[i] != k) continue;
+
+            pend[i] = 0;
+            if (sump.trigger[i].start) return k + 1;
+            if (level < 3) ++level;
+        }
+    }
+
+    return -1;
+}
+
+static int check_trigger(void) {
+    static uint8_t buf[1 << 12] __attribute__((__aligned__(4)));
+    int            bad = 0;
+
+    srand(3);
+    for (int it = 0; it < 20000; ++it) {
+        int w  = 1 + (it & 1);
+        int ns = 1 + rand() % 4;
+
+        memset(&sump, 0, sizeof sump);
+        sump.width = w;
+        for (int i = 0; i < ns; ++i) {
+            struct _trigger* t = &sump.trigger[i];
+
+            t->mask = rand() & 0x3;
+            if (rand() % 3 == 0) t->mask |= rand() & 0xff;
+            t->value   = rand() & t->mask;
+            t->level   = i;
+            t->delay   = (rand() % 3 == 0) ? rand() % 50 : 0;
+            t->serial  = rand() % 5 == 0;
+            t->channel = rand() % 8;
+            t->start   = i == ns - 1;
+        }
+
+        long n = 1024;
+        for (long i = 0; i < n * w; ++i) buf[i] = rand() & ((it & 2) ? 0xff : 0x0f);
+
+        sump_trigger_init();
+        long want = trigger_model(buf, n, w);
+
+        // the model doesn't touch the engine state, but start from scratch
+        sump_trigger_init();
+        int  chunk = 1 << (rand() % 8);
+        long got   = -1;
+        for (long p = 0; p < n && got < 0; p += chunk) {
+            uint8_t* q = sump_analyze_trigger(buf + p * w, chunk * w);
+            if (q) got = (q - buf) / w;
+        }
+
+        if (got != want && bad++ < 5)
+            printf("it=%d width=%d chunk=%d: model starts at %ld, engine at %ld\n", it, w,
+                    chunk, want, got);
+    }
+
+    printf("trigger: %s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+/* benchmark =============================================================== */
+
+// what the trigger did before the word-at-a-time finders
+static const uint8_t* scalar_find8(
+        const uint8_t* src, const uint8_t* end, uint8_t tmask, uint8_t tvalue) {
+    for (; src < end; ++src)
+        if ((*src & tmask) == tvalue) return src;
+    return NULL;
+}
+static const uint16_t* scalar_find16(
+        const uint16_t* src, const uint16_t* end, uint16_t tmask, uint16_t tvalue) {
+    for (; src < end; ++src)
+        if ((*src & tmask) == tvalue) return src;
+    return NULL;
+}
+
+static double now_us(void) {
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec * 1e-3;
+}
+
+// samples per us, scanning whole chunks that don't match (the common case
+// while waiting for a trigger). 'buf' goes through an asm statement on every
+// round, so that the compiler can't hoist the scan out of the loop
+#define BENCH(name, samples, buf, expr)                                         \
+    do {                                                                        \
+        const uint32_t reps = 20000;                                            \
+        double         t0   = now_us();                                         \
+        for (uint32_t r = 0; r < reps; ++r) {                                   \
+            const void* sink;                                                   \
+            __asm__ volatile("" : "+r"(buf) : : "memory");                      \
+            sink = (expr);                                                      \
+            __asm__ volatile("" : : "r"(sink) : "memory");                      \
+        }                                                                       \
+        double t = now_us() - t0;                                               \
+        printf("%-28s %8.1f samples/us\n", name, (double)(samples) * reps / t); \
+    } while (0)
+
+static void bench(void) {
+    static uint8_t chunk[SUMP_MAX_CHUNK_SIZE] __attribute__((__aligned__(4)));
+    const uint32_t n8 = sizeof chunk, n16 = n8 / 2;
+    uint8_t*       c8  = chunk;
+    uint16_t*      c16 = (uint16_t*)chunk;
+
+    // samples toggle the lower bits, the trigger waits for the top one
+    for (uint32_t i = 0; i < n8; ++i) c8[i] = i & 0x7f;
+    BENCH("8-bit, per sample", n8, c8, scalar_find8(c8, c8 + n8, 0x80, 0x80));
+    BENCH("8-bit, word at a time", n8, c8, sump_find8(c8, c8 + n8, 0x80, 0x80));
+
+    for (uint32_t i = 0; i < n16; ++i) c16[i] = i & 0x7fff;
+    BENCH("16-bit, per sample", n16, c16, scalar_find16(c16, c16 + n16, 0x8000, 0x8000));
+    BENCH("16-bit, word at a time", n16, c16, sump_find16(c16, c16 + n16, 0x8000, 0x8000));
+
+    for (uint32_t i = 0; i < n8; ++i) c8[i] = 0x77;
+    BENCH("4-bit, word at a time", 2 * n8, c8,
+            (const void*)(uintptr_t)sump_find4(c8, 0, 2 * n8, 0x8, 0x8));
+
+    // the whole engine, with one stage
+    for (uint32_t i = 0; i < n8; ++i) c8[i] = i & 0x7f;
+    memset(&sump, 0, sizeof sump);
+    sump.width            = 1;
+    sump.trigger[0].mask  = 0x80;
+    sump.trigger[0].value = 0x80;
+    sump.trigger[0].start = true;
+    sump_trigger_init();
+    BENCH("8-bit, sump_analyze_trigger", n8, c8, sump_analyze_trigger(c8, n8));
+}
+
+int main(int argc, char** argv) {
+    if (check_finders() || check_trigger()) return 1;
+    if (argc > 1 && !strcmp(argv[1], "-b")) bench();
+
+    return 0;
+}